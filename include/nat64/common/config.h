@@ -79,7 +79,7 @@ enum config_mode {
 #define POOL4_OPS (DATABASE_OPS)
 #define BLACKLIST_OPS (DATABASE_OPS)
 #define RFC6791_OPS (DATABASE_OPS)
-#define EAMT_OPS (DATABASE_OPS | OP_TEST)
+#define EAMT_OPS (DATABASE_OPS | OP_TEST | OP_LOAD)
 #define BIB_OPS (DATABASE_OPS & ~OP_FLUSH)
 #define SESSION_OPS (OP_DISPLAY | OP_COUNT)
 #define LOGTIME_OPS (OP_DISPLAY)
@@ -102,6 +102,8 @@ enum config_operation {
 	OP_FLUSH = (1 << 5),
 	/* The user is a tester and s/he wants Jool's answer regarding a query. */
 	OP_TEST = (1 << 6),
+	/* The userspace app wants to replace the entire table being requested. */
+	OP_LOAD = (1 << 7),
 };
 
 /**
@@ -119,6 +121,7 @@ enum config_operation {
 #define FLUSH_MODES (POOL_MODES | MODE_EAMT)
 #define UPDATE_MODES (MODE_GLOBAL)
 #define TEST_MODES (MODE_EAMT)
+#define LOAD_MODES (MODE_EAMT)
 
 #define SIIT_MODES (MODE_GLOBAL | MODE_POOL6 | MODE_BLACKLIST | MODE_RFC6791 \
 		| MODE_EAMT | MODE_LOGTIME)
@@ -271,6 +274,16 @@ union request_eamt {
 	struct {
 		/* Nothing needed here ATM. */
 	} flush;
+	struct {
+		/** Is this the first chunk of the table? (boolean) */
+		__u8 first;
+		/** Is this the last chunk of the table? (boolean) */
+		__u8 last;
+		/** Allow the entries to overlap? (boolean) */
+		__u8 force;
+		/** Number of "struct eamt_entry"s that follow this union. */
+		__u16 count;
+	} load;
 };
 
 /**
@@ -393,6 +406,16 @@ enum global_type {
 	DISABLE,
 	ENABLE,
 	ATOMIC_FRAGMENTS,
+
+	/*
+	 * Added after 3.4.4.0. struct global_config changed along with them,
+	 * so the kernel module and the userspace application have to be the
+	 * same version; validate_version() (nl_handler.c) rejects the rest.
+	 */
+	IPV4_ID_MODE,
+	MSS_CLAMP,
+	ICMP_LIMIT_RATE,
+	ICMP_LIMIT_BURST,
 };
 
 /**
@@ -512,6 +535,12 @@ struct global_config {
 	 * If "reset_tos" is "false", then this doesn't do anything.
 	 */
 	__u8 new_tos;
+	/**
+	 * How translated IPv4 headers' Identification fields are computed (whenever
+	 * "build_ipv4_id" decides they need one).
+	 * See @ipv4_id_mode.
+	 */
+	__u8 ipv4_id_mode;
 
 	struct {
 		/**
@@ -554,6 +583,23 @@ struct global_config {
 	__u16 *mtu_plateaus;
 	/** Length of the mtu_plateaus array. */
 	__u16 mtu_plateau_count;
+	/**
+	 * If nonzero, the MSS option of translated TCP SYNs is lowered so that
+	 * the connection's segments fit in this IPv6 MTU (and in the MTU of the
+	 * route they'll take on the IPv6 side, if that is lower) once
+	 * translated. This spares the endpoints from Packet Too Bigs and
+	 * fragmentation, given IPv6 headers are 20 bytes bigger.
+	 * Zero disables clamping.
+	 */
+	__u16 mss_clamp;
+	/**
+	 * Jool's own ICMP error rate limit, in errors per second. Each CPU
+	 * applies it separately to every error type and source prefix.
+	 * Packet Too Bigs are never limited. Zero disables the limit.
+	 */
+	__u16 icmp_limit_rate;
+	/** Number of ICMP errors the limit lets through in a single burst. */
+	__u16 icmp_limit_burst;
 
 	struct {
 		/**
@@ -639,6 +685,18 @@ enum eam_hairpinning_mode {
 #define EAM_HAIRPIN_MODE_COUNT 3
 };
 
+/**
+ * Ways to fill translated IPv4 headers' Identification fields.
+ */
+enum ipv4_id_mode {
+	/** Fetch two random bytes from the kernel for every packet. */
+	IPV4_ID_RANDOM = 0,
+	/** Use per-CPU counters keyed by the packet's addresses; much cheaper. */
+	IPV4_ID_COUNTER = 1,
+
+#define IPV4_ID_MODE_COUNT 2
+};
+
 /**
  * "struct global_config" has pointers, so if the userspace app wants the configuration,
  * the structure cannot simply be copied to userspace.
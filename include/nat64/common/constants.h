@@ -80,11 +80,15 @@
 #define DEFAULT_DF_ALWAYS_ON false
 #define DEFAULT_BUILD_IPV6_FH false
 #define DEFAULT_BUILD_IPV4_ID true
+#define DEFAULT_IPV4_ID_MODE IPV4_ID_RANDOM
 #define DEFAULT_LOWER_MTU_FAIL true
 #define DEFAULT_COMPUTE_UDP_CSUM0 false
 #define DEFAULT_EAM_HAIRPIN_MODE EAM_HAIRPIN_INTRINSIC
 #define DEFAULT_RANDOMIZE_RFC6791 true
 #define DEFAULT_MTU_PLATEAUS { 65535, 32000, 17914, 8166, 4352, 2002, 1492, 1006, 508, 296, 68 }
+#define DEFAULT_MSS_CLAMP 0
+#define DEFAULT_ICMP_LIMIT_RATE 100
+#define DEFAULT_ICMP_LIMIT_BURST 20
 
 
 /* -- IPv6 Pool -- */
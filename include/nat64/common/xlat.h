@@ -13,7 +13,7 @@
 #define JOOL_VERSION_MAJOR 3
 #define JOOL_VERSION_MINOR 4
 #define JOOL_VERSION_REV 4
-#define JOOL_VERSION_DEV 0
+#define JOOL_VERSION_DEV 1
 
 /** See http://stackoverflow.com/questions/195975 */
 #define STR_VALUE(arg) #arg
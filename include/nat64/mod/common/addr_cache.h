@@ -0,0 +1,42 @@
+#ifndef _JOOL_MOD_ADDR_CACHE_H
+#define _JOOL_MOD_ADDR_CACHE_H
+
+/**
+ * @file
+ * A per-CPU cache of recent SIIT address translations (EAMT, pool6 and
+ * blacklist lookups), so established flows don't have to query every table
+ * for every packet.
+ *
+ * Entries are stamped with the generation they were computed in, and any
+ * change to the tables bumps the generation. Callers have to read the
+ * generation *before* they query the tables, and stamp the entry they add
+ * with it; that way, an entry computed out of a table that changed midway is
+ * stale from the start.
+ *
+ * Only SIIT Jool initializes the cache, but anyone can invalidate it.
+ */
+
+#include <linux/types.h>
+#include <linux/in6.h>
+
+int addrcache_init(void);
+void addrcache_destroy(void);
+
+/**
+ * Has to be called after every change to the tables the translation depends
+ * on, once the change is visible to the readers.
+ */
+void addrcache_invalidate(void);
+unsigned int addrcache_generation(void);
+
+bool addrcache_get64(struct in6_addr *addr6, bool is_dst, __be32 *addr4,
+		bool *was_6052);
+void addrcache_put64(unsigned int generation, struct in6_addr *addr6,
+		bool is_dst, __be32 addr4, bool was_6052);
+
+bool addrcache_get46(__be32 addr4, bool dst, bool enable_eam,
+		struct in6_addr *addr6);
+void addrcache_put46(unsigned int generation, __be32 addr4, bool dst,
+		bool enable_eam, struct in6_addr *addr6);
+
+#endif /* _JOOL_MOD_ADDR_CACHE_H */
@@ -1,14 +1,48 @@
 #ifndef _JOOL_MOD_CONFIG_H
 #define _JOOL_MOD_CONFIG_H
 
+#include <linux/jump_label.h>
+#include <linux/version.h>
 #include "nat64/common/config.h"
 #include "nat64/common/types.h"
 
+/*
+ * Static branches for the features that are usually off.
+ * While a feature is disabled, its check is patched out of the packet path.
+ * config_replace() flips them whenever the configuration changes.
+ *
+ * These are only hints; the configuration has the final word. (The switch is
+ * turned on before the configuration that needs it is published, and turned
+ * off after the last reader of the old configuration is gone.)
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 3, 0)
+typedef struct static_key_false config_switch;
+#define DEFINE_CONFIG_SWITCH(name) DEFINE_STATIC_KEY_FALSE(name)
+#define config_switch_on(name) static_branch_unlikely(&name)
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(3, 3, 0)
+typedef struct static_key config_switch;
+#define DEFINE_CONFIG_SWITCH(name) config_switch name = STATIC_KEY_INIT_FALSE
+#define config_switch_on(name) static_key_false(&name)
+#else
+typedef struct jump_label_key config_switch;
+#define DEFINE_CONFIG_SWITCH(name) config_switch name
+#define config_switch_on(name) static_branch(&name)
+#endif
+
+extern config_switch bib_logging_switch;
+extern config_switch session_logging_switch;
+extern config_switch drop_by_addr_switch;
+extern config_switch drop_icmp6_info_switch;
+extern config_switch drop_external_tcp_switch;
+extern config_switch randomize_rfc6791_switch;
+extern config_switch mss_clamp_switch;
+
 int config_init(bool is_disable);
 void config_destroy(void);
 
 int config_clone(struct global_config *clone);
 void config_replace(struct global_config *new);
+void config_snapshot(struct global_config *snapshot);
 
 unsigned long config_get_ttl_udp(void);
 unsigned long config_get_ttl_tcpest(void);
@@ -16,28 +50,45 @@ unsigned long config_get_ttl_tcptrans(void);
 unsigned long config_get_ttl_icmp(void);
 
 unsigned int config_get_max_pkts(void);
-bool config_get_src_icmp6errs_better(void);
-unsigned int config_get_f_args(void);
-bool config_handle_rst_during_fin_rcv(void);
 
 bool config_get_bib_logging(void);
 bool config_get_session_logging(void);
 
-bool config_get_filter_icmpv6_info(void);
-bool config_get_addr_dependent_filtering(void);
-bool config_get_drop_external_connections(void);
+static inline bool config_drop_by_addr(struct global_config *cfg)
+{
+	return config_switch_on(drop_by_addr_switch) && cfg->nat64.drop_by_addr;
+}
+
+static inline bool config_drop_icmp6_info(struct global_config *cfg)
+{
+	return config_switch_on(drop_icmp6_info_switch)
+			&& cfg->nat64.drop_icmp6_info;
+}
+
+static inline bool config_drop_external_tcp(struct global_config *cfg)
+{
+	return config_switch_on(drop_external_tcp_switch)
+			&& cfg->nat64.drop_external_tcp;
+}
+
+static inline bool config_randomize_rfc6791(struct global_config *cfg)
+{
+	return config_switch_on(randomize_rfc6791_switch)
+			&& cfg->siit.randomize_error_addresses;
+}
 
-bool config_amend_zero_csum(void);
-enum eam_hairpinning_mode config_eam_hairpin_mode(void);
-bool config_randomize_rfc6791_pool(void);
+/**
+ * Returns the IPv6 MTU translated TCP SYNs' MSS should be clamped to, or zero
+ * if clamping is disabled.
+ */
+static inline __u16 config_mss_clamp(struct global_config *cfg)
+{
+	return config_switch_on(mss_clamp_switch) ? cfg->mss_clamp : 0;
+}
 
-bool config_get_reset_traffic_class(void);
-void config_get_hdr4_config(bool *reset_tos, __u8 *new_tos, bool *build_ipv4_id,
-		bool *df_always_on);
-bool config_get_build_ipv6_fh(void);
 bool config_get_lower_mtu_fail(void);
+void config_get_icmp_limit(__u16 *rate, __u16 *burst);
 void config_get_mtu_plateaus(__u16 **plateaus, __u16 *count);
-bool config_is_xlat_disabled(void);
 
 unsigned long config_get_ttl_frag(void);
 
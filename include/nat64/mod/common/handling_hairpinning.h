@@ -16,6 +16,8 @@
 
 bool is_hairpin(struct packet *pkt, struct tuple *tuple);
 verdict handling_hairpinning(struct packet *pkt, struct tuple *tuple_in);
+verdict hairpin_shortcut(struct packet *in, struct tuple *tuple_out,
+		struct packet *out);
 
 
 #endif /* _JOOL_MOD_HARPINNING_H */
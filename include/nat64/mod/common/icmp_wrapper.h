@@ -32,8 +32,15 @@ typedef enum icmp_error_code {
 	ICMPERR_FILTER,
 } icmp_error_code;
 
+int icmp64_init(void);
+void icmp64_destroy(void);
+
 /**
  * Wrapper for the icmp_send() and the icmpv6_send() functions.
+ *
+ * Errors other than Packet Too Big are rate-limited per CPU, per error type and
+ * per source prefix (see the icmp_limit_* globals), on top of the kernel's own
+ * limits.
  */
 void icmp64_send(struct packet *pkt, icmp_error_code code, __u32 info);
 
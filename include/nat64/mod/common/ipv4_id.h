@@ -0,0 +1,21 @@
+#ifndef _JOOL_MOD_IPV4_ID_H
+#define _JOOL_MOD_IPV4_ID_H
+
+/**
+ * @file
+ * Cheap generator of IPv4 Identification values (see IPV4_ID_COUNTER).
+ *
+ * Every CPU keeps a table of counters, indexed by a keyed hash of the
+ * packet's addresses and protocol. Consecutive packets of the same flow (which
+ * RSS tends to keep on the same CPU) therefore get consecutive IDs, while
+ * the starting point of each counter remains unpredictable.
+ */
+
+#include <linux/types.h>
+
+int ipv4id_init(void);
+void ipv4id_destroy(void);
+
+__be16 ipv4id_next(__be32 saddr, __be32 daddr, __u8 proto);
+
+#endif /* _JOOL_MOD_IPV4_ID_H */
@@ -0,0 +1,42 @@
+#ifndef _JOOL_MOD_LOCAL_ADDRS_H
+#define _JOOL_MOD_LOCAL_ADDRS_H
+
+/**
+ * @file
+ * A copy of the namespace's local IPv4 addresses, so the packet path doesn't
+ * have to walk every interface every time it needs to know whether an address
+ * belongs to this node.
+ *
+ * A couple of notifiers keep the copy up to date. If the last rebuild failed,
+ * the readers silently walk the interfaces instead, so none of these
+ * functions fail because of the copy.
+ *
+ * The SIIT blacklist cares about every local address. Empty pool4 only cares
+ * about the primary addresses of global scope ("global addresses" below).
+ */
+
+#include <linux/netdevice.h>
+#include "nat64/mod/common/types.h"
+
+int localaddrs_init(void);
+void localaddrs_destroy(void);
+
+/**
+ * Is @addr assigned to any of the namespace's interfaces?
+ */
+bool localaddrs_contains(__be32 addr);
+/**
+ * Is @addr one of the namespace's global addresses?
+ */
+bool localaddrs_contains_global(__be32 addr);
+
+/**
+ * Picks the first global address of @dev, unless one of @dev's global
+ * addresses shares a subnet with @daddr, in which case it picks that one.
+ *
+ * Returns -EINVAL if @dev is not an IPv4 device, and -ESRCH if it has no
+ * global addresses.
+ */
+int localaddrs_pick(struct net_device *dev, __be32 daddr, __be32 *result);
+
+#endif /* _JOOL_MOD_LOCAL_ADDRS_H */
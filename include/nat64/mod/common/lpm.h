@@ -0,0 +1,37 @@
+#ifndef _JOOL_MOD_LPM_H
+#define _JOOL_MOD_LPM_H
+
+/**
+ * @file
+ * A compiled, read-only longest prefix match table.
+ *
+ * It's a level-compressed trie: every node picks its own width (as many key
+ * bits as it can index while still filling half of its slots), runs of bits
+ * every prefix below a node agrees on are skipped (and checked once, on the
+ * way down), and the leaves are pushed down. The nodes and their slots all
+ * live in flat arrays. Dense tables get wide, shallow nodes, and sparse ones
+ * (such as an IPv6 EAMT of scattered /128s) cost a few slots per prefix
+ * instead of a node per byte.
+ *
+ * These are meant to be built off the packet path from a mutable source of
+ * truth (such as a rtrie) and then published via RCU. They cannot be updated;
+ * rebuild them instead.
+ */
+
+#include <linux/types.h>
+
+struct lpm;
+
+struct lpm_prefix {
+	const __u8 *bytes;
+	/* In bits; not bytes. */
+	__u8 len;
+};
+
+struct lpm *lpm_build(unsigned int key_bytes, struct lpm_prefix *prefixes,
+		unsigned int count);
+void lpm_destroy(struct lpm *lpm);
+
+int lpm_lookup(const struct lpm *lpm, const __u8 *key);
+
+#endif /* _JOOL_MOD_LPM_H */
@@ -14,6 +14,7 @@
 #include <linux/tcp.h>
 #include <linux/icmp.h>
 
+#include "nat64/common/config.h"
 #include "nat64/mod/common/types.h"
 
 
@@ -146,6 +147,23 @@ static inline unsigned int tcp_hdr_len(struct tcphdr *hdr)
 	return hdr->doff << 2;
 }
 
+/**
+ * Whatever the translation needs to know about an IPv6 packet's extension
+ * header chain.
+ * pkt_init_ipv6() walks the chain exactly once, so nobody else needs to.
+ */
+struct pkt_hdr6_summary {
+	/** Next Header value of the last header (ie. the layer-4 protocol). */
+	__u8 nexthdr;
+	/** Length of the IPv6 header plus all of its extension headers. */
+	__u16 hdrs_len;
+	/**
+	 * Offset (from the start of the IPv6 header) of the first Routing
+	 * header's Segments Left field. Zero if there is no Routing header.
+	 */
+	__u16 segments_left_offset;
+};
+
 /**
  * We need to store packet metadata, so we encapsulate sk_buffs into this.
  *
@@ -178,8 +196,45 @@ struct packet {
 	 * hairpin don't need any flags.
 	 */
 	bool is_hairpin;
+	/**
+	 * NAT64 only. Is this packet's translation going to hairpin?
+	 * It takes a pool4 lookup, so the core decides it once (as soon as the
+	 * outgoing tuple is known) and the later steps just read it from here.
+	 */
+	bool will_hairpin;
+	/**
+	 * Is this a plain TCP or UDP packet? (Unfragmented, with no IPv4 options
+	 * nor IPv6 extension headers.)
+	 * Decided once by pkt_init_ipv4() and pkt_init_ipv6(), so the translator
+	 * can pick its fast path without re-examining the headers.
+	 */
+	bool is_simple;
 
 	struct frag_hdr *hdr_frag;
+	/**
+	 * Outgoing IPv6 packets translated from IPv4 only.
+	 * The IPv4 packet's DF flag was off, so send_packet is allowed to
+	 * fragment this one if it doesn't fit the next hop.
+	 */
+	bool fragmentable;
+	/**
+	 * The Identification the fragments should carry, in case @fragmentable.
+	 * (In-place translation overrides the IPv4 header, so this cannot be
+	 * computed later.)
+	 */
+	__be32 frag_id;
+	/**
+	 * IPv6 packets initialized by pkt_init_ipv6() only.
+	 * The summary of this packet's extension headers. While an inner packet
+	 * is being translated, this describes the inner packet instead.
+	 */
+	struct pkt_hdr6_summary hdr6;
+	/**
+	 * IPv6 packets initialized by pkt_init_ipv6() only.
+	 * The summary of the packet contained in this ICMPv6 error. Undefined if
+	 * pkt_is_icmp6_error() is false.
+	 */
+	struct pkt_hdr6_summary inner_hdr6;
 	/**
 	 * Pointer to the packet's payload.
 	 * Because skbs only store pointers to headers.
@@ -198,6 +253,17 @@ struct packet {
 	 * translated. Also used by the packet queue.
 	 */
 	struct packet *original_pkt;
+	/**
+	 * The configuration this packet is being translated with.
+	 * core_4to6() and core_6to4() snapshot it once per incoming packet
+	 * (see config_snapshot()), and every packet derived from it inherits the
+	 * same pointer, so the whole translation sees a single consistent
+	 * version of the global values.
+	 *
+	 * It lives in the stack of the core function, so it is only valid during
+	 * the translation. Do not keep it around after that.
+	 */
+	struct global_config *cfg;
 
 #ifdef BENCHMARK
 	/**
@@ -219,9 +285,14 @@ static inline void pkt_fill(struct packet *pkt, struct sk_buff *skb,
 	pkt->l4_proto = l4_proto;
 	pkt->is_inner = 0;
 	pkt->is_hairpin = false;
+	pkt->will_hairpin = false;
+	pkt->is_simple = false;
 	pkt->hdr_frag = hdr_frag;
+	pkt->fragmentable = false;
+	pkt->frag_id = 0;
 	pkt->payload = payload;
 	pkt->original_pkt = original_pkt;
+	pkt->cfg = original_pkt ? original_pkt->cfg : NULL;
 #ifdef BENCHMARK
 	pkt->start_time = original_pkt->start_time;
 #endif
@@ -298,6 +369,16 @@ static inline bool pkt_is_intrinsic_hairpin(const struct packet *pkt)
 	return pkt->is_hairpin;
 }
 
+static inline bool pkt_will_hairpin(const struct packet *pkt)
+{
+	return pkt->will_hairpin;
+}
+
+static inline bool pkt_is_simple(const struct packet *pkt)
+{
+	return pkt->is_simple;
+}
+
 static inline bool pkt_is_fragment(const struct packet *pkt)
 {
 	return skb_shinfo(pkt->skb)->frag_list ? true : false;
@@ -453,6 +534,17 @@ static inline unsigned int pkt_len(const struct packet *pkt)
 	return skb_pagelen(pkt->skb) + (skb_shinfo(pkt->skb)->frag_list ? 0 : pkt_hdrs_len(pkt));
 }
 
+/**
+ * Returns the length of the largest packet "pkt" will become once the kernel
+ * segments it. (ie. pkt_len(), unless "pkt" is GSO.)
+ */
+static inline unsigned int pkt_seg_len(const struct packet *pkt)
+{
+	if (skb_is_gso(pkt->skb))
+		return pkt_hdrs_len(pkt) + skb_shinfo(pkt->skb)->gso_size;
+	return pkt_len(pkt);
+}
+
 static inline bool pkt_is_icmp6_error(const struct packet *pkt)
 {
 	return pkt_l4_proto(pkt) == L4PROTO_ICMP && is_icmp6_error(pkt_icmp6_hdr(pkt)->icmp6_type);
@@ -36,6 +36,8 @@ int pool6_flush(void);
  * Because you're not actually borrowing the prefix,
  * - you don't have to return it, and
  * - this function can also be described as a way to infer "addr"'s actual network prefix.
+ *
+ * If several prefixes contain "addr", the longest one wins.
  */
 int pool6_get(const struct in6_addr *addr, struct ipv6_prefix *prefix);
 /**
@@ -0,0 +1,26 @@
+#ifndef _JOOL_MOD_PREFILTER_H
+#define _JOOL_MOD_PREFILTER_H
+
+/**
+ * @file
+ * A cheap summary of the destination addresses Jool might want to translate.
+ *
+ * Hooks ask it before parsing anything, so traffic that merely happens to
+ * cross a translator interface can be handed back to the kernel right away.
+ * It is derived from pool6, pool4, the EAMT and the blacklist; it can yield
+ * false positives (the rest of the pipeline still has the final word), but
+ * never false negatives.
+ */
+
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+
+int prefilter_init(void);
+void prefilter_destroy(void);
+
+int prefilter_update(void);
+
+bool prefilter_wants4(const struct iphdr *hdr);
+bool prefilter_wants6(const struct ipv6hdr *hdr);
+
+#endif /* _JOOL_MOD_PREFILTER_H */
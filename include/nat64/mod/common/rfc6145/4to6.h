@@ -32,5 +32,10 @@ verdict ttp46_tcp(struct tuple *tuple6, struct packet *in, struct packet *out);
  * Translates "in"'s UDP header and payload, and places the result in "out".
  */
 verdict ttp46_udp(struct tuple *tuple6, struct packet *in, struct packet *out);
+/**
+ * Translates "in" into "out" by rewriting "in"'s skb instead of creating a new one.
+ * Only valid if ttpcomm_can_xlat_in_place() says so. "in" cannot be used after this succeeds.
+ */
+verdict ttp46_xlat_in_place(struct tuple *tuple6, struct packet *in, struct packet *out);
 
 #endif /* _JOOL_MOD_RFC6145_4TO6_H */
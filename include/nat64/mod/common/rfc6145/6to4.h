@@ -33,8 +33,13 @@ verdict ttp64_tcp(struct tuple *tuple4, struct packet *in, struct packet *out);
  * Translates "in"'s UDP header and payload, and places the result in "out".
  */
 verdict ttp64_udp(struct tuple *tuple4, struct packet *in, struct packet *out);
+/**
+ * Translates "in" into "out" by rewriting "in"'s skb instead of creating a new one.
+ * Only valid if ttpcomm_can_xlat_in_place() says so. "in" cannot be used after this succeeds.
+ */
+verdict ttp64_xlat_in_place(struct tuple *tuple4, struct packet *in, struct packet *out);
 
-__u8 ttp64_xlat_tos(struct ipv6hdr *hdr);
-__u8 ttp64_xlat_proto(struct ipv6hdr *hdr);
+__u8 ttp64_xlat_tos(struct global_config *cfg, struct ipv6hdr *hdr);
+__u8 ttp64_xlat_proto(struct packet *in);
 
 #endif /* _JOOL_MOD_RFC6145_6TO4_H */
@@ -2,6 +2,8 @@
 #define _JOOL_MOD_RFC6145_COMMON_H
 
 #include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
 #include "nat64/mod/common/types.h"
 #include "nat64/mod/common/packet.h"
 
@@ -27,12 +29,34 @@ struct translation_steps {
 	verdict (*l3_payload_fn)(struct tuple *out_tuple, struct packet *in, struct packet *out);
 };
 
+/**
+ * Stack copy of a fixed-size transport header, used by the in-place translators to compute the
+ * new header before they start overriding the packet.
+ */
+union ttpcomm_l4_hdr {
+	struct tcphdr tcp;
+	struct udphdr udp;
+};
+
 struct translation_steps *ttpcomm_get_steps(enum l3_protocol l3_proto, enum l4_protocol l4_proto);
 
 void partialize_skb(struct sk_buff *skb, unsigned int csum_offset);
+void ttpcomm_clamp_mss(struct tcphdr *tcp, unsigned int mtu, bool update_csum);
 int copy_payload(struct packet *in, struct packet *out);
-bool will_need_frag_hdr(struct iphdr *in_hdr);
+bool will_need_frag_hdr(struct global_config *cfg, struct iphdr *in_hdr);
 verdict ttpcomm_translate_inner_packet(struct tuple *outer_tuple, struct packet *in,
 		struct packet *out);
 
+bool ttpcomm_can_xlat_in_place(struct tuple *out_tuple, struct packet *in);
+unsigned int ttpcomm_in_place_len(struct packet *in);
+bool ttpcomm_in_place_too_big(struct packet *in, struct dst_entry *dst, unsigned int out_len);
+void ttpcomm_in_place_finish(struct sk_buff *skb, struct dst_entry *dst,
+		unsigned int l3hdr_len, unsigned int csum_offset);
+
+__wsum ttpcomm_l4_csum_complete(struct packet *pkt);
+
+bool ttpcomm_gso_supported(struct sk_buff *skb);
+unsigned short ttpcomm_xlat_gso_size(struct sk_buff *skb, l3_protocol out_proto);
+void ttpcomm_xlat_gso(struct sk_buff *in, struct sk_buff *out, l3_protocol out_proto);
+
 #endif /* _JOOL_MOD_TTP_COMMON_H */
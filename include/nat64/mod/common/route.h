@@ -3,6 +3,9 @@
 
 #include "nat64/mod/common/packet.h"
 
+int route_init(void);
+void route_destroy(void);
+
 /**
  * Routes @in's outgoing packet.
  *
@@ -18,6 +21,13 @@ struct dst_entry *__route4(__be32 daddr, __u8 tos, __u8 proto, __u32 mark,
  */
 struct dst_entry *route4(struct packet *pkt);
 
+/**
+ * Same as __route4(), except for IPv6.
+ */
+struct dst_entry *__route6(struct ipv6hdr *hdr, __u8 proto,
+		l4_protocol l4_proto, void *l4_hdr, __u32 mark,
+		struct packet *pkt);
+
 /**
  * Same as route4(), except for IPv6.
  */
@@ -105,6 +105,9 @@ void rtrie_print(char *prefix, struct rtrie *trie);
 int rtrie_add(struct rtrie *trie, void *value, size_t key_offset, __u8 key_len);
 int rtrie_rm(struct rtrie *trie, struct rtrie_key *key);
 void rtrie_flush(struct rtrie *trie);
+int rtrie_add_offline(struct rtrie *trie, void *value, size_t key_offset,
+		__u8 key_len);
+void rtrie_replace(struct rtrie *trie, struct rtrie *new);
 int rtrie_foreach(struct rtrie *trie,
 		int (*cb)(void *, void *), void *arg,
 		struct rtrie_key *offset);
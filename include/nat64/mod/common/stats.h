@@ -30,4 +30,17 @@ void inc_stats_skb4(struct sk_buff *skb, int field);
  * @}
  */
 
+/**
+ * For packets that no longer exist (eg. because the kernel failed to send
+ * them). @dev is the interface they were going to be sent through.
+ */
+void inc_stats_dev(struct net_device *dev, l3_protocol l3_proto, int field);
+
+/**
+ * For ICMP errors @skb should have triggered, but which were not sent.
+ * Increases ICMP_MIB_OUTERRORS or ICMP6_MIB_OUTERRORS, depending on @skb's
+ * protocol.
+ */
+void inc_stats_icmp_outerrors(struct sk_buff *skb);
+
 #endif /* _JOOL_MOD_STATS_H */
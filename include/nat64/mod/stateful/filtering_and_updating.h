@@ -17,5 +17,6 @@ int filtering_init(void);
 void filtering_destroy(void);
 
 verdict filtering_and_updating(struct packet *pkt, struct tuple *in_tuple);
+verdict filtering_and_updating_hairpin(struct packet *in, struct tuple *tuple4);
 
 #endif /* _JOOL_MOD_FILTERING_H */
@@ -1,21 +1,38 @@
 #ifndef _JOOL_MOD_POOL4_TABLE_H
 #define _JOOL_MOD_POOL4_TABLE_H
 
+#include <linux/mutex.h>
 #include "nat64/mod/stateful/pool4/entry.h"
 
+struct pool4_index;
+
 struct pool4_table {
 	__u32 mark;
 	enum l4_protocol proto;
+	/** The authoritative copy; only the writers walk this if they can. */
 	struct list_head rows;
-
-	struct hlist_node hlist_hook;
+	/**
+	 * Flat, read-only copy of @rows the packet path can binary search.
+	 * Rebuilt after every write. NULL if @rows is empty or the last
+	 * rebuild failed; the readers fall back to @rows in that case.
+	 */
+	struct pool4_index __rcu *index;
+	/**
+	 * The lock that serializes this table's writers. The table doesn't
+	 * take it; it's only here so lockdep can check the writers hold it.
+	 */
+	struct mutex *lock;
+
+	/* Two, so the database can be resized under RCU. See pool4/db.c. */
+	struct hlist_node hlist_hook[2];
 };
 
 /*
  * Write functions (Caller must prevent concurrence)
  */
 
-struct pool4_table *pool4table_create(__u32 mark, enum l4_protocol proto);
+struct pool4_table *pool4table_create(__u32 mark, enum l4_protocol proto,
+		struct mutex *lock);
 void pool4table_destroy(struct pool4_table *table);
 
 int pool4table_add(struct pool4_table *table, struct ipv4_prefix *prefix,
@@ -24,6 +24,8 @@ int eamt_add(struct ipv6_prefix *prefix6, struct ipv4_prefix *prefix4,
 		bool force);
 int eamt_rm(struct ipv6_prefix *prefix6, struct ipv4_prefix *prefix4);
 void eamt_flush(void);
+int eamt_load(struct eamt_entry *entries, unsigned int count,
+		bool first, bool last, bool force);
 
 int eamt_count(__u64 *count);
 int eamt_foreach(int (*cb)(struct eamt_entry *, void *), void *arg,
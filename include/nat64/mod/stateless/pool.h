@@ -14,21 +14,38 @@
 
 struct pool_entry {
 	struct ipv4_prefix prefix;
-	struct list_head list_hook;
+	/** @prefix's first address, in host byte order. */
+	__u32 first;
+	/** Number of addresses held by the entries that precede this one. */
+	__u64 offset;
 };
 
-int pool_init(struct list_head __rcu **pool, char *pref_strs[], int pref_count);
-void pool_destroy(struct list_head __rcu **pool);
+/**
+ * A pool of IPv4 prefixes.
+ *
+ * Read-only once published. Updates build a modified copy and swap it in
+ * (RCU), so readers never need locks.
+ */
+struct addr4_pool {
+	unsigned int count;
+	/** Sorted by address. They never intersect each other. */
+	struct pool_entry entries[];
+};
+
+int pool_init(struct addr4_pool __rcu **pool, char *pref_strs[], int pref_count);
+void pool_destroy(struct addr4_pool __rcu **pool);
 
-int pool_add(struct list_head __rcu *pool, struct ipv4_prefix *prefix);
-int pool_rm(struct list_head __rcu *pool, struct ipv4_prefix *prefix);
-int pool_flush(struct list_head __rcu **pool);
+int pool_add(struct addr4_pool __rcu **pool, struct ipv4_prefix *prefix);
+int pool_rm(struct addr4_pool __rcu **pool, struct ipv4_prefix *prefix);
+int pool_flush(struct addr4_pool __rcu **pool);
 
-bool pool_contains(struct list_head __rcu *pool, struct in_addr *addr);
-int pool_foreach(struct list_head __rcu *pool,
+bool pool_contains(struct addr4_pool __rcu *pool, struct in_addr *addr);
+int pool_get_nth(struct addr4_pool __rcu *pool, __u32 n,
+		struct in_addr *result);
+int pool_foreach(struct addr4_pool __rcu *pool,
 		int (*func)(struct ipv4_prefix *, void *), void *arg,
 		struct ipv4_prefix *offset);
-int pool_count(struct list_head __rcu *pool, __u64 *result);
-bool pool_is_empty(struct list_head __rcu *pool);
+int pool_count(struct addr4_pool __rcu *pool, __u64 *result);
+bool pool_is_empty(struct addr4_pool __rcu *pool);
 
 #endif /* _JOOL_MOD_POOL4_H */
@@ -0,0 +1,14 @@
+#ifndef _JOOL_UNIT_ROUTE_H
+#define _JOOL_UNIT_ROUTE_H
+
+#include "nat64/mod/common/route.h"
+
+
+/**
+ * Makes __route4() and __route6() hand out references to @dst.
+ * They fail (as they do by default) if @dst is NULL.
+ */
+void set_route_dst(struct dst_entry *dst);
+
+
+#endif /* _JOOL_UNIT_ROUTE_H */
@@ -25,6 +25,7 @@ enum argp_flags {
 	ARGP_DISPLAY = 'd',
 	ARGP_COUNT = 'c',
 	ARGP_TEST = 5001,
+	ARGP_LOAD = 5002,
 	ARGP_ADD = 'a',
 	ARGP_UPDATE = 5000,
 	ARGP_REMOVE = 'r',
@@ -75,6 +76,10 @@ enum argp_flags {
 	ARGP_EAM_HAIRPIN_MODE = 4018,
 	ARGP_RANDOMIZE_RFC6791 = 4017,
 	ARGP_ATOMIC_FRAGMENTS = 4016,
+	ARGP_IPV4_ID_MODE = 4019,
+	ARGP_MSS_CLAMP = 4020,
+	ARGP_ICMP_LIMIT_RATE = 4021,
+	ARGP_ICMP_LIMIT_BURST = 4022,
 };
 
 struct argp_option *build_options(void);
@@ -10,6 +10,10 @@
 #define OPTNAME_OVERRIDE_TOS		"override-tos"
 #define OPTNAME_TOS			"tos"
 #define OPTNAME_MTU_PLATEAUS		"mtu-plateaus"
+#define OPTNAME_IPV4_ID_MODE		"ipv4-id-mode"
+#define OPTNAME_MSS_CLAMP		"mss-clamp"
+#define OPTNAME_ICMP_LIMIT_RATE		"icmp-error-rate"
+#define OPTNAME_ICMP_LIMIT_BURST	"icmp-error-burst"
 
 /* Atomic fragment flags (deprecated) */
 #define OPTNAME_ALLOW_ATOMIC_FRAGS	"allow-atomic-fragments"
@@ -0,0 +1,145 @@
+#include "nat64/mod/common/addr_cache.h"
+
+#include <linux/atomic.h>
+#include <linux/hash.h>
+#include <linux/percpu.h>
+#include <net/ipv6.h>
+
+#define ADDRCACHE_BITS 7
+#define ADDRCACHE_SIZE (1 << ADDRCACHE_BITS)
+
+struct addrcache64 {
+	unsigned int generation;
+	struct in6_addr addr6;
+	bool is_dst;
+	__be32 addr4;
+	bool was_6052;
+};
+
+struct addrcache46 {
+	unsigned int generation;
+	__be32 addr4;
+	bool dst;
+	bool enable_eam;
+	struct in6_addr addr6;
+};
+
+struct addrcache {
+	struct addrcache64 v64[ADDRCACHE_SIZE];
+	struct addrcache46 v46[ADDRCACHE_SIZE];
+};
+
+static struct addrcache __percpu *cache;
+/* Fresh entries are zeroed, so generation zero is never current. */
+static atomic_t cache_generation = ATOMIC_INIT(1);
+
+int addrcache_init(void)
+{
+	cache = alloc_percpu(struct addrcache);
+	return cache ? 0 : -ENOMEM;
+}
+
+void addrcache_destroy(void)
+{
+	free_percpu(cache);
+	cache = NULL;
+}
+
+void addrcache_invalidate(void)
+{
+	/* atomic_inc_return() is a full barrier; the table change goes first. */
+	if (atomic_inc_return(&cache_generation) == 0)
+		atomic_inc(&cache_generation);
+}
+
+unsigned int addrcache_generation(void)
+{
+	unsigned int result = atomic_read(&cache_generation);
+	/* Pairs with addrcache_invalidate(); query the tables after this. */
+	smp_rmb();
+	return result;
+}
+
+static struct addrcache64 *entry64(struct in6_addr *addr6, bool is_dst)
+{
+	u32 hash = (__force u32) addr6->s6_addr32[3]
+			^ (__force u32) addr6->s6_addr32[2]
+			^ is_dst;
+	return &this_cpu_ptr(cache)->v64[hash_32(hash, ADDRCACHE_BITS)];
+}
+
+static struct addrcache46 *entry46(__be32 addr4, bool dst, bool enable_eam)
+{
+	u32 hash = (__force u32) addr4 ^ (dst << 1) ^ enable_eam;
+	return &this_cpu_ptr(cache)->v46[hash_32(hash, ADDRCACHE_BITS)];
+}
+
+bool addrcache_get64(struct in6_addr *addr6, bool is_dst, __be32 *addr4,
+		bool *was_6052)
+{
+	struct addrcache64 *entry;
+	bool found = false;
+
+	local_bh_disable();
+	entry = entry64(addr6, is_dst);
+	if (entry->generation == atomic_read(&cache_generation)
+			&& entry->is_dst == is_dst
+			&& ipv6_addr_equal(&entry->addr6, addr6)) {
+		*addr4 = entry->addr4;
+		*was_6052 = entry->was_6052;
+		found = true;
+	}
+	local_bh_enable();
+
+	return found;
+}
+
+void addrcache_put64(unsigned int generation, struct in6_addr *addr6,
+		bool is_dst, __be32 addr4, bool was_6052)
+{
+	struct addrcache64 *entry;
+
+	local_bh_disable();
+	entry = entry64(addr6, is_dst);
+	entry->generation = generation;
+	entry->addr6 = *addr6;
+	entry->is_dst = is_dst;
+	entry->addr4 = addr4;
+	entry->was_6052 = was_6052;
+	local_bh_enable();
+}
+
+bool addrcache_get46(__be32 addr4, bool dst, bool enable_eam,
+		struct in6_addr *addr6)
+{
+	struct addrcache46 *entry;
+	bool found = false;
+
+	local_bh_disable();
+	entry = entry46(addr4, dst, enable_eam);
+	if (entry->generation == atomic_read(&cache_generation)
+			&& entry->addr4 == addr4
+			&& entry->dst == dst
+			&& entry->enable_eam == enable_eam) {
+		*addr6 = entry->addr6;
+		found = true;
+	}
+	local_bh_enable();
+
+	return found;
+}
+
+void addrcache_put46(unsigned int generation, __be32 addr4, bool dst,
+		bool enable_eam, struct in6_addr *addr6)
+{
+	struct addrcache46 *entry;
+
+	local_bh_disable();
+	entry = entry46(addr4, dst, enable_eam);
+	entry->generation = generation;
+	entry->addr4 = addr4;
+	entry->dst = dst;
+	entry->enable_eam = enable_eam;
+	entry->addr6 = *addr6;
+	local_bh_enable();
+}
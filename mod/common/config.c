@@ -9,6 +9,61 @@
 static struct global_config __rcu *config;
 static DEFINE_MUTEX(lock);
 
+DEFINE_CONFIG_SWITCH(bib_logging_switch);
+DEFINE_CONFIG_SWITCH(session_logging_switch);
+DEFINE_CONFIG_SWITCH(drop_by_addr_switch);
+DEFINE_CONFIG_SWITCH(drop_icmp6_info_switch);
+DEFINE_CONFIG_SWITCH(drop_external_tcp_switch);
+DEFINE_CONFIG_SWITCH(randomize_rfc6791_switch);
+DEFINE_CONFIG_SWITCH(mss_clamp_switch);
+
+static void set_switch(config_switch *sw, bool enable)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 3, 0)
+	if (enable)
+		static_branch_enable(sw);
+	else
+		static_branch_disable(sw);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(3, 3, 0)
+	if (enable && !static_key_enabled(sw))
+		static_key_slow_inc(sw);
+	else if (!enable && static_key_enabled(sw))
+		static_key_slow_dec(sw);
+#else
+	if (enable && !jump_label_enabled(sw))
+		jump_label_inc(sw);
+	else if (!enable && jump_label_enabled(sw))
+		jump_label_dec(sw);
+#endif
+}
+
+/**
+ * Sets to @value every switch whose feature is set to @value in @cfg.
+ * (ie. call with true to only turn switches on, false to only turn them off.)
+ * A NULL @cfg counts as all features disabled.
+ */
+static void update_switches(struct global_config *cfg, bool value)
+{
+	struct {
+		config_switch *sw;
+		bool enabled;
+	} switches[] = {
+		{ &bib_logging_switch, cfg && cfg->nat64.bib_logging },
+		{ &session_logging_switch, cfg && cfg->nat64.session_logging },
+		{ &drop_by_addr_switch, cfg && cfg->nat64.drop_by_addr },
+		{ &drop_icmp6_info_switch, cfg && cfg->nat64.drop_icmp6_info },
+		{ &drop_external_tcp_switch, cfg && cfg->nat64.drop_external_tcp },
+		{ &randomize_rfc6791_switch,
+				cfg && cfg->siit.randomize_error_addresses },
+		{ &mss_clamp_switch, cfg && cfg->mss_clamp },
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(switches); i++)
+		if (switches[i].enabled == value)
+			set_switch(switches[i].sw, value);
+}
+
 RCUTAG_USR
 int config_init(bool is_disable)
 {
@@ -24,6 +79,7 @@ int config_init(bool is_disable)
 	cfg->reset_traffic_class = DEFAULT_RESET_TRAFFIC_CLASS;
 	cfg->reset_tos = DEFAULT_RESET_TOS;
 	cfg->new_tos = DEFAULT_NEW_TOS;
+	cfg->ipv4_id_mode = DEFAULT_IPV4_ID_MODE;
 
 	cfg->atomic_frags.df_always_on = DEFAULT_DF_ALWAYS_ON;
 	cfg->atomic_frags.build_ipv6_fh = DEFAULT_BUILD_IPV6_FH;
@@ -49,6 +105,9 @@ int config_init(bool is_disable)
 	cfg->siit.eam_hairpin_mode = DEFAULT_EAM_HAIRPIN_MODE;
 	cfg->siit.randomize_error_addresses = DEFAULT_RANDOMIZE_RFC6791;
 
+	cfg->mss_clamp = DEFAULT_MSS_CLAMP;
+	cfg->icmp_limit_rate = DEFAULT_ICMP_LIMIT_RATE;
+	cfg->icmp_limit_burst = DEFAULT_ICMP_LIMIT_BURST;
 	cfg->mtu_plateau_count = ARRAY_SIZE(plateaus);
 	cfg->mtu_plateaus = kmalloc(sizeof(plateaus), GFP_ATOMIC);
 	if (!cfg->mtu_plateaus) {
@@ -59,6 +118,7 @@ int config_init(bool is_disable)
 	memcpy(cfg->mtu_plateaus, &plateaus, sizeof(plateaus));
 
 	mutex_lock(&lock);
+	update_switches(cfg, true);
 	rcu_assign_pointer(config, cfg);
 	mutex_unlock(&lock);
 
@@ -95,18 +155,43 @@ int config_clone(struct global_config *clone)
 	return 0;
 }
 
+/**
+ * Copies the current configuration into @snapshot, so a packet can be
+ * translated against one consistent version of it without visiting RCU once
+ * per field.
+ *
+ * The MTU plateaus are not part of the snapshot (@snapshot->mtu_plateaus is
+ * set to NULL); use config_get_mtu_plateaus() for those.
+ */
+RCUTAG_PKT
+void config_snapshot(struct global_config *snapshot)
+{
+	rcu_read_lock_bh();
+	*snapshot = *rcu_dereference_bh(config);
+	rcu_read_unlock_bh();
+
+	snapshot->mtu_plateaus = NULL;
+}
+
 RCUTAG_USR
 void config_replace(struct global_config *new)
 {
 	struct global_config *old;
 
 	mutex_lock(&lock);
+	update_switches(new, true);
 	old = rcu_dereference_protected(config, lockdep_is_held(&lock));
 	rcu_assign_pointer(config, new);
 	mutex_unlock(&lock);
 
 	synchronize_rcu_bh();
 
+	mutex_lock(&lock);
+	/* Only if nobody replaced @new in the meantime. */
+	if (rcu_access_pointer(config) == new)
+		update_switches(new, false);
+	mutex_unlock(&lock);
+
 	kfree(old->mtu_plateaus);
 	kfree(old);
 }
@@ -150,21 +235,6 @@ unsigned int config_get_max_pkts(void)
 	return RCU_THINGY(unsigned int, nat64.max_stored_pkts);
 }
 
-bool config_get_src_icmp6errs_better(void)
-{
-	return RCU_THINGY(bool, nat64.src_icmp6errs_better);
-}
-
-unsigned int config_get_f_args(void)
-{
-	return RCU_THINGY(unsigned int, nat64.f_args);
-}
-
-bool config_handle_rst_during_fin_rcv(void)
-{
-	return RCU_THINGY(bool, nat64.handle_rst_during_fin_rcv);
-}
-
 bool config_get_bib_logging(void)
 {
 	return RCU_THINGY(bool, nat64.bib_logging);
@@ -175,67 +245,22 @@ bool config_get_session_logging(void)
 	return RCU_THINGY(bool, nat64.session_logging);
 }
 
-bool config_get_filter_icmpv6_info(void)
-{
-	return RCU_THINGY(bool, nat64.drop_icmp6_info);
-}
-
-bool config_get_addr_dependent_filtering(void)
-{
-	return RCU_THINGY(bool, nat64.drop_by_addr);
-}
-
-bool config_get_drop_external_connections(void)
-{
-	return RCU_THINGY(bool, nat64.drop_external_tcp);
-}
-
-bool config_amend_zero_csum(void)
-{
-	return RCU_THINGY(bool, siit.compute_udp_csum_zero);
-}
-
-enum eam_hairpinning_mode config_eam_hairpin_mode(void)
-{
-	return RCU_THINGY(__u8, siit.eam_hairpin_mode);
-}
-
-bool config_randomize_rfc6791_pool(void)
-{
-	return RCU_THINGY(bool, siit.randomize_error_addresses);
-}
-
-bool config_get_reset_traffic_class(void)
+bool config_get_lower_mtu_fail(void)
 {
-	return RCU_THINGY(bool, reset_traffic_class);
+	return RCU_THINGY(bool, atomic_frags.lower_mtu_fail);
 }
 
-void config_get_hdr4_config(bool *reset_tos, __u8 *new_tos, bool *build_ipv4_id,
-		bool *df_always_on)
+void config_get_icmp_limit(__u16 *rate, __u16 *burst)
 {
 	struct global_config *tmp;
 
 	rcu_read_lock_bh();
 	tmp = rcu_dereference_bh(config);
-	*reset_tos = tmp->reset_tos;
-	*new_tos = tmp->new_tos;
-	if (build_ipv4_id)
-		*build_ipv4_id = tmp->atomic_frags.build_ipv4_id;
-	if (df_always_on)
-		*df_always_on = tmp->atomic_frags.df_always_on;
+	*rate = tmp->icmp_limit_rate;
+	*burst = tmp->icmp_limit_burst;
 	rcu_read_unlock_bh();
 }
 
-bool config_get_build_ipv6_fh(void)
-{
-	return RCU_THINGY(bool, atomic_frags.build_ipv6_fh);
-}
-
-bool config_get_lower_mtu_fail(void)
-{
-	return RCU_THINGY(bool, atomic_frags.lower_mtu_fail);
-}
-
 /**
  * You need to call rcu_read_lock_bh() before calling this function,
  * and then rcu_read_unlock_bh() when you don't need plateaus & count anymore.
@@ -249,11 +274,6 @@ void config_get_mtu_plateaus(__u16 **plateaus, __u16 *count)
 	*count = tmp->mtu_plateau_count;
 }
 
-bool config_is_xlat_disabled(void)
-{
-	return RCU_THINGY(bool, is_disable);
-}
-
 RCUTAG_USR /* Only because of GFP_KERNEL. Can be easily upgraded to _FREE. */
 int serialize_global_config(struct global_config *config, bool pools_empty,
 		unsigned char **buffer_out, size_t *buffer_len_out)
@@ -3,6 +3,8 @@
 #include "nat64/mod/common/config.h"
 #include "nat64/mod/common/handling_hairpinning.h"
 #include "nat64/mod/common/namespace.h"
+#include "nat64/mod/common/prefilter.h"
+#include "nat64/mod/common/stats.h"
 #include "nat64/mod/common/rfc6145/core.h"
 #include "nat64/mod/stateful/compute_outgoing_tuple.h"
 #include "nat64/mod/stateful/determine_incoming_tuple.h"
@@ -11,11 +13,36 @@
 #include "nat64/mod/common/send_packet.h"
 
 
+/**
+ * Sends @out, which is @in's own skb, translated in place (either by
+ * translating_the_packet() or by hairpin_shortcut()).
+ *
+ * sendpkt_send() releases the skb whatever happens, so "in" is gone either way
+ * and the kernel must not see it again. Failures can only be logged and
+ * counted here.
+ */
+static unsigned int send_in_place(struct packet *in, struct packet *out)
+{
+	/* The in-place translators always route the packet themselves. */
+	struct net_device *dev = skb_dst(out->skb)->dev;
+	l3_protocol l3_proto = pkt_l3_proto(out);
+
+	if (sendpkt_send(in, out) == VERDICT_CONTINUE) {
+		log_debug("Success.");
+	} else {
+		log_debug("The translated packet could not be sent.");
+		inc_stats_dev(dev, l3_proto, IPSTATS_MIB_OUTDISCARDS);
+	}
+
+	return (unsigned int) VERDICT_STOLEN;
+}
+
 static unsigned int core_common(struct packet *in)
 {
 	struct packet out;
 	struct tuple tuple_in;
 	struct tuple tuple_out;
+	bool hairpin;
 	verdict result;
 
 	if (xlat_is_nat64()) {
@@ -28,12 +55,29 @@ static unsigned int core_common(struct packet *in)
 		result = compute_out_tuple(&tuple_in, &tuple_out, in);
 		if (result != VERDICT_CONTINUE)
 			goto end;
+		in->will_hairpin = is_hairpin(in, &tuple_out);
+		if (pkt_will_hairpin(in)) {
+			result = hairpin_shortcut(in, &tuple_out, &out);
+			if (result != VERDICT_CONTINUE)
+				goto end;
+			if (out.skb)
+				return send_in_place(in, &out);
+		}
 	}
 	result = translating_the_packet(&tuple_out, in, &out);
 	if (result != VERDICT_CONTINUE)
 		goto end;
+	/* Hairpins are never translated in place. */
+	if (out.skb == in->skb)
+		return send_in_place(in, &out);
+
+	/* SIIT only learns about (intrinsic) hairpins while translating. */
+	if (xlat_is_nat64())
+		hairpin = pkt_will_hairpin(in);
+	else
+		hairpin = is_hairpin(&out, &tuple_out);
 
-	if (is_hairpin(&out, &tuple_out)) {
+	if (hairpin) {
 		result = handling_hairpinning(&out, &tuple_out);
 		kfree_skb(out.skb);
 	} else {
@@ -76,15 +120,17 @@ static bool check_namespace(const struct net_device *dev)
 unsigned int core_4to6(struct sk_buff *skb, const struct net_device *dev)
 {
 	struct packet pkt;
+	struct global_config cfg;
 	struct iphdr *hdr = ip_hdr(skb);
 
+	if (!check_namespace(dev) || !prefilter_wants4(hdr))
+		return NF_ACCEPT;
+	config_snapshot(&cfg);
 	/*
-	 * TODO (fine) The first if is silly.
+	 * TODO (fine) This if is silly.
 	 * We should probably unhook Jool from Netfilter instead.
 	 */
-	if (config_is_xlat_disabled())
-		return NF_ACCEPT;
-	if (!check_namespace(dev))
+	if (cfg.is_disable)
 		return NF_ACCEPT;
 
 	log_debug("===============================================");
@@ -93,6 +139,7 @@ unsigned int core_4to6(struct sk_buff *skb, const struct net_device *dev)
 	/* Reminder: This function might change pointers. */
 	if (pkt_init_ipv4(&pkt, skb) != 0)
 		return NF_DROP;
+	pkt.cfg = &cfg;
 
 	return core_common(&pkt);
 }
@@ -100,11 +147,13 @@ unsigned int core_4to6(struct sk_buff *skb, const struct net_device *dev)
 unsigned int core_6to4(struct sk_buff *skb, const struct net_device *dev)
 {
 	struct packet pkt;
+	struct global_config cfg;
 	struct ipv6hdr *hdr = ipv6_hdr(skb);
 
-	if (config_is_xlat_disabled())
+	if (!check_namespace(dev) || !prefilter_wants6(hdr))
 		return NF_ACCEPT;
-	if (!check_namespace(dev))
+	config_snapshot(&cfg);
+	if (cfg.is_disable)
 		return NF_ACCEPT;
 
 	log_debug("===============================================");
@@ -114,6 +163,7 @@ unsigned int core_6to4(struct sk_buff *skb, const struct net_device *dev)
 	/* Reminder: This function might change pointers. */
 	if (pkt_init_ipv6(&pkt, skb) != 0)
 		return NF_DROP;
+	pkt.cfg = &cfg;
 
 	if (xlat_is_nat64()) {
 		verdict result = fragdb_handle(&pkt);
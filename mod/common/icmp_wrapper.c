@@ -1,11 +1,74 @@
 #include "nat64/mod/common/icmp_wrapper.h"
+#include "nat64/mod/common/config.h"
 #include "nat64/mod/common/types.h"
 #include "nat64/mod/common/route.h"
+#include "nat64/mod/common/stats.h"
 
+#include <linux/hash.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/jiffies.h>
+#include <linux/percpu.h>
 #include <linux/version.h>
 #include <net/icmp.h>
 #include <linux/icmpv6.h>
 
+/*
+ * Jool-level ICMP error rate limiting, so floods of untranslatable packets
+ * don't keep the CPUs busy building errors.
+ *
+ * Each CPU has one token bucket per error type per source prefix: /24 for
+ * IPv4, /64 for IPv6. A bucket gains "rate" tokens per jiffy, every error
+ * costs HZ of them, and a bucket never holds more than "burst" errors' worth
+ * (see the icmp_limit_* globals). Since the buckets are per-CPU, a prefix that
+ * spreads over several CPUs gets proportionally more errors; the kernel's own
+ * per-destination limits still apply on top of these.
+ *
+ * The buckets live in a set-associative table that stores and compares the
+ * whole key, so prefixes that hash alike don't share their limit. When a set
+ * runs out of ways, the bucket that went the longest without being charged is
+ * recycled (and its replacement starts full). A flooding prefix charges its
+ * bucket all the time, so it is never the one that gets recycled.
+ *
+ * Like the kernel's limiter, this one never drops Packet Too Bigs, because
+ * that would black-hole Path MTU Discovery.
+ */
+#define ICMPLIMIT_BITS 7
+#define ICMPLIMIT_SETS (1 << ICMPLIMIT_BITS)
+#define ICMPLIMIT_WAYS 4
+#define ICMPERR_TYPES (ICMPERR_FILTER + 1)
+
+struct icmp_key {
+	/** The source's /24 or /64, in host byte order. */
+	__u64 prefix;
+	/** (error type << 1) | is_ipv6. Never zero. */
+	__u32 tag;
+};
+
+struct icmp_bucket {
+	struct icmp_key key;
+	unsigned long stamp;
+	__u64 tokens;
+};
+
+struct icmp_limiter {
+	struct icmp_bucket sets[ICMPLIMIT_SETS][ICMPLIMIT_WAYS];
+};
+
+static struct icmp_limiter __percpu *limiter;
+
+int icmp64_init(void)
+{
+	limiter = alloc_percpu(struct icmp_limiter);
+	return limiter ? 0 : -ENOMEM;
+}
+
+void icmp64_destroy(void)
+{
+	free_percpu(limiter);
+	limiter = NULL;
+}
+
 static char *icmp_error_to_string(icmp_error_code error) {
 	switch (error) {
 	case ICMPERR_SILENT:
@@ -116,6 +179,130 @@ static void icmp6_send(struct sk_buff *skb, icmp_error_code error, __u32 info)
 #endif
 }
 
+static void get_key(struct sk_buff *skb, icmp_error_code error,
+		struct icmp_key *key)
+{
+	struct ipv6hdr *hdr6;
+
+	switch (ntohs(skb->protocol)) {
+	case ETH_P_IP:
+		key->prefix = be32_to_cpu(ip_hdr(skb)->saddr) & 0xFFFFFF00U;
+		key->tag = error << 1;
+		return;
+	case ETH_P_IPV6:
+		hdr6 = ipv6_hdr(skb);
+		key->prefix = be32_to_cpu(hdr6->saddr.s6_addr32[0]);
+		key->prefix = (key->prefix << 32)
+				| be32_to_cpu(hdr6->saddr.s6_addr32[1]);
+		key->tag = (error << 1) | 1;
+		return;
+	}
+
+	key->prefix = 0;
+	key->tag = error << 1;
+}
+
+static bool key_equals(struct icmp_key *k1, struct icmp_key *k2)
+{
+	return k1->prefix == k2->prefix && k1->tag == k2->tag;
+}
+
+/**
+ * Returns @key's bucket from @local. If there's none, one is recycled and
+ * filled to @burst errors' worth.
+ */
+static struct icmp_bucket *get_bucket(struct icmp_limiter *local,
+		struct icmp_key *key, unsigned long now, unsigned int burst)
+{
+	struct icmp_bucket *set;
+	struct icmp_bucket *victim;
+	unsigned int i;
+
+	set = local->sets[hash_64(key->prefix ^ key->tag, ICMPLIMIT_BITS)];
+	victim = &set[0];
+
+	for (i = 0; i < ICMPLIMIT_WAYS; i++) {
+		if (key_equals(&set[i].key, key))
+			return &set[i];
+		if (victim->key.tag == 0)
+			continue;
+		if (set[i].key.tag == 0
+				|| time_before(set[i].stamp, victim->stamp))
+			victim = &set[i];
+	}
+
+	victim->key = *key;
+	victim->stamp = now;
+	victim->tokens = (__u64) burst * HZ;
+	return victim;
+}
+
+/**
+ * Refills @bucket up to @now, then takes an error's worth of tokens from it if
+ * it has them. Returns whether it did.
+ */
+static bool bucket_charge(struct icmp_bucket *bucket, unsigned long now,
+		unsigned int rate, unsigned int burst)
+{
+	__u64 max = (__u64) burst * HZ;
+	unsigned long elapsed = now - bucket->stamp;
+
+	bucket->stamp = now;
+	/* It's full after this long anyway, and the product could overflow. */
+	if (elapsed >= max)
+		bucket->tokens = max;
+	else
+		bucket->tokens = min(bucket->tokens + (__u64) elapsed * rate, max);
+
+	if (bucket->tokens < HZ)
+		return false;
+
+	bucket->tokens -= HZ;
+	return true;
+}
+
+/**
+ * Returns true if the rate limits allow @pkt's source to receive an @error
+ * right now, and charges the corresponding bucket if so.
+ */
+static bool icmp64_allow(struct packet *pkt, icmp_error_code error)
+{
+	struct icmp_key key;
+	unsigned long now;
+	__u16 rate;
+	__u16 burst;
+	bool allowed;
+
+	if (error == ICMPERR_SILENT || error == ICMPERR_FRAG_NEEDED
+			|| error >= ICMPERR_TYPES)
+		return true;
+
+	if (pkt->cfg) {
+		rate = pkt->cfg->icmp_limit_rate;
+		burst = pkt->cfg->icmp_limit_burst;
+	} else {
+		/* Stored packets outlive their translation's snapshot. */
+		config_get_icmp_limit(&rate, &burst);
+	}
+	if (rate == 0)
+		return true;
+
+	get_key(pkt->skb, error, &key);
+	now = jiffies;
+
+	local_bh_disable();
+	allowed = bucket_charge(get_bucket(this_cpu_ptr(limiter), &key, now,
+			burst), now, rate, burst);
+	local_bh_enable();
+
+	if (!allowed) {
+		log_debug("Rate limit reached; not sending %s.",
+				icmp_error_to_string(error));
+		inc_stats_icmp_outerrors(pkt->skb);
+	}
+	return allowed;
+}
+
 void icmp64_send(struct packet *pkt, icmp_error_code error, __u32 info)
 {
 	struct sk_buff *skb;
@@ -129,6 +316,8 @@ void icmp64_send(struct packet *pkt, icmp_error_code error, __u32 info)
 	skb = pkt->skb;
 	if (unlikely(!skb) || !skb->dev)
 		return;
+	if (!icmp64_allow(pkt, error))
+		return;
 
 	/* Send the error. */
 	switch (ntohs(skb->protocol)) {
@@ -0,0 +1,56 @@
+#include "nat64/mod/common/ipv4_id.h"
+
+#include <linux/jhash.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
+#include "nat64/mod/common/tags.h"
+
+#define IDENTS_BITS 8
+#define IDENTS_SIZE (1 << IDENTS_BITS)
+
+static u32 secret;
+static u16 __percpu *idents;
+
+RCUTAG_INIT
+int ipv4id_init(void)
+{
+	unsigned int cpu;
+
+	idents = __alloc_percpu(IDENTS_SIZE * sizeof(*idents),
+			__alignof__(*idents));
+	if (!idents)
+		return -ENOMEM;
+
+	get_random_bytes(&secret, sizeof(secret));
+	for_each_possible_cpu(cpu) {
+		get_random_bytes(per_cpu_ptr(idents, cpu),
+				IDENTS_SIZE * sizeof(*idents));
+	}
+
+	return 0;
+}
+
+RCUTAG_INIT
+void ipv4id_destroy(void)
+{
+	free_percpu(idents);
+}
+
+/**
+ * Returns the next Identification value for a packet whose header contains
+ * @saddr, @daddr and @proto.
+ *
+ * Has to be called with preemption disabled (ie. during packet processing).
+ */
+RCUTAG_PKT
+__be16 ipv4id_next(__be32 saddr, __be32 daddr, __u8 proto)
+{
+	u32 hash;
+	u16 *ident;
+
+	hash = jhash_3words((__force u32) daddr, (__force u32) saddr, proto,
+			secret);
+	ident = this_cpu_ptr(idents) + (hash & (IDENTS_SIZE - 1));
+
+	return cpu_to_be16((*ident)++);
+}
@@ -0,0 +1,396 @@
+#include "nat64/mod/common/local_addrs.h"
+
+#include <linux/hash.h>
+#include <linux/inetdevice.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/version.h>
+#include "nat64/mod/common/addr_cache.h"
+#include "nat64/mod/common/namespace.h"
+
+/**
+ * One of the namespace's global addresses.
+ */
+struct global_addr4 {
+	int ifindex;
+	__be32 local;
+	__be32 address;
+	__be32 mask;
+};
+
+/**
+ * A slot from the local address hash table.
+ */
+struct local_addr4 {
+	__be32 addr;
+	/* Zero is a legal address, so it can't mark the empty slots. */
+	bool used;
+	/* The address can be assigned more than once; is any of them global? */
+	bool global;
+};
+
+struct local_addrs {
+	struct rcu_head rcu;
+	/** Number of addresses the snapshot still has room for. */
+	unsigned int room;
+
+	/** log2 of the number of slots. */
+	unsigned int bits;
+	/** Every local address. Open addressing, linear probing. */
+	struct local_addr4 *slots;
+
+	unsigned int global_count;
+	/** In interface order, which is the order localaddrs_pick() needs. */
+	struct global_addr4 globals[];
+};
+
+/**
+ * NULL means "no snapshot", and the readers walk the interfaces themselves.
+ * (This only happens if the last rebuild failed.)
+ */
+static struct local_addrs __rcu *snapshot;
+static DEFINE_MUTEX(lock);
+
+static bool is_global(struct in_ifaddr *ifa)
+{
+	return !(ifa->ifa_flags & IFA_F_SECONDARY)
+			&& ifa->ifa_scope == RT_SCOPE_UNIVERSE;
+}
+
+static unsigned int count_addrs(void)
+{
+	struct net_device *dev;
+	struct in_device *in_dev;
+	struct in_ifaddr *ifa;
+	unsigned int result = 0;
+
+	for_each_netdev_rcu(joolns_get(), dev) {
+		in_dev = __in_dev_get_rcu(dev);
+		if (!in_dev)
+			continue;
+		for (ifa = in_dev->ifa_list; ifa; ifa = ifa->ifa_next)
+			result++;
+	}
+
+	return result;
+}
+
+/**
+ * Returns a snapshot with room for @count addresses. At most half of the slots
+ * will be used, so the probe sequences stay short.
+ */
+static struct local_addrs *snapshot_alloc(unsigned int count)
+{
+	struct local_addrs *result;
+	unsigned int bits;
+
+	bits = ilog2(roundup_pow_of_two(2 * count + 8));
+	result = kzalloc(sizeof(*result)
+			+ count * sizeof(result->globals[0])
+			+ (sizeof(result->slots[0]) << bits),
+			GFP_ATOMIC);
+	if (!result)
+		return NULL;
+
+	result->room = count;
+	result->bits = bits;
+	result->slots = (struct local_addr4 *)&result->globals[count];
+	return result;
+}
+
+static struct local_addr4 *snapshot_probe(struct local_addrs *snap,
+		__be32 addr)
+{
+	unsigned int mask = (1U << snap->bits) - 1;
+	unsigned int i;
+
+	i = hash_32((__force __u32)addr, snap->bits);
+	while (snap->slots[i].used && snap->slots[i].addr != addr)
+		i = (i + 1) & mask;
+
+	return &snap->slots[i];
+}
+
+static int snapshot_add(struct local_addrs *snap, int ifindex,
+		struct in_ifaddr *ifa)
+{
+	struct local_addr4 *slot;
+	struct global_addr4 *global;
+
+	if (snap->room == 0)
+		return -ENOSPC;
+	snap->room--;
+
+	slot = snapshot_probe(snap, ifa->ifa_local);
+	slot->addr = ifa->ifa_local;
+	slot->used = true;
+
+	if (!is_global(ifa))
+		return 0;
+
+	slot->global = true;
+	global = &snap->globals[snap->global_count];
+	global->ifindex = ifindex;
+	global->local = ifa->ifa_local;
+	global->address = ifa->ifa_address;
+	global->mask = ifa->ifa_mask;
+	snap->global_count++;
+	return 0;
+}
+
+static int snapshot_create(struct local_addrs **result)
+{
+	struct local_addrs *snap;
+	struct net_device *dev;
+	struct in_device *in_dev;
+	struct in_ifaddr *ifa;
+	int error;
+
+	snap = snapshot_alloc(count_addrs());
+	if (!snap)
+		return -ENOMEM;
+
+	for_each_netdev_rcu(joolns_get(), dev) {
+		in_dev = __in_dev_get_rcu(dev);
+		if (!in_dev)
+			continue;
+
+		for (ifa = in_dev->ifa_list; ifa; ifa = ifa->ifa_next) {
+			/* Notifiers are serialized, but let's not trust that. */
+			error = snapshot_add(snap, dev->ifindex, ifa);
+			if (error) {
+				kfree(snap);
+				return error;
+			}
+		}
+	}
+
+	*result = snap;
+	return 0;
+}
+
+static void snapshot_update(void)
+{
+	struct local_addrs *old;
+	struct local_addrs *new = NULL;
+	int error;
+
+	mutex_lock(&lock);
+
+	rcu_read_lock();
+	error = snapshot_create(&new);
+	rcu_read_unlock();
+	if (error == -ENOMEM)
+		log_debug("Out of memory; the local addresses will be looked up the slow way.");
+	else if (error)
+		log_debug("The addresses changed while they were being copied (%d); they will be looked up the slow way.",
+				error);
+
+	old = rcu_dereference_protected(snapshot, lockdep_is_held(&lock));
+	rcu_assign_pointer(snapshot, new);
+	/* The SIIT blacklist depends on the local addresses. */
+	addrcache_invalidate();
+
+	mutex_unlock(&lock);
+
+	/* We're in a notifier, under RTNL; don't block for a grace period. */
+	if (old)
+		kfree_rcu(old, rcu);
+}
+
+static int handle_inetaddr_event(struct notifier_block *nb,
+		unsigned long event, void *ptr)
+{
+	struct in_ifaddr *ifa = ptr;
+
+	if (net_eq(dev_net(ifa->ifa_dev->dev), joolns_get()))
+		snapshot_update();
+
+	return NOTIFY_DONE;
+}
+
+static int handle_netdev_event(struct notifier_block *nb,
+		unsigned long event, void *ptr)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 11, 0)
+	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+#else
+	struct net_device *dev = ptr;
+#endif
+
+	/* Address changes are handled by the other notifier. */
+	if (event != NETDEV_REGISTER && event != NETDEV_UNREGISTER)
+		return NOTIFY_DONE;
+
+	if (net_eq(dev_net(dev), joolns_get()))
+		snapshot_update();
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block inetaddr_notifier = {
+	.notifier_call = handle_inetaddr_event,
+};
+
+static struct notifier_block netdev_notifier = {
+	.notifier_call = handle_netdev_event,
+};
+
+int localaddrs_init(void)
+{
+	int error;
+
+	RCU_INIT_POINTER(snapshot, NULL);
+
+	/* Registering the netdev notifier replays REGISTER, so this builds. */
+	error = register_netdevice_notifier(&netdev_notifier);
+	if (error)
+		return error;
+	error = register_inetaddr_notifier(&inetaddr_notifier);
+	if (error) {
+		unregister_netdevice_notifier(&netdev_notifier);
+		return error;
+	}
+
+	snapshot_update();
+	return 0;
+}
+
+void localaddrs_destroy(void)
+{
+	struct local_addrs *old;
+
+	unregister_inetaddr_notifier(&inetaddr_notifier);
+	unregister_netdevice_notifier(&netdev_notifier);
+
+	old = rcu_dereference_raw(snapshot);
+	RCU_INIT_POINTER(snapshot, NULL);
+	synchronize_rcu();
+	kfree(old);
+}
+
+bool localaddrs_contains(__be32 addr)
+{
+	struct local_addrs *snap;
+	struct net_device *dev;
+	struct in_device *in_dev;
+	struct in_ifaddr *ifa;
+	bool found = false;
+
+	rcu_read_lock();
+
+	snap = rcu_dereference(snapshot);
+	if (snap) {
+		found = snapshot_probe(snap, addr)->used;
+		goto end;
+	}
+
+	for_each_netdev_rcu(joolns_get(), dev) {
+		in_dev = __in_dev_get_rcu(dev);
+		if (!in_dev)
+			continue;
+
+		for (ifa = in_dev->ifa_list; ifa; ifa = ifa->ifa_next) {
+			if (ifa->ifa_local == addr) {
+				found = true;
+				goto end;
+			}
+		}
+	}
+
+end:
+	rcu_read_unlock();
+	return found;
+}
+
+bool localaddrs_contains_global(__be32 addr)
+{
+	struct local_addrs *snap;
+	struct local_addr4 *slot;
+	struct net_device *dev;
+	struct in_device *in_dev;
+	bool found = false;
+
+	rcu_read_lock();
+
+	snap = rcu_dereference(snapshot);
+	if (snap) {
+		slot = snapshot_probe(snap, addr);
+		found = slot->used && slot->global;
+		goto end;
+	}
+
+	for_each_netdev_rcu(joolns_get(), dev) {
+		in_dev = __in_dev_get_rcu(dev);
+		if (!in_dev)
+			continue;
+
+		for_primary_ifa(in_dev) {
+			if (ifa->ifa_scope != RT_SCOPE_UNIVERSE)
+				continue;
+			if (ifa->ifa_local == addr) {
+				found = true;
+				goto end;
+			}
+		} endfor_ifa(in_dev);
+	}
+
+end:
+	rcu_read_unlock();
+	return found;
+}
+
+int localaddrs_pick(struct net_device *dev, __be32 daddr, __be32 *result)
+{
+	struct local_addrs *snap;
+	struct global_addr4 *global;
+	struct in_device *in_dev;
+	__be32 saddr = 0;
+	unsigned int i;
+	int error = 0;
+
+	rcu_read_lock();
+
+	/* Devices without addresses are not in the snapshot, so check first. */
+	in_dev = __in_dev_get_rcu(dev);
+	if (!in_dev) {
+		log_debug("IPv4 route doesn't involve an IPv4 device.");
+		error = -EINVAL;
+		goto end;
+	}
+
+	snap = rcu_dereference(snapshot);
+	if (snap) {
+		for (i = 0; i < snap->global_count; i++) {
+			global = &snap->globals[i];
+			if (global->ifindex != dev->ifindex)
+				continue;
+			if (!((daddr ^ global->address) & global->mask)) {
+				*result = global->local;
+				goto end;
+			}
+			if (!saddr)
+				saddr = global->local;
+		}
+	} else {
+		for_primary_ifa(in_dev) {
+			if (ifa->ifa_scope != RT_SCOPE_UNIVERSE)
+				continue;
+			if (inet_ifa_match(daddr, ifa)) {
+				*result = ifa->ifa_local;
+				goto end;
+			}
+			if (!saddr)
+				saddr = ifa->ifa_local;
+		} endfor_ifa(in_dev);
+	}
+
+	if (saddr)
+		*result = saddr;
+	else
+		error = -ESRCH;
+
+end:
+	rcu_read_unlock();
+	return error;
+}
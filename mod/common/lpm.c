@@ -0,0 +1,506 @@
+#include "nat64/mod/common/lpm.h"
+
+#include <linux/bitops.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+#include "nat64/mod/common/types.h"
+
+/** Slots with this bit set point to a node; others hold (value + 1). */
+#define LPM_CHILD	(1U << 31)
+/** A node never indexes its slots with more key bits than this. */
+#define MAX_NODE_BITS	16
+/*
+ * 64 MB worth of slots. Nodes only grow as wide as they can fill, so real
+ * tables shouldn't get anywhere near this; it's here so a pathological one
+ * fails instead of eating the kernel's memory. The caller is expected to keep
+ * using its slower structure in that case.
+ */
+#define MAX_SLOTS	(1U << 24)
+
+/* Not const, so the unit tests can reach it. */
+static unsigned int max_slots = MAX_SLOTS;
+
+struct lpm_node {
+	/*
+	 * The path to this node skipped key bits [@from, @pos). (They were the
+	 * same for every prefix below.) They have to match @rep's.
+	 */
+	__u8 from;
+	__u8 pos;
+	/** The node has 2^@bits slots, indexed by key bits [@pos, @pos + @bits). */
+	__u8 bits;
+	/** Slot value of the keys whose skipped bits don't match. */
+	__u32 fallback;
+	/** Index (from lpm_build()'s @prefixes) of any prefix below the node. */
+	__u32 rep;
+	/** Index of the node's first slot in @slots. */
+	__u32 first;
+};
+
+struct lpm {
+	unsigned int key_bytes;
+	/** Every prefix's bytes, @key_bytes each, in lpm_build() order. */
+	__u8 *keys;
+
+	/** @nodes[0] is the root. */
+	struct lpm_node *nodes;
+	unsigned int node_count;
+	unsigned int node_capacity;
+
+	__u32 *slots;
+	unsigned int slot_count;
+	unsigned int slot_capacity;
+};
+
+struct sortable_prefix {
+	const __u8 *bytes;
+	__u8 len;
+	unsigned int index;
+};
+
+/**
+ * A node lpm_build() still has to create.
+ */
+struct lpm_task {
+	/** The node will hold prefixes sorted[@lo] through sorted[@hi - 1]. */
+	unsigned int lo;
+	unsigned int hi;
+	/** First key bit the node is responsible for. */
+	unsigned int start;
+	/** Value of the longest prefix above the node that covers all of it. */
+	__u32 fallback;
+	/** Slot that has to point to the node. (Unused by the root.) */
+	unsigned int parent;
+};
+
+/**
+ * Returns the number of leading bits @bytes1 and @bytes2 have in common, up to
+ * @limit.
+ */
+static unsigned int match_bits(const __u8 *bytes1, const __u8 *bytes2,
+		unsigned int limit)
+{
+	unsigned int result;
+	unsigned int y;
+	__u8 diff;
+
+	for (y = 0; 8 * y < limit; y++) {
+		diff = bytes1[y] ^ bytes2[y];
+		if (diff) {
+			result = 8 * y + (8 - fls(diff));
+			return min(result, limit);
+		}
+	}
+
+	return limit;
+}
+
+/**
+ * Returns whether bits [@from, @to) of @bytes1 and @bytes2 are the same.
+ */
+static bool bits_equal(const __u8 *bytes1, const __u8 *bytes2,
+		unsigned int from, unsigned int to)
+{
+	unsigned int y;
+	__u8 diff;
+
+	for (y = from >> 3; 8 * y < to; y++) {
+		diff = bytes1[y] ^ bytes2[y];
+		if (8 * y < from)
+			diff &= 0xFFU >> (from - 8 * y);
+		if (8 * y + 8 > to)
+			diff &= 0xFFU << (8 * y + 8 - to);
+		if (diff)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Returns bits [@pos, @pos + @bits) of @key as a number.
+ * @bits can't exceed MAX_NODE_BITS, and @key is @key_bytes long.
+ */
+static unsigned int get_bits(const __u8 *key, unsigned int key_bytes,
+		unsigned int pos, unsigned int bits)
+{
+	unsigned int y = pos >> 3;
+	__u32 window;
+
+	if (bits == 0)
+		return 0;
+
+	window = key[y] << 16;
+	if (y + 1 < key_bytes)
+		window |= key[y + 1] << 8;
+	if (y + 2 < key_bytes)
+		window |= key[y + 2];
+
+	return (window >> (24 - (pos & 7) - bits)) & ((1U << bits) - 1);
+}
+
+static unsigned int get_bit(const __u8 *bytes, unsigned int pos)
+{
+	return (bytes[pos >> 3] >> (7 - (pos & 7))) & 1U;
+}
+
+/**
+ * Sorts the prefixes as a preorder walk of a binary trie would visit them.
+ * Prefixes therefore come before the prefixes they contain, and the prefixes
+ * that share any given bits are contiguous.
+ */
+static int compare_prefixes(const void *a, const void *b)
+{
+	const struct sortable_prefix *prefix1 = a;
+	const struct sortable_prefix *prefix2 = b;
+	unsigned int limit;
+	unsigned int bits;
+
+	limit = min(prefix1->len, prefix2->len);
+	bits = match_bits(prefix1->bytes, prefix2->bytes, limit);
+	if (bits < limit)
+		return get_bit(prefix1->bytes, bits) ? 1 : -1;
+
+	return ((int)prefix1->len) - ((int)prefix2->len);
+}
+
+/**
+ * Makes sure @array can hold @needed elements of size @size. Might move it.
+ */
+static int grow(void **array, unsigned int *capacity, unsigned int needed,
+		size_t size, unsigned int max)
+{
+	unsigned int new_capacity;
+	void *new;
+
+	if (needed <= *capacity)
+		return 0;
+	if (needed > max)
+		return -E2BIG;
+
+	new_capacity = *capacity ? *capacity : min(64U, max);
+	while (new_capacity < needed)
+		new_capacity = min(2 * new_capacity, max);
+
+	new = vmalloc(new_capacity * size);
+	if (!new)
+		return -ENOMEM;
+	if (*array) {
+		memcpy(new, *array, *capacity * size);
+		vfree(*array);
+	}
+
+	*array = new;
+	*capacity = new_capacity;
+	return 0;
+}
+
+/**
+ * Returns the number of slots a node at @pos would need to tell apart
+ * prefixes sorted[@lo] through sorted[@hi - 1] if it were @bits wide.
+ *
+ * A prefix shorter than the node is counted as a single slot, even though it
+ * will be copied to several. Otherwise, any short prefix would make the node
+ * look full, and it would grow needlessly wide.
+ */
+static unsigned int count_used_slots(struct lpm *lpm,
+		struct sortable_prefix *sorted, unsigned int lo, unsigned int hi,
+		unsigned int pos, unsigned int bits)
+{
+	struct sortable_prefix *prefix;
+	unsigned int end = pos + bits;
+	unsigned int index;
+	unsigned int last = 0;
+	unsigned int result = 0;
+	unsigned int i;
+
+	for (i = lo; i < hi; i++) {
+		prefix = &sorted[i];
+		if (prefix->len >= end) {
+			index = get_bits(prefix->bytes, lpm->key_bytes, pos, bits);
+		} else {
+			index = get_bits(prefix->bytes, lpm->key_bytes, pos,
+					prefix->len - pos) << (end - prefix->len);
+		}
+
+		/* The order guarantees @index never decreases. */
+		if (result == 0 || index != last)
+			result++;
+		last = index;
+	}
+
+	return result;
+}
+
+/**
+ * Picks the widest node that would use at least half of its slots.
+ * (The "level compression".)
+ */
+static unsigned int choose_bits(struct lpm *lpm,
+		struct sortable_prefix *sorted, unsigned int lo, unsigned int hi,
+		unsigned int pos)
+{
+	unsigned int max_bits;
+	unsigned int result = 1;
+	unsigned int bits;
+
+	max_bits = min(MAX_NODE_BITS, 8 * lpm->key_bytes - pos);
+	for (bits = 2; bits <= max_bits; bits++) {
+		if (2 * count_used_slots(lpm, sorted, lo, hi, pos, bits)
+				>= (1U << bits))
+			result = bits;
+	}
+
+	return result;
+}
+
+static int add_task(struct lpm_task **tasks, unsigned int *capacity,
+		unsigned int *count, struct lpm_task *task)
+{
+	int error;
+
+	error = grow((void **)tasks, capacity, *count + 1, sizeof(**tasks),
+			UINT_MAX / sizeof(**tasks));
+	if (error)
+		return error;
+
+	(*tasks)[(*count)++] = *task;
+	return 0;
+}
+
+/**
+ * Creates the node @task describes, and queues its children.
+ */
+static int build_node(struct lpm *lpm, struct sortable_prefix *sorted,
+		struct lpm_task *task, struct lpm_task **tasks,
+		unsigned int *task_capacity, unsigned int *task_count)
+{
+	struct sortable_prefix *prefix;
+	struct lpm_node *node;
+	struct lpm_task child;
+	unsigned int lo = task->lo;
+	unsigned int pos;
+	unsigned int bits;
+	unsigned int end;
+	unsigned int index;
+	unsigned int count;
+	unsigned int i;
+	__u32 fill = task->fallback;
+	__u32 *slots;
+	int error;
+
+	/* Path compression: skip the bits every prefix here agrees on. */
+	pos = sorted[lo].len;
+	for (i = lo + 1; i < task->hi; i++) {
+		pos = min_t(unsigned int, pos, sorted[i].len);
+		pos = match_bits(sorted[lo].bytes, sorted[i].bytes, pos);
+	}
+
+	/* If a prefix ends right here, it contains the others; it goes first. */
+	if (sorted[lo].len == pos) {
+		fill = sorted[lo].index + 1;
+		lo++;
+	}
+
+	bits = (lo < task->hi) ? choose_bits(lpm, sorted, lo, task->hi, pos) : 0;
+	end = pos + bits;
+	count = 1U << bits;
+
+	error = grow((void **)&lpm->nodes, &lpm->node_capacity,
+			lpm->node_count + 1, sizeof(*lpm->nodes),
+			UINT_MAX / sizeof(*lpm->nodes));
+	if (error)
+		return error;
+	error = grow((void **)&lpm->slots, &lpm->slot_capacity,
+			lpm->slot_count + count, sizeof(*lpm->slots), max_slots);
+	if (error)
+		return error;
+
+	if (lpm->node_count > 0)
+		lpm->slots[task->parent] = LPM_CHILD | lpm->node_count;
+
+	node = &lpm->nodes[lpm->node_count++];
+	node->from = task->start;
+	node->pos = pos;
+	node->bits = bits;
+	node->fallback = task->fallback;
+	node->rep = sorted[task->lo].index;
+	node->first = lpm->slot_count;
+
+	slots = &lpm->slots[lpm->slot_count];
+	lpm->slot_count += count;
+	for (i = 0; i < count; i++)
+		slots[i] = fill;
+
+	/*
+	 * Containing prefixes come first, so the longer prefixes overwrite the
+	 * shorter ones, and the children inherit the right fallback.
+	 */
+	i = lo;
+	while (i < task->hi) {
+		prefix = &sorted[i];
+
+		if (prefix->len <= end) {
+			index = get_bits(prefix->bytes, lpm->key_bytes, pos,
+					prefix->len - pos) << (end - prefix->len);
+			count = 1U << (end - prefix->len);
+			for (; count > 0; count--)
+				slots[index++] = prefix->index + 1;
+			i++;
+			continue;
+		}
+
+		index = get_bits(prefix->bytes, lpm->key_bytes, pos, bits);
+		child.lo = i;
+		for (i++; i < task->hi; i++) {
+			if (sorted[i].len <= end)
+				break;
+			if (get_bits(sorted[i].bytes, lpm->key_bytes, pos, bits)
+					!= index)
+				break;
+		}
+		child.hi = i;
+		child.start = end;
+		child.fallback = slots[index];
+		child.parent = node->first + index;
+
+		error = add_task(tasks, task_capacity, task_count, &child);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+static int build_nodes(struct lpm *lpm, struct sortable_prefix *sorted,
+		unsigned int count)
+{
+	struct lpm_task *tasks = NULL;
+	struct lpm_task root;
+	unsigned int capacity = 0;
+	unsigned int task_count = 0;
+	unsigned int i;
+	int error;
+
+	root.lo = 0;
+	root.hi = count;
+	root.start = 0;
+	root.fallback = 0;
+	root.parent = 0;
+	error = add_task(&tasks, &capacity, &task_count, &root);
+	if (error)
+		return error;
+
+	/*
+	 * Breadth first, which keeps the parents and their children close, and
+	 * doesn't need a stack as deep as the keys are long.
+	 * (build_node() might move @tasks, so don't hold pointers to it.)
+	 */
+	for (i = 0; i < task_count; i++) {
+		root = tasks[i];
+		error = build_node(lpm, sorted, &root, &tasks, &capacity,
+				&task_count);
+		if (error)
+			break;
+	}
+
+	vfree(tasks);
+	return error;
+}
+
+/**
+ * lpm_build - Compiles @prefixes into a lookup table.
+ * @key_bytes: length of the keys, in bytes (4 for IPv4, 16 for IPv6).
+ * @prefixes: the prefixes. Their @bytes have to be @key_bytes long, and they
+ *	can't repeat. lpm_lookup() returns indexes from this array.
+ * @count: length of @prefixes. Has to be positive.
+ *
+ * Can sleep. Returns NULL on failure (either out of memory, or too many slots).
+ */
+struct lpm *lpm_build(unsigned int key_bytes, struct lpm_prefix *prefixes,
+		unsigned int count)
+{
+	struct lpm *lpm;
+	struct sortable_prefix *sorted;
+	unsigned int i;
+	int error = -ENOMEM;
+
+	if (WARN(count == 0 || key_bytes > 16, "Invalid LPM parameters."))
+		return NULL;
+
+	lpm = kzalloc(sizeof(*lpm), GFP_KERNEL);
+	if (!lpm)
+		goto fail;
+	lpm->key_bytes = key_bytes;
+
+	lpm->keys = vmalloc(count * key_bytes);
+	if (!lpm->keys)
+		goto fail;
+	sorted = vmalloc(count * sizeof(*sorted));
+	if (!sorted)
+		goto fail;
+
+	for (i = 0; i < count; i++) {
+		memcpy(&lpm->keys[i * key_bytes], prefixes[i].bytes, key_bytes);
+		sorted[i].bytes = &lpm->keys[i * key_bytes];
+		sorted[i].len = prefixes[i].len;
+		sorted[i].index = i;
+	}
+	sort(sorted, count, sizeof(*sorted), compare_prefixes, NULL);
+
+	error = build_nodes(lpm, sorted, count);
+	vfree(sorted);
+	if (error)
+		goto fail;
+
+	return lpm;
+
+fail:
+	/* The callers fall back to something slower, so make some noise. */
+	log_warn_once("Could not compile a %u-prefix lookup table (error %d). Lookups will be slower.",
+			count, error);
+	lpm_destroy(lpm);
+	return NULL;
+}
+
+void lpm_destroy(struct lpm *lpm)
+{
+	if (!lpm)
+		return;
+
+	vfree(lpm->keys);
+	vfree(lpm->nodes);
+	vfree(lpm->slots);
+	kfree(lpm);
+}
+
+/**
+ * lpm_lookup - Returns the index (from lpm_build()'s @prefixes) of the longest
+ * prefix that contains @key, or -ESRCH if there's none.
+ * @key has to be as long as lpm_build()'s @key_bytes.
+ */
+int lpm_lookup(const struct lpm *lpm, const __u8 *key)
+{
+	const struct lpm_node *node = &lpm->nodes[0];
+	const __u8 *rep;
+	__u32 slot;
+
+	while (true) {
+		if (node->from < node->pos) {
+			rep = &lpm->keys[node->rep * lpm->key_bytes];
+			if (!bits_equal(key, rep, node->from, node->pos)) {
+				slot = node->fallback;
+				break;
+			}
+		}
+
+		slot = lpm->slots[node->first + get_bits(key, lpm->key_bytes,
+				node->pos, node->bits)];
+		if (!(slot & LPM_CHILD))
+			break;
+		node = &lpm->nodes[slot & ~LPM_CHILD];
+	}
+
+	return slot ? (slot - 1) : -ESRCH;
+}
@@ -3,6 +3,7 @@
 #include <linux/module.h>
 #include <linux/sort.h>
 #include <linux/version.h>
+#include <net/ipv6.h>
 #include "nat64/common/constants.h"
 #include "nat64/mod/common/types.h"
 #include "nat64/mod/common/config.h"
@@ -10,6 +11,7 @@
 #include "nat64/mod/common/namespace.h"
 #include "nat64/mod/common/nl_buffer.h"
 #include "nat64/mod/common/pool6.h"
+#include "nat64/mod/common/prefilter.h"
 #include "nat64/mod/common/error_pool.h"
 #include "nat64/mod/stateless/eam.h"
 #include "nat64/mod/stateless/blacklist4.h"
@@ -29,6 +31,12 @@ static struct sock *nl_socket;
  */
 static DEFINE_MUTEX(config_mutex);
 
+/**
+ * Whether the current batch of requests touched the addresses the prefilter
+ * is built from. Protected by config_mutex.
+ */
+static bool prefilter_dirty;
+
 
 /**
  * Use this when data_len is known to be smaller than NLBUFFER_SIZE. When this might not be the
@@ -115,6 +123,17 @@ respond_error_on_failure:
 			sizeof(hdr_out));
 }
 
+/**
+ * respond_error() for requests that edit the addresses the prefilter is built
+ * from. Successful ones get the prefilter rebuilt once the batch is done.
+ */
+static int respond_prefilter_change(struct nlmsghdr *nl_hdr_in, int error)
+{
+	if (!error)
+		prefilter_dirty = true;
+	return respond_error(nl_hdr_in, error);
+}
+
 /*
 static int respond_ack(struct nlmsghdr *nl_hdr_in)
 {
@@ -231,7 +250,8 @@ static int handle_pool6_config(struct nlmsghdr *nl_hdr, struct request_hdr *jool
 
 		log_debug("Adding a prefix to the IPv6 pool.");
 
-		return respond_error(nl_hdr, pool6_add(&request->add.prefix));
+		return respond_prefilter_change(nl_hdr,
+				pool6_add(&request->add.prefix));
 
 	case OP_REMOVE:
 		if (verify_superpriv())
@@ -245,7 +265,7 @@ static int handle_pool6_config(struct nlmsghdr *nl_hdr, struct request_hdr *jool
 		if (xlat_is_nat64() && !request->flush.quick)
 			sessiondb_delete_taddr6s(&request->rm.prefix);
 
-		return respond_error(nl_hdr, error);
+		return respond_prefilter_change(nl_hdr, error);
 
 	case OP_FLUSH:
 		if (verify_superpriv())
@@ -257,7 +277,7 @@ static int handle_pool6_config(struct nlmsghdr *nl_hdr, struct request_hdr *jool
 		if (xlat_is_nat64() && !request->flush.quick)
 			sessiondb_flush();
 
-		return respond_error(nl_hdr, error);
+		return respond_prefilter_change(nl_hdr, error);
 
 	default:
 		log_err("Unknown operation: %d", jool_hdr->operation);
@@ -299,7 +319,7 @@ static int handle_pool4_add(struct nlmsghdr *nl_hdr, union request_pool4 *reques
 
 	log_debug("Adding elements to the IPv4 pool.");
 
-	return respond_error(nl_hdr, pool4db_add(request->add.mark,
+	return respond_prefilter_change(nl_hdr, pool4db_add(request->add.mark,
 			request->add.proto, &request->add.addrs,
 			&request->add.ports));
 }
@@ -321,7 +341,7 @@ static int handle_pool4_rm(struct nlmsghdr *nl_hdr, union request_pool4 *request
 		bibdb_delete_taddr4s(&request->rm.addrs, &request->rm.ports);
 	}
 
-	return respond_error(nl_hdr, error);
+	return respond_prefilter_change(nl_hdr, error);
 }
 
 static int handle_pool4_flush(struct nlmsghdr *nl_hdr, union request_pool4 *request)
@@ -344,7 +364,7 @@ static int handle_pool4_flush(struct nlmsghdr *nl_hdr, union request_pool4 *requ
 		bibdb_flush();
 	}
 
-	return respond_error(nl_hdr, error);
+	return respond_prefilter_change(nl_hdr, error);
 }
 
 static int handle_pool4_config(struct nlmsghdr *nl_hdr, struct request_hdr *jool_hdr,
@@ -584,6 +604,27 @@ static int handle_eamt_test(struct nlmsghdr *nl_hdr, union request_eamt *request
 	}
 }
 
+static int handle_eamt_load(struct nlmsghdr *nl_hdr, struct request_hdr *jool_hdr,
+		union request_eamt *request)
+{
+	size_t entries_len;
+
+	if (jool_hdr->length > nlmsg_len(nl_hdr)) {
+		log_err("The request is longer than the Netlink message carrying it.");
+		return -EINVAL;
+	}
+
+	entries_len = jool_hdr->length - sizeof(*jool_hdr) - sizeof(*request);
+	if (entries_len != request->load.count * sizeof(struct eamt_entry)) {
+		log_err("The EAMT chunk claims to hold %u entries, but it is %zu bytes long.",
+				request->load.count, entries_len);
+		return -EINVAL;
+	}
+
+	return eamt_load((struct eamt_entry *) (request + 1), request->load.count,
+			request->load.first, request->load.last, request->load.force);
+}
+
 static int handle_eamt_config(struct nlmsghdr *nl_hdr, struct request_hdr *jool_hdr,
 		union request_eamt *request)
 {
@@ -614,15 +655,17 @@ static int handle_eamt_config(struct nlmsghdr *nl_hdr, struct request_hdr *jool_
 			return respond_error(nl_hdr, -EPERM);
 
 		log_debug("Adding EAMT entry.");
-		return respond_error(nl_hdr, eamt_add(&request->add.prefix6,
-				&request->add.prefix4, request->add.force));
+		return respond_prefilter_change(nl_hdr,
+				eamt_add(&request->add.prefix6,
+						&request->add.prefix4,
+						request->add.force));
 
 	case OP_REMOVE:
 		if (verify_superpriv())
 			return respond_error(nl_hdr, -EPERM);
 
 		log_debug("Removing EAMT entry.");
-		return respond_error(nl_hdr, eamt_rm(
+		return respond_prefilter_change(nl_hdr, eamt_rm(
 				request->rm.prefix6_set ? &request->rm.prefix6 : NULL,
 				request->rm.prefix4_set ? &request->rm.prefix4 : NULL));
 
@@ -631,7 +674,18 @@ static int handle_eamt_config(struct nlmsghdr *nl_hdr, struct request_hdr *jool_
 			return respond_error(nl_hdr, -EPERM);
 
 		eamt_flush();
-		return respond_error(nl_hdr, 0);
+		return respond_prefilter_change(nl_hdr, 0);
+
+	case OP_LOAD:
+		if (verify_superpriv())
+			return respond_error(nl_hdr, -EPERM);
+
+		log_debug("Loading EAMT chunk.");
+		error = handle_eamt_load(nl_hdr, jool_hdr, request);
+		/* Only the last chunk touches the live table. */
+		if (!request->load.last)
+			return respond_error(nl_hdr, error);
+		return respond_prefilter_change(nl_hdr, error);
 
 	default:
 		log_err("Unknown operation: %d", jool_hdr->operation);
@@ -759,21 +813,23 @@ static int handle_blacklist_config(struct nlmsghdr *nl_hdr, struct request_hdr *
 			return respond_error(nl_hdr, -EPERM);
 
 		log_debug("Adding an address to the Blacklist pool.");
-		return respond_error(nl_hdr, blacklist_add(&request->add.addrs));
+		return respond_prefilter_change(nl_hdr,
+				blacklist_add(&request->add.addrs));
 
 	case OP_REMOVE:
 		if (verify_superpriv())
 			return respond_error(nl_hdr, -EPERM);
 
 		log_debug("Removing an address from the Blacklist pool.");
-		return respond_error(nl_hdr, blacklist_rm(&request->rm.addrs));
+		return respond_prefilter_change(nl_hdr,
+				blacklist_rm(&request->rm.addrs));
 
 	case OP_FLUSH:
 		if (verify_superpriv())
 			return respond_error(nl_hdr, -EPERM);
 
 		log_debug("Flushing the Blacklist pool...");
-		return respond_error(nl_hdr, blacklist_flush());
+		return respond_prefilter_change(nl_hdr, blacklist_flush());
 
 	default:
 		log_err("Unknown operation: %d", jool_hdr->operation);
@@ -1059,6 +1115,16 @@ static int handle_global_update(enum global_type type, size_t size, unsigned cha
 			goto einval;
 		config->atomic_frags.build_ipv4_id = *((__u8 *) value);
 		break;
+	case IPV4_ID_MODE:
+		if (!ensure_bytes(size, 1))
+			goto einval;
+		if (*((__u8 *) value) >= IPV4_ID_MODE_COUNT) {
+			log_err("Unknown IPv4 identification mode: %u",
+					*((__u8 *) value));
+			goto einval;
+		}
+		config->ipv4_id_mode = *((__u8 *) value);
+		break;
 	case LOWER_MTU_FAIL:
 		if (!ensure_bytes(size, 1))
 			goto einval;
@@ -1068,6 +1134,30 @@ static int handle_global_update(enum global_type type, size_t size, unsigned cha
 		if (is_error(update_plateaus(config, size, value)))
 			goto einval;
 		break;
+	case MSS_CLAMP:
+		if (!ensure_bytes(size, 2))
+			goto einval;
+		if (*((__u16 *) value) && *((__u16 *) value) < IPV6_MIN_MTU) {
+			log_err("The MSS clamp MTU (%u) can't be lower than %u.",
+					*((__u16 *) value), IPV6_MIN_MTU);
+			goto einval;
+		}
+		config->mss_clamp = *((__u16 *) value);
+		break;
+	case ICMP_LIMIT_RATE:
+		if (!ensure_bytes(size, 2))
+			goto einval;
+		config->icmp_limit_rate = *((__u16 *) value);
+		break;
+	case ICMP_LIMIT_BURST:
+		if (!ensure_bytes(size, 2))
+			goto einval;
+		if (*((__u16 *) value) == 0) {
+			log_err("The ICMP error burst has to be at least 1.");
+			goto einval;
+		}
+		config->icmp_limit_burst = *((__u16 *) value);
+		break;
 	case DISABLE:
 		config->is_disable = (__u8) true;
 		break;
@@ -1226,6 +1316,11 @@ static void receive_from_userspace(struct sk_buff *skb)
 	netlink_rcv_skb(skb, &handle_netlink_message);
 	error_pool_deactivate();
 
+	if (prefilter_dirty) {
+		prefilter_update();
+		prefilter_dirty = false;
+	}
+
 	mutex_unlock(&config_mutex);
 }
 
@@ -20,6 +20,10 @@ struct pkt_metadata {
 	unsigned int l4_offset;
 	/* Offset is from skb->data. */
 	unsigned int payload_offset;
+	/* IPv6 only. */
+	struct pkt_hdr6_summary hdr6;
+	/* ICMPv6 errors only. */
+	struct pkt_hdr6_summary inner_hdr6;
 };
 
 #define skb_hdr_ptr(skb, offset, buffer) skb_header_pointer(skb, offset, sizeof(buffer), &buffer)
@@ -118,8 +122,13 @@ static int summarize_skb6(struct sk_buff *skb, unsigned int hdr6_offset, struct
 	offset = hdr6_offset + sizeof(struct ipv6hdr);
 
 	meta->has_frag_hdr = false;
+	meta->hdr6.segments_left_offset = 0;
 
 	do {
+		/* Whichever header ends the chain, these will describe it. */
+		meta->hdr6.nexthdr = nexthdr;
+		meta->hdr6.hdrs_len = offset - hdr6_offset;
+
 		switch (nexthdr) {
 		case NEXTHDR_TCP:
 			meta->l4_proto = L4PROTO_TCP;
@@ -167,6 +176,12 @@ static int summarize_skb6(struct sk_buff *skb, unsigned int hdr6_offset, struct
 			if (!ptr.opt)
 				return truncated6(skb, "extension header");
 
+			if (nexthdr == NEXTHDR_ROUTING
+					&& !meta->hdr6.segments_left_offset) {
+				meta->hdr6.segments_left_offset = offset - hdr6_offset
+						+ offsetof(struct ipv6_rt_hdr, segments_left);
+			}
+
 			offset += 8 + 8 * ptr.opt->hdrlen;
 			nexthdr = ptr.opt->nexthdr;
 			break;
@@ -229,6 +244,7 @@ static int validate_inner6(struct sk_buff *skb, struct pkt_metadata *outer_meta)
 		return -EINVAL;
 	}
 
+	outer_meta->inner_hdr6 = meta.hdr6;
 	return 0;
 }
 
@@ -267,6 +283,11 @@ static int handle_icmp6(struct sk_buff *skb, struct pkt_metadata *meta)
 	return 0;
 }
 
+static bool is_tcp_or_udp(enum l4_protocol proto)
+{
+	return proto == L4PROTO_TCP || proto == L4PROTO_UDP;
+}
+
 /**
  * As a contract, pkt_destroy() doesn't need to be called if this fails.
  * (Just like other init functions.)
@@ -295,6 +316,7 @@ int pkt_init_ipv6(struct packet *pkt, struct sk_buff *skb)
 	error = summarize_skb6(skb, skb_network_offset(skb), &meta);
 	if (error)
 		return error;
+	memset(&meta.inner_hdr6, 0, sizeof(meta.inner_hdr6));
 
 	if (meta.l4_proto == L4PROTO_ICMP) {
 		/* Do not move this to summarize_skb6(), because it risks infinite recursion. */
@@ -313,10 +335,16 @@ int pkt_init_ipv6(struct packet *pkt, struct sk_buff *skb)
 	pkt->l4_proto = meta.l4_proto;
 	pkt->is_inner = 0;
 	pkt->is_hairpin = false;
+	pkt->will_hairpin = false;
+	pkt->is_simple = (meta.hdr6.hdrs_len == sizeof(struct ipv6hdr))
+			&& is_tcp_or_udp(meta.l4_proto);
 	pkt->hdr_frag = meta.has_frag_hdr ? offset_to_ptr(skb, meta.frag_offset) : NULL;
+	pkt->hdr6 = meta.hdr6;
+	pkt->inner_hdr6 = meta.inner_hdr6;
 	skb_set_transport_header(skb, meta.l4_offset);
 	pkt->payload = offset_to_ptr(skb, meta.payload_offset);
 	pkt->original_pkt = pkt;
+	pkt->cfg = NULL;
 
 	return 0;
 }
@@ -470,10 +498,15 @@ int pkt_init_ipv4(struct packet *pkt, struct sk_buff *skb)
 	pkt->l4_proto = meta.l4_proto;
 	pkt->is_inner = 0;
 	pkt->is_hairpin = false;
+	pkt->will_hairpin = false;
+	pkt->is_simple = (ip_hdr(skb)->ihl == 5)
+			&& !is_fragmented_ipv4(ip_hdr(skb))
+			&& is_tcp_or_udp(meta.l4_proto);
 	pkt->hdr_frag = NULL;
 	skb_set_transport_header(skb, meta.l4_offset);
 	pkt->payload = offset_to_ptr(skb, meta.payload_offset);
 	pkt->original_pkt = pkt;
+	pkt->cfg = NULL;
 
 	return 0;
 }
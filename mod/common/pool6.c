@@ -1,11 +1,14 @@
 #include "nat64/mod/common/pool6.h"
 #include "nat64/common/constants.h"
 #include "nat64/common/str_utils.h"
+#include "nat64/mod/common/addr_cache.h"
+#include "nat64/mod/common/lpm.h"
 #include "nat64/mod/common/rcu.h"
 #include "nat64/mod/common/tags.h"
 #include "nat64/mod/common/types.h"
 
 #include <linux/rculist.h>
+#include <linux/slab.h>
 #include <net/ipv6.h>
 
 
@@ -26,6 +29,22 @@ struct pool_entry {
  */
 static struct list_head __rcu *pool;
 
+/**
+ * A read-only copy of the pool, compiled into a lookup table (see lpm.h) so
+ * pool6_get() doesn't have to walk the list.
+ */
+struct pool6_index {
+	/* lpm_lookup() returns indexes from @prefixes. */
+	struct lpm *lpm;
+	struct ipv6_prefix prefixes[];
+};
+
+/**
+ * Index of @pool. NULL if the pool is empty, or if the index could not be
+ * built (in which case the readers fall back to the list).
+ */
+static struct pool6_index __rcu *pool_index;
+
 static DEFINE_MUTEX(lock);
 
 RCUTAG_FREE
@@ -85,6 +104,81 @@ static struct list_head *create_pool(void)
 	return result;
 }
 
+RCUTAG_FREE
+static void index_destroy(struct pool6_index *index)
+{
+	if (!index)
+		return;
+	lpm_destroy(index->lpm);
+	kfree(index);
+}
+
+RCUTAG_USR
+static struct pool6_index *index_create(struct list_head *list)
+{
+	struct pool6_index *index;
+	struct lpm_prefix *keys;
+	struct pool_entry *entry;
+	unsigned int count = 0;
+	unsigned int i = 0;
+
+	list_for_each_entry(entry, list, list_hook)
+		count++;
+	if (count == 0)
+		return NULL;
+
+	index = kmalloc(sizeof(*index) + count * sizeof(index->prefixes[0]),
+			GFP_KERNEL);
+	if (!index)
+		return NULL;
+	keys = kmalloc(count * sizeof(*keys), GFP_KERNEL);
+	if (!keys) {
+		kfree(index);
+		return NULL;
+	}
+
+	list_for_each_entry(entry, list, list_hook) {
+		index->prefixes[i] = entry->prefix;
+		keys[i].bytes = index->prefixes[i].address.s6_addr;
+		keys[i].len = index->prefixes[i].len;
+		i++;
+	}
+
+	index->lpm = lpm_build(16, keys, count);
+	kfree(keys);
+	if (!index->lpm) {
+		kfree(index);
+		return NULL;
+	}
+
+	return index;
+}
+
+/**
+ * reindex - Brings the index up to date with @list, which is about to become
+ * (or already is) the pool.
+ *
+ * Has to be called with @lock held, after every modification of the pool.
+ * If the index cannot be built, the readers simply fall back to the list.
+ *
+ * Returns the old index, which the caller has to free once a grace period
+ * has elapsed.
+ */
+RCUTAG_USR
+static struct pool6_index *reindex(struct list_head *list)
+{
+	struct pool6_index *old;
+	struct pool6_index *new;
+
+	old = rcu_dereference_protected(pool_index, lockdep_is_held(&lock));
+	new = list ? index_create(list) : NULL;
+	if (list && !list_empty(list) && !new)
+		log_debug("Could not build pool6's index; it will be slow.");
+
+	rcu_assign_pointer(pool_index, new);
+	return old;
+}
+
 RCUTAG_USR
 int pool6_init(char *pref_strs[], int pref_count)
 {
@@ -124,16 +218,21 @@ RCUTAG_USR
 static void pool6_replace(struct list_head *new)
 {
 	struct list_head *old_pool;
+	struct pool6_index *old_index;
 	struct list_head *node;
 	struct list_head *tmp;
 
 	mutex_lock(&lock);
 	old_pool = rcu_dereference_protected(pool, lockdep_is_held(&lock));
+	old_index = reindex(new);
 	rcu_assign_pointer(pool, new);
+	addrcache_invalidate();
 	mutex_unlock(&lock);
 
 	synchronize_rcu_bh();
 
+	index_destroy(old_index);
+
 	list_for_each_safe(node, tmp, old_pool) {
 		list_del(node);
 		kfree(get_entry(node));
@@ -167,12 +266,24 @@ int pool6_get(const struct in6_addr *addr, struct ipv6_prefix *result)
 	struct list_head *list;
 	struct list_head *node;
 	struct pool_entry *entry;
+	struct pool_entry *best = NULL;
+	struct pool6_index *index;
+	int i;
 
 	if (WARN(!addr, "NULL is not a valid address."))
 		return -EINVAL;
 
 	rcu_read_lock_bh();
 
+	index = rcu_dereference_bh(pool_index);
+	if (index) {
+		i = lpm_lookup(index->lpm, addr->s6_addr);
+		if (i >= 0)
+			*result = index->prefixes[i];
+		rcu_read_unlock_bh();
+		return (i >= 0) ? 0 : -ESRCH;
+	}
+
 	list = rcu_dereference_bh(pool);
 
 	if (list_empty(list)) {
@@ -181,17 +292,20 @@ int pool6_get(const struct in6_addr *addr, struct ipv6_prefix *result)
 		return -ESRCH;
 	}
 
+	/* Same as the index: the longest prefix wins. */
 	list_for_each_rcu_bh(node, list) {
 		entry = get_entry(node);
-		if (ipv6_prefix_equal(&entry->prefix.address, addr, entry->prefix.len)) {
-			*result = entry->prefix;
-			rcu_read_unlock_bh();
-			return 0;
-		}
+		if (!ipv6_prefix_equal(&entry->prefix.address, addr, entry->prefix.len))
+			continue;
+		if (!best || entry->prefix.len > best->prefix.len)
+			best = entry;
 	}
 
+	if (best)
+		*result = best->prefix;
+
 	rcu_read_unlock_bh();
-	return -ESRCH;
+	return best ? 0 : -ESRCH;
 }
 
 RCUTAG_PKT
@@ -231,6 +345,7 @@ int pool6_add(struct ipv6_prefix *prefix)
 	struct list_head *list;
 	struct list_head *node;
 	struct pool_entry *entry;
+	struct pool6_index *old_index;
 	int error;
 
 	log_debug("Inserting prefix to the IPv6 pool: %pI6c/%u.",
@@ -267,6 +382,15 @@ int pool6_add(struct ipv6_prefix *prefix)
 	entry->prefix = *prefix;
 
 	list_add_tail_rcu(&entry->list_hook, list);
+	old_index = reindex(list);
+	addrcache_invalidate();
+	mutex_unlock(&lock);
+
+	if (old_index) {
+		synchronize_rcu_bh();
+		index_destroy(old_index);
+	}
+	return 0;
 
 end:
 	mutex_unlock(&lock);
@@ -279,6 +403,7 @@ int pool6_remove(struct ipv6_prefix *prefix)
 	struct list_head *list;
 	struct list_head *node;
 	struct pool_entry *entry;
+	struct pool6_index *old_index;
 
 	mutex_lock(&lock);
 	list = rcu_dereference_protected(pool, lockdep_is_held(&lock));
@@ -287,8 +412,11 @@ int pool6_remove(struct ipv6_prefix *prefix)
 		entry = get_entry(node);
 		if (prefix6_equals(&entry->prefix, prefix)) {
 			list_del_rcu(&entry->list_hook);
+			old_index = reindex(list);
+			addrcache_invalidate();
 			mutex_unlock(&lock);
 			synchronize_rcu_bh();
+			index_destroy(old_index);
 			kfree(entry);
 			return 0;
 		}
@@ -0,0 +1,271 @@
+#include "nat64/mod/common/prefilter.h"
+
+#include <linux/bitmap.h>
+#include <linux/slab.h>
+#include "nat64/common/xlat.h"
+#include "nat64/mod/common/pool6.h"
+#include "nat64/mod/common/tags.h"
+#include "nat64/mod/common/types.h"
+#include "nat64/mod/stateless/blacklist4.h"
+#include "nat64/mod/stateless/eam.h"
+#include "nat64/mod/stateful/pool4/db.h"
+
+/*
+ * Both address families are bucketed by the first 16 bits of the address.
+ * Translation prefixes are rarely shorter than that, and ordinary routed
+ * traffic rarely shares a /16 with them, so this is precise enough.
+ */
+#define SLOT_BITS 16
+#define SLOTS (1 << SLOT_BITS)
+
+struct prefilter {
+	/** Bit n is set if IPv4 destinations in (n << 16)/16 might be xlat'd. */
+	DECLARE_BITMAP(addrs4, SLOTS);
+	/** Bit n is set if IPv6 destinations in n::/16 might be xlat'd. */
+	DECLARE_BITMAP(addrs6, SLOTS);
+};
+
+/**
+ * The current filter. NULL means "let everything through", which is what
+ * happens before the first build and after a failed one.
+ */
+static struct prefilter __rcu *filter;
+static DEFINE_MUTEX(lock);
+
+/**
+ * Networks generate_addr6_siit() refuses to translate, EAM or not.
+ * (See addr4_is_scope_subnet(); the limited broadcast address is too small to
+ * be worth a slot.)
+ */
+static const struct {
+	__u32 addr;
+	__u8 len;
+} scope_subnets[] = {
+	{ 0x00000000U, 8 },	/* 0.0.0.0/8 */
+	{ 0x7f000000U, 8 },	/* 127.0.0.0/8 */
+	{ 0xa9fe0000U, 16 },	/* 169.254.0.0/16 */
+	{ 0xe0000000U, 4 },	/* 224.0.0.0/4 */
+};
+
+static unsigned int slot4(__be32 addr)
+{
+	return be32_to_cpu(addr) >> (32 - SLOT_BITS);
+}
+
+static unsigned int slot6(const struct in6_addr *addr)
+{
+	return be16_to_cpu(addr->s6_addr16[0]);
+}
+
+/**
+ * Returns the number of slots a prefix of length @len spans, and aligns @slot
+ * to the first of them.
+ */
+static unsigned int span(unsigned int *slot, __u8 len)
+{
+	unsigned int count;
+
+	if (len >= SLOT_BITS)
+		return 1;
+
+	count = 1U << (SLOT_BITS - len);
+	*slot &= ~(count - 1);
+	return count;
+}
+
+static void set_slots(unsigned long *map, unsigned int slot, __u8 len)
+{
+	unsigned int count = span(&slot, len);
+	bitmap_set(map, slot, count);
+}
+
+static void clear_slots(unsigned long *map, unsigned int slot, __u8 len)
+{
+	unsigned int count = span(&slot, len);
+	bitmap_clear(map, slot, count);
+}
+
+static int add_prefix6(struct ipv6_prefix *prefix, void *arg)
+{
+	struct prefilter *new = arg;
+	set_slots(new->addrs6, slot6(&prefix->address), prefix->len);
+	return 0;
+}
+
+static int add_eam(struct eamt_entry *eam, void *arg)
+{
+	struct prefilter *new = arg;
+	set_slots(new->addrs6, slot6(&eam->prefix6.address), eam->prefix6.len);
+	set_slots(new->addrs4, slot4(eam->prefix4.address.s_addr),
+			eam->prefix4.len);
+	return 0;
+}
+
+/**
+ * Blacklisted destinations are only translated when the EAMT says so (and EAMT
+ * slots are added afterwards), so blacklisted /16s or larger can be skipped.
+ * Smaller blacklisted networks share their slot with translatable addresses,
+ * so they're left alone.
+ */
+static int rm_blacklisted(struct ipv4_prefix *prefix, void *arg)
+{
+	struct prefilter *new = arg;
+	if (prefix->len <= SLOT_BITS)
+		clear_slots(new->addrs4, slot4(prefix->address.s_addr),
+				prefix->len);
+	return 0;
+}
+
+static int add_sample(struct pool4_sample *sample, void *arg)
+{
+	struct prefilter *new = arg;
+	__set_bit(slot4(sample->addr.s_addr), new->addrs4);
+	return 0;
+}
+
+static int build_siit(struct prefilter *new)
+{
+	unsigned int i;
+	int error;
+
+	/* With pool6, anything EAM-less and not blacklisted goes RFC 6052. */
+	if (!pool6_is_empty()) {
+		bitmap_fill(new->addrs4, SLOTS);
+		error = blacklist_for_each(rm_blacklisted, new, NULL);
+		if (error)
+			return error;
+	}
+
+	error = pool6_for_each(add_prefix6, new, NULL);
+	if (error)
+		return error;
+	error = eamt_foreach(add_eam, new, NULL);
+	if (error)
+		return error;
+
+	for (i = 0; i < ARRAY_SIZE(scope_subnets); i++) {
+		clear_slots(new->addrs4, scope_subnets[i].addr >> (32 - SLOT_BITS),
+				scope_subnets[i].len);
+	}
+
+	return 0;
+}
+
+static int build_nat64(struct prefilter *new)
+{
+	int error;
+
+	error = pool6_for_each(add_prefix6, new, NULL);
+	if (error)
+		return error;
+
+	/* An empty pool4 stands for the node's own addresses; see empty.c. */
+	if (pool4db_is_empty()) {
+		bitmap_fill(new->addrs4, SLOTS);
+		return 0;
+	}
+
+	return pool4db_foreach_sample(add_sample, new, NULL);
+}
+
+static void replace(struct prefilter *new)
+{
+	struct prefilter *old;
+
+	mutex_lock(&lock);
+	old = rcu_dereference_protected(filter, lockdep_is_held(&lock));
+	rcu_assign_pointer(filter, new);
+	mutex_unlock(&lock);
+
+	if (old) {
+		synchronize_rcu_bh();
+		kfree(old);
+	}
+}
+
+RCUTAG_INIT
+int prefilter_init(void)
+{
+	return prefilter_update();
+}
+
+RCUTAG_INIT
+void prefilter_destroy(void)
+{
+	replace(NULL);
+}
+
+/**
+ * Recomputes the filter from the current state of the pools.
+ * Has to be called whenever pool6, pool4, the EAMT or the blacklist change.
+ *
+ * If this fails, the filter is dropped, so all traffic is inspected in full
+ * until a later update succeeds.
+ */
+RCUTAG_USR
+int prefilter_update(void)
+{
+	struct prefilter *new;
+	int error;
+
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+	if (!new) {
+		log_err("Could not allocate the destination prefilter.");
+		replace(NULL);
+		return -ENOMEM;
+	}
+
+	error = xlat_is_siit() ? build_siit(new) : build_nat64(new);
+	if (error) {
+		log_err("Could not build the destination prefilter: %d", error);
+		kfree(new);
+		replace(NULL);
+		return error;
+	}
+
+	replace(new);
+	return 0;
+}
+
+/**
+ * Returns false if IPv4 packet @hdr is certainly not meant to be translated,
+ * true otherwise.
+ */
+RCUTAG_PKT
+bool prefilter_wants4(const struct iphdr *hdr)
+{
+	struct prefilter *pf;
+	bool result;
+
+	/*
+	 * NAT64 matches ICMP errors against pool4 using their inner packet,
+	 * so their outer destination tells us nothing.
+	 */
+	if (xlat_is_nat64() && hdr->protocol == IPPROTO_ICMP)
+		return true;
+
+	rcu_read_lock_bh();
+	pf = rcu_dereference_bh(filter);
+	result = !pf || test_bit(slot4(hdr->daddr), pf->addrs4);
+	rcu_read_unlock_bh();
+
+	return result;
+}
+
+/**
+ * Returns false if IPv6 packet @hdr is certainly not meant to be translated,
+ * true otherwise.
+ */
+RCUTAG_PKT
+bool prefilter_wants6(const struct ipv6hdr *hdr)
+{
+	struct prefilter *pf;
+	bool result;
+
+	rcu_read_lock_bh();
+	pf = rcu_dereference_bh(filter);
+	result = !pf || test_bit(slot6(&hdr->daddr), pf->addrs6);
+	rcu_read_unlock_bh();
+
+	return result;
+}
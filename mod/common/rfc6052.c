@@ -2,119 +2,87 @@
 
 #include <linux/module.h>
 #include <linux/printk.h>
+#include <asm/unaligned.h>
 #include "nat64/common/types.h"
 #include "nat64/mod/common/pool6.h"
 
-union ipv4_address {
-	__be32 as32;
-	__u8 as8[4];
-};
+/*
+ * RFC 6052 section 2.2: The IPv4 address goes right after the prefix, except
+ * bits 64-71 (the "u" octet) are skipped.
+ * So, working on the IPv6 address's 64-bit halves, every prefix length is a
+ * couple of shifts.
+ */
 
-int addr_6to4(const struct in6_addr *src, struct ipv6_prefix *prefix,
-		struct in_addr *dst)
+static bool is_valid_len(__u8 len)
 {
-	union ipv4_address dst_aux;
-
-	switch (prefix->len) {
+	switch (len) {
 	case 32:
-		dst_aux.as32 = src->s6_addr32[1];
-		break;
 	case 40:
-		dst_aux.as8[0] = src->s6_addr[5];
-		dst_aux.as8[1] = src->s6_addr[6];
-		dst_aux.as8[2] = src->s6_addr[7];
-		dst_aux.as8[3] = src->s6_addr[9];
-		break;
 	case 48:
-		dst_aux.as8[0] = src->s6_addr[6];
-		dst_aux.as8[1] = src->s6_addr[7];
-		dst_aux.as8[2] = src->s6_addr[9];
-		dst_aux.as8[3] = src->s6_addr[10];
-		break;
 	case 56:
-		dst_aux.as8[0] = src->s6_addr[7];
-		dst_aux.as8[1] = src->s6_addr[9];
-		dst_aux.as8[2] = src->s6_addr[10];
-		dst_aux.as8[3] = src->s6_addr[11];
-		break;
 	case 64:
-		dst_aux.as8[0] = src->s6_addr[9];
-		dst_aux.as8[1] = src->s6_addr[10];
-		dst_aux.as8[2] = src->s6_addr[11];
-		dst_aux.as8[3] = src->s6_addr[12];
-		break;
 	case 96:
-		dst_aux.as32 = src->s6_addr32[3];
-		break;
-	default:
-		/* Critical because enforcing valid prefixes is pool6's responsibility, not ours. */
-		WARN(true, "Prefix has an invalid length: %u.", prefix->len);
+		return true;
+	}
+
+	/* Critical because enforcing valid prefixes is pool6's responsibility, not ours. */
+	WARN(true, "Prefix has an invalid length: %u.", len);
+	return false;
+}
+
+int addr_6to4(const struct in6_addr *src, struct ipv6_prefix *prefix,
+		struct in_addr *dst)
+{
+	__u64 hi, lo;
+	unsigned int hi_bits; /* IPv4 address bits in the upper half. */
+	__u32 result;
+
+	if (!is_valid_len(prefix->len))
 		return -EINVAL;
+
+	hi = get_unaligned_be64(&src->s6_addr[0]);
+	lo = get_unaligned_be64(&src->s6_addr[8]);
+
+	if (prefix->len == 96) {
+		result = lo;
+	} else {
+		hi_bits = 64 - prefix->len;
+		result = hi_bits ? (((__u32)hi) << (32 - hi_bits)) : 0;
+		/* The rest is in the lower half, after the u octet. */
+		if (hi_bits < 32)
+			result |= (lo << 8) >> (32 + hi_bits);
 	}
 
-	dst->s_addr = dst_aux.as32;
+	dst->s_addr = cpu_to_be32(result);
 	return 0;
 }
 
 int addr_4to6(struct in_addr *src, struct ipv6_prefix *prefix, struct in6_addr *dst)
 {
-	union ipv4_address src_aux;
-
-	src_aux.as32 = src->s_addr;
-	memset(dst, 0, sizeof(*dst));
+	__u32 addr4;
+	__u64 hi, lo;
+	unsigned int hi_bits; /* IPv4 address bits in the upper half. */
 
-	switch (prefix->len) {
-	case 32:
-		dst->s6_addr32[0] = prefix->address.s6_addr32[0];
-		dst->s6_addr32[1] = src_aux.as32;
-		break;
-	case 40:
-		dst->s6_addr32[0] = prefix->address.s6_addr32[0];
-		dst->s6_addr[4] = prefix->address.s6_addr[4];
-		dst->s6_addr[5] = src_aux.as8[0];
-		dst->s6_addr[6] = src_aux.as8[1];
-		dst->s6_addr[7] = src_aux.as8[2];
-		dst->s6_addr[9] = src_aux.as8[3];
-		break;
-	case 48:
-		dst->s6_addr32[0] = prefix->address.s6_addr32[0];
-		dst->s6_addr[4] = prefix->address.s6_addr[4];
-		dst->s6_addr[5] = prefix->address.s6_addr[5];
-		dst->s6_addr[6] = src_aux.as8[0];
-		dst->s6_addr[7] = src_aux.as8[1];
-		dst->s6_addr[9] = src_aux.as8[2];
-		dst->s6_addr[10] = src_aux.as8[3];
-		break;
-	case 56:
-		dst->s6_addr32[0] = prefix->address.s6_addr32[0];
-		dst->s6_addr[4] = prefix->address.s6_addr[4];
-		dst->s6_addr[5] = prefix->address.s6_addr[5];
-		dst->s6_addr[6] = prefix->address.s6_addr[6];
-		dst->s6_addr[7] = src_aux.as8[0];
-		dst->s6_addr[9] = src_aux.as8[1];
-		dst->s6_addr[10] = src_aux.as8[2];
-		dst->s6_addr[11] = src_aux.as8[3];
-		break;
-	case 64:
-		dst->s6_addr32[0] = prefix->address.s6_addr32[0];
-		dst->s6_addr32[1] = prefix->address.s6_addr32[1];
-		dst->s6_addr[9] = src_aux.as8[0];
-		dst->s6_addr[10] = src_aux.as8[1];
-		dst->s6_addr[11] = src_aux.as8[2];
-		dst->s6_addr[12] = src_aux.as8[3];
-		break;
-	case 96:
-		dst->s6_addr32[0] = prefix->address.s6_addr32[0];
-		dst->s6_addr32[1] = prefix->address.s6_addr32[1];
-		dst->s6_addr32[2] = prefix->address.s6_addr32[2];
-		dst->s6_addr32[3] = src_aux.as32;
-		break;
-	default:
-		/* Critical because enforcing valid prefixes is pool6's responsibility, not ours. */
-		WARN(true, "Prefix has an invalid length: %u.", prefix->len);
+	if (!is_valid_len(prefix->len))
 		return -EINVAL;
+
+	addr4 = be32_to_cpu(src->s_addr);
+	hi = get_unaligned_be64(&prefix->address.s6_addr[0]);
+
+	if (prefix->len == 96) {
+		lo = get_unaligned_be64(&prefix->address.s6_addr[8]);
+		lo = (lo & 0xFFFFFFFF00000000ULL) | addr4;
+	} else {
+		hi_bits = 64 - prefix->len;
+		hi &= ~0ULL << hi_bits;
+		if (hi_bits)
+			hi |= addr4 >> (32 - hi_bits);
+		/* The rest goes to the lower half, after the u octet. */
+		lo = (hi_bits < 32) ? ((((__u64)addr4) << (32 + hi_bits)) >> 8) : 0;
 	}
 
+	put_unaligned_be64(hi, &dst->s6_addr[0]);
+	put_unaligned_be64(lo, &dst->s6_addr[8]);
 	return 0;
 }
 
@@ -1,6 +1,7 @@
 #include "nat64/mod/common/rfc6145/4to6.h"
 
 #include "nat64/common/constants.h"
+#include "nat64/mod/common/addr_cache.h"
 #include "nat64/mod/common/config.h"
 #include "nat64/mod/common/icmp_wrapper.h"
 #include "nat64/mod/common/pool6.h"
@@ -10,6 +11,16 @@
 #include "nat64/mod/stateless/blacklist4.h"
 #include "nat64/mod/stateless/eam.h"
 
+#include <net/dst.h>
+
+/**
+ * One-liner for creating the Identification field of the IPv6 Fragment header.
+ */
+static inline __be32 build_id_field(struct iphdr *ip4_hdr)
+{
+	return cpu_to_be32(be16_to_cpu(ip4_hdr->id));
+}
+
 verdict ttp46_create_skb(struct packet *in, struct packet *out)
 {
 	int l3_hdr_len;
@@ -35,7 +46,7 @@ verdict ttp46_create_skb(struct packet *in, struct packet *out)
 	 * packet's responsibility).
 	 */
 	l3_hdr_len = sizeof(struct ipv6hdr);
-	if (will_need_frag_hdr(pkt_ip4_hdr(in)))
+	if (will_need_frag_hdr(in->cfg, pkt_ip4_hdr(in)))
 		l3_hdr_len += sizeof(struct frag_hdr);
 	else
 		reserve += sizeof(struct frag_hdr);
@@ -43,7 +54,7 @@ verdict ttp46_create_skb(struct packet *in, struct packet *out)
 	total_len = l3_hdr_len + pkt_l3payload_len(in);
 	if (is_first && pkt_is_icmp4_error(in)) {
 		total_len += sizeof(struct ipv6hdr) - sizeof(struct iphdr);
-		if (will_need_frag_hdr(pkt_payload(in)))
+		if (will_need_frag_hdr(in->cfg, pkt_payload(in)))
 			total_len += sizeof(struct frag_hdr);
 
 		/* All errors from RFC 4443 share this. */
@@ -64,12 +75,16 @@ verdict ttp46_create_skb(struct packet *in, struct packet *out)
 	skb_set_transport_header(skb, l3_hdr_len);
 
 	pkt_fill(out, skb, L3PROTO_IPV6, pkt_l4_proto(in),
-			will_need_frag_hdr(pkt_ip4_hdr(in)) ? ((struct frag_hdr *) (ipv6_hdr(skb) + 1)) : NULL,
+			will_need_frag_hdr(in->cfg, pkt_ip4_hdr(in)) ? ((struct frag_hdr *) (ipv6_hdr(skb) + 1)) : NULL,
 			skb_transport_header(skb) + pkt_l4hdr_len(in),
 			pkt_original_pkt(in));
+	out->fragmentable = !is_dont_fragment_set(pkt_ip4_hdr(in));
+	out->frag_id = build_id_field(pkt_ip4_hdr(in));
 
 	skb->mark = in->skb->mark;
 	skb->protocol = htons(ETH_P_IPV6);
+	if (skb_is_gso(in->skb) && ttpcomm_gso_supported(in->skb))
+		ttpcomm_xlat_gso(in->skb, skb, L3PROTO_IPV6);
 
 	return VERDICT_CONTINUE;
 }
@@ -108,7 +123,7 @@ static int generate_saddr6_nat64(struct tuple *tuple6, struct packet *in, struct
 	struct in_addr tmp;
 	int error;
 
-	if (config_get_src_icmp6errs_better() && pkt_is_icmp4_error(in)) {
+	if (in->cfg->nat64.src_icmp6errs_better && pkt_is_icmp4_error(in)) {
 		/* Issue #132 behaviour. */
 		error = pool6_get(&tuple6->src.addr6.l3, &prefix6);
 		if (error)
@@ -122,7 +137,7 @@ static int generate_saddr6_nat64(struct tuple *tuple6, struct packet *in, struct
 	return 0;
 }
 
-static verdict generate_addr6_siit(__be32 addr4, struct in6_addr *addr6,
+static verdict __generate_addr6_siit(__be32 addr4, struct in6_addr *addr6,
 		bool dst, bool enable_eam)
 {
 	struct ipv6_prefix prefix;
@@ -159,6 +174,23 @@ static verdict generate_addr6_siit(__be32 addr4, struct in6_addr *addr6,
 	return VERDICT_CONTINUE;
 }
 
+static verdict generate_addr6_siit(__be32 addr4, struct in6_addr *addr6,
+		bool dst, bool enable_eam)
+{
+	unsigned int generation;
+	verdict result;
+
+	if (addrcache_get46(addr4, dst, enable_eam, addr6))
+		return VERDICT_CONTINUE;
+
+	generation = addrcache_generation();
+	result = __generate_addr6_siit(addr4, addr6, dst, enable_eam);
+	if (result == VERDICT_CONTINUE)
+		addrcache_put46(generation, addr4, dst, enable_eam, addr6);
+
+	return result;
+}
+
 static bool disable_src_eam(struct packet *in, bool hairpin)
 {
 	struct iphdr *inner_hdr;
@@ -177,14 +209,13 @@ static bool disable_dst_eam(struct packet *in, bool hairpin)
 	return hairpin && pkt_is_inner(in);
 }
 
-static verdict translate_addrs46_siit(struct packet *in, struct packet *out)
+static verdict translate_addrs46_siit(struct packet *in, struct ipv6hdr *hdr6)
 {
 	struct iphdr *hdr4 = pkt_ip4_hdr(in);
-	struct ipv6hdr *hdr6 = pkt_ip6_hdr(out);
 	bool hairpin;
 	verdict result;
 
-	hairpin = (config_eam_hairpin_mode() == EAM_HAIRPIN_SIMPLE)
+	hairpin = (in->cfg->siit.eam_hairpin_mode == EAM_HAIRPIN_SIMPLE)
 			|| pkt_is_intrinsic_hairpin(in);
 
 	/* Src address. */
@@ -247,14 +278,6 @@ static bool has_unexpired_src_route(struct iphdr *hdr)
 	return src_route_length >= src_route_pointer;
 }
 
-/**
- * One-liner for creating the Identification field of the IPv6 Fragment header.
- */
-static inline __be32 build_id_field(struct iphdr *ip4_hdr)
-{
-	return cpu_to_be32(be16_to_cpu(ip4_hdr->id));
-}
-
 /**
  * Infers a IPv6 header from "in"'s IPv4 header and "tuple". Places the result in "out"->l3_hdr.
  * This is RFC 6145 section 4.1.
@@ -276,13 +299,13 @@ verdict ttp46_ipv6(struct tuple *tuple6, struct packet *in, struct packet *out)
 			return VERDICT_DROP;
 		ip6_hdr->daddr = tuple6->dst.addr6.l3;
 	} else {
-		result = translate_addrs46_siit(in, out);
+		result = translate_addrs46_siit(in, ip6_hdr);
 		if (result != VERDICT_CONTINUE)
 			return result;
 	}
 
 	ip6_hdr->version = 6;
-	if (config_get_reset_traffic_class()) {
+	if (in->cfg->reset_traffic_class) {
 		ip6_hdr->priority = 0;
 		ip6_hdr->flow_lbl[0] = 0;
 	} else {
@@ -317,7 +340,7 @@ verdict ttp46_ipv6(struct tuple *tuple6, struct packet *in, struct packet *out)
 		return VERDICT_DROP;
 	}
 
-	if (will_need_frag_hdr(pkt_ip4_hdr(in))) {
+	if (will_need_frag_hdr(in->cfg, pkt_ip4_hdr(in))) {
 		struct frag_hdr *frag_header = (struct frag_hdr *) (ip6_hdr + 1);
 
 		/* Override some fixed header fields... */
@@ -570,8 +593,15 @@ static verdict validate_icmp4_csum(struct packet *in)
 {
 	__sum16 csum;
 
-	if (in->skb->ip_summed != CHECKSUM_NONE)
+	switch (in->skb->ip_summed) {
+	case CHECKSUM_UNNECESSARY:
+	case CHECKSUM_PARTIAL:
 		return VERDICT_CONTINUE;
+	case CHECKSUM_COMPLETE:
+		if (!csum_fold(ttpcomm_l4_csum_complete(in)))
+			return VERDICT_CONTINUE;
+		/* Don't trust the device on failure; confirm below. */
+	}
 
 	csum = csum_fold(skb_checksum(in->skb, skb_transport_offset(in->skb),
 			pkt_datagram_len(in), 0));
@@ -743,7 +773,7 @@ static bool can_compute_csum(struct packet *in)
 	 * addresses and port numbers in the packet.
 	 */
 	hdr4 = pkt_ip4_hdr(in);
-	if (is_more_fragments_set_ipv4(hdr4) || !config_amend_zero_csum()) {
+	if (is_more_fragments_set_ipv4(hdr4) || !in->cfg->siit.compute_udp_csum_zero) {
 		hdr_udp = pkt_udp_hdr(in);
 		log_debug("Dropping zero-checksum UDP packet: %pI4#%u->%pI4#%u",
 				&hdr4->saddr, ntohs(hdr_udp->source),
@@ -755,106 +785,152 @@ static bool can_compute_csum(struct packet *in)
 }
 
 /**
- * Assumes that "out" is IPv6 and UDP, and computes and sets its l4-checksum.
+ * Returns the checksum a zero-checksum UDP "in" should have once translated,
+ * assuming it will be left to the NIC (ie. CHECKSUM_PARTIAL). @hdr6 is the
+ * translated network header.
+ *
  * This has to be done because the field is mandatory only in IPv6, so Jool has to make up for lazy
  * IPv4 nodes.
  * This is actually required in the Determine Incoming Tuple step, but it feels more at home here.
+ *
+ * There's no need to compute the full checksum in software; the payload doesn't change, so the
+ * device (or the kernel, if the device can't, or if the packet needs fragmenting) can do it later
+ * from the pseudoheader alone.
  */
-static int handle_zero_csum(struct packet *in, struct packet *out)
+static __sum16 zero_csum_partial(struct packet *in, struct ipv6hdr *hdr6)
 {
-	struct ipv6hdr *hdr6 = pkt_ip6_hdr(out);
-	struct udphdr *hdr_udp = pkt_udp_hdr(out);
-	__wsum csum;
+	return ~csum_ipv6_magic(&hdr6->saddr, &hdr6->daddr, pkt_datagram_len(in),
+			IPPROTO_UDP, 0);
+}
 
+static int handle_zero_csum(struct packet *in, struct packet *out)
+{
 	if (!can_compute_csum(in))
 		return -EINVAL;
 
-	/*
-	 * Here's the deal:
-	 * We want to compute out's checksum. **out is a packet whose fragment offset is zero**.
-	 *
-	 * Problem is, out's payload hasn't been translated yet. Because it can be scattered through
-	 * several fragments, moving this step would make it look annoyingly out of place way later.
-	 *
-	 * Instead, we can exploit the fact that the translation does not affect the UDP payload,
-	 * so here's what we will actually include in the checksum:
-	 * - out's pseudoheader (this will actually be summed last).
-	 * - out's UDP header.
-	 * - in's payload.
-	 *
-	 * That's the reason why we needed in as an argument.
-	 */
-
-	csum = csum_partial(hdr_udp, sizeof(*hdr_udp), 0);
-	csum = skb_checksum(in->skb, pkt_payload_offset(in), pkt_payload_len_pkt(in), csum);
-	hdr_udp->check = csum_ipv6_magic(&hdr6->saddr, &hdr6->daddr, pkt_datagram_len(in),
-			IPPROTO_UDP, csum);
-
+	pkt_udp_hdr(out)->check = zero_csum_partial(in, pkt_ip6_hdr(out));
+	partialize_skb(out->skb, offsetof(struct udphdr, check));
 	return 0;
 }
 
-verdict ttp46_tcp(struct tuple *tuple6, struct packet *in, struct packet *out)
+/**
+ * Writes in @tcp_out the translated version of "in"'s fixed TCP header.
+ * @hdr4 and @hdr6 are the (old and new) network headers the checksum has to be
+ * adjusted for.
+ */
+static void xlat_tcp_hdr(struct tuple *tuple6, struct packet *in,
+		struct iphdr *hdr4, struct ipv6hdr *hdr6, struct tcphdr *tcp_out)
 {
 	struct tcphdr *tcp_in = pkt_tcp_hdr(in);
-	struct tcphdr *tcp_out = pkt_tcp_hdr(out);
 	struct tcphdr tcp_copy;
 
-	/* Header */
-	memcpy(tcp_out, tcp_in, pkt_l4hdr_len(in));
+	memcpy(tcp_out, tcp_in, sizeof(*tcp_out));
 	if (xlat_is_nat64()) {
 		tcp_out->source = cpu_to_be16(tuple6->src.addr6.l4);
 		tcp_out->dest = cpu_to_be16(tuple6->dst.addr6.l4);
 	}
 
-	/* Header.checksum */
 	if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
 		memcpy(&tcp_copy, tcp_in, sizeof(*tcp_in));
 		tcp_copy.check = 0;
 
 		tcp_out->check = 0;
 		tcp_out->check = update_csum_4to6(tcp_in->check,
-				pkt_ip4_hdr(in), &tcp_copy, sizeof(tcp_copy),
-				pkt_ip6_hdr(out), tcp_out, sizeof(*tcp_out));
+				hdr4, &tcp_copy, sizeof(tcp_copy),
+				hdr6, tcp_out, sizeof(*tcp_out));
 	} else {
 		tcp_out->check = update_csum_4to6_partial(tcp_in->check,
-				pkt_ip4_hdr(in), pkt_ip6_hdr(out));
-		partialize_skb(out->skb, offsetof(struct tcphdr, check));
+				hdr4, hdr6);
+	}
+}
+
+/**
+ * Clamps the MSS of @tcp, which is about to reach an IPv6 node.
+ * The node's segments will come back along (roughly) the route @tcp takes.
+ */
+static void clamp_mss46(struct packet *in, struct tcphdr *tcp,
+		struct dst_entry *dst)
+{
+	unsigned int mtu = config_mss_clamp(in->cfg);
+
+	if (!mtu || !tcp->syn)
+		return;
+	if (dst)
+		mtu = min(mtu, dst_mtu(dst));
+
+	ttpcomm_clamp_mss(tcp, mtu, in->skb->ip_summed != CHECKSUM_PARTIAL);
+}
+
+verdict ttp46_tcp(struct tuple *tuple6, struct packet *in, struct packet *out)
+{
+	struct tcphdr *tcp_out = pkt_tcp_hdr(out);
+
+	/* Header (options included) */
+	memcpy(tcp_out, pkt_tcp_hdr(in), pkt_l4hdr_len(in));
+	xlat_tcp_hdr(tuple6, in, pkt_ip4_hdr(in), pkt_ip6_hdr(out), tcp_out);
+	if (config_mss_clamp(in->cfg) && tcp_out->syn && !pkt_is_inner(out)) {
+		/* sendpkt_send() reuses this route. */
+		clamp_mss46(in, tcp_out, route6(out));
 	}
 
+	if (in->skb->ip_summed == CHECKSUM_PARTIAL)
+		partialize_skb(out->skb, offsetof(struct tcphdr, check));
+
 	/* Payload */
 	return copy_payload(in, out) ? VERDICT_DROP : VERDICT_CONTINUE;
 }
 
-verdict ttp46_udp(struct tuple *tuple6, struct packet *in, struct packet *out)
+/**
+ * Writes in @udp_out the translated version of "in"'s UDP header.
+ * Assumes "in"'s checksum is not zero (see handle_zero_csum()).
+ * @hdr4 and @hdr6 are the (old and new) network headers the checksum has to be
+ * adjusted for.
+ */
+static void xlat_udp_hdr(struct tuple *tuple6, struct packet *in,
+		struct iphdr *hdr4, struct ipv6hdr *hdr6, struct udphdr *udp_out)
 {
 	struct udphdr *udp_in = pkt_udp_hdr(in);
-	struct udphdr *udp_out = pkt_udp_hdr(out);
 	struct udphdr udp_copy;
 
-	/* Header */
-	memcpy(udp_out, udp_in, pkt_l4hdr_len(in));
+	memcpy(udp_out, udp_in, sizeof(*udp_out));
 	if (xlat_is_nat64()) {
 		udp_out->source = cpu_to_be16(tuple6->src.addr6.l4);
 		udp_out->dest = cpu_to_be16(tuple6->dst.addr6.l4);
 	}
 
+	if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+		memcpy(&udp_copy, udp_in, sizeof(*udp_in));
+		udp_copy.check = 0;
+
+		udp_out->check = 0;
+		udp_out->check = update_csum_4to6(udp_in->check,
+				hdr4, &udp_copy, sizeof(udp_copy),
+				hdr6, udp_out, sizeof(*udp_out));
+	} else {
+		udp_out->check = update_csum_4to6_partial(udp_in->check,
+				hdr4, hdr6);
+	}
+}
+
+verdict ttp46_udp(struct tuple *tuple6, struct packet *in, struct packet *out)
+{
+	struct udphdr *udp_in = pkt_udp_hdr(in);
+	struct udphdr *udp_out = pkt_udp_hdr(out);
+
 	/* Header.checksum */
 	if (udp_in->check != 0) {
-		if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
-			memcpy(&udp_copy, udp_in, sizeof(*udp_in));
-			udp_copy.check = 0;
-
-			udp_out->check = 0;
-			udp_out->check = update_csum_4to6(udp_in->check,
-					pkt_ip4_hdr(in), &udp_copy, sizeof(udp_copy),
-					pkt_ip6_hdr(out), udp_out, sizeof(*udp_out));
-		} else {
-			udp_out->check = update_csum_4to6_partial(udp_in->check,
-					pkt_ip4_hdr(in), pkt_ip6_hdr(out));
+		xlat_udp_hdr(tuple6, in, pkt_ip4_hdr(in), pkt_ip6_hdr(out),
+				udp_out);
+		if (in->skb->ip_summed == CHECKSUM_PARTIAL)
 			partialize_skb(out->skb, offsetof(struct udphdr, check));
-		}
 	} else {
-		/* TODO (performance) handling this as partial might work just as well, or better. */
+		/* Header */
+		memcpy(udp_out, udp_in, pkt_l4hdr_len(in));
+		if (xlat_is_nat64()) {
+			udp_out->source = cpu_to_be16(tuple6->src.addr6.l4);
+			udp_out->dest = cpu_to_be16(tuple6->dst.addr6.l4);
+		}
+
 		if (handle_zero_csum(in, out))
 			return VERDICT_DROP;
 	}
@@ -862,3 +938,131 @@ verdict ttp46_udp(struct tuple *tuple6, struct packet *in, struct packet *out)
 	/* Payload */
 	return copy_payload(in, out) ? VERDICT_DROP : VERDICT_CONTINUE;
 }
+
+/**
+ * Builds in @hdr6 the IPv6 version of @hdr4 (which is "in"'s network header,
+ * already known to lack options and to not need a fragment header).
+ * This is the subset of ttp46_ipv6() that applies to in-place translation.
+ */
+static verdict xlat_ipv6_in_place(struct tuple *tuple6, struct packet *in,
+		struct iphdr *hdr4, struct ipv6hdr *hdr6)
+{
+	verdict result;
+
+	/* Translate the address first because of issue #167. */
+	if (xlat_is_nat64()) {
+		/* (generate_saddr6_nat64() only deviates from this on ICMP errors.) */
+		hdr6->saddr = tuple6->src.addr6.l3;
+		hdr6->daddr = tuple6->dst.addr6.l3;
+	} else {
+		result = translate_addrs46_siit(in, hdr6);
+		if (result != VERDICT_CONTINUE)
+			return result;
+	}
+
+	hdr6->version = 6;
+	if (in->cfg->reset_traffic_class) {
+		hdr6->priority = 0;
+		hdr6->flow_lbl[0] = 0;
+	} else {
+		hdr6->priority = hdr4->tos >> 4;
+		hdr6->flow_lbl[0] = hdr4->tos << 4;
+	}
+	hdr6->flow_lbl[1] = 0;
+	hdr6->flow_lbl[2] = 0;
+	hdr6->payload_len = cpu_to_be16(in->skb->len - sizeof(*hdr4));
+	hdr6->nexthdr = hdr4->protocol;
+
+	if (hdr4->ttl <= 1) {
+		icmp64_send(in, ICMPERR_HOP_LIMIT, 0);
+		inc_stats(in, IPSTATS_MIB_INHDRERRORS);
+		return VERDICT_DROP;
+	}
+	hdr6->hop_limit = hdr4->ttl - 1;
+
+	return VERDICT_CONTINUE;
+}
+
+verdict ttp46_xlat_in_place(struct tuple *tuple6, struct packet *in, struct packet *out)
+{
+	struct sk_buff *skb = in->skb;
+	struct iphdr hdr4;
+	struct ipv6hdr hdr6;
+	union ttpcomm_l4_hdr l4;
+	unsigned int l4hdr_len;
+	unsigned int l4_fixed_len;
+	unsigned int csum_offset;
+	struct dst_entry *dst;
+	bool zero_csum = false;
+	verdict result;
+
+	/* See ttp64_xlat_in_place(). */
+	memcpy(&hdr4, pkt_ip4_hdr(in), sizeof(hdr4));
+	l4hdr_len = pkt_l4hdr_len(in);
+
+	result = xlat_ipv6_in_place(tuple6, in, &hdr4, &hdr6);
+	if (result != VERDICT_CONTINUE)
+		return result;
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		xlat_tcp_hdr(tuple6, in, &hdr4, &hdr6, &l4.tcp);
+		l4_fixed_len = sizeof(l4.tcp);
+		csum_offset = offsetof(struct tcphdr, check);
+		break;
+	case L4PROTO_UDP:
+		zero_csum = (pkt_udp_hdr(in)->check == 0);
+		if (zero_csum) {
+			if (!can_compute_csum(in))
+				return VERDICT_DROP;
+			memcpy(&l4.udp, pkt_udp_hdr(in), sizeof(l4.udp));
+			if (xlat_is_nat64()) {
+				l4.udp.source = cpu_to_be16(tuple6->src.addr6.l4);
+				l4.udp.dest = cpu_to_be16(tuple6->dst.addr6.l4);
+			}
+			l4.udp.check = zero_csum_partial(in, &hdr6);
+		} else {
+			xlat_udp_hdr(tuple6, in, &hdr4, &hdr6, &l4.udp);
+		}
+		l4_fixed_len = sizeof(l4.udp);
+		csum_offset = offsetof(struct udphdr, check);
+		break;
+	default:
+		WARN(true, "Unsupported in-place transport protocol: %u.", pkt_l4_proto(in));
+		return VERDICT_DROP;
+	}
+
+	dst = __route6(&hdr6, hdr6.nexthdr, pkt_l4_proto(in), &l4, skb->mark, NULL);
+	if (!dst)
+		return VERDICT_ACCEPT;
+	if (ttpcomm_in_place_too_big(in, dst, ttpcomm_in_place_len(in))) {
+		dst_release(dst);
+		return VERDICT_DROP;
+	}
+
+	if (skb_cow(skb, LL_MAX_HEADER + sizeof(hdr6) - sizeof(hdr4))) {
+		dst_release(dst);
+		inc_stats(in, IPSTATS_MIB_INDISCARDS);
+		return VERDICT_DROP;
+	}
+
+	/* Point of no return; from now on, "in" is gone. */
+	memcpy(skb->data + sizeof(hdr4), &l4, l4_fixed_len);
+	if (pkt_l4_proto(in) == L4PROTO_TCP)
+		clamp_mss46(in, (struct tcphdr *) (skb->data + sizeof(hdr4)), dst);
+	__skb_push(skb, sizeof(hdr6) - sizeof(hdr4));
+	memcpy(skb->data, &hdr6, sizeof(hdr6));
+	skb->protocol = htons(ETH_P_IPV6);
+	if (zero_csum)
+		skb->ip_summed = CHECKSUM_PARTIAL;
+	ttpcomm_in_place_finish(skb, dst, sizeof(hdr6), csum_offset);
+	ttpcomm_xlat_gso(skb, skb, L3PROTO_IPV6);
+
+	pkt_fill(out, skb, L3PROTO_IPV6, pkt_l4_proto(in), NULL,
+			skb_transport_header(skb) + l4hdr_len,
+			pkt_original_pkt(in));
+	out->fragmentable = !is_dont_fragment_set(&hdr4);
+	out->frag_id = build_id_field(&hdr4);
+
+	return VERDICT_CONTINUE;
+}
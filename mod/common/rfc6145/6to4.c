@@ -1,8 +1,9 @@
 #include "nat64/mod/common/rfc6145/6to4.h"
 
+#include "nat64/mod/common/addr_cache.h"
 #include "nat64/mod/common/config.h"
 #include "nat64/mod/common/icmp_wrapper.h"
-#include "nat64/mod/common/ipv6_hdr_iterator.h"
+#include "nat64/mod/common/ipv4_id.h"
 #include "nat64/mod/common/pool6.h"
 #include "nat64/mod/common/rfc6052.h"
 #include "nat64/mod/common/stats.h"
@@ -11,6 +12,8 @@
 #include "nat64/mod/stateless/rfc6791.h"
 #include "nat64/mod/stateless/eam.h"
 
+#include <net/dst.h>
+
 verdict ttp64_create_skb(struct packet *in, struct packet *out)
 {
 	unsigned int total_len;
@@ -34,11 +37,8 @@ verdict ttp64_create_skb(struct packet *in, struct packet *out)
 	 */
 	total_len = sizeof(struct iphdr) + pkt_l3payload_len(in);
 	if (is_first && pkt_is_icmp6_error(in)) {
-		struct hdr_iterator iterator = HDR_ITERATOR_INIT((struct ipv6hdr *) pkt_payload(in));
-		hdr_iterator_last(&iterator);
-
 		/* Add the IPv4 subheader, remove the IPv6 subheaders. */
-		total_len += sizeof(struct iphdr) - (iterator.data - pkt_payload(in));
+		total_len += sizeof(struct iphdr) - in->inner_hdr6.hdrs_len;
 
 		/* RFC1812 section 4.3.2.3. I'm using a literal because the RFC does. */
 		if (total_len > 576)
@@ -63,21 +63,15 @@ verdict ttp64_create_skb(struct packet *in, struct packet *out)
 
 	skb->mark = in->skb->mark;
 	skb->protocol = htons(ETH_P_IP);
+	if (skb_is_gso(in->skb) && ttpcomm_gso_supported(in->skb))
+		ttpcomm_xlat_gso(in->skb, skb, L3PROTO_IPV4);
 
 	return VERDICT_CONTINUE;
 }
 
-static __u8 __xlat_tos(bool reset_tos, __u8 new_tos, struct ipv6hdr *hdr)
-{
-	return reset_tos ? new_tos : get_traffic_class(hdr);
-}
-
-__u8 ttp64_xlat_tos(struct ipv6hdr *hdr)
+__u8 ttp64_xlat_tos(struct global_config *cfg, struct ipv6hdr *hdr)
 {
-	bool reset_tos;
-	__u8 new_tos;
-	config_get_hdr4_config(&reset_tos, &new_tos, NULL, NULL);
-	return __xlat_tos(reset_tos, new_tos, hdr);
+	return cfg->reset_tos ? cfg->new_tos : get_traffic_class(hdr);
 }
 
 /**
@@ -125,39 +119,55 @@ static __be16 build_tot_len(struct packet *in, struct packet *out)
 
 /**
  * One-liner for creating the IPv4 header's Identification field.
- * It assumes that the packet will not contain a fragment header.
+ * It assumes that the packet will not contain a fragment header, and that
+ * @hdr4's addresses and protocol have already been translated.
  */
-static __be16 generate_ipv4_id_nofrag(struct packet *skb_out)
+static __be16 __generate_ipv4_id_nofrag(struct global_config *cfg,
+		struct iphdr *hdr4, unsigned int len)
 {
 	__be16 random;
 
-	if (pkt_len(skb_out) <= 1260) {
-		get_random_bytes(&random, 2);
-		return random;
-	}
+	if (len > 1260)
+		return 0; /* Because the DF flag will be set. */
+
+	if (cfg->ipv4_id_mode == IPV4_ID_COUNTER)
+		return ipv4id_next(hdr4->saddr, hdr4->daddr, hdr4->protocol);
+
+	get_random_bytes(&random, 2);
+	return random;
+}
 
-	return 0; /* Because the DF flag will be set. */
+static __be16 generate_ipv4_id_nofrag(struct global_config *cfg,
+		struct packet *skb_out)
+{
+	/* If GSO, what matters is the length of the segments. */
+	return __generate_ipv4_id_nofrag(cfg, pkt_ip4_hdr(skb_out),
+			pkt_seg_len(skb_out));
 }
 
 /**
  * One-liner for creating the IPv4 header's Dont Fragment flag.
  */
+static bool __generate_df_flag(unsigned int len)
+{
+	return len > 1260;
+}
+
 static bool generate_df_flag(struct packet *pkt_out)
 {
-	return pkt_len(pkt_out) > 1260;
+	return __generate_df_flag(pkt_seg_len(pkt_out));
 }
 
 /**
  * One-liner for creating the IPv4 header's Protocol field.
  */
-__u8 ttp64_xlat_proto(struct ipv6hdr *hdr6)
+__u8 ttp64_xlat_proto(struct packet *in)
 {
-	struct hdr_iterator iterator = HDR_ITERATOR_INIT(hdr6);
-	hdr_iterator_last(&iterator);
-	return (iterator.hdr_type == NEXTHDR_ICMP) ? IPPROTO_ICMP : iterator.hdr_type;
+	__u8 nexthdr = in->hdr6.nexthdr;
+	return (nexthdr == NEXTHDR_ICMP) ? IPPROTO_ICMP : nexthdr;
 }
 
-static verdict generate_addr4_siit(struct in6_addr *addr6, __be32 *addr4,
+static verdict __generate_addr4_siit(struct in6_addr *addr6, __be32 *addr4,
 		bool is_dst, bool *was_6052)
 {
 	struct ipv6_prefix prefix;
@@ -202,6 +212,23 @@ success:
 	return VERDICT_CONTINUE;
 }
 
+static verdict generate_addr4_siit(struct in6_addr *addr6, __be32 *addr4,
+		bool is_dst, bool *was_6052)
+{
+	unsigned int generation;
+	verdict result;
+
+	if (addrcache_get64(addr6, is_dst, addr4, was_6052))
+		return VERDICT_CONTINUE;
+
+	generation = addrcache_generation();
+	result = __generate_addr4_siit(addr6, addr4, is_dst, was_6052);
+	if (result == VERDICT_CONTINUE)
+		addrcache_put64(generation, addr6, is_dst, *addr4, *was_6052);
+
+	return result;
+}
+
 static verdict translate_addrs64_siit(struct packet *in, struct packet *out)
 {
 	struct ipv6hdr *hdr6 = pkt_ip6_hdr(in);
@@ -231,7 +258,7 @@ static verdict translate_addrs64_siit(struct packet *in, struct packet *out)
 	 * involved.
 	 * See the EAM draft.
 	 */
-	if (config_eam_hairpin_mode() == EAM_HAIRPIN_INTRINSIC) {
+	if (in->cfg->siit.eam_hairpin_mode == EAM_HAIRPIN_INTRINSIC) {
 		/* Condition set A */
 		if (pkt_is_outer(in) && !pkt_is_icmp6_error(in)
 				&& dst_was_6052
@@ -251,27 +278,26 @@ static verdict translate_addrs64_siit(struct packet *in, struct packet *out)
 }
 
 /**
- * Returns "true" if ip6_hdr's first routing header contains a Segments Field which is not zero.
+ * Returns "true" if in's first routing header contains a Segments Field which is not zero.
  *
- * @param ip6_hdr IPv6 header of the packet you want to test.
+ * @param in the packet you want to test.
  * @param field_location (out parameter) if the header contains a routing header, the offset of the
- *		segments left field (from the start of ip6_hdr) will be stored here.
- * @return whether ip6_hdr's first routing header contains a Segments Field which is not zero.
+ *		segments left field (from the start of in's IPv6 header) will be stored here.
+ * @return whether in's first routing header contains a Segments Field which is not zero.
  */
-static bool has_nonzero_segments_left(struct ipv6hdr *ip6_hdr, __u32 *field_location)
+static bool has_nonzero_segments_left(struct packet *in, __u32 *field_location)
 {
-	struct ipv6_rt_hdr *rt_hdr;
-	unsigned int offset;
+	__u16 offset = in->hdr6.segments_left_offset;
+	__u8 *segments_left;
 
-	rt_hdr = hdr_iterator_find(ip6_hdr, NEXTHDR_ROUTING);
-	if (!rt_hdr)
+	if (!offset)
 		return false;
 
-	if (rt_hdr->segments_left == 0)
+	segments_left = (__u8 *) pkt_ip6_hdr(in) + offset;
+	if (*segments_left == 0)
 		return false;
 
-	offset = (void *) rt_hdr - (void *) ip6_hdr;
-	*field_location = offset + offsetof(struct ipv6_rt_hdr, segments_left);
+	*field_location = offset;
 	return true;
 }
 
@@ -296,20 +322,16 @@ verdict ttp64_ipv4(struct tuple *tuple4, struct packet *in, struct packet *out)
 	struct ipv6hdr *ip6_hdr = pkt_ip6_hdr(in);
 	struct frag_hdr *ip6_frag_hdr;
 	struct iphdr *ip4_hdr = pkt_ip4_hdr(out);
+	struct global_config *cfg = in->cfg;
+	__u8 dont_fragment;
 	verdict result;
 
-	bool reset_tos, build_ipv4_id, df_always_on;
-	__u8 new_tos, dont_fragment;
-
-	config_get_hdr4_config(&reset_tos, &new_tos, &build_ipv4_id,
-			&df_always_on);
-
 	/*
 	 * translate_addrs64_siit->rfc6791_get->get_host_address needs tos
 	 * and protocol, so translate them first.
 	 */
-	ip4_hdr->tos = __xlat_tos(reset_tos, new_tos, ip6_hdr);
-	ip4_hdr->protocol = ttp64_xlat_proto(ip6_hdr);
+	ip4_hdr->tos = ttp64_xlat_tos(cfg, ip6_hdr);
+	ip4_hdr->protocol = ttp64_xlat_proto(in);
 
 	/* Translate the address before TTL because of issue #167. */
 	if (xlat_is_nat64()) {
@@ -324,8 +346,12 @@ verdict ttp64_ipv4(struct tuple *tuple4, struct packet *in, struct packet *out)
 	ip4_hdr->version = 4;
 	ip4_hdr->ihl = 5;
 	ip4_hdr->tot_len = build_tot_len(in, out);
-	ip4_hdr->id = build_ipv4_id ? generate_ipv4_id_nofrag(out) : 0;
-	dont_fragment = df_always_on ? 1 : generate_df_flag(out);
+	ip4_hdr->id = cfg->atomic_frags.build_ipv4_id
+			? generate_ipv4_id_nofrag(cfg, out)
+			: 0;
+	dont_fragment = cfg->atomic_frags.df_always_on
+			? 1
+			: generate_df_flag(out);
 	ip4_hdr->frag_off = build_ipv4_frag_off_field(dont_fragment, 0, 0);
 	if (pkt_is_outer(in)) {
 		if (ip6_hdr->hop_limit <= 1) {
@@ -341,7 +367,7 @@ verdict ttp64_ipv4(struct tuple *tuple4, struct packet *in, struct packet *out)
 
 	if (pkt_is_outer(in)) {
 		__u32 nonzero_location;
-		if (has_nonzero_segments_left(ip6_hdr, &nonzero_location)) {
+		if (has_nonzero_segments_left(in, &nonzero_location)) {
 			log_debug("Packet's segments left field is nonzero.");
 			icmp64_send(in, ICMPERR_HDR_FIELD, nonzero_location);
 			inc_stats(in, IPSTATS_MIB_INHDRERRORS);
@@ -600,11 +626,21 @@ static verdict validate_icmp6_csum(struct packet *in)
 	unsigned int len;
 	__sum16 csum;
 
-	if (in->skb->ip_summed != CHECKSUM_NONE)
+	if (in->skb->ip_summed == CHECKSUM_UNNECESSARY
+			|| in->skb->ip_summed == CHECKSUM_PARTIAL)
 		return VERDICT_CONTINUE;
 
 	hdr6 = pkt_ip6_hdr(in);
 	len = pkt_datagram_len(in);
+
+	if (in->skb->ip_summed == CHECKSUM_COMPLETE) {
+		csum = csum_ipv6_magic(&hdr6->saddr, &hdr6->daddr, len, NEXTHDR_ICMP,
+				ttpcomm_l4_csum_complete(in));
+		if (!csum)
+			return VERDICT_CONTINUE;
+		/* Don't trust the device on failure; confirm below. */
+	}
+
 	csum = csum_ipv6_magic(&hdr6->saddr, &hdr6->daddr, len, NEXTHDR_ICMP,
 			skb_checksum(in->skb, skb_transport_offset(in->skb),
 					len, 0));
@@ -773,70 +809,245 @@ static __sum16 update_csum_6to4_partial(__sum16 csum16, struct ipv6hdr *in_ip6,
 	return ~csum_fold(csum);
 }
 
-verdict ttp64_tcp(struct tuple *tuple4, struct packet *in, struct packet *out)
+/**
+ * Writes in @tcp_out the translated version of "in"'s fixed TCP header.
+ * @hdr6 and @hdr4 are the (old and new) network headers the checksum has to be
+ * adjusted for.
+ */
+static void xlat_tcp_hdr(struct tuple *tuple4, struct packet *in,
+		struct ipv6hdr *hdr6, struct iphdr *hdr4, struct tcphdr *tcp_out)
 {
 	struct tcphdr *tcp_in = pkt_tcp_hdr(in);
-	struct tcphdr *tcp_out = pkt_tcp_hdr(out);
 	struct tcphdr tcp_copy;
 
-	/* Header */
-	memcpy(tcp_out, tcp_in, pkt_l4hdr_len(in));
+	memcpy(tcp_out, tcp_in, sizeof(*tcp_out));
 	if (xlat_is_nat64()) {
 		tcp_out->source = cpu_to_be16(tuple4->src.addr4.l4);
 		tcp_out->dest = cpu_to_be16(tuple4->dst.addr4.l4);
 	}
 
-	/* Header.checksum */
 	if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
 		memcpy(&tcp_copy, tcp_in, sizeof(*tcp_in));
 		tcp_copy.check = 0;
 
 		tcp_out->check = 0;
 		tcp_out->check = update_csum_6to4(tcp_in->check,
-				pkt_ip6_hdr(in), &tcp_copy, sizeof(tcp_copy),
-				pkt_ip4_hdr(out), tcp_out, sizeof(*tcp_out));
-		out->skb->ip_summed = CHECKSUM_NONE;
+				hdr6, &tcp_copy, sizeof(tcp_copy),
+				hdr4, tcp_out, sizeof(*tcp_out));
 	} else {
 		tcp_out->check = update_csum_6to4_partial(tcp_in->check,
-				pkt_ip6_hdr(in), pkt_ip4_hdr(out));
-		partialize_skb(out->skb, offsetof(struct tcphdr, check));
+				hdr6, hdr4);
 	}
+}
+
+/**
+ * Clamps the MSS of @tcp, which is about to reach an IPv4 node.
+ * The node's segments will be translated and then reach IPv6 through
+ * (roughly) the interface @in came from.
+ */
+static void clamp_mss64(struct packet *in, struct tcphdr *tcp)
+{
+	unsigned int mtu = config_mss_clamp(in->cfg);
+
+	if (!mtu || !tcp->syn)
+		return;
+	if (in->skb->dev)
+		mtu = min(mtu, in->skb->dev->mtu);
+
+	ttpcomm_clamp_mss(tcp, mtu, in->skb->ip_summed != CHECKSUM_PARTIAL);
+}
+
+verdict ttp64_tcp(struct tuple *tuple4, struct packet *in, struct packet *out)
+{
+	struct tcphdr *tcp_out = pkt_tcp_hdr(out);
+
+	/* Header (options included) */
+	memcpy(tcp_out, pkt_tcp_hdr(in), pkt_l4hdr_len(in));
+	xlat_tcp_hdr(tuple4, in, pkt_ip6_hdr(in), pkt_ip4_hdr(out), tcp_out);
+	if (!pkt_is_inner(out))
+		clamp_mss64(in, tcp_out);
+
+	if (in->skb->ip_summed != CHECKSUM_PARTIAL)
+		out->skb->ip_summed = CHECKSUM_NONE;
+	else
+		partialize_skb(out->skb, offsetof(struct tcphdr, check));
 
 	/* Payload */
 	return copy_payload(in, out) ? VERDICT_DROP : VERDICT_CONTINUE;
 }
 
-verdict ttp64_udp(struct tuple *tuple4, struct packet *in, struct packet *out)
+/**
+ * Writes in @udp_out the translated version of "in"'s UDP header.
+ * @hdr6 and @hdr4 are the (old and new) network headers the checksum has to be
+ * adjusted for.
+ */
+static void xlat_udp_hdr(struct tuple *tuple4, struct packet *in,
+		struct ipv6hdr *hdr6, struct iphdr *hdr4, struct udphdr *udp_out)
 {
 	struct udphdr *udp_in = pkt_udp_hdr(in);
-	struct udphdr *udp_out = pkt_udp_hdr(out);
 	struct udphdr udp_copy;
 
-	/* Header */
-	memcpy(udp_out, udp_in, pkt_l4hdr_len(in));
+	memcpy(udp_out, udp_in, sizeof(*udp_out));
 	if (xlat_is_nat64()) {
 		udp_out->source = cpu_to_be16(tuple4->src.addr4.l4);
 		udp_out->dest = cpu_to_be16(tuple4->dst.addr4.l4);
 	}
 
-	/* Header.checksum */
 	if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
 		memcpy(&udp_copy, udp_in, sizeof(*udp_in));
 		udp_copy.check = 0;
 
 		udp_out->check = 0;
 		udp_out->check = update_csum_6to4(udp_in->check,
-				pkt_ip6_hdr(in), &udp_copy, sizeof(udp_copy),
-				pkt_ip4_hdr(out), udp_out, sizeof(*udp_out));
+				hdr6, &udp_copy, sizeof(udp_copy),
+				hdr4, udp_out, sizeof(*udp_out));
 		if (udp_out->check == 0)
 			udp_out->check = CSUM_MANGLED_0;
-		out->skb->ip_summed = CHECKSUM_NONE;
 	} else {
 		udp_out->check = update_csum_6to4_partial(udp_in->check,
-				pkt_ip6_hdr(in), pkt_ip4_hdr(out));
-		partialize_skb(out->skb, offsetof(struct udphdr, check));
+				hdr6, hdr4);
 	}
+}
+
+verdict ttp64_udp(struct tuple *tuple4, struct packet *in, struct packet *out)
+{
+	xlat_udp_hdr(tuple4, in, pkt_ip6_hdr(in), pkt_ip4_hdr(out),
+			pkt_udp_hdr(out));
+
+	if (in->skb->ip_summed != CHECKSUM_PARTIAL)
+		out->skb->ip_summed = CHECKSUM_NONE;
+	else
+		partialize_skb(out->skb, offsetof(struct udphdr, check));
 
 	/* Payload */
 	return copy_payload(in, out) ? VERDICT_DROP : VERDICT_CONTINUE;
 }
+
+/**
+ * Builds in @hdr4 the IPv4 version of @hdr6 (which is "in"'s network header,
+ * already known to lack extension headers).
+ * This is the subset of ttp64_ipv4() that applies to in-place translation.
+ */
+static verdict xlat_ipv4_in_place(struct tuple *tuple4, struct packet *in,
+		struct ipv6hdr *hdr6, struct iphdr *hdr4)
+{
+	struct global_config *cfg = in->cfg;
+	bool was_6052;
+	unsigned int len;
+	verdict result;
+
+	/* If GSO, this is the segment length. */
+	len = ttpcomm_in_place_len(in);
+
+	hdr4->version = 4;
+	hdr4->ihl = 5;
+	hdr4->tos = ttp64_xlat_tos(cfg, hdr6);
+	hdr4->tot_len = cpu_to_be16(in->skb->len - sizeof(*hdr6) + sizeof(*hdr4));
+	hdr4->frag_off = build_ipv4_frag_off_field(
+			cfg->atomic_frags.df_always_on ? 1 : __generate_df_flag(len),
+			0, 0);
+	hdr4->protocol = hdr6->nexthdr;
+
+	/* Translate the address before TTL because of issue #167. */
+	if (xlat_is_nat64()) {
+		hdr4->saddr = tuple4->src.addr4.l3.s_addr;
+		hdr4->daddr = tuple4->dst.addr4.l3.s_addr;
+	} else {
+		/* See translate_addrs64_siit(). */
+		result = generate_addr4_siit(&hdr6->daddr, &hdr4->daddr, true,
+				&was_6052);
+		if (result != VERDICT_CONTINUE)
+			return result;
+		result = generate_addr4_siit(&hdr6->saddr, &hdr4->saddr, false,
+				&was_6052);
+		if (result != VERDICT_CONTINUE)
+			return result;
+		log_debug("Result: %pI4->%pI4", &hdr4->saddr, &hdr4->daddr);
+	}
+
+	hdr4->id = cfg->atomic_frags.build_ipv4_id
+			? __generate_ipv4_id_nofrag(cfg, hdr4, len)
+			: 0;
+
+	if (hdr6->hop_limit <= 1) {
+		icmp64_send(in, ICMPERR_HOP_LIMIT, 0);
+		inc_stats(in, IPSTATS_MIB_INHDRERRORS);
+		return VERDICT_DROP;
+	}
+	hdr4->ttl = hdr6->hop_limit - 1;
+
+	hdr4->check = 0;
+	hdr4->check = ip_fast_csum(hdr4, hdr4->ihl);
+
+	return VERDICT_CONTINUE;
+}
+
+verdict ttp64_xlat_in_place(struct tuple *tuple4, struct packet *in, struct packet *out)
+{
+	struct sk_buff *skb = in->skb;
+	struct ipv6hdr hdr6;
+	struct iphdr hdr4;
+	union ttpcomm_l4_hdr l4;
+	unsigned int l4hdr_len;
+	unsigned int l4_fixed_len;
+	unsigned int csum_offset;
+	struct dst_entry *dst;
+	verdict result;
+
+	/*
+	 * Nothing in the skb is written until it's certain the packet will be
+	 * sent, so every early return leaves "in" as it was.
+	 */
+	memcpy(&hdr6, pkt_ip6_hdr(in), sizeof(hdr6));
+	l4hdr_len = pkt_l4hdr_len(in);
+
+	result = xlat_ipv4_in_place(tuple4, in, &hdr6, &hdr4);
+	if (result != VERDICT_CONTINUE)
+		return result;
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		xlat_tcp_hdr(tuple4, in, &hdr6, &hdr4, &l4.tcp);
+		l4_fixed_len = sizeof(l4.tcp);
+		csum_offset = offsetof(struct tcphdr, check);
+		break;
+	case L4PROTO_UDP:
+		xlat_udp_hdr(tuple4, in, &hdr6, &hdr4, &l4.udp);
+		l4_fixed_len = sizeof(l4.udp);
+		csum_offset = offsetof(struct udphdr, check);
+		break;
+	default:
+		WARN(true, "Unsupported in-place transport protocol: %u.", pkt_l4_proto(in));
+		return VERDICT_DROP;
+	}
+
+	dst = __route4(hdr4.daddr, hdr4.tos, hdr4.protocol, skb->mark, NULL);
+	if (!dst)
+		return VERDICT_ACCEPT;
+	if (ttpcomm_in_place_too_big(in, dst, ttpcomm_in_place_len(in))) {
+		dst_release(dst);
+		return VERDICT_DROP;
+	}
+
+	if (skb_cow(skb, LL_MAX_HEADER)) {
+		dst_release(dst);
+		inc_stats(in, IPSTATS_MIB_INDISCARDS);
+		return VERDICT_DROP;
+	}
+
+	/* Point of no return; from now on, "in" is gone. */
+	memcpy(skb->data + sizeof(hdr6), &l4, l4_fixed_len);
+	if (pkt_l4_proto(in) == L4PROTO_TCP)
+		clamp_mss64(in, (struct tcphdr *) (skb->data + sizeof(hdr6)));
+	__skb_pull(skb, sizeof(hdr6) - sizeof(hdr4));
+	memcpy(skb->data, &hdr4, sizeof(hdr4));
+	skb->protocol = htons(ETH_P_IP);
+	ttpcomm_in_place_finish(skb, dst, sizeof(hdr4), csum_offset);
+	ttpcomm_xlat_gso(skb, skb, L3PROTO_IPV4);
+
+	pkt_fill(out, skb, L3PROTO_IPV4, pkt_l4_proto(in), NULL,
+			skb_transport_header(skb) + l4hdr_len,
+			pkt_original_pkt(in));
+
+	return VERDICT_CONTINUE;
+}
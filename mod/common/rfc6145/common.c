@@ -1,11 +1,17 @@
 #include "nat64/mod/common/rfc6145/common.h"
 #include "nat64/mod/common/config.h"
-#include "nat64/mod/common/ipv6_hdr_iterator.h"
+#include "nat64/mod/common/icmp_wrapper.h"
 #include "nat64/mod/common/packet.h"
 #include "nat64/mod/common/stats.h"
 #include "nat64/mod/common/rfc6145/4to6.h"
 #include "nat64/mod/common/rfc6145/6to4.h"
 #include <linux/icmp.h>
+#include <linux/version.h>
+#include <net/checksum.h>
+#include <net/dst.h>
+#include <net/tcp.h>
+#include <linux/netfilter.h>
+#include <asm/unaligned.h>
 
 struct backup_skb {
 	unsigned int pulled;
@@ -15,6 +21,7 @@ struct backup_skb {
 	} offset;
 	void *payload;
 	l4_protocol l4_proto;
+	struct pkt_hdr6_summary hdr6;
 };
 
 static verdict handle_unknown_l4(struct tuple *out_tuple, struct packet *in, struct packet *out)
@@ -81,22 +88,23 @@ int copy_payload(struct packet *in, struct packet *out)
 	return error;
 }
 
-static bool build_ipv6_frag_hdr(struct iphdr *in_hdr)
+static bool build_ipv6_frag_hdr(struct global_config *cfg,
+		struct iphdr *in_hdr)
 {
 	if (is_dont_fragment_set(in_hdr))
 		return false;
 
-	return config_get_build_ipv6_fh();
+	return cfg->atomic_frags.build_ipv6_fh;
 }
 
-bool will_need_frag_hdr(struct iphdr *in_hdr)
+bool will_need_frag_hdr(struct global_config *cfg, struct iphdr *in_hdr)
 {
 	/*
 	 * Note, build_ipv6_frag_hdr(in_hdr) should remain disabled.
 	 * See www.jool.mx/usr-flags-atomic.html.
 	 * (if that's down, try doc/usr/usr-flags-atomic.md in Jool's source.)
 	 */
-	return build_ipv6_frag_hdr(in_hdr) || is_more_fragments_set_ipv4(in_hdr)
+	return build_ipv6_frag_hdr(cfg, in_hdr) || is_more_fragments_set_ipv4(in_hdr)
 			|| get_fragment_offset_ipv4(in_hdr);
 }
 
@@ -158,22 +166,21 @@ static int move_pointers4(struct packet *in, struct packet *out)
 		return error;
 
 	l3hdr_len = sizeof(struct ipv6hdr);
-	if (will_need_frag_hdr(hdr4))
+	if (will_need_frag_hdr(in->cfg, hdr4))
 		l3hdr_len += sizeof(struct frag_hdr);
 	return move_pointers_out(in, out, l3hdr_len);
 }
 
 static int move_pointers6(struct packet *in, struct packet *out)
 {
-	struct ipv6hdr *hdr6 = pkt_payload(in);
-	struct hdr_iterator iterator = HDR_ITERATOR_INIT(hdr6);
 	int error;
 
-	hdr_iterator_last(&iterator);
-
-	error = move_pointers_in(in, iterator.hdr_type, iterator.data - (void *) hdr6);
+	/* pkt_init_ipv6() already walked the inner packet's headers. */
+	error = move_pointers_in(in, in->inner_hdr6.nexthdr,
+			in->inner_hdr6.hdrs_len);
 	if (error)
 		return error;
+	in->hdr6 = in->inner_hdr6;
 
 	return move_pointers_out(in, out, sizeof(struct iphdr));
 }
@@ -185,6 +192,7 @@ static void backup(struct packet *pkt, struct backup_skb *bkp)
 	bkp->offset.l4 = skb_transport_offset(pkt->skb);
 	bkp->payload = pkt_payload(pkt);
 	bkp->l4_proto = pkt_l4_proto(pkt);
+	bkp->hdr6 = pkt->hdr6;
 }
 
 static void restore(struct packet *pkt, struct backup_skb *bkp)
@@ -194,6 +202,7 @@ static void restore(struct packet *pkt, struct backup_skb *bkp)
 	skb_set_transport_header(pkt->skb, bkp->offset.l4);
 	pkt->payload = bkp->payload;
 	pkt->l4_proto = bkp->l4_proto;
+	pkt->hdr6 = bkp->hdr6;
 	pkt->is_inner = 0;
 }
 
@@ -292,3 +301,267 @@ void partialize_skb(struct sk_buff *out_skb, unsigned int csum_offset)
 	out_skb->csum_start = skb_transport_header(out_skb) - out_skb->head;
 	out_skb->csum_offset = csum_offset;
 }
+
+/**
+ * ttpcomm_clamp_mss - Lowers the MSS option of @tcp (if it's a SYN) so the
+ * connection's segments fit in @mtu once they are carried by IPv6.
+ * @tcp: the translated TCP header. Its options have to follow it in memory.
+ * @update_csum: whether @tcp's checksum has to be updated. (Partial checksums
+ *	only cover the pseudoheader, so they don't.)
+ */
+void ttpcomm_clamp_mss(struct tcphdr *tcp, unsigned int mtu, bool update_csum)
+{
+	__u8 *opts = (__u8 *)(tcp + 1);
+	unsigned int len = (tcp->doff << 2) - sizeof(*tcp);
+	unsigned int max_mss;
+	unsigned int i = 0;
+	__u16 mss;
+
+	if (!tcp->syn || mtu <= sizeof(struct ipv6hdr) + sizeof(*tcp))
+		return;
+	max_mss = mtu - sizeof(struct ipv6hdr) - sizeof(*tcp);
+
+	while (i < len) {
+		switch (opts[i]) {
+		case TCPOPT_EOL:
+			return;
+		case TCPOPT_NOP:
+			i++;
+			continue;
+		}
+
+		if (i + 1 >= len || opts[i + 1] < 2 || i + opts[i + 1] > len)
+			return; /* Garbage; leave it to the endpoints. */
+
+		if (opts[i] == TCPOPT_MSS && opts[i + 1] == TCPOLEN_MSS) {
+			mss = get_unaligned_be16(&opts[i + 2]);
+			if (mss <= max_mss)
+				return;
+
+			log_debug("Clamping MSS %u to %u.", mss, max_mss);
+			put_unaligned_be16(max_mss, &opts[i + 2]);
+			if (update_csum)
+				csum_replace2(&tcp->check, cpu_to_be16(mss),
+						cpu_to_be16(max_mss));
+			return;
+		}
+
+		i += opts[i + 1];
+	}
+}
+
+/**
+ * ttpcomm_can_xlat_in_place - Can @in be translated by simply rewriting its
+ * own skb (as opposed to building a new one)?
+ *
+ * Assumes pkt_is_simple(@in), so only the runtime conditions are checked
+ * here: the packet must not be GSO (unless ttpcomm_gso_supported()), nor need
+ * an IPv6 fragment header, nor need its translation attempted more than once.
+ * Everything else takes the regular copying path.
+ */
+bool ttpcomm_can_xlat_in_place(struct tuple *out_tuple, struct packet *in)
+{
+	struct sk_buff *skb = in->skb;
+
+	/*
+	 * Hairpins get translated twice, and the second pass might need to
+	 * send ICMP errors to the original packet.
+	 */
+	if (pkt_original_pkt(in) != in || pkt_is_inner(in))
+		return false;
+	if (xlat_is_nat64()) {
+		if (pkt_will_hairpin(in))
+			return false;
+	} else {
+		if (in->cfg->siit.eam_hairpin_mode == EAM_HAIRPIN_INTRINSIC)
+			return false;
+	}
+
+	if (skb_network_offset(skb) != 0 || pkt_is_fragment(in))
+		return false;
+	if (skb_is_gso(skb) && !ttpcomm_gso_supported(skb))
+		return false;
+
+	if (pkt_l3_proto(in) == L3PROTO_IPV4)
+		return !will_need_frag_hdr(in->cfg, pkt_ip4_hdr(in));
+	return true;
+}
+
+/**
+ * ttpcomm_in_place_len - Returns the length @in will have once translated.
+ * If @in is GSO, returns the length of the largest segment it will be split
+ * into instead, since that's what the MTU and the DF flag are concerned about.
+ */
+unsigned int ttpcomm_in_place_len(struct packet *in)
+{
+	l3_protocol out_proto;
+	unsigned int out_l3hdr_len;
+
+	if (pkt_l3_proto(in) == L3PROTO_IPV6) {
+		out_proto = L3PROTO_IPV4;
+		out_l3hdr_len = sizeof(struct iphdr);
+	} else {
+		out_proto = L3PROTO_IPV6;
+		out_l3hdr_len = sizeof(struct ipv6hdr);
+	}
+
+	if (skb_is_gso(in->skb))
+		return out_l3hdr_len + pkt_l4hdr_len(in)
+				+ ttpcomm_xlat_gso_size(in->skb, out_proto);
+
+	return in->skb->len - pkt_l3hdr_len(in) + out_l3hdr_len;
+}
+
+/**
+ * ttpcomm_in_place_too_big - In-place version of send_packet's
+ * whine_if_too_big().
+ *
+ * The in-place translators have to run this before they start overriding @in,
+ * because the resulting ICMP error is addressed to it.
+ * @out_len is the length the packet will have once translated.
+ */
+bool ttpcomm_in_place_too_big(struct packet *in, struct dst_entry *dst, unsigned int out_len)
+{
+	unsigned int mtu;
+
+	if (pkt_l3_proto(in) == L3PROTO_IPV4 && !is_dont_fragment_set(pkt_ip4_hdr(in)))
+		return false;
+
+	mtu = dst->dev->mtu;
+	if (out_len <= mtu)
+		return false;
+
+	log_debug("Packet is too big (len: %u, mtu: %u).", out_len, mtu);
+
+	switch (pkt_l3_proto(in)) {
+	case L3PROTO_IPV4: /* out is IPv6. */
+		mtu -= 20;
+		break;
+	case L3PROTO_IPV6: /* out is IPv4. */
+		mtu += 20;
+		break;
+	}
+	icmp64_send(in, ICMPERR_FRAG_NEEDED, mtu);
+
+	return true;
+}
+
+/**
+ * ttpcomm_in_place_finish - Updates the metadata of an skb whose contents
+ * were just translated in place.
+ * @l3hdr_len: Length of the new network header, which @skb->data now points
+ *	to.
+ * @csum_offset: The checksum field's offset within the transport header.
+ *
+ * Whatever the kernel learned about the packet on the way in (route,
+ * conntrack, control buffer) refers to the old protocol, so it is dropped
+ * here and @dst (the route of the translated packet) takes its place.
+ */
+void ttpcomm_in_place_finish(struct sk_buff *skb, struct dst_entry *dst,
+		unsigned int l3hdr_len, unsigned int csum_offset)
+{
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, l3hdr_len);
+	memset(skb->cb, 0, sizeof(skb->cb));
+
+	skb_dst_drop(skb);
+	skb_dst_set(skb, dst);
+	nf_reset(skb);
+
+	if (skb->ip_summed == CHECKSUM_PARTIAL)
+		partialize_skb(skb, csum_offset);
+	else
+		skb->ip_summed = CHECKSUM_NONE;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0)
+#define GSO_TCP_TYPES (SKB_GSO_TCPV4 | SKB_GSO_TCPV6 | SKB_GSO_TCP_FIXEDID)
+#else
+#define GSO_TCP_TYPES (SKB_GSO_TCPV4 | SKB_GSO_TCPV6)
+#endif
+
+/**
+ * ttpcomm_gso_supported - Can @skb's GSO metadata survive translation?
+ *
+ * This is the case for GRO'd TCP, which is what a translator normally gets.
+ * Its header only needs to be translated once; the kernel will segment the
+ * result on the way out. (Assuming the checksum is still partial; that's what
+ * the segmentation code expects.)
+ * Other GSO types (tunnels, UFO) are translated as one large packet, as usual.
+ */
+bool ttpcomm_gso_supported(struct sk_buff *skb)
+{
+	unsigned int type = skb_shinfo(skb)->gso_type;
+
+	if (skb->ip_summed != CHECKSUM_PARTIAL)
+		return false;
+	if (!(type & (SKB_GSO_TCPV4 | SKB_GSO_TCPV6)))
+		return false;
+	return !(type & ~(GSO_TCP_TYPES | SKB_GSO_TCP_ECN | SKB_GSO_DODGY));
+}
+
+/**
+ * ttpcomm_xlat_gso_size - Returns the gso_size @skb should have once
+ * translated into @out_proto.
+ *
+ * Segments grow 20 bytes when they become IPv6, so their payload shrinks to
+ * make up for it; otherwise they'd no longer fit the MTU they were built for.
+ * IPv4 segments are simply left 20 bytes shorter, because growing them would
+ * exceed the peer's MSS.
+ */
+unsigned short ttpcomm_xlat_gso_size(struct sk_buff *skb, l3_protocol out_proto)
+{
+	unsigned short gso_size = skb_shinfo(skb)->gso_size;
+	unsigned short delta = sizeof(struct ipv6hdr) - sizeof(struct iphdr);
+
+	if (out_proto == L3PROTO_IPV6 && gso_size > delta)
+		return gso_size - delta;
+	return gso_size;
+}
+
+/**
+ * ttpcomm_xlat_gso - Copies @in's GSO metadata into @out, adapted to
+ * @out_proto. @in and @out can be the same skb.
+ *
+ * Assumes ttpcomm_gso_supported(@in).
+ */
+void ttpcomm_xlat_gso(struct sk_buff *in, struct sk_buff *out, l3_protocol out_proto)
+{
+	unsigned short gso_size;
+	unsigned int gso_type;
+
+	if (!skb_is_gso(in))
+		return;
+
+	gso_size = ttpcomm_xlat_gso_size(in, out_proto);
+	gso_type = skb_shinfo(in)->gso_type & ~GSO_TCP_TYPES;
+	gso_type |= (out_proto == L3PROTO_IPV6) ? SKB_GSO_TCPV6 : SKB_GSO_TCPV4;
+
+	skb_shinfo(out)->gso_size = gso_size;
+	/* DODGY: Have the kernel recompute gso_segs. */
+	skb_shinfo(out)->gso_type = gso_type | SKB_GSO_DODGY;
+	skb_shinfo(out)->gso_segs = 0;
+}
+
+/**
+ * ttpcomm_l4_csum_complete - Returns the (unfolded) sum of @pkt's transport
+ * header and payload, according to the CHECKSUM_COMPLETE value the device left
+ * in skb->csum.
+ *
+ * skb->csum covers everything from skb->data onwards, so the network headers
+ * only need to be subtracted. This is a lot cheaper than summing the entire
+ * payload again.
+ * If skb->data isn't the network header, this returns a value that will not
+ * validate, and the caller is expected to fall back to software.
+ */
+__wsum ttpcomm_l4_csum_complete(struct packet *pkt)
+{
+	struct sk_buff *skb = pkt->skb;
+
+	if (skb_network_offset(skb) != 0)
+		return 0;
+
+	return csum_sub(skb->csum, csum_partial(skb->data,
+			skb_transport_offset(skb), 0));
+}
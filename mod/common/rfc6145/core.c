@@ -2,12 +2,31 @@
 #include "nat64/mod/common/stats.h"
 #include "nat64/mod/common/rfc6145/core.h"
 #include "nat64/mod/common/rfc6145/common.h"
+#include "nat64/mod/common/rfc6145/4to6.h"
+#include "nat64/mod/common/rfc6145/6to4.h"
+
+#include <linux/version.h>
 
 static verdict translate_first(struct tuple *tuple, struct packet *in, struct packet *out)
 {
-	struct translation_steps *steps = ttpcomm_get_steps(pkt_l3_proto(in), pkt_l4_proto(in));
+	struct translation_steps *steps;
 	verdict result;
 
+	/*
+	 * Fast path: plain TCP and UDP skip the step table (and its indirect
+	 * calls) altogether.
+	 */
+	if (pkt_is_simple(in) && ttpcomm_can_xlat_in_place(tuple, in)) {
+		switch (pkt_l3_proto(in)) {
+		case L3PROTO_IPV6:
+			return ttp64_xlat_in_place(tuple, in, out);
+		case L3PROTO_IPV4:
+			return ttp46_xlat_in_place(tuple, in, out);
+		}
+	}
+
+	steps = ttpcomm_get_steps(pkt_l3_proto(in), pkt_l4_proto(in));
+
 	result = steps->skb_create_fn(in, out);
 	if (result != VERDICT_CONTINUE)
 		return result;
@@ -30,6 +49,7 @@ static verdict translate_subsequent(struct packet *pkt_in, struct sk_buff *in,
 {
 	struct sk_buff *result;
 	unsigned int hdrs_len = 0;
+	unsigned int copy_len;
 	__u16 proto = 0;
 	int error;
 
@@ -44,18 +64,35 @@ static verdict translate_subsequent(struct packet *pkt_in, struct sk_buff *in,
 		break;
 	}
 
-	result = alloc_skb(LL_MAX_HEADER + hdrs_len + in->len, GFP_ATOMIC);
+	/*
+	 * Subsequent fragments are pure payload, so there's no reason to copy
+	 * them; reference in's pages instead. Only the linear area that cannot
+	 * be shared (if any) is copied.
+	 * The headroom is reserved so the kernel can still push the fragment
+	 * headers later without reallocating.
+	 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 14, 0)
+	copy_len = skb_zerocopy_headlen(in);
+#else
+	copy_len = in->len;
+#endif
+
+	result = alloc_skb(LL_MAX_HEADER + hdrs_len + copy_len, GFP_ATOMIC);
 	if (!result) {
 		inc_stats(pkt_in, IPSTATS_MIB_INDISCARDS);
 		return VERDICT_DROP;
 	}
 
 	skb_reserve(result, LL_MAX_HEADER + hdrs_len);
-	skb_put(result, in->len);
 	result->mark = in->mark;
 	result->protocol = htons(proto);
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 14, 0)
+	error = skb_zerocopy(result, in, in->len, copy_len);
+#else
+	skb_put(result, in->len);
 	error = skb_copy_bits(in, 0, result->data, in->len);
+#endif
 	if (error) {
 		kfree_skb(result);
 		log_debug("The payload copy threw errcode %d.", error);
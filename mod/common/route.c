@@ -1,15 +1,276 @@
 #include "nat64/mod/common/route.h"
 
 #include <linux/icmp.h>
+#include <linux/jhash.h>
+#include <linux/netdevice.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+#include <net/ip6_fib.h>
 #include <net/ip6_route.h>
 #include <net/route.h>
 
-#include "nat64/mod/common/ipv6_hdr_iterator.h"
 #include "nat64/mod/common/namespace.h"
 #include "nat64/mod/common/packet.h"
 #include "nat64/mod/common/stats.h"
 #include "nat64/mod/common/types.h"
 
+/*
+ * A small per-CPU cache of recent routing decisions, so established flows
+ * don't have to query the routing table for every packet.
+ *
+ * Slots are keyed by destination, mark, traffic class and protocol only; the
+ * source and ports of a translated flow are too diverse to share slots, and
+ * too diverse to be worth one each. Source-specific IPv6 routes are therefore
+ * not cached, and (same as in __route4(), which never takes the source into
+ * account) anything else that routes by source or ports, such as policy rules
+ * or multipath hashing, sees the first flow that filled the slot.
+ *
+ * Each slot holds a reference to its dst. Entries are validated via
+ * dst_check() before use, so routing table changes invalidate them the same
+ * way they invalidate sockets' cached routes. The whole cache is also flushed
+ * whenever an interface goes down, so the references don't keep it from
+ * unregistering.
+ */
+#define DSTCACHE_BITS 6
+#define DSTCACHE_SIZE (1 << DSTCACHE_BITS)
+
+struct dstcache4 {
+	struct dst_entry *dst;
+	struct flowi4 flow;
+};
+
+struct dstcache6 {
+	struct dst_entry *dst;
+	/* The fib node serial number the dst was validated against. */
+	u32 cookie;
+	struct in6_addr daddr;
+	u32 mark;
+	u8 tos;
+	u8 proto;
+};
+
+struct dstcache {
+	/* Only ever contended by dstcache_flush(). */
+	spinlock_t lock;
+	struct dstcache4 v4[DSTCACHE_SIZE];
+	struct dstcache6 v6[DSTCACHE_SIZE];
+};
+
+static struct dstcache __percpu *cache;
+
+static void dstcache_flush(void)
+{
+	struct dstcache *local;
+	unsigned int cpu;
+	unsigned int i;
+
+	for_each_possible_cpu(cpu) {
+		local = per_cpu_ptr(cache, cpu);
+		spin_lock_bh(&local->lock);
+		for (i = 0; i < DSTCACHE_SIZE; i++) {
+			if (local->v4[i].dst) {
+				dst_release(local->v4[i].dst);
+				local->v4[i].dst = NULL;
+			}
+			if (local->v6[i].dst) {
+				dst_release(local->v6[i].dst);
+				local->v6[i].dst = NULL;
+			}
+		}
+		spin_unlock_bh(&local->lock);
+	}
+}
+
+static int handle_netdev_event(struct notifier_block *nb,
+		unsigned long event, void *ptr)
+{
+	/*
+	 * Whatever the device, routes that used to go through it are
+	 * useless now. Routes through other devices might survive, but this is
+	 * rare enough to not bother sorting them out.
+	 */
+	if (event == NETDEV_DOWN || event == NETDEV_UNREGISTER)
+		dstcache_flush();
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block netdev_notifier = {
+	.notifier_call = handle_netdev_event,
+};
+
+int route_init(void)
+{
+	unsigned int cpu;
+	int error;
+
+	cache = alloc_percpu(struct dstcache);
+	if (!cache)
+		return -ENOMEM;
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(cache, cpu)->lock);
+
+	error = register_netdevice_notifier(&netdev_notifier);
+	if (error)
+		free_percpu(cache);
+	return error;
+}
+
+void route_destroy(void)
+{
+	unregister_netdevice_notifier(&netdev_notifier);
+	dstcache_flush();
+	free_percpu(cache);
+}
+
+static u32 dst6_cookie(struct dst_entry *dst)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
+	return rt6_get_cookie((struct rt6_info *) dst);
+#else
+	struct rt6_info *rt = (struct rt6_info *) dst;
+	return rt->rt6i_node ? rt->rt6i_node->fn_sernum : 0;
+#endif
+}
+
+/**
+ * Returns a new reference to @entry_dst if it's still valid.
+ * Otherwise drops the cache's reference and returns NULL.
+ */
+static struct dst_entry *dstcache_check(struct dst_entry **entry_dst,
+		u32 cookie)
+{
+	struct dst_entry *dst = *entry_dst;
+
+	/* Dead (eg. its device is gone); dst_check() doesn't always see it. */
+	if (dst->obsolete > 0)
+		dst = NULL;
+	else
+		dst = dst_check(dst, cookie);
+
+	if (!dst) {
+		dst_release(*entry_dst);
+		*entry_dst = NULL;
+		return NULL;
+	}
+
+	dst_hold(dst);
+	return dst;
+}
+
+static void dstcache_set(struct dst_entry **entry_dst, struct dst_entry *dst)
+{
+	if (*entry_dst)
+		dst_release(*entry_dst);
+	dst_hold(dst);
+	*entry_dst = dst;
+}
+
+/* __route4() only fills these fields; everything else is zero. */
+static struct dstcache4 *dstcache_entry4(struct dstcache *local,
+		struct flowi4 *flow)
+{
+	u32 hash = jhash_3words((__force u32) flow->daddr,
+			flow->flowi4_mark,
+			(flow->flowi4_tos << 8) | flow->flowi4_proto,
+			0);
+	return &local->v4[hash & (DSTCACHE_SIZE - 1)];
+}
+
+static struct dst_entry *dstcache_get4(struct flowi4 *flow)
+{
+	struct dstcache *local;
+	struct dstcache4 *entry;
+	struct dst_entry *dst = NULL;
+
+	local_bh_disable();
+	local = this_cpu_ptr(cache);
+	spin_lock(&local->lock);
+	entry = dstcache_entry4(local, flow);
+	if (entry->dst && memcmp(&entry->flow, flow, sizeof(*flow)) == 0)
+		dst = dstcache_check(&entry->dst, 0);
+	spin_unlock(&local->lock);
+	local_bh_enable();
+
+	return dst;
+}
+
+static void dstcache_put4(struct flowi4 *flow, struct dst_entry *dst)
+{
+	struct dstcache *local;
+	struct dstcache4 *entry;
+
+	local_bh_disable();
+	local = this_cpu_ptr(cache);
+	spin_lock(&local->lock);
+	entry = dstcache_entry4(local, flow);
+	dstcache_set(&entry->dst, dst);
+	entry->flow = *flow;
+	spin_unlock(&local->lock);
+	local_bh_enable();
+}
+
+/* Only hashes the key (see the top of this file), not the whole @flow. */
+static struct dstcache6 *dstcache_entry6(struct dstcache *local,
+		struct flowi6 *flow)
+{
+	u32 hash = jhash2((const u32 *) &flow->daddr, 4, flow->flowi6_mark);
+	hash = jhash_1word((flow->flowi6_tos << 8) | flow->flowi6_proto, hash);
+	return &local->v6[hash & (DSTCACHE_SIZE - 1)];
+}
+
+static bool dstcache_match6(struct dstcache6 *entry, struct flowi6 *flow)
+{
+	return ipv6_addr_equal(&entry->daddr, &flow->daddr)
+			&& entry->mark == flow->flowi6_mark
+			&& entry->tos == flow->flowi6_tos
+			&& entry->proto == flow->flowi6_proto;
+}
+
+static struct dst_entry *dstcache_get6(struct flowi6 *flow)
+{
+	struct dstcache *local;
+	struct dstcache6 *entry;
+	struct dst_entry *dst = NULL;
+
+	local_bh_disable();
+	local = this_cpu_ptr(cache);
+	spin_lock(&local->lock);
+	entry = dstcache_entry6(local, flow);
+	if (entry->dst && dstcache_match6(entry, flow))
+		dst = dstcache_check(&entry->dst, entry->cookie);
+	spin_unlock(&local->lock);
+	local_bh_enable();
+
+	return dst;
+}
+
+static void dstcache_put6(struct flowi6 *flow, struct dst_entry *dst)
+{
+	struct dstcache *local;
+	struct dstcache6 *entry;
+
+#ifdef CONFIG_IPV6_SUBTREES
+	/* The key can't tell this route's flows from the others. */
+	if (((struct rt6_info *) dst)->rt6i_src.plen)
+		return;
+#endif
+
+	local_bh_disable();
+	local = this_cpu_ptr(cache);
+	spin_lock(&local->lock);
+	entry = dstcache_entry6(local, flow);
+	dstcache_set(&entry->dst, dst);
+	entry->cookie = dst6_cookie(dst);
+	entry->daddr = flow->daddr;
+	entry->mark = flow->flowi6_mark;
+	entry->tos = flow->flowi6_tos;
+	entry->proto = flow->flowi6_proto;
+	spin_unlock(&local->lock);
+	local_bh_enable();
+}
+
 /**
  * Callers of this function need to mind hairpinning. What happens if @daddr
  * belongs to the translator?
@@ -21,6 +282,7 @@ struct dst_entry *__route4(__be32 daddr, __u8 tos, __u8 proto, __u32 mark,
 		struct packet *pkt)
 {
 	struct flowi4 flow;
+	struct flowi4 key;
 	struct rtable *table;
 	struct dst_entry *dst;
 
@@ -68,6 +330,12 @@ struct dst_entry *__route4(__be32 daddr, __u8 tos, __u8 proto, __u32 mark,
 	 * aside from XFRM code.
 	 */
 
+	dst = dstcache_get4(&flow);
+	if (dst)
+		goto success;
+	/* The lookup writes on the flow, so keep a pristine copy for the cache. */
+	key = flow;
+
 	/*
 	 * I'm using neither ip_route_output_key() nor ip_route_output_flow()
 	 * because they only add XFRM overhead.
@@ -89,6 +357,9 @@ struct dst_entry *__route4(__be32 daddr, __u8 tos, __u8 proto, __u32 mark,
 		return NULL;
 	}
 
+	dstcache_put4(&key, dst);
+
+success:
 	log_debug("Packet routed via device '%s'.", dst->dev->name);
 
 	if (pkt) {
@@ -107,30 +378,33 @@ struct dst_entry *route4(struct packet *out)
 }
 
 /**
- * Unlike route4(), this function doesn't currently have any weird callers.
- * Therefore, @pkt is the outgoing IPv6 packet.
+ * @proto is the IPv6 header chain's last nexthdr, and @l4_hdr is the (@l4_proto)
+ * transport header.
+ *
+ * The @pkt can be NULL. If this happens, make sure the resulting dst is
+ * dst_release()d.
  */
-struct dst_entry *route6(struct packet *pkt)
+struct dst_entry *__route6(struct ipv6hdr *hdr_ip, __u8 proto,
+		l4_protocol l4_proto, void *l4_hdr, __u32 mark,
+		struct packet *pkt)
 {
-	struct ipv6hdr *hdr_ip = pkt_ip6_hdr(pkt);
 	struct flowi6 flow;
+	struct flowi6 key;
 	struct dst_entry *dst;
-	struct hdr_iterator iterator;
-
-	dst = skb_dst(pkt->skb);
-	if (dst)
-		return dst;
 
-	hdr_iterator_init(&iterator, hdr_ip);
-	hdr_iterator_last(&iterator);
+	if (pkt) {
+		dst = skb_dst(pkt->skb);
+		if (dst)
+			return dst;
+	}
 
 	memset(&flow, 0, sizeof(flow));
 	/* flow->flowi6_oif; */
 	/* flow->flowi6_iif; */
-	flow.flowi6_mark = pkt->skb->mark;
+	flow.flowi6_mark = mark;
 	flow.flowi6_tos = get_traffic_class(hdr_ip);
 	flow.flowi6_scope = RT_SCOPE_UNIVERSE;
-	flow.flowi6_proto = iterator.hdr_type;
+	flow.flowi6_proto = proto;
 	flow.flowi6_flags = 0;
 	/* flow->flowi6_secid; */
 	flow.saddr = hdr_ip->saddr;
@@ -143,19 +417,19 @@ struct dst_entry *route6(struct packet *pkt)
 			struct icmp6hdr *icmp6;
 		} hdr;
 
-		switch (pkt_l4_proto(pkt)) {
+		switch (l4_proto) {
 		case L4PROTO_TCP:
-			hdr.tcp = pkt_tcp_hdr(pkt);
+			hdr.tcp = l4_hdr;
 			flow.fl6_sport = hdr.tcp->source;
 			flow.fl6_dport = hdr.tcp->dest;
 			break;
 		case L4PROTO_UDP:
-			hdr.udp = pkt_udp_hdr(pkt);
+			hdr.udp = l4_hdr;
 			flow.fl6_sport = hdr.udp->source;
 			flow.fl6_dport = hdr.udp->dest;
 			break;
 		case L4PROTO_ICMP:
-			hdr.icmp6 = pkt_icmp6_hdr(pkt);
+			hdr.icmp6 = l4_hdr;
 			flow.fl6_icmp_type = hdr.icmp6->icmp6_type;
 			flow.fl6_icmp_code = hdr.icmp6->icmp6_code;
 			break;
@@ -164,6 +438,11 @@ struct dst_entry *route6(struct packet *pkt)
 		}
 	}
 
+	dst = dstcache_get6(&flow);
+	if (dst)
+		goto success;
+	key = flow;
+
 	dst = ip6_route_output(joolns_get(), NULL, &flow);
 	if (!dst) {
 		log_debug("ip6_route_output() returned NULL. Cannot route packet.");
@@ -175,11 +454,37 @@ struct dst_entry *route6(struct packet *pkt)
 		return NULL;
 	}
 
+	dstcache_put6(&key, dst);
+
+success:
 	log_debug("Packet routed via device '%s'.", dst->dev->name);
-	skb_dst_set(pkt->skb, dst);
+	if (pkt)
+		skb_dst_set(pkt->skb, dst);
 	return dst;
 }
 
+/**
+ * Unlike route4(), this function doesn't currently have any weird callers.
+ * Therefore, @pkt is the outgoing IPv6 packet.
+ *
+ * Jool's IPv6 packets never carry extension headers other than the fragment
+ * header, so there's no need to walk the header chain.
+ */
+struct dst_entry *route6(struct packet *pkt)
+{
+	struct ipv6hdr *hdr_ip = pkt_ip6_hdr(pkt);
+	struct frag_hdr *hdr_frag = pkt_frag_hdr(pkt);
+	struct dst_entry *dst;
+
+	dst = skb_dst(pkt->skb);
+	if (dst)
+		return dst;
+
+	return __route6(hdr_ip, hdr_frag ? hdr_frag->nexthdr : hdr_ip->nexthdr,
+			pkt_l4_proto(pkt), skb_transport_header(pkt->skb),
+			pkt->skb->mark, pkt);
+}
+
 struct dst_entry *route(struct packet *pkt)
 {
 	switch (pkt_l3_proto(pkt)) {
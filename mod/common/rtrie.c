@@ -16,13 +16,14 @@ static __u8 bits_to_bytes(__u8 bits)
 
 static struct rtrie_node *create_inode(struct rtrie_key *key,
 		struct rtrie_node *left_child,
-		struct rtrie_node *right_child)
+		struct rtrie_node *right_child,
+		gfp_t gfp)
 {
 	struct rtrie_node *inode;
 	__u8 value_bytes;
 
 	value_bytes = bits_to_bytes(key->len);
-	inode = kmalloc(sizeof(*inode) + value_bytes, GFP_ATOMIC);
+	inode = kmalloc(sizeof(*inode) + value_bytes, gfp);
 	if (!inode)
 		return NULL;
 
@@ -39,11 +40,11 @@ static struct rtrie_node *create_inode(struct rtrie_key *key,
 }
 
 static struct rtrie_node *create_leaf(void *content, size_t content_len,
-		size_t key_offset, __u8 key_len)
+		size_t key_offset, __u8 key_len, gfp_t gfp)
 {
 	struct rtrie_node *leaf;
 
-	leaf = kmalloc(sizeof(*leaf) + content_len, GFP_ATOMIC);
+	leaf = kmalloc(sizeof(*leaf) + content_len, gfp);
 	if (!leaf)
 		return NULL;
 
@@ -125,9 +126,31 @@ static bool key_equals(struct rtrie_key *key1, struct rtrie_key *key2)
 			: false;
 }
 
+static unsigned int free_nodes(struct list_head *list)
+{
+	struct rtrie_node *node;
+	struct rtrie_node *tmp_node;
+	unsigned int i = 0;
+
+	list_for_each_entry_safe(node, tmp_node, list, list_hook) {
+		list_del(&node->list_hook);
+		kfree(node);
+		i++;
+	}
+
+	return i;
+}
+
+/**
+ * rtrie_destroy - Frees @trie's nodes right away.
+ *
+ * Assumes nobody can reach @trie anymore, not even RCU readers. If they can,
+ * use rtrie_flush() instead.
+ */
 void rtrie_destroy(struct rtrie *trie)
 {
-	rtrie_flush(trie);
+	RCU_INIT_POINTER(trie->root, NULL);
+	free_nodes(&trie->list);
 }
 
 /**
@@ -207,7 +230,7 @@ static void swap_nodes(struct rtrie *trie, struct rtrie_node *old,
 	kfree(old);
 }
 
-static int add_to_root(struct rtrie *trie, struct rtrie_node *new)
+static int add_to_root(struct rtrie *trie, struct rtrie_node *new, gfp_t gfp)
 {
 	struct rtrie_node *root = deref_updater(trie, trie->root);
 	struct rtrie_node *inode;
@@ -230,7 +253,7 @@ static int add_to_root(struct rtrie *trie, struct rtrie_node *new)
 	key.bytes = new->key.bytes;
 	key.len = key_match(&root->key, &new->key);
 
-	inode = create_inode(&key, root, new);
+	inode = create_inode(&key, root, new, gfp);
 	if (!inode)
 		return -ENOMEM;
 
@@ -244,7 +267,7 @@ static int add_to_root(struct rtrie *trie, struct rtrie_node *new)
 }
 
 static int add_full_collision(struct rtrie *trie, struct rtrie_node *parent,
-		struct rtrie_node *new)
+		struct rtrie_node *new, bool offline)
 {
 	/*
 	 * We're adding new to
@@ -305,13 +328,15 @@ static int add_full_collision(struct rtrie *trie, struct rtrie_node *parent,
 	}
 	inode_prefix.bytes = higher_prefix1->key.bytes;
 
-	inode = create_inode(&inode_prefix, higher_prefix1, higher_prefix2);
+	inode = create_inode(&inode_prefix, higher_prefix1, higher_prefix2,
+			offline ? GFP_KERNEL : GFP_ATOMIC);
 	if (!inode)
 		return -ENOMEM;
 
 	rcu_assign_pointer(parent->left, NULL);
 	rcu_assign_pointer(parent->right, NULL);
-	synchronize_rcu_bh();
+	if (!offline)
+		synchronize_rcu_bh();
 	rcu_assign_pointer(parent->left, smallest_prefix);
 	rcu_assign_pointer(parent->right, inode);
 
@@ -325,22 +350,27 @@ static int add_full_collision(struct rtrie *trie, struct rtrie_node *parent,
 	return 0;
 }
 
+/**
+ * @offline: true if no readers can see @trie, so the grace periods can be
+ *	skipped (and the allocations are allowed to sleep).
+ */
 static int __rtrie_add(struct rtrie *trie, void *value, size_t key_offset,
-		__u8 key_len)
+		__u8 key_len, bool offline)
 {
 	struct rtrie_node *new;
 	struct rtrie_node *parent;
 	struct rtrie_node *left, *right;
 	bool contains_left;
 	bool contains_right;
+	gfp_t gfp = offline ? GFP_KERNEL : GFP_ATOMIC;
 
-	new = create_leaf(value, trie->value_size, key_offset, key_len);
+	new = create_leaf(value, trie->value_size, key_offset, key_len, gfp);
 	if (!new)
 		return -ENOMEM;
 
 	parent = find_longest_common_prefix(trie, &new->key, false);
 	if (!parent)
-		return add_to_root(trie, new);
+		return add_to_root(trie, new, gfp);
 
 	if (key_equals(&parent->key, &new->key)) {
 		if (parent->color == COLOR_BLACK) {
@@ -375,7 +405,8 @@ static int __rtrie_add(struct rtrie *trie, void *value, size_t key_offset,
 		RCU_INIT_POINTER(new->right, right);
 		rcu_assign_pointer(parent->left, NULL);
 		rcu_assign_pointer(parent->right, NULL);
-		synchronize_rcu_bh();
+		if (!offline)
+			synchronize_rcu_bh();
 		rcu_assign_pointer(parent->right, new);
 
 		left->parent = new;
@@ -399,7 +430,7 @@ static int __rtrie_add(struct rtrie *trie, void *value, size_t key_offset,
 		goto simple_success;
 	}
 
-	return add_full_collision(trie, parent, new);
+	return add_full_collision(trie, parent, new, offline);
 
 simple_success:
 	new->parent = parent;
@@ -412,12 +443,57 @@ int rtrie_add(struct rtrie *trie, void *value, size_t key_offset, __u8 key_len)
 	int error;
 
 	mutex_lock(&trie->lock);
-	error = __rtrie_add(trie, value, key_offset, key_len);
+	error = __rtrie_add(trie, value, key_offset, key_len, false);
 	mutex_unlock(&trie->lock);
 
 	return error;
 }
 
+/**
+ * rtrie_add_offline - Same as rtrie_add(), except @trie must not be visible to
+ * anyone yet. Considerably faster, since it doesn't wait for grace periods.
+ *
+ * Can sleep.
+ */
+int rtrie_add_offline(struct rtrie *trie, void *value, size_t key_offset,
+		__u8 key_len)
+{
+	int error;
+
+	mutex_lock(&trie->lock);
+	error = __rtrie_add(trie, value, key_offset, key_len, true);
+	mutex_unlock(&trie->lock);
+
+	return error;
+}
+
+/**
+ * rtrie_replace - Atomically makes @trie hold @new's nodes, and @new hold
+ * @trie's old nodes.
+ *
+ * Readers might still be traversing the old nodes, so wait for a grace period
+ * before you rtrie_destroy() @new.
+ */
+void rtrie_replace(struct rtrie *trie, struct rtrie *new)
+{
+	struct rtrie_node *old_root;
+	LIST_HEAD(tmp_list);
+
+	mutex_lock(&trie->lock);
+	mutex_lock_nested(&new->lock, SINGLE_DEPTH_NESTING);
+
+	old_root = deref_updater(trie, trie->root);
+	rcu_assign_pointer(trie->root, deref_updater(new, new->root));
+	RCU_INIT_POINTER(new->root, old_root);
+
+	list_splice_init(&trie->list, &tmp_list);
+	list_splice_init(&new->list, &trie->list);
+	list_splice_init(&tmp_list, &new->list);
+
+	mutex_unlock(&new->lock);
+	mutex_unlock(&trie->lock);
+}
+
 /**
  * rtrie_get - Finds the node keyed @key, and copies its value to @result.
  */
@@ -474,7 +550,8 @@ static int __rtrie_rm(struct rtrie *trie, struct rtrie_key *key)
 	if (node->left && node->right) {
 		new = create_inode(&node->key,
 				deref_updater(trie, node->left),
-				deref_updater(trie, node->right));
+				deref_updater(trie, node->right),
+				GFP_ATOMIC);
 		if (!new)
 			return -ENOMEM;
 
@@ -543,8 +620,6 @@ int rtrie_rm(struct rtrie *trie, struct rtrie_key *key)
 
 void rtrie_flush(struct rtrie *trie)
 {
-	struct rtrie_node *node;
-	struct rtrie_node *tmp_node;
 	struct list_head tmp_list;
 	unsigned int i = 0;
 
@@ -562,12 +637,7 @@ void rtrie_flush(struct rtrie *trie)
 	mutex_unlock(&trie->lock);
 
 	synchronize_rcu_bh();
-
-	list_for_each_entry_safe(node, tmp_node, &tmp_list, list_hook) {
-		list_del(&node->list_hook);
-		kfree(node);
-		i++;
-	}
+	i = free_nodes(&tmp_list);
 
 end:
 	log_debug("Deleted %u nodes.", i);
@@ -1,12 +1,14 @@
 #include "nat64/mod/common/send_packet.h"
 
 #include <linux/version.h>
+#include <net/ipv6.h>
 
 #include "nat64/mod/common/icmp_wrapper.h"
 #include "nat64/mod/common/packet.h"
 #include "nat64/mod/common/route.h"
 #include "nat64/mod/common/log_time.h"
 #include "nat64/mod/common/namespace.h"
+#include "nat64/mod/common/stats.h"
 
 static unsigned int get_nexthop_mtu(struct packet *pkt)
 {
@@ -25,7 +27,7 @@ static int whine_if_too_big(struct packet *in, struct packet *out)
 	if (pkt_l3_proto(in) == L3PROTO_IPV4 && !is_dont_fragment_set(pkt_ip4_hdr(in)))
 		return 0;
 
-	len = pkt_len(out);
+	len = pkt_seg_len(out);
 	mtu = get_nexthop_mtu(out);
 	if (len > mtu) {
 		/*
@@ -50,8 +52,246 @@ static int whine_if_too_big(struct packet *in, struct packet *out)
 	return 0;
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0)
+# define JOOL_SKB_IGNORE_DF
+#else
+# ifdef RHEL_RELEASE_CODE
+#  if RHEL_RELEASE_CODE >= RHEL_RELEASE_VERSION(7, 2)
+#   define JOOL_SKB_IGNORE_DF
+#  endif
+# endif
+#endif
+
+#ifdef UNIT_TESTING
+/** The packets output() would have handed over to the kernel. */
+static struct sk_buff_head sent_skbs;
+#endif
+
+/**
+ * Hands @skb over to the kernel. Frees it, even on failure.
+ */
+static int output(struct sk_buff *skb)
+{
+#ifdef JOOL_SKB_IGNORE_DF
+	skb->ignore_df = true; /* FFS, kernel. */
+#else
+	skb->local_df = true; /* FFS, kernel. */
+#endif
+
+#ifdef UNIT_TESTING
+	skb_queue_tail(&sent_skbs, skb);
+	return 0;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 4, 0)
+	return dst_output(joolns_get(), NULL, skb);
+#else
+	return dst_output(skb);
+#endif
+}
+
+/**
+ * Appends @len bytes of @from's data (starting at @offset) to @to.
+ *
+ * Paged data is not copied; @to just takes references to @from's pages.
+ * Linear data has to be copied, but it always precedes the pages, so it lands
+ * in @to's linear area (which has to have enough tailroom).
+ * @from cannot have a frag_list.
+ */
+static int append_data(struct sk_buff *to, struct sk_buff *from,
+		unsigned int offset, unsigned int len)
+{
+	unsigned int headlen = skb_headlen(from);
+	unsigned int start;
+	unsigned int end;
+	unsigned int size;
+	skb_frag_t *frag;
+	int i;
+
+	if (offset < headlen) {
+		size = min(len, headlen - offset);
+		memcpy(skb_put(to, size), from->data + offset, size);
+		offset += size;
+		len -= size;
+	}
+
+	start = headlen;
+	for (i = 0; len > 0 && i < skb_shinfo(from)->nr_frags; i++) {
+		frag = &skb_shinfo(from)->frags[i];
+		end = start + skb_frag_size(frag);
+		if (offset < end) {
+			size = min(len, end - offset);
+			__skb_frag_ref(frag);
+			skb_fill_page_desc(to, skb_shinfo(to)->nr_frags,
+					skb_frag_page(frag),
+					frag->page_offset + offset - start,
+					size);
+			to->len += size;
+			to->data_len += size;
+			to->truesize += size;
+			offset += size;
+			len -= size;
+		}
+		start = end;
+	}
+
+	return len ? -EINVAL : 0;
+}
+
+/**
+ * Builds the fragment of @out that carries its fragmentable part's bytes
+ * @offset through @offset + @len.
+ */
+static struct sk_buff *create_fragment(struct packet *out,
+		unsigned int data_start, unsigned int offset, unsigned int len,
+		__u16 base_offset, bool more)
+{
+	struct sk_buff *skb = out->skb;
+	struct sk_buff *frag;
+	struct ipv6hdr *hdr6;
+	struct frag_hdr *hdr_frag;
+	unsigned int hdrs_len = sizeof(*hdr6) + sizeof(*hdr_frag);
+	unsigned int linear;
+	int error;
+
+	/* Whatever falls in the linear area gets copied; the rest is shared. */
+	if (skb_has_frag_list(skb))
+		linear = len;
+	else if (data_start + offset < skb_headlen(skb))
+		linear = min(len, skb_headlen(skb) - data_start - offset);
+	else
+		linear = 0;
+
+	frag = alloc_skb(LL_MAX_HEADER + hdrs_len + linear, GFP_ATOMIC);
+	if (!frag)
+		return NULL;
+
+	skb_reserve(frag, LL_MAX_HEADER);
+	skb_reset_network_header(frag);
+	skb_put(frag, hdrs_len);
+
+	hdr6 = ipv6_hdr(frag);
+	memcpy(hdr6, ipv6_hdr(skb), sizeof(*hdr6));
+	hdr6->payload_len = cpu_to_be16(sizeof(*hdr_frag) + len);
+	hdr6->nexthdr = NEXTHDR_FRAGMENT;
+
+	hdr_frag = (struct frag_hdr *) (hdr6 + 1);
+	hdr_frag->nexthdr = out->hdr_frag
+			? out->hdr_frag->nexthdr
+			: ipv6_hdr(skb)->nexthdr;
+	hdr_frag->reserved = 0;
+	hdr_frag->frag_off = build_ipv6_frag_off_field(base_offset + offset,
+			more);
+	hdr_frag->identification = out->hdr_frag
+			? out->hdr_frag->identification
+			: out->frag_id;
+	skb_set_transport_header(frag, hdrs_len);
+
+	if (skb_has_frag_list(skb)) {
+		error = skb_copy_bits(skb, data_start + offset,
+				skb_put(frag, len), len);
+	} else {
+		error = append_data(frag, skb, data_start + offset, len);
+	}
+	if (error) {
+		kfree_skb(frag);
+		return NULL;
+	}
+
+	frag->protocol = htons(ETH_P_IPV6);
+	frag->mark = skb->mark;
+	frag->priority = skb->priority;
+	frag->dev = skb->dev;
+	skb_dst_set(frag, dst_clone(skb_dst(skb)));
+
+	return frag;
+}
+
+/**
+ * Splits @out into IPv6 fragments that fit @mtu and sends them, sparing the
+ * kernel from having to fragment (and copy) the packet again after
+ * dst_output(), and sparing the sender from a Packet Too Big round trip.
+ * If @out already has a fragment header (because the IPv4 packet was a
+ * fragment), the new fragments extend it rather than nest another one.
+ *
+ * Frees @out's skb.
+ */
+static verdict fragment6(struct packet *out, unsigned int mtu)
+{
+	struct sk_buff *skb = out->skb;
+	struct sk_buff *frag;
+	unsigned int data_start;
+	unsigned int data_len;
+	unsigned int max_len;
+	unsigned int offset;
+	unsigned int len;
+	__u16 base_offset = 0;
+	bool last_mf = false;
+	int error;
+
+	data_start = sizeof(struct ipv6hdr);
+	if (out->hdr_frag) {
+		data_start += sizeof(struct frag_hdr);
+		base_offset = get_fragment_offset_ipv6(out->hdr_frag);
+		last_mf = is_more_fragments_set_ipv6(out->hdr_frag);
+	}
+	data_len = skb->len - data_start;
+	max_len = (mtu - sizeof(struct ipv6hdr) - sizeof(struct frag_hdr)) & ~7U;
+
+	log_debug("Fragmenting (len: %u, mtu: %u).", skb->len, mtu);
+
+	/* The fragments can't be checksummed by the NIC. */
+	if (skb->ip_summed == CHECKSUM_PARTIAL && skb_checksum_help(skb))
+		goto fail;
+
+	for (offset = 0; offset < data_len; offset += len) {
+		len = min(max_len, data_len - offset);
+		frag = create_fragment(out, data_start, offset, len,
+				base_offset,
+				(offset + len < data_len) || last_mf);
+		if (!frag)
+			goto fail;
+
+		error = output(frag);
+		if (error) {
+			log_debug("dst_output() returned errcode %d.", error);
+			goto fail;
+		}
+		inc_stats(out, IPSTATS_MIB_FRAGCREATES);
+	}
+
+	inc_stats(out, IPSTATS_MIB_FRAGOKS);
+	kfree_skb(skb);
+	return VERDICT_CONTINUE;
+
+fail:
+	inc_stats(out, IPSTATS_MIB_FRAGFAILS);
+	kfree_skb(skb);
+	return VERDICT_DROP;
+}
+
+/**
+ * Should Jool fragment @out itself?
+ * Not if it fits, nor if the kernel can already fragment it without copying (a
+ * frag_list of pieces that each fit, most likely an IPv4 packet the kernel
+ * reassembled).
+ *
+ * GSO packets are left to the kernel even if they exceed @mtu: it segments
+ * them after dst_output(), and sizing (and, if need be, fragmenting) those
+ * segments is its job, not ours.
+ */
+static bool must_fragment(struct packet *out, unsigned int mtu)
+{
+	struct sk_buff *skb = out->skb;
+
+	if (!out->fragmentable || skb->len <= mtu || skb_is_gso(skb))
+		return false;
+	if (mtu < IPV6_MIN_MTU)
+		return false;
+	return !skb_has_frag_list(skb) || out->hdr_frag;
+}
+
 verdict sendpkt_send(struct packet *in, struct packet *out)
 {
+	unsigned int mtu;
 	int error;
 
 #ifdef BENCHMARK
@@ -66,34 +306,24 @@ verdict sendpkt_send(struct packet *in, struct packet *out)
 	out->skb->dev = skb_dst(out->skb)->dev;
 	log_debug("Sending skb.");
 
-	error = whine_if_too_big(in, out);
-	if (error) {
-		kfree_skb(out->skb);
-		return VERDICT_DROP;
+	/*
+	 * In-place translations have to do this before they override "in".
+	 * See ttpcomm_in_place_too_big().
+	 */
+	if (out->skb != in->skb) {
+		error = whine_if_too_big(in, out);
+		if (error) {
+			kfree_skb(out->skb);
+			return VERDICT_DROP;
+		}
 	}
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0)
-# define JOOL_SKB_IGNORE_DF
-#else
-# ifdef RHEL_RELEASE_CODE
-#  if RHEL_RELEASE_CODE >= RHEL_RELEASE_VERSION(7, 2)
-#   define JOOL_SKB_IGNORE_DF
-#  endif
-# endif
-#endif
-
-#ifdef JOOL_SKB_IGNORE_DF
-	out->skb->ignore_df = true; /* FFS, kernel. */
-#else
-	out->skb->local_df = true; /* FFS, kernel. */
-#endif
+	mtu = get_nexthop_mtu(out);
+	if (must_fragment(out, mtu))
+		return fragment6(out, mtu);
 
 	/* Implicit kfree_skb(out->skb) goes here. */
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 4, 0)
-	error = dst_output(joolns_get(), NULL, out->skb);
-#else
-	error = dst_output(out->skb);
-#endif
+	error = output(out->skb);
 	if (error) {
 		log_debug("dst_output() returned errcode %d.", error);
 		return VERDICT_DROP;
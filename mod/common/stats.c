@@ -1,6 +1,7 @@
 #include "nat64/mod/common/stats.h"
 #include <linux/skbuff.h>
 #include <linux/netdevice.h>
+#include <net/icmp.h>
 #include <net/ip.h>
 #include <net/ipv6.h>
 #include <net/addrconf.h>
@@ -25,32 +26,32 @@ static int validate_pkt(struct packet *pkt)
 	return likely(pkt) ? validate_skb(pkt->skb) : -EINVAL;
 }
 
-static void inc_stats6(struct sk_buff *skb, int field)
+static void inc_stats6(struct net_device *dev, int field)
 {
-	struct inet6_dev *idev = in6_dev_get(skb->dev);
+	struct inet6_dev *idev = in6_dev_get(dev);
 	if (!idev)
 		return;
 
-	IP6_INC_STATS_BH(dev_net(skb->dev), idev, field);
+	IP6_INC_STATS_BH(dev_net(dev), idev, field);
 
 	in6_dev_put(idev);
 }
 
-static void inc_stats4(struct sk_buff *skb, int field)
+static void inc_stats4(struct net_device *dev, int field)
 {
-	IP_INC_STATS_BH(dev_net(skb->dev), field);
+	IP_INC_STATS_BH(dev_net(dev), field);
 }
 
 void inc_stats_skb6(struct sk_buff *skb, int field)
 {
 	if (!is_error(validate_skb(skb)))
-		inc_stats6(skb, field);
+		inc_stats6(skb->dev, field);
 }
 
 void inc_stats_skb4(struct sk_buff *skb, int field)
 {
 	if (!is_error(validate_skb(skb)))
-		inc_stats4(skb, field);
+		inc_stats4(skb->dev, field);
 }
 
 static void inc_stats_pkt6(struct packet *pkt, int field)
@@ -62,7 +63,7 @@ static void inc_stats_pkt6(struct packet *pkt, int field)
 			return;
 	}
 
-	inc_stats6(pkt->skb, field);
+	inc_stats6(pkt->skb->dev, field);
 }
 
 static void inc_stats_pkt4(struct packet *pkt, int field)
@@ -73,7 +74,7 @@ static void inc_stats_pkt4(struct packet *pkt, int field)
 			return;
 	}
 
-	inc_stats4(pkt->skb, field);
+	inc_stats4(pkt->skb->dev, field);
 }
 
 void inc_stats(struct packet *pkt, int field)
@@ -90,3 +91,39 @@ void inc_stats(struct packet *pkt, int field)
 		break;
 	}
 }
+
+void inc_stats_dev(struct net_device *dev, l3_protocol l3_proto, int field)
+{
+	if (unlikely(!dev || !dev_net(dev)))
+		return;
+
+	switch (l3_proto) {
+	case L3PROTO_IPV6:
+		inc_stats6(dev, field);
+		break;
+	case L3PROTO_IPV4:
+		inc_stats4(dev, field);
+		break;
+	}
+}
+
+void inc_stats_icmp_outerrors(struct sk_buff *skb)
+{
+	struct inet6_dev *idev;
+
+	if (is_error(validate_skb(skb)))
+		return;
+
+	switch (ntohs(skb->protocol)) {
+	case ETH_P_IPV6:
+		idev = in6_dev_get(skb->dev);
+		if (!idev)
+			return;
+		ICMP6_INC_STATS_BH(dev_net(skb->dev), idev, ICMP6_MIB_OUTERRORS);
+		in6_dev_put(idev);
+		break;
+	case ETH_P_IP:
+		ICMP_INC_STATS_BH(dev_net(skb->dev), ICMP_MIB_OUTERRORS);
+		break;
+	}
+}
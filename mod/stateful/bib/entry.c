@@ -109,7 +109,7 @@ void bibentry_log(const struct bib_entry *bib, const char *action)
 	struct timeval tval;
 	struct tm t;
 
-	if (!config_get_bib_logging())
+	if (!config_switch_on(bib_logging_switch) || !config_get_bib_logging())
 		return;
 
 	do_gettimeofday(&tval);
@@ -53,14 +53,12 @@ void palloc_destroy(void)
 	kfree(secret_key);
 }
 
-void build_scatterlist(const struct tuple *tuple6, struct scatterlist *sg,
-		unsigned int *sg_len)
+void build_scatterlist(const struct tuple *tuple6, unsigned int f_args,
+		struct scatterlist *sg, unsigned int *sg_len)
 {
-	unsigned int f_args;
 	unsigned int sg_index;
 	unsigned int field_len;
 
-	f_args = config_get_f_args();
 	*sg_len = 0;
 	sg_index = 0;
 
@@ -93,7 +91,8 @@ void build_scatterlist(const struct tuple *tuple6, struct scatterlist *sg,
 	*sg_len += secret_key_len;
 }
 
-static int f(const struct tuple *tuple6, unsigned int *result)
+static int f(const struct tuple *tuple6, unsigned int f_args,
+		unsigned int *result)
 {
 	/*
 	 * See http://stackoverflow.com/questions/3869028.
@@ -110,7 +109,7 @@ static int f(const struct tuple *tuple6, unsigned int *result)
 	int error;
 
 	sg_init_table(sg, ARRAY_SIZE(sg));
-	build_scatterlist(tuple6, sg, &sg_len);
+	build_scatterlist(tuple6, f_args, sg, &sg_len);
 
 	desc.tfm = tfm;
 	desc.flags = 0;
@@ -165,7 +164,7 @@ int palloc_allocate(struct packet *in_pkt, const struct tuple *tuple6,
 	unsigned int offset;
 	int error;
 
-	error = f(tuple6, &offset);
+	error = f(tuple6, in_pkt->cfg->nat64.f_args, &offset);
 	if (error)
 		return error;
 
@@ -317,7 +317,7 @@ static int get_bib4(struct packet *pkt, struct tuple *tuple4,
 		return error;
 	}
 
-	if (config_get_addr_dependent_filtering() && !sessiondb_allow(tuple4)) {
+	if (config_drop_by_addr(pkt->cfg) && !sessiondb_allow(tuple4)) {
 		log_debug("Packet was blocked by address-dependent filtering.");
 		icmp64_send(pkt, ICMPERR_FILTER, 0);
 		inc_stats(pkt, IPSTATS_MIB_INDISCARDS);
@@ -413,7 +413,7 @@ static verdict tcp_closed_v4_syn(struct packet *pkt, struct tuple *tuple4)
 	int error;
 	verdict result = VERDICT_DROP;
 
-	if (config_get_drop_external_connections()) {
+	if (config_drop_external_tcp(pkt->cfg)) {
 		log_debug("Applying policy: Dropping externally initiated TCP "
 				"connections.");
 		return VERDICT_DROP;
@@ -434,7 +434,7 @@ static verdict tcp_closed_v4_syn(struct packet *pkt, struct tuple *tuple4)
 
 	session->state = V4_INIT;
 
-	if (!bib || config_get_addr_dependent_filtering()) {
+	if (!bib || config_drop_by_addr(pkt->cfg)) {
 		error = pktqueue_add(session, pkt);
 		if (error)
 			goto end_session;
@@ -586,7 +586,7 @@ static enum session_fate tcp_v4_fin_rcv_state(struct session_entry *session,
 			session->state = V4_FIN_V6_FIN_RCV;
 			return FATE_TIMER_TRANS;
 		}
-		if (config_handle_rst_during_fin_rcv() && hdr->rst) {
+		if (pkt->cfg->nat64.handle_rst_during_fin_rcv && hdr->rst) {
 			/* https://github.com/NICMx/Jool/issues/212 */
 			return FATE_TIMER_TRANS;
 		}
@@ -610,7 +610,7 @@ static enum session_fate tcp_v6_fin_rcv_state(struct session_entry *session,
 			session->state = V4_FIN_V6_FIN_RCV;
 			return FATE_TIMER_TRANS;
 		}
-		if (config_handle_rst_during_fin_rcv() && hdr->rst) {
+		if (pkt->cfg->nat64.handle_rst_during_fin_rcv && hdr->rst) {
 			/* https://github.com/NICMx/Jool/issues/212 */
 			return FATE_TIMER_TRANS;
 		}
@@ -699,6 +699,19 @@ static verdict tcp(struct packet *pkt, struct tuple *tuple)
 	return VERDICT_CONTINUE;
 }
 
+/**
+ * filtering_and_updating_hairpin - IPv4 half of filtering_and_updating(), for
+ * hairpinned UDP packets that skip the intermediate IPv4 packet (see
+ * hairpin_shortcut()).
+ * @in is the original IPv6 packet, so that's where any ICMP errors go.
+ * Assumes @tuple4 has already been found to belong to pool4.
+ */
+verdict filtering_and_updating_hairpin(struct packet *in, struct tuple *tuple4)
+{
+	log_debug("Step 2 (hairpin): Filtering and Updating");
+	return ipv4_simple(in, tuple4);
+}
+
 /**
  * filtering_and_updating - Main F&U routine. Decides if "skb" should be
  * processed, updating binding and session information.
@@ -765,7 +778,7 @@ verdict filtering_and_updating(struct packet *pkt, struct tuple *in_tuple)
 	case L4PROTO_ICMP:
 		switch (pkt_l3_proto(pkt)) {
 		case L3PROTO_IPV6:
-			if (config_get_filter_icmpv6_info()) {
+			if (config_drop_icmp6_info(pkt->cfg)) {
 				log_debug("Packet is ICMPv6 info (ping); "
 						"dropping due to policy.");
 				inc_stats(pkt, IPSTATS_MIB_INDISCARDS);
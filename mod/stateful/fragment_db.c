@@ -160,6 +160,8 @@ static struct reassembly_buffer *add_pkt(struct packet *pkt)
 
 	buffer->pkt = *pkt;
 	buffer->pkt.original_pkt = &buffer->pkt;
+	/* The snapshot dies along with this fragment's translation attempt. */
+	buffer->pkt.cfg = NULL;
 	buffer->next_slot = &skb_shinfo(pkt->skb)->frag_list;
 	buffer->dying_time = jiffies + config_get_ttl_frag();
 
@@ -322,6 +324,7 @@ verdict fragdb_handle(struct packet *pkt)
 	/* The fragment collector skb belongs to. */
 	struct reassembly_buffer *buffer;
 	struct frag_hdr *hdr_frag = pkt_frag_hdr(pkt);
+	struct global_config *cfg;
 	int error;
 
 	if (!is_fragmented_ipv6(hdr_frag))
@@ -364,8 +367,10 @@ verdict fragdb_handle(struct packet *pkt)
 		return VERDICT_STOLEN;
 	}
 
+	cfg = pkt->cfg;
 	*pkt = buffer->pkt;
 	pkt->original_pkt = pkt;
+	pkt->cfg = cfg;
 	buffer->pkt.skb = NULL;
 	/* Note, at this point, buffer->pkt is invalid. Do not use. */
 	buffer_destroy(buffer, pkt);
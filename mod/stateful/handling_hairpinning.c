@@ -1,6 +1,12 @@
 #include "nat64/mod/common/handling_hairpinning.h"
 
+#include <net/ip6_checksum.h>
+#include "nat64/mod/common/icmp_wrapper.h"
+#include "nat64/mod/common/route.h"
+#include "nat64/mod/common/stats.h"
+#include "nat64/mod/common/rfc6145/common.h"
 #include "nat64/mod/common/rfc6145/core.h"
+#include "nat64/mod/common/rfc6145/6to4.h"
 #include "nat64/mod/common/send_packet.h"
 #include "nat64/mod/stateful/compute_outgoing_tuple.h"
 #include "nat64/mod/stateful/filtering_and_updating.h"
@@ -62,3 +68,169 @@ verdict handling_hairpinning(struct packet *in, struct tuple *tuple_in)
 	log_debug("Done step 5.");
 	return VERDICT_CONTINUE;
 }
+
+/**
+ * Can @in (an IPv6 packet whose translation is about to be hairpinned) skip
+ * the intermediate IPv4 packet?
+ *
+ * Only simple UDP qualifies. The TCP state machine and the simultaneous open
+ * queue need to see an actual IPv4 packet on the second leg, and nothing else
+ * is common enough to deserve its own code.
+ */
+static bool can_shortcut(struct packet *in)
+{
+	struct sk_buff *skb = in->skb;
+
+	if (pkt_l4_proto(in) != L4PROTO_UDP || !pkt_is_simple(in))
+		return false;
+	if (pkt_original_pkt(in) != in || skb_network_offset(skb) != 0)
+		return false;
+	if (skb_is_gso(skb) || skb_has_frag_list(skb))
+		return false;
+	/* The IPv4 leg might have needed a fragment header on the way back. */
+	if (in->cfg->atomic_frags.build_ipv6_fh)
+		return false;
+	/* Leave the Time Exceeded errors to the regular path. */
+	return pkt_ip6_hdr(in)->hop_limit > 2;
+}
+
+/**
+ * Builds in @hdr6 the IPv6 header the packet would have after being
+ * translated to IPv4 and back.
+ */
+static void shortcut_ipv6(struct tuple *tuple6, struct packet *in,
+		struct ipv6hdr *hdr6)
+{
+	struct global_config *cfg = in->cfg;
+	__u8 tos;
+
+	memcpy(hdr6, pkt_ip6_hdr(in), sizeof(*hdr6));
+
+	tos = ttp64_xlat_tos(cfg, hdr6);
+	if (cfg->reset_traffic_class) {
+		hdr6->priority = 0;
+		hdr6->flow_lbl[0] = 0;
+	} else {
+		hdr6->priority = tos >> 4;
+		hdr6->flow_lbl[0] = tos << 4;
+	}
+	hdr6->flow_lbl[1] = 0;
+	hdr6->flow_lbl[2] = 0;
+	hdr6->hop_limit -= 2;
+	hdr6->saddr = tuple6->src.addr6.l3;
+	hdr6->daddr = tuple6->dst.addr6.l3;
+}
+
+/**
+ * Builds in @udp the UDP header that goes along with shortcut_ipv6()'s @hdr6.
+ */
+static void shortcut_udp(struct tuple *tuple6, struct packet *in,
+		struct ipv6hdr *hdr6, struct udphdr *udp)
+{
+	struct ipv6hdr *hdr_in = pkt_ip6_hdr(in);
+	struct udphdr *udp_in = pkt_udp_hdr(in);
+	__wsum csum, pseudohdr_csum;
+
+	memcpy(udp, udp_in, sizeof(*udp));
+	udp->source = cpu_to_be16(tuple6->src.addr6.l4);
+	udp->dest = cpu_to_be16(tuple6->dst.addr6.l4);
+
+	/* Same tricks as update_csum_6to4(); only addresses and ports change. */
+	if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
+		csum = ~csum_unfold(udp_in->check);
+		pseudohdr_csum = ~csum_unfold(csum_ipv6_magic(&hdr_in->saddr,
+				&hdr_in->daddr, 0, 0, 0));
+		csum = csum_sub(csum, pseudohdr_csum);
+		csum = csum_sub(csum, csum_partial(udp_in, 4, 0));
+		pseudohdr_csum = ~csum_unfold(csum_ipv6_magic(&hdr6->saddr,
+				&hdr6->daddr, 0, 0, 0));
+		csum = csum_add(csum, pseudohdr_csum);
+		csum = csum_add(csum, csum_partial(udp, 4, 0));
+
+		udp->check = csum_fold(csum);
+		if (udp->check == 0)
+			udp->check = CSUM_MANGLED_0;
+	} else {
+		csum = csum_unfold(udp_in->check);
+		pseudohdr_csum = ~csum_unfold(csum_ipv6_magic(&hdr_in->saddr,
+				&hdr_in->daddr, 0, 0, 0));
+		csum = csum_sub(csum, pseudohdr_csum);
+		pseudohdr_csum = ~csum_unfold(csum_ipv6_magic(&hdr6->saddr,
+				&hdr6->daddr, 0, 0, 0));
+		csum = csum_add(csum, pseudohdr_csum);
+
+		udp->check = ~csum_fold(csum);
+	}
+}
+
+/**
+ * hairpin_shortcut - Hairpins @in (an IPv6 packet) without translating it into
+ * IPv4 first.
+ * @tuple4: @in's outgoing (IPv4) tuple.
+ * @out: the resulting packet.
+ *
+ * Assumes pkt_will_hairpin(@in).
+ *
+ * If the packet doesn't qualify for the shortcut, this returns VERDICT_CONTINUE
+ * and leaves @out->skb NULL; the caller should carry on with the regular
+ * pipeline then.
+ * Otherwise, it does both of Filtering and Updating's IPv4 half and the
+ * outgoing tuple computation straight away, and then rewrites @in's own skb
+ * into the final (already routed) IPv6 packet, which is left in @out for the
+ * caller to send. @in is gone in this case.
+ * Other verdicts leave @in as it was.
+ */
+verdict hairpin_shortcut(struct packet *in, struct tuple *tuple4,
+		struct packet *out)
+{
+	struct sk_buff *skb = in->skb;
+	struct tuple tuple6;
+	struct ipv6hdr hdr6;
+	struct udphdr udp;
+	struct dst_entry *dst;
+	verdict result;
+
+	out->skb = NULL;
+	if (!can_shortcut(in))
+		return VERDICT_CONTINUE;
+
+	log_debug("Step 5: Handling Hairpinning (shortcut)...");
+
+	result = filtering_and_updating_hairpin(in, tuple4);
+	if (result != VERDICT_CONTINUE)
+		return result;
+	result = compute_out_tuple(tuple4, &tuple6, in);
+	if (result != VERDICT_CONTINUE)
+		return result;
+
+	shortcut_ipv6(&tuple6, in, &hdr6);
+	shortcut_udp(&tuple6, in, &hdr6, &udp);
+
+	dst = __route6(&hdr6, NEXTHDR_UDP, L4PROTO_UDP, &udp, skb->mark, NULL);
+	if (!dst)
+		return VERDICT_ACCEPT;
+	if (skb->len > dst->dev->mtu) {
+		log_debug("Packet is too big (len: %u, mtu: %u).", skb->len,
+				dst->dev->mtu);
+		icmp64_send(in, ICMPERR_FRAG_NEEDED, dst->dev->mtu);
+		dst_release(dst);
+		return VERDICT_DROP;
+	}
+	if (skb_cow(skb, LL_MAX_HEADER)) {
+		dst_release(dst);
+		inc_stats(in, IPSTATS_MIB_INDISCARDS);
+		return VERDICT_DROP;
+	}
+
+	/* Point of no return; from now on, "in" is gone. */
+	memcpy(skb->data, &hdr6, sizeof(hdr6));
+	memcpy(skb->data + sizeof(hdr6), &udp, sizeof(udp));
+	ttpcomm_in_place_finish(skb, dst, sizeof(hdr6),
+			offsetof(struct udphdr, check));
+
+	pkt_fill(out, skb, L3PROTO_IPV6, L4PROTO_UDP, NULL,
+			skb_transport_header(skb) + sizeof(udp), in);
+
+	log_debug("Done step 5.");
+	return VERDICT_CONTINUE;
+}
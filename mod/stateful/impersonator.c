@@ -98,6 +98,12 @@ void eamt_flush(void)
 	fail(__func__);
 }
 
+int eamt_load(struct eamt_entry *entries, unsigned int count,
+		bool first, bool last, bool force)
+{
+	return fail(__func__);
+}
+
 bool eamt_contains4(__be32 addr)
 {
 	fail(__func__);
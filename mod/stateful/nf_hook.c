@@ -2,11 +2,16 @@
 #include "nat64/common/xlat.h"
 #include "nat64/mod/common/config.h"
 #include "nat64/mod/common/core.h"
+#include "nat64/mod/common/icmp_wrapper.h"
+#include "nat64/mod/common/ipv4_id.h"
+#include "nat64/mod/common/local_addrs.h"
 #include "nat64/mod/common/log_time.h"
 #include "nat64/mod/common/namespace.h"
 #include "nat64/mod/common/nf_wrapper.h"
 #include "nat64/mod/common/nl_handler.h"
 #include "nat64/mod/common/pool6.h"
+#include "nat64/mod/common/prefilter.h"
+#include "nat64/mod/common/route.h"
 #include "nat64/mod/stateful/filtering_and_updating.h"
 #include "nat64/mod/stateful/fragment_db.h"
 #include "nat64/mod/stateful/pool4/db.h"
@@ -34,7 +39,7 @@ MODULE_PARM_DESC(pool4, "The IPv4 pool's addresses.");
 
 static unsigned int pool4_size;
 module_param(pool4_size, uint, 0);
-MODULE_PARM_DESC(pool4_size, "Size of pool4 DB's hashtable.");
+MODULE_PARM_DESC(pool4_size, "Initial (and minimum) size of pool4 DB's hashtable.");
 
 static bool disabled;
 module_param(disabled, bool, 0);
@@ -101,6 +106,15 @@ static int __init nat64_init(void)
 	error = config_init(disabled);
 	if (error)
 		goto config_failure;
+	error = route_init();
+	if (error)
+		goto route_failure;
+	error = icmp64_init();
+	if (error)
+		goto icmp64_failure;
+	error = ipv4id_init();
+	if (error)
+		goto ipv4id_failure;
 	error = nlhandler_init();
 	if (error)
 		goto nlhandler_failure;
@@ -110,6 +124,9 @@ static int __init nat64_init(void)
 	error = pool4db_init(pool4_size, pool4, pool4_len);
 	if (error)
 		goto pool4_failure;
+	error = localaddrs_init();
+	if (error)
+		goto localaddrs_failure;
 	error = filtering_init();
 	if (error)
 		goto filtering_failure;
@@ -121,6 +138,9 @@ static int __init nat64_init(void)
 	if (error)
 		goto log_time_failure;
 #endif
+	error = prefilter_init();
+	if (error)
+		goto prefilter_failure;
 
 	/* Hook Jool to Netfilter. */
 	error = nf_register_hooks(nfho, ARRAY_SIZE(nfho));
@@ -132,6 +152,9 @@ static int __init nat64_init(void)
 	return error;
 
 nf_register_hooks_failure:
+	prefilter_destroy();
+
+prefilter_failure:
 #ifdef BENCHMARK
 	logtime_destroy();
 
@@ -143,6 +166,9 @@ fragdb_failure:
 	filtering_destroy();
 
 filtering_failure:
+	localaddrs_destroy();
+
+localaddrs_failure:
 	pool4db_destroy();
 
 pool4_failure:
@@ -152,6 +178,15 @@ pool6_failure:
 	nlhandler_destroy();
 
 nlhandler_failure:
+	ipv4id_destroy();
+
+ipv4id_failure:
+	icmp64_destroy();
+
+icmp64_failure:
+	route_destroy();
+
+route_failure:
 	config_destroy();
 
 config_failure:
@@ -167,14 +202,19 @@ static void __exit nat64_exit(void)
 	nf_unregister_hooks(nfho, ARRAY_SIZE(nfho));
 
 	/* Deinitialize the submodules. */
+	prefilter_destroy();
 #ifdef BENCHMARK
 	logtime_destroy();
 #endif
 	fragdb_destroy();
 	filtering_destroy();
+	localaddrs_destroy();
 	pool4db_destroy();
 	pool6_destroy();
 	nlhandler_destroy();
+	ipv4id_destroy();
+	icmp64_destroy();
+	route_destroy();
 	config_destroy();
 	joolns_destroy();
 
@@ -11,20 +11,36 @@
 #include "nat64/mod/stateful/pool4/table.h"
 #include "nat64/mod/stateful/pool4/empty.h"
 
-/** Note, this is an array (size 2^@power). */
-static struct hlist_head __rcu *db;
-/** Number of entries (ie. tables) in the database. */
-static unsigned int tables;
+/**
+ * A hash table of pool4 tables, keyed by mark.
+ *
+ * Each table carries two hooks, so it can be linked to two of these at the
+ * same time. This is what allows resize() to build a new array while the
+ * readers are still walking the old one.
+ */
+struct pool4_db {
+	/** Number of entries (ie. tables) in the database. */
+	unsigned int tables;
+	/** The array has 2^@power slots. */
+	unsigned int power;
+	/** Index of the tables' hlist_hook this array links. */
+	unsigned int hook;
+	struct hlist_head slots[];
+};
+
+static struct pool4_db __rcu *db;
 
 /**
- * Defines the number of "slots" in the table (2^power).
+ * Defines the initial and minimum number of "slots" in the table (2^power).
  * (Each slot is a hlist_head.)
+ * The database grows past this as tables are added, and shrinks back as they
+ * are removed.
  *
  * It doesn't require locking because it never changes after init.
  */
 static unsigned int power;
 
-/** Protects @db and @tables, only on updater code. */
+/** Protects @db, only on updater code. */
 static DEFINE_MUTEX(lock);
 
 RCUTAG_FREE
@@ -34,22 +50,35 @@ static unsigned int slots(void)
 }
 
 RCUTAG_FREE
-static struct pool4_table *table_entry(struct hlist_node *node)
+static unsigned int db_slots(struct pool4_db *database)
+{
+	return 1 << database->power;
+}
+
+RCUTAG_FREE
+static struct pool4_table *table_entry(struct hlist_node *node,
+		struct pool4_db *database)
 {
-	return hlist_entry(node, struct pool4_table, hlist_hook);
+	return hlist_entry(node, struct pool4_table,
+			hlist_hook[database->hook]);
 }
 
 RCUTAG_USR /* Only because of GFP_KERNEL. Can be easily upgraded to FREE. */
-static struct hlist_head *init_db(unsigned int size)
+static struct pool4_db *init_db(unsigned int power, unsigned int hook)
 {
-	struct hlist_head *result;
+	struct pool4_db *result;
 	unsigned int i;
 
-	result = kmalloc(size * sizeof(*result), GFP_KERNEL);
+	result = kmalloc(sizeof(*result) + (sizeof(result->slots[0]) << power),
+			GFP_KERNEL | __GFP_NOWARN);
 	if (!result)
 		return NULL;
-	for (i = 0; i < size; i++)
-		INIT_HLIST_HEAD(&result[i]);
+
+	result->tables = 0;
+	result->power = power;
+	result->hook = hook;
+	for (i = 0; i < db_slots(result); i++)
+		INIT_HLIST_HEAD(&result->slots[i]);
 
 	return result;
 }
@@ -118,15 +147,14 @@ static int init_power(unsigned int size)
 RCUTAG_INIT /* Inherits INIT from init_power(). */
 int pool4db_init(unsigned int size, char *prefix_strs[], int prefix_count)
 {
-	struct hlist_head *tmp;
+	struct pool4_db *tmp;
 	int error;
 
 	error = init_power(size);
 	if (error)
 		return error;
 
-	tables = 0;
-	tmp = init_db(slots());
+	tmp = init_db(power, 0);
 	if (!tmp)
 		return -ENOMEM;
 	rcu_assign_pointer(db, tmp);
@@ -139,31 +167,33 @@ int pool4db_init(unsigned int size, char *prefix_strs[], int prefix_count)
 }
 
 RCUTAG_FREE
-static void __destroy(struct hlist_head *db)
+static void __destroy(struct pool4_db *database)
 {
 	struct hlist_node *node;
 	struct hlist_node *tmp;
 	unsigned int i;
 
-	for (i = 0; i < slots(); i++) {
-		hlist_for_each_safe(node, tmp, &db[i]) {
+	if (!database)
+		return;
+
+	for (i = 0; i < db_slots(database); i++) {
+		hlist_for_each_safe(node, tmp, &database->slots[i]) {
 			hlist_del(node);
-			pool4table_destroy(table_entry(node));
+			pool4table_destroy(table_entry(node, database));
 		}
 	}
 
-	kfree(db);
+	kfree(database);
 }
 
 RCUTAG_USR
-static void pool4db_replace(struct hlist_head *new, unsigned int count)
+static void pool4db_replace(struct pool4_db *new)
 {
-	struct hlist_head *old;
+	struct pool4_db *old;
 
 	mutex_lock(&lock);
 	old = rcu_dereference_protected(db, lockdep_is_held(&lock));
 	rcu_assign_pointer(db, new);
-	tables = count;
 	mutex_unlock(&lock);
 
 	synchronize_rcu_bh();
@@ -174,25 +204,25 @@ static void pool4db_replace(struct hlist_head *new, unsigned int count)
 RCUTAG_USR
 void pool4db_destroy(void)
 {
-	pool4db_replace(NULL, 0);
+	pool4db_replace(NULL);
 }
 
 RCUTAG_PKT /* Assumes locking (whether RCU or mutex) has already been done. */
-static struct pool4_table *find_table(struct hlist_head *database,
+static struct pool4_table *find_table(struct pool4_db *database,
 		const __u32 mark, enum l4_protocol proto)
 {
 	struct pool4_table *table;
 	struct hlist_node *node;
 	u32 hash;
 
-	hash = hash_32(mark, power);
+	hash = hash_32(mark, database->power);
 
-	/* Short version: node = database[hash]->first. */
-	node = rcu_dereference_bh_check(hlist_first_rcu(&database[hash]),
+	/* Short version: node = database->slots[hash]->first. */
+	node = rcu_dereference_bh_check(hlist_first_rcu(&database->slots[hash]),
 			lockdep_is_held(&lock));
 
 	while (node) {
-		table = table_entry(node);
+		table = table_entry(node, database);
 		if (table->mark == mark && table->proto == proto)
 			return table;
 
@@ -204,11 +234,65 @@ static struct pool4_table *find_table(struct hlist_head *database,
 	return NULL;
 }
 
+/**
+ * resize - Moves @database's tables to a new array of 2^@new_power slots.
+ *
+ * The new array links the tables' other hook, so readers of the old array
+ * are not disturbed. Failure is not fatal; the old array stays.
+ * Dumps that are in progress don't care either; see pool4db_foreach_sample().
+ * Returns the database that should be used from now on.
+ */
+RCUTAG_USR
+static struct pool4_db *resize(struct pool4_db *database,
+		unsigned int new_power)
+{
+	struct pool4_db *new;
+	struct pool4_table *table;
+	struct hlist_node *node;
+	unsigned int i;
+
+	new = init_db(new_power, !database->hook);
+	if (!new) {
+		log_debug("Could not resize pool4's hashtable; chains will "
+				"stay long.");
+		return database;
+	}
+
+	new->tables = database->tables;
+	for (i = 0; i < db_slots(database); i++) {
+		hlist_for_each(node, &database->slots[i]) {
+			table = table_entry(node, database);
+			hlist_add_head_rcu(&table->hlist_hook[new->hook],
+					&new->slots[hash_32(table->mark,
+							new->power)]);
+		}
+	}
+
+	rcu_assign_pointer(db, new);
+	synchronize_rcu_bh();
+	kfree(database);
+	return new;
+}
+
+/**
+ * Grows or shrinks @database so there's roughly one table per slot.
+ * Hysteresis prevents add/remove cycles from resizing every time.
+ */
+RCUTAG_USR
+static void maybe_resize(struct pool4_db *database)
+{
+	if (database->tables > db_slots(database) && database->power < 31)
+		resize(database, database->power + 1);
+	else if (database->power > power
+			&& database->tables < (db_slots(database) >> 2))
+		resize(database, database->power - 1);
+}
+
 RCUTAG_USR
 int pool4db_add(const __u32 mark, enum l4_protocol proto,
 		struct ipv4_prefix *prefix, struct port_range *ports)
 {
-	struct hlist_head *database;
+	struct pool4_db *database;
 	struct pool4_table *table;
 	int error;
 
@@ -217,7 +301,7 @@ int pool4db_add(const __u32 mark, enum l4_protocol proto,
 	database = rcu_dereference_protected(db, lockdep_is_held(&lock));
 	table = find_table(database, mark, proto);
 	if (!table) {
-		table = pool4table_create(mark, proto);
+		table = pool4table_create(mark, proto, &lock);
 		if (!table) {
 			error = -ENOMEM;
 			goto end;
@@ -229,14 +313,11 @@ int pool4db_add(const __u32 mark, enum l4_protocol proto,
 			goto end;
 		}
 
-		tables++;
-		hlist_add_head_rcu(&table->hlist_hook,
-				&database[hash_32(mark, power)]);
-		if (tables > slots()) {
-			log_warn_once("You have lots of pool4s, which can lag "
-					"Jool. Consider increasing "
-					"pool4_size.");
-		}
+		hlist_add_head_rcu(&table->hlist_hook[database->hook],
+				&database->slots[hash_32(mark,
+						database->power)]);
+		database->tables++;
+		maybe_resize(database);
 
 	} else {
 		error = pool4table_add(table, prefix, ports);
@@ -252,7 +333,7 @@ RCUTAG_USR
 int pool4db_rm(const __u32 mark, enum l4_protocol proto,
 		struct ipv4_prefix *prefix, struct port_range *ports)
 {
-	struct hlist_head *database;
+	struct pool4_db *database;
 	struct pool4_table *table;
 	int error;
 
@@ -270,10 +351,11 @@ int pool4db_rm(const __u32 mark, enum l4_protocol proto,
 		goto end;
 
 	if (pool4table_is_empty(table)) {
-		hlist_del_rcu(&table->hlist_hook);
+		hlist_del_rcu(&table->hlist_hook[database->hook]);
+		database->tables--;
 		synchronize_rcu_bh();
 		pool4table_destroy(table);
-		tables--;
+		maybe_resize(database);
 	}
 
 end:
@@ -284,20 +366,20 @@ end:
 RCUTAG_USR
 int pool4db_flush(void)
 {
-	struct hlist_head *new;
+	struct pool4_db *new;
 
-	new = init_db(slots());
+	new = init_db(power, 0);
 	if (!new)
 		return -ENOMEM;
 
-	pool4db_replace(new, 0);
+	pool4db_replace(new);
 	return 0;
 }
 
 RCUTAG_PKT
 bool pool4db_contains(enum l4_protocol proto, struct ipv4_transport_addr *addr)
 {
-	struct hlist_head *database;
+	struct pool4_db *database;
 	struct pool4_table *table;
 	struct hlist_node *node;
 	unsigned int i;
@@ -311,9 +393,9 @@ bool pool4db_contains(enum l4_protocol proto, struct ipv4_transport_addr *addr)
 	}
 
 	database = rcu_dereference_bh(db);
-	for (i = 0; i < slots(); i++) {
-		hlist_for_each_rcu_bh(node, &database[i]) {
-			table = table_entry(node);
+	for (i = 0; i < db_slots(database); i++) {
+		hlist_for_each_rcu_bh(node, &database->slots[i]) {
+			table = table_entry(node, database);
 			if (table->proto != proto)
 				continue;
 
@@ -332,32 +414,25 @@ end:
 RCUTAG_PKT
 bool pool4db_is_empty(void)
 {
-	struct hlist_head *database;
-	struct hlist_node *node;
-	unsigned int i;
-	bool empty = true;
+	struct pool4_db *database;
+	bool empty;
 
+	/*
+	 * Tables are deleted as soon as they become empty, so there's no need
+	 * to look inside them.
+	 */
 	rcu_read_lock_bh();
-
 	database = rcu_dereference_bh(db);
-	for (i = 0; i < slots(); i++) {
-		hlist_for_each_rcu_bh(node, &database[i]) {
-			if (!pool4table_is_empty(table_entry(node))) {
-				empty = false;
-				goto end;
-			}
-		}
-	}
-
-end:
+	empty = (database->tables == 0);
 	rcu_read_unlock_bh();
+
 	return empty;
 }
 
 RCUTAG_PKT
 void pool4db_count(__u32 *tables_out, __u64 *samples, __u64 *taddrs)
 {
-	struct hlist_head *database;
+	struct pool4_db *database;
 	struct hlist_node *node;
 	unsigned int i;
 
@@ -367,48 +442,103 @@ void pool4db_count(__u32 *tables_out, __u64 *samples, __u64 *taddrs)
 
 	rcu_read_lock_bh();
 	database = rcu_dereference_bh(db);
-	for (i = 0; i < slots(); i++) {
-		hlist_for_each_rcu_bh(node, &database[i]) {
+	for (i = 0; i < db_slots(database); i++) {
+		hlist_for_each_rcu_bh(node, &database->slots[i]) {
 			(*tables_out)++;
-			pool4table_count(table_entry(node), samples, taddrs);
+			pool4table_count(table_entry(node, database), samples,
+					taddrs);
 		}
 	}
+	WARN((*tables_out) != database->tables, "Computed table count doesn't "
+			"match stored table count.");
 	rcu_read_unlock_bh();
+}
 
-	WARN((*tables_out) != tables, "Computed table count doesn't match "
-			"stored table count.");
+/**
+ * Order in which pool4db_foreach_sample() visits the tables.
+ *
+ * hash_32() is a multiplication (a bijection, in other words) followed by a
+ * shift that keeps the high bits, so walking the slots in order visits the
+ * tables in increasing order of this key, whatever the size of the array.
+ */
+RCUTAG_FREE
+static u64 dump_key(__u32 mark, __u8 proto)
+{
+	return ((u64)hash_32(mark, 32) << 8) | proto;
 }
 
+/**
+ * Returns the table from @database's @slot that has the smallest dump_key()
+ * greater than @prev (or the smallest, if @prev is NULL).
+ * Chains are short, so there's no point in keeping them sorted.
+ */
+RCUTAG_PKT
+static struct pool4_table *next_table(struct pool4_db *database, u32 slot,
+		u64 *prev)
+{
+	struct pool4_table *table;
+	struct pool4_table *result = NULL;
+	struct hlist_node *node;
+	u64 key;
+	u64 result_key = 0;
+
+	hlist_for_each_rcu_bh(node, &database->slots[slot]) {
+		table = table_entry(node, database);
+		key = dump_key(table->mark, table->proto);
+		if (prev && key <= *prev)
+			continue;
+		if (!result || key < result_key) {
+			result = table;
+			result_key = key;
+		}
+	}
+
+	return result;
+}
+
+/**
+ * Runs @cb on every sample, resuming after @offset if it's set.
+ *
+ * The tables are visited in dump_key() order, so @offset still points to the
+ * right place if maybe_resize() replaced the array in the meantime (eg. between
+ * two Netlink dump requests). If @offset's table is gone, iteration resumes
+ * from the next one.
+ */
 RCUTAG_PKT
 int pool4db_foreach_sample(int (*cb)(struct pool4_sample *, void *), void *arg,
 		struct pool4_sample *offset)
 {
-	struct hlist_head *database;
+	struct pool4_db *database;
 	struct pool4_table *table;
-	struct hlist_node *node;
-	u32 hash = offset ? hash_32(offset->mark, power) : 0;
+	u64 key;
+	u64 *prev = NULL;
+	u32 slot = 0;
 	int error = 0;
 
 	rcu_read_lock_bh();
 
 	database = rcu_dereference_bh(db);
-	for (; hash < slots(); hash++) {
-		hlist_for_each_rcu_bh(node, &database[hash]) {
-			table = table_entry(node);
-			if (offset) {
-				if (table->mark == offset->mark && table->proto == offset->proto) {
-					error = pool4table_foreach_sample(table,
-							cb, arg, offset);
-					if (error)
-						goto end;
-					offset = NULL;
-				}
-			} else {
-				error = pool4table_foreach_sample(table, cb,
-						arg, NULL);
-				if (error)
-					goto end;
-			}
+	if (offset) {
+		slot = hash_32(offset->mark, database->power);
+		key = dump_key(offset->mark, offset->proto);
+		prev = &key;
+
+		table = find_table(database, offset->mark, offset->proto);
+		if (table) {
+			error = pool4table_foreach_sample(table, cb, arg,
+					offset);
+			if (error)
+				goto end;
+		}
+	}
+
+	for (; slot < db_slots(database); slot++) {
+		while ((table = next_table(database, slot, prev)) != NULL) {
+			error = pool4table_foreach_sample(table, cb, arg, NULL);
+			if (error)
+				goto end;
+			key = dump_key(table->mark, table->proto);
+			prev = &key;
 		}
 	}
 
@@ -1,56 +1,25 @@
 #include "nat64/mod/stateful/pool4/empty.h"
-#include <linux/inetdevice.h>
-#include <linux/in_route.h>
-#include <linux/netdevice.h>
 #include "nat64/common/constants.h"
-#include "nat64/mod/common/ipv6_hdr_iterator.h"
-#include "nat64/mod/common/namespace.h"
+#include "nat64/mod/common/local_addrs.h"
 #include "nat64/mod/common/route.h"
 #include "nat64/mod/common/rfc6145/6to4.h"
 
-static bool contains_addr(const struct in_addr *addr)
-{
-	struct net_device *dev;
-	struct in_device *in_dev;
-
-	for_each_netdev_rcu(joolns_get(), dev) {
-		in_dev = __in_dev_get_rcu(dev);
-		if (!in_dev)
-			continue;
-
-		for_primary_ifa(in_dev) {
-			if (ifa->ifa_scope != RT_SCOPE_UNIVERSE)
-				continue;
-			if (ifa->ifa_local == addr->s_addr)
-				return true;
-		} endfor_ifa(in_dev);
-	}
-
-	return false;
-}
-
 bool pool4empty_contains(const struct ipv4_transport_addr *addr)
 {
-	bool found;
-
 	if (addr->l4 < DEFAULT_POOL4_MIN_PORT)
 		return false;
 	/* I sure hope this gets compiled out :p */
 	if (DEFAULT_POOL4_MAX_PORT < addr->l4)
 		return false;
 
-	rcu_read_lock();
-	found = contains_addr(&addr->l3);
-	rcu_read_unlock();
-
-	return found;
+	return localaddrs_contains_global(addr->l3.s_addr);
 }
 
 static struct dst_entry *____route4(struct packet *in, struct in_addr *daddr)
 {
 	struct ipv6hdr *hdr = pkt_ip6_hdr(in);
-	__u8 tos = ttp64_xlat_tos(hdr);
-	__u8 proto = ttp64_xlat_proto(hdr);
+	__u8 tos = ttp64_xlat_tos(in->cfg, hdr);
+	__u8 proto = ttp64_xlat_proto(in);
 
 	return __route4(daddr->s_addr, tos, proto, in->skb->mark, NULL);
 }
@@ -61,35 +30,16 @@ static struct dst_entry *____route4(struct packet *in, struct in_addr *daddr)
  * precedence.
  * If everything fails, attempts to use a host address.
  */
-static int __pick_addr(struct dst_entry *dst, struct in_addr *daddr,
+static int pick_addr(struct dst_entry *dst, struct in_addr *daddr,
 		struct in_addr *result)
 {
-	struct in_device *in_dev;
-	__be32 saddr = 0;
-
-	in_dev = __in_dev_get_rcu(dst->dev);
-	if (!in_dev) {
-		log_debug("IPv4 route doesn't involve an IPv4 device.");
-		return -EINVAL;
-	}
+	int error;
 
-	for_primary_ifa(in_dev) {
-		if (ifa->ifa_scope != RT_SCOPE_UNIVERSE)
-			continue;
-		if (inet_ifa_match(daddr->s_addr, ifa)) {
-			result->s_addr = ifa->ifa_local;
-			return 0;
-		}
-		if (!saddr)
-			saddr = ifa->ifa_local;
-	} endfor_ifa(in_dev);
-
-	if (saddr) {
-		result->s_addr = saddr;
-		return 0; /* This is the typical happy path. */
-	}
+	error = localaddrs_pick(dst->dev, daddr->s_addr, &result->s_addr);
+	if (error != -ESRCH)
+		return error;
 
-	if (contains_addr(daddr)) {
+	if (localaddrs_contains_global(daddr->s_addr)) {
 		*result = *daddr;
 		return 0;
 	}
@@ -98,18 +48,6 @@ static int __pick_addr(struct dst_entry *dst, struct in_addr *daddr,
 	return -ESRCH;
 }
 
-static int pick_addr(struct dst_entry *dst, struct in_addr *daddr,
-		struct in_addr *result)
-{
-	int error;
-
-	rcu_read_lock();
-	error = __pick_addr(dst, daddr, result);
-	rcu_read_unlock();
-
-	return error;
-}
-
 static int foreach_port(struct in_addr *addr,
 		int (*cb)(struct ipv4_transport_addr *, void *), void *arg,
 		unsigned int offset)
@@ -4,8 +4,44 @@
 
 #include <linux/slab.h>
 #include <linux/rculist.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
 
-struct pool4_table *pool4table_create(__u32 mark, enum l4_protocol proto)
+/**
+ * A port range from @rows, along with the number of transport addresses that
+ * precede it in iteration order.
+ */
+struct pool4_index_range {
+	struct in_addr addr;
+	struct port_range range;
+	unsigned int offset;
+};
+
+/**
+ * A port range from @rows, keyed for membership lookups.
+ */
+struct pool4_index_key {
+	/* Host byte order, so it can be compared numerically. */
+	__u32 addr;
+	struct port_range range;
+};
+
+struct pool4_index {
+	/** Number of port ranges. (Length of both arrays.) */
+	unsigned int count;
+	/** Number of addresses. */
+	unsigned int addrs;
+	/** Number of transport addresses. */
+	unsigned int taddrs;
+
+	/** Port ranges in iteration order (see pool4table_add()). */
+	struct pool4_index_range *ranges;
+	/** Port ranges sorted by address, then by port. */
+	struct pool4_index_key *keys;
+};
+
+struct pool4_table *pool4table_create(__u32 mark, enum l4_protocol proto,
+		struct mutex *lock)
 {
 	struct pool4_table *result;
 
@@ -16,9 +52,43 @@ struct pool4_table *pool4table_create(__u32 mark, enum l4_protocol proto)
 	result->mark = mark;
 	result->proto = proto;
 	INIT_LIST_HEAD(&result->rows);
+	RCU_INIT_POINTER(result->index, NULL);
+	result->lock = lock;
 	return result;
 }
 
+/*
+ * Indexes can get big (a /16 with one range per address is 64k ranges), so
+ * don't insist on physically contiguous memory.
+ */
+static void *index_alloc(size_t size)
+{
+	void *result;
+
+	if (size <= PAGE_SIZE)
+		return kmalloc(size, GFP_KERNEL);
+
+	result = kmalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	return result ? result : vmalloc(size);
+}
+
+static void index_free_array(void *array)
+{
+	if (is_vmalloc_addr(array))
+		vfree(array);
+	else
+		kfree(array);
+}
+
+static void index_destroy(struct pool4_index *index)
+{
+	if (!index)
+		return;
+	index_free_array(index->ranges);
+	index_free_array(index->keys);
+	kfree(index);
+}
+
 /**
  * pool4_destroy - frees resources allocated by the pool. Reverts pool4_init().
  */
@@ -37,6 +107,7 @@ void pool4table_destroy(struct pool4_table *table)
 		kfree(addr);
 	}
 
+	index_destroy(rcu_dereference_raw(table->index));
 	kfree(table);
 }
 
@@ -55,6 +126,86 @@ static unsigned int count_ports(struct pool4_table *table)
 	return result;
 }
 
+static int compare_keys(const void *a, const void *b)
+{
+	const struct pool4_index_key *key1 = a;
+	const struct pool4_index_key *key2 = b;
+
+	if (key1->addr != key2->addr)
+		return (key1->addr < key2->addr) ? -1 : 1;
+	/* Ranges of the same address never overlap (see try_fusion()). */
+	return ((int)key1->range.min) - ((int)key2->range.min);
+}
+
+static struct pool4_index *index_create(struct pool4_table *table)
+{
+	struct pool4_index *index;
+	struct pool4_addr *addr;
+	struct pool4_ports *ports;
+	unsigned int i;
+
+	index = kzalloc(sizeof(*index), GFP_KERNEL);
+	if (!index)
+		return NULL;
+
+	list_for_each_entry(addr, &table->rows, list_hook) {
+		index->addrs++;
+		list_for_each_entry(ports, &addr->ports, list_hook)
+			index->count++;
+	}
+
+	index->ranges = index_alloc(index->count * sizeof(*index->ranges));
+	index->keys = index_alloc(index->count * sizeof(*index->keys));
+	if (!index->ranges || !index->keys) {
+		index_destroy(index);
+		return NULL;
+	}
+
+	i = 0;
+	list_for_each_entry(addr, &table->rows, list_hook) {
+		list_for_each_entry(ports, &addr->ports, list_hook) {
+			index->ranges[i].addr = addr->addr;
+			index->ranges[i].range = ports->range;
+			index->ranges[i].offset = index->taddrs;
+			index->keys[i].addr = be32_to_cpu(addr->addr.s_addr);
+			index->keys[i].range = ports->range;
+			/* validate_overflow() prevents this from wrapping. */
+			index->taddrs += port_range_count(&ports->range);
+			i++;
+		}
+	}
+
+	sort(index->keys, index->count, sizeof(*index->keys), compare_keys,
+			NULL);
+	return index;
+}
+
+/**
+ * reindex - Brings @table's index up to date with its rows.
+ *
+ * Must be called after every modification of @table->rows, including failed
+ * ones (since they can be partial).
+ * If the index cannot be allocated, the readers will simply fall back to the
+ * (slower) lists, so this doesn't fail.
+ */
+static void reindex(struct pool4_table *table)
+{
+	struct pool4_index *old;
+	struct pool4_index *new;
+
+	old = rcu_dereference_protected(table->index,
+			lockdep_is_held(table->lock));
+	new = list_empty(&table->rows) ? NULL : index_create(table);
+	if (!list_empty(&table->rows) && !new)
+		log_debug("Could not allocate pool4's index; it will be slow.");
+
+	rcu_assign_pointer(table->index, new);
+	if (old) {
+		synchronize_rcu_bh();
+		index_destroy(old);
+	}
+}
+
 static void fuse(struct port_range *first, struct port_range *second,
 		struct port_range *result)
 {
@@ -230,6 +381,7 @@ int pool4table_add(struct pool4_table *table, struct ipv4_prefix *prefix,
 			break;
 	}
 
+	reindex(table);
 	return error;
 }
 
@@ -327,6 +479,7 @@ int pool4table_rm(struct pool4_table *table, struct ipv4_prefix *prefix,
 			break;
 	}
 
+	reindex(table);
 	return error;
 }
 
@@ -377,16 +530,10 @@ int pool4table_foreach_sample(struct pool4_table *table,
 }
 
 /**
- * pool4table_foreach_taddr4 - run @func on every transport address on @table.
- * @table: sample collection that will be iterated.
- * @func: callback to be run for every transport address in @table.
- * @arg: additional argument to send to @func on every iteration.
- * @offset: iteration will start from the @offset'th element (inclusive).
- *
- * Iterations wraps around and doesn't stop naturally until the @offset'th
- * element is reached. You want @func to break iteration early!
+ * List-based version of pool4table_foreach_taddr4(), for tables whose index
+ * could not be built.
  */
-int pool4table_foreach_taddr4(struct pool4_table *table,
+static int foreach_taddr4_slow(struct pool4_table *table,
 		int (*func)(struct ipv4_transport_addr *, void *), void *arg,
 		unsigned int offset_main)
 {
@@ -448,9 +595,103 @@ int pool4table_foreach_taddr4(struct pool4_table *table,
 }
 
 /**
- * pool4table_contains - is @taddr listed within @table?
+ * Returns the index of the range that contains @index's @offset'th transport
+ * address. @offset has to be lower than @index->taddrs.
  */
-bool pool4table_contains(struct pool4_table *table,
+static unsigned int find_offset(struct pool4_index *index, unsigned int offset)
+{
+	unsigned int left = 0;
+	unsigned int right = index->count - 1;
+	unsigned int middle;
+
+	/* Find the last range whose offset is <= @offset. */
+	while (left < right) {
+		middle = left + (right - left + 1) / 2;
+		if (index->ranges[middle].offset <= offset)
+			left = middle;
+		else
+			right = middle - 1;
+	}
+
+	return left;
+}
+
+static int foreach_port(struct pool4_index_range *range,
+		unsigned int first, unsigned int last,
+		int (*func)(struct ipv4_transport_addr *, void *), void *arg)
+{
+	struct ipv4_transport_addr tmp;
+	unsigned int i;
+	int error;
+
+	tmp.l3 = range->addr;
+	for (i = first; i < last; i++) {
+		tmp.l4 = range->range.min + i;
+		error = func(&tmp, arg);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+/**
+ * pool4table_foreach_taddr4 - run @func on every transport address on @table.
+ * @table: sample collection that will be iterated.
+ * @func: callback to be run for every transport address in @table.
+ * @arg: additional argument to send to @func on every iteration.
+ * @offset: iteration will start from the @offset'th element (inclusive).
+ *
+ * Iterations wraps around and doesn't stop naturally until the @offset'th
+ * element is reached. You want @func to break iteration early!
+ */
+int pool4table_foreach_taddr4(struct pool4_table *table,
+		int (*func)(struct ipv4_transport_addr *, void *), void *arg,
+		unsigned int offset)
+{
+	struct pool4_index *index;
+	struct pool4_index_range *range;
+	unsigned int start;
+	unsigned int port;
+	unsigned int i;
+	int error;
+
+	index = rcu_dereference_bh(table->index);
+	if (!index)
+		return foreach_taddr4_slow(table, func, arg, offset);
+	if (index->taddrs == 0)
+		return 0;
+
+	offset %= index->taddrs;
+	start = find_offset(index, offset);
+	port = offset - index->ranges[start].offset;
+
+	range = &index->ranges[start];
+	error = foreach_port(range, port, port_range_count(&range->range),
+			func, arg);
+	if (error)
+		return error;
+
+	for (i = start + 1; i < index->count; i++) {
+		range = &index->ranges[i];
+		error = foreach_port(range, 0, port_range_count(&range->range),
+				func, arg);
+		if (error)
+			return error;
+	}
+
+	for (i = 0; i < start; i++) {
+		range = &index->ranges[i];
+		error = foreach_port(range, 0, port_range_count(&range->range),
+				func, arg);
+		if (error)
+			return error;
+	}
+
+	return foreach_port(&index->ranges[start], 0, port, func, arg);
+}
+
+static bool contains_slow(struct pool4_table *table,
 		const struct ipv4_transport_addr *taddr)
 {
 	struct pool4_addr *addr;
@@ -471,6 +712,45 @@ bool pool4table_contains(struct pool4_table *table,
 	return false;
 }
 
+/**
+ * pool4table_contains - is @taddr listed within @table?
+ */
+bool pool4table_contains(struct pool4_table *table,
+		const struct ipv4_transport_addr *taddr)
+{
+	struct pool4_index *index;
+	struct pool4_index_key *key;
+	__u32 addr;
+	unsigned int left;
+	unsigned int right;
+	unsigned int middle;
+
+	index = rcu_dereference_bh(table->index);
+	if (!index)
+		return contains_slow(table, taddr);
+
+	addr = be32_to_cpu(taddr->l3.s_addr);
+	left = 0;
+	right = index->count;
+	while (left < right) {
+		middle = left + (right - left) / 2;
+		key = &index->keys[middle];
+
+		if (addr < key->addr)
+			right = middle;
+		else if (addr > key->addr)
+			left = middle + 1;
+		else if (taddr->l4 < key->range.min)
+			right = middle;
+		else if (taddr->l4 > key->range.max)
+			left = middle + 1;
+		else
+			return true;
+	}
+
+	return false;
+}
+
 bool pool4table_is_empty(struct pool4_table *table)
 {
 	return list_empty(&table->rows);
@@ -478,9 +758,17 @@ bool pool4table_is_empty(struct pool4_table *table)
 
 void pool4table_count(struct pool4_table *table, __u64 *samples, __u64 *taddrs)
 {
+	struct pool4_index *index;
 	struct pool4_addr *addr;
 	struct pool4_ports *ports;
 
+	index = rcu_dereference_bh(table->index);
+	if (index) {
+		(*samples) += index->addrs;
+		(*taddrs) += index->taddrs;
+		return;
+	}
+
 	list_for_each_entry_rcu(addr, &table->rows, list_hook) {
 		(*samples)++;
 		list_for_each_entry_rcu(ports, &addr->ports, list_hook) {
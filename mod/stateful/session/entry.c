@@ -100,7 +100,8 @@ void session_log(const struct session_entry *session, const char *action)
 	struct timeval tval;
 	struct tm t;
 
-	if (!config_get_session_logging())
+	if (!config_switch_on(session_logging_switch)
+			|| !config_get_session_logging())
 		return;
 
 	do_gettimeofday(&tval);
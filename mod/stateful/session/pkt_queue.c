@@ -156,6 +156,8 @@ int pktqueue_add(struct session_entry *session, struct packet *pkt)
 	node->session = session;
 	node->pkt = *pkt_original_pkt(pkt);
 	node->pkt.original_pkt = &node->pkt;
+	/* Stored packets outlive their translation's config snapshot. */
+	node->pkt.cfg = NULL;
 	RB_CLEAR_NODE(&node->tree_hook);
 
 	spin_lock_bh(&lock);
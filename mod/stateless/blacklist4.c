@@ -2,15 +2,14 @@
 
 #include <linux/rculist.h>
 #include <linux/inet.h>
-#include <linux/netdevice.h>
-#include <linux/inetdevice.h>
 
 #include "nat64/common/str_utils.h"
-#include "nat64/mod/common/namespace.h"
+#include "nat64/mod/common/addr_cache.h"
+#include "nat64/mod/common/local_addrs.h"
 #include "nat64/mod/common/rcu.h"
 #include "nat64/mod/stateless/pool.h"
 
-static struct list_head __rcu *pool;
+static struct addr4_pool __rcu *pool;
 
 int blacklist_init(char *pref_strs[], int pref_count)
 {
@@ -24,48 +23,41 @@ void blacklist_destroy(void)
 
 int blacklist_add(struct ipv4_prefix *prefix)
 {
-	return pool_add(pool, prefix);
+	int error;
+
+	error = pool_add(&pool, prefix);
+	if (!error)
+		addrcache_invalidate();
+
+	return error;
 }
 
 int blacklist_rm(struct ipv4_prefix *prefix)
 {
-	return pool_rm(pool, prefix);
+	int error;
+
+	error = pool_rm(&pool, prefix);
+	if (!error)
+		addrcache_invalidate();
+
+	return error;
 }
 
 int blacklist_flush(void)
 {
-	return pool_flush(&pool);
-}
+	int error;
 
-static bool interface_contains(struct in_addr *addr)
-{
-	struct net_device *dev;
-	struct in_device *in_dev;
-	struct in_ifaddr *ifaddr;
-	struct in_addr net_addr;
-
-	rcu_read_lock();
-	for_each_netdev_rcu(joolns_get(), dev) {
-		in_dev = rcu_dereference(dev->ip_ptr);
-		ifaddr = in_dev->ifa_list;
-		while (ifaddr) {
-			net_addr.s_addr = ifaddr->ifa_local;
-			if (ipv4_addr_cmp(&net_addr, addr) == 0) {
-				rcu_read_unlock();
-				return true;
-			}
-			ifaddr = ifaddr->ifa_next;
-		}
-	}
-	rcu_read_unlock();
-
-	return false;
+	error = pool_flush(&pool);
+	if (!error)
+		addrcache_invalidate();
+
+	return error;
 }
 
 bool blacklist_contains(__be32 be_addr)
 {
 	struct in_addr addr = { .s_addr = be_addr };
-	return pool_contains(pool, &addr) ? true : interface_contains(&addr);
+	return pool_contains(pool, &addr) ? true : localaddrs_contains(be_addr);
 }
 
 int blacklist_for_each(int (*func)(struct ipv4_prefix *, void *), void *arg,
@@ -1,4 +1,10 @@
 #include "nat64/mod/stateless/eam.h"
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <asm/unaligned.h>
+#include "nat64/mod/common/addr_cache.h"
+#include "nat64/mod/common/lpm.h"
 #include "nat64/mod/common/rtrie.h"
 #include "nat64/mod/common/types.h"
 
@@ -14,7 +20,55 @@
 #define ADDR_TO_KEY(addr)	INIT_KEY(addr, 8 * sizeof(*addr))
 #define PREFIX_TO_KEY(prefix)	INIT_KEY(&(prefix)->address, (prefix)->len)
 
+/**
+ * How long after the last change the tries are compiled.
+ * This is so adding entries one by one doesn't trigger one compilation each.
+ */
+#define COMPILE_DELAY		msecs_to_jiffies(200)
+
+/**
+ * An EAMT entry, as stored in the tries.
+ */
+struct eam {
+	/* Has to be first; eamt_foreach() hands these out as eamt_entries. */
+	struct eamt_entry entry;
+
+	/*
+	 * The rest is precomputed by eamt_add() so translating is just a
+	 * couple of shifts instead of a loop over the suffix bits.
+	 * Everything is in host byte order.
+	 */
+
+	/* @entry.prefix6's address, as two 64-bit halves. */
+	__u64 prefix6_hi;
+	__u64 prefix6_lo;
+	/* @entry.prefix4's address. */
+	__u32 prefix4;
+	/* Covers the IPv4 suffix. (Its length is the IPv4 suffix length.) */
+	__u32 suffix_mask;
+	/*
+	 * Distance between the end of the IPv6 address and the end of the
+	 * suffix's copy within it.
+	 */
+	unsigned int shift;
+};
+
+/**
+ * A read-only copy of the tries, compiled into lookup tables (see lpm.h).
+ */
+struct eamt_compiled {
+	/* lpm_lookup() returns indexes from @entries. */
+	struct lpm *lpm6;
+	struct lpm *lpm4;
+	unsigned int count;
+	struct eam entries[];
+};
+
 struct eam_table {
+	/**
+	 * The source of truth. Lookups fall back to these while @compiled is
+	 * missing.
+	 */
 	struct rtrie trie6;
 	struct rtrie trie4;
 	/**
@@ -22,9 +76,192 @@ struct eam_table {
 	 * config spinlock.
 	 */
 	u64 count;
+
+	/** NULL if the tries changed since the last compilation. */
+	struct eamt_compiled __rcu *compiled;
+	/** Bumped every time the tries change. Protected by @compile_lock. */
+	unsigned int generation;
+	struct delayed_work compile_work;
 };
 
 static struct eam_table eamt;
+static DEFINE_MUTEX(compile_lock);
+
+/**
+ * The table eamt_load() is receiving, one chunk at a time.
+ * Like the tries, this is protected by the configuration mutex.
+ */
+static struct {
+	struct eam *entries;
+	unsigned int count;
+	unsigned int capacity;
+	/** Whether we've received a first chunk but not its last one. */
+	bool loading;
+} pending;
+
+static void compiled_destroy(struct eamt_compiled *compiled)
+{
+	if (!compiled)
+		return;
+	lpm_destroy(compiled->lpm6);
+	lpm_destroy(compiled->lpm4);
+	vfree(compiled);
+}
+
+struct collect_args {
+	struct eamt_compiled *compiled;
+	unsigned int capacity;
+};
+
+static int count_cb(void *eam, void *arg)
+{
+	(*(unsigned int *)arg)++;
+	return 0;
+}
+
+static int collect_cb(void *eam, void *void_args)
+{
+	struct collect_args *args = void_args;
+	struct eamt_compiled *compiled = args->compiled;
+
+	/* The trie changed under our feet; the next compilation will fix it. */
+	if (compiled->count >= args->capacity)
+		return -EAGAIN;
+
+	compiled->entries[compiled->count++] = *(struct eam *)eam;
+	return 0;
+}
+
+static struct lpm *build_lpm(struct eamt_compiled *compiled, bool ipv6)
+{
+	struct lpm_prefix *prefixes;
+	struct eamt_entry *eam;
+	struct lpm *result;
+	unsigned int i;
+
+	prefixes = vmalloc(compiled->count * sizeof(*prefixes));
+	if (!prefixes)
+		return NULL;
+
+	for (i = 0; i < compiled->count; i++) {
+		eam = &compiled->entries[i].entry;
+		if (ipv6) {
+			prefixes[i].bytes = eam->prefix6.address.s6_addr;
+			prefixes[i].len = eam->prefix6.len;
+		} else {
+			prefixes[i].bytes = (__u8 *)&eam->prefix4.address;
+			prefixes[i].len = eam->prefix4.len;
+		}
+	}
+
+	result = lpm_build(ipv6 ? 16 : 4, prefixes, i);
+	vfree(prefixes);
+	return result;
+}
+
+static struct eamt_compiled *compiled_create(void)
+{
+	struct eamt_compiled *compiled;
+	struct collect_args args;
+	unsigned int count = 0;
+
+	rtrie_foreach(&eamt.trie6, count_cb, &count, NULL);
+	if (count == 0)
+		return NULL;
+
+	compiled = vmalloc(sizeof(*compiled)
+			+ count * sizeof(compiled->entries[0]));
+	if (!compiled)
+		return NULL;
+	compiled->lpm6 = NULL;
+	compiled->lpm4 = NULL;
+	compiled->count = 0;
+
+	args.compiled = compiled;
+	args.capacity = count;
+	if (rtrie_foreach(&eamt.trie6, collect_cb, &args, NULL))
+		goto fail;
+
+	compiled->lpm6 = build_lpm(compiled, true);
+	if (!compiled->lpm6)
+		goto fail;
+	compiled->lpm4 = build_lpm(compiled, false);
+	if (!compiled->lpm4)
+		goto fail;
+
+	return compiled;
+
+fail:
+	compiled_destroy(compiled);
+	return NULL;
+}
+
+/**
+ * compile - Replaces @eamt.compiled with a fresh compilation of the tries.
+ *
+ * If the tries change during the compilation, the result is dropped; whoever
+ * changed them has already scheduled another one.
+ * If the compilation fails, the lookups simply stay on the tries.
+ */
+static void compile(void)
+{
+	struct eamt_compiled *old;
+	struct eamt_compiled *new;
+	unsigned int generation;
+
+	mutex_lock(&compile_lock);
+	generation = eamt.generation;
+	mutex_unlock(&compile_lock);
+
+	new = compiled_create();
+	if (!new)
+		return;
+
+	mutex_lock(&compile_lock);
+	if (generation != eamt.generation) {
+		mutex_unlock(&compile_lock);
+		compiled_destroy(new);
+		return;
+	}
+	old = rcu_dereference_protected(eamt.compiled,
+			lockdep_is_held(&compile_lock));
+	rcu_assign_pointer(eamt.compiled, new);
+	mutex_unlock(&compile_lock);
+
+	if (old) {
+		synchronize_rcu_bh();
+		compiled_destroy(old);
+	}
+}
+
+static void compile_work_fn(struct work_struct *work)
+{
+	compile();
+}
+
+/**
+ * Has to be called after every change to the tries.
+ */
+static void invalidate(void)
+{
+	struct eamt_compiled *old;
+
+	mutex_lock(&compile_lock);
+	eamt.generation++;
+	old = rcu_dereference_protected(eamt.compiled,
+			lockdep_is_held(&compile_lock));
+	RCU_INIT_POINTER(eamt.compiled, NULL);
+	mutex_unlock(&compile_lock);
+
+	addrcache_invalidate();
+
+	schedule_delayed_work(&eamt.compile_work, COMPILE_DELAY);
+
+	if (old) {
+		synchronize_rcu_bh();
+		compiled_destroy(old);
+	}
+}
 
 static bool eamt_entry_equals(const struct eamt_entry *eam1,
 		const struct eamt_entry *eam2)
@@ -62,7 +299,8 @@ static int validate_prefixes(struct ipv6_prefix *prefix6,
 static int validate_overlapping(struct ipv6_prefix *prefix6,
 		struct ipv4_prefix *prefix4)
 {
-	struct eamt_entry old;
+	struct eam tmp;
+	struct eamt_entry *old = &tmp.entry;
 	struct rtrie_key key6 = PREFIX_TO_KEY(prefix6);
 	struct rtrie_key key4 = PREFIX_TO_KEY(prefix4);
 	int error;
@@ -70,23 +308,23 @@ static int validate_overlapping(struct ipv6_prefix *prefix6,
 	key6.len = 128;
 	key4.len = 32;
 
-	error = rtrie_get(&eamt.trie6, &key6, &old);
+	error = rtrie_get(&eamt.trie6, &key6, &tmp);
 	if (!error) {
 		pr_err("Prefix %pI6c/%u overlaps with EAMT entry "
 				"[%pI6c/%u|%pI4/%u]. ",
 				&prefix6->address, prefix6->len,
-				&old.prefix6.address, old.prefix6.len,
-				&old.prefix4.address, old.prefix4.len);
+				&old->prefix6.address, old->prefix6.len,
+				&old->prefix4.address, old->prefix4.len);
 		goto exists;
 	}
 
-	error = rtrie_get(&eamt.trie4, &key4, &old);
+	error = rtrie_get(&eamt.trie4, &key4, &tmp);
 	if (!error) {
 		pr_err("Prefix %pI4/%u overlaps with EAMT entry "
 				"[%pI6c/%u|%pI4/%u]. ",
 				&prefix4->address, prefix4->len,
-				&old.prefix6.address, old.prefix6.len,
-				&old.prefix4.address, old.prefix4.len);
+				&old->prefix6.address, old->prefix6.len,
+				&old->prefix4.address, old->prefix4.len);
 		goto exists;
 	}
 
@@ -107,42 +345,66 @@ static void __revert_add6(struct ipv6_prefix *prefix6)
 			"just added.", error);
 }
 
-static int eamt_add6(struct eamt_entry *eam)
+static int eamt_add6(struct eam *eam)
 {
 	int error;
 
 	error = rtrie_add(&eamt.trie6, eam,
-			offsetof(typeof(*eam), prefix6.address),
-			eam->prefix6.len);
+			offsetof(typeof(*eam), entry.prefix6.address),
+			eam->entry.prefix6.len);
 	if (error == -EEXIST) {
 		log_err("Prefix %pI6c/%u already exists.",
-				&eam->prefix6.address, eam->prefix6.len);
+				&eam->entry.prefix6.address,
+				eam->entry.prefix6.len);
 	}
 	/* rtrie_print("IPv6 trie after add", &eamt.trie6); */
 
 	return error;
 }
 
-static int eamt_add4(struct eamt_entry *eam)
+static int eamt_add4(struct eam *eam)
 {
 	int error;
 
 	error = rtrie_add(&eamt.trie4, eam,
-			offsetof(typeof(*eam), prefix4.address),
-			eam->prefix4.len);
+			offsetof(typeof(*eam), entry.prefix4.address),
+			eam->entry.prefix4.len);
 	if (error == -EEXIST) {
 		log_err("Prefix %pI4/%u already exists.",
-				&eam->prefix4.address, eam->prefix4.len);
+				&eam->entry.prefix4.address,
+				eam->entry.prefix4.len);
 	}
 	/* rtrie_print("IPv4 trie after add", &eamt.trie4); */
 
 	return error;
 }
 
+/**
+ * Fills in @eam's precomputed fields (see struct eam).
+ * Assumes validate_prefixes() already approved @eam's prefixes.
+ */
+static void eam_precompute(struct eam *eam)
+{
+	struct in6_addr *addr6 = &eam->entry.prefix6.address;
+	unsigned int suffix_len = ADDR4_BITS - eam->entry.prefix4.len;
+
+	eam->prefix6_hi = get_unaligned_be64(&addr6->s6_addr[0]);
+	eam->prefix6_lo = get_unaligned_be64(&addr6->s6_addr[8]);
+	eam->prefix4 = be32_to_cpu(eam->entry.prefix4.address.s_addr);
+
+	if (suffix_len == 0) {
+		eam->suffix_mask = 0;
+		eam->shift = 0;
+	} else {
+		eam->suffix_mask = ~0U >> (ADDR4_BITS - suffix_len);
+		eam->shift = ADDR6_BITS - eam->entry.prefix6.len - suffix_len;
+	}
+}
+
 int eamt_add(struct ipv6_prefix *prefix6, struct ipv4_prefix *prefix4,
 		bool force)
 {
-	struct eamt_entry new;
+	struct eam new;
 	int error;
 
 	error = validate_prefixes(prefix6, prefix4);
@@ -155,8 +417,9 @@ int eamt_add(struct ipv6_prefix *prefix6, struct ipv4_prefix *prefix4,
 			return error;
 	}
 
-	new.prefix6 = *prefix6;
-	new.prefix4 = *prefix4;
+	new.entry.prefix6 = *prefix6;
+	new.entry.prefix4 = *prefix4;
+	eam_precompute(&new);
 
 	error = eamt_add6(&new);
 	if (error)
@@ -168,10 +431,11 @@ int eamt_add(struct ipv6_prefix *prefix6, struct ipv4_prefix *prefix4,
 	}
 
 	eamt.count++;
+	invalidate();
 	return 0;
 }
 
-static int get_exact6(struct ipv6_prefix *prefix, struct eamt_entry *eam)
+static int get_exact6(struct ipv6_prefix *prefix, struct eam *eam)
 {
 	struct rtrie_key key = PREFIX_TO_KEY(prefix);
 	int error;
@@ -180,10 +444,10 @@ static int get_exact6(struct ipv6_prefix *prefix, struct eamt_entry *eam)
 	if (error)
 		return error;
 
-	return (eam->prefix6.len == prefix->len) ? 0 : -ESRCH;
+	return (eam->entry.prefix6.len == prefix->len) ? 0 : -ESRCH;
 }
 
-static int get_exact4(struct ipv4_prefix *prefix, struct eamt_entry *eam)
+static int get_exact4(struct ipv4_prefix *prefix, struct eam *eam)
 {
 	struct rtrie_key key = PREFIX_TO_KEY(prefix);
 	int error;
@@ -192,7 +456,7 @@ static int get_exact4(struct ipv4_prefix *prefix, struct eamt_entry *eam)
 	if (error)
 		return error;
 
-	return (eam->prefix4.len == prefix->len) ? 0 : -ESRCH;
+	return (eam->entry.prefix4.len == prefix->len) ? 0 : -ESRCH;
 }
 
 static int __rm(struct ipv6_prefix *prefix6, struct ipv4_prefix *prefix4)
@@ -209,6 +473,7 @@ static int __rm(struct ipv6_prefix *prefix6, struct ipv4_prefix *prefix4)
 		goto corrupted;
 
 	eamt.count--;
+	invalidate();
 	/* rtrie_print("IPv6 trie after remove", &eamt.trie6); */
 	/* rtrie_print("IPv4 trie after remove", &eamt.trie4); */
 	return 0;
@@ -222,8 +487,8 @@ corrupted:
 
 int eamt_rm(struct ipv6_prefix *prefix6, struct ipv4_prefix *prefix4)
 {
-	struct eamt_entry eam6;
-	struct eamt_entry eam4;
+	struct eam eam6;
+	struct eam eam4;
 	int error;
 
 	if (WARN(!prefix6 && !prefix4, "Prefixes can't both be NULL"))
@@ -231,12 +496,12 @@ int eamt_rm(struct ipv6_prefix *prefix6, struct ipv4_prefix *prefix4)
 
 	if (!prefix4) {
 		error = get_exact6(prefix6, &eam6);
-		return error ? error : __rm(prefix6, &eam6.prefix4);
+		return error ? error : __rm(prefix6, &eam6.entry.prefix4);
 	}
 
 	if (!prefix6) {
 		error = get_exact4(prefix4, &eam4);
-		return error ? error : __rm(&eam4.prefix6, prefix4);
+		return error ? error : __rm(&eam4.entry.prefix6, prefix4);
 	}
 
 	error = get_exact6(prefix6, &eam6);
@@ -246,71 +511,124 @@ int eamt_rm(struct ipv6_prefix *prefix6, struct ipv4_prefix *prefix4)
 	if (error)
 		return error;
 
-	return eamt_entry_equals(&eam6, &eam4)
+	return eamt_entry_equals(&eam6.entry, &eam4.entry)
 			? __rm(prefix6, prefix4)
 			: -ESRCH;
 }
 
-bool eamt_contains6(struct in6_addr *addr)
+/**
+ * Finds the EAMT entry @addr belongs to.
+ */
+static int get6(struct in6_addr *addr, struct eam *result)
+{
+	struct rtrie_key key = ADDR_TO_KEY(addr);
+	struct eamt_compiled *compiled;
+	int index;
+
+	rcu_read_lock_bh();
+	compiled = rcu_dereference_bh(eamt.compiled);
+	if (compiled) {
+		index = lpm_lookup(compiled->lpm6, addr->s6_addr);
+		if (index >= 0)
+			*result = compiled->entries[index];
+		rcu_read_unlock_bh();
+		return (index >= 0) ? 0 : -ESRCH;
+	}
+	rcu_read_unlock_bh();
+
+	return rtrie_get(&eamt.trie6, &key, result);
+}
+
+/**
+ * Finds the EAMT entry @addr belongs to.
+ */
+static int get4(struct in_addr *addr, struct eam *result)
 {
 	struct rtrie_key key = ADDR_TO_KEY(addr);
-	return rtrie_contains(&eamt.trie6, &key);
+	struct eamt_compiled *compiled;
+	int index;
+
+	rcu_read_lock_bh();
+	compiled = rcu_dereference_bh(eamt.compiled);
+	if (compiled) {
+		index = lpm_lookup(compiled->lpm4, (__u8 *)addr);
+		if (index >= 0)
+			*result = compiled->entries[index];
+		rcu_read_unlock_bh();
+		return (index >= 0) ? 0 : -ESRCH;
+	}
+	rcu_read_unlock_bh();
+
+	return rtrie_get(&eamt.trie4, &key, result);
+}
+
+bool eamt_contains6(struct in6_addr *addr)
+{
+	struct eam eam;
+	return !get6(addr, &eam);
 }
 
 bool eamt_contains4(__u32 addr)
 {
 	struct in_addr tmp = { .s_addr = addr };
-	struct rtrie_key key = ADDR_TO_KEY(&tmp);
-	return rtrie_contains(&eamt.trie4, &key);
+	struct eam eam;
+	return !get4(&tmp, &eam);
 }
 
 int eamt_xlat_6to4(struct in6_addr *addr6, struct in_addr *result)
 {
-	struct rtrie_key key = ADDR_TO_KEY(addr6);
-	struct eamt_entry eam;
-	unsigned int i;
+	struct eam eam;
+	__u64 hi, lo;
+	__u32 suffix;
 	int error;
 
 	/* Find the entry. */
-	error = rtrie_get(&eamt.trie6, &key, &eam);
+	error = get6(addr6, &eam);
 	if (error)
 		return error;
 
-	/* Translate the address. */
-	for (i = 0; i < ADDR4_BITS - eam.prefix4.len; i++) {
-		unsigned int offset4 = eam.prefix4.len + i;
-		unsigned int offset6 = eam.prefix6.len + i;
-		addr4_set_bit(&eam.prefix4.address, offset4,
-				addr6_get_bit(addr6, offset6));
-	}
+	/* Translate the address. (Shift the 128-bit address right.) */
+	hi = get_unaligned_be64(&addr6->s6_addr[0]);
+	lo = get_unaligned_be64(&addr6->s6_addr[8]);
+	if (eam.shift == 0)
+		suffix = lo;
+	else if (eam.shift < 64)
+		suffix = (lo >> eam.shift) | (hi << (64 - eam.shift));
+	else
+		suffix = hi >> (eam.shift - 64);
 
 	/* I'm assuming the prefix address is already zero-trimmed. */
-	*result = eam.prefix4.address;
+	result->s_addr = cpu_to_be32(eam.prefix4 | (suffix & eam.suffix_mask));
 	return 0;
 }
 
 int eamt_xlat_4to6(struct in_addr *addr4, struct in6_addr *result)
 {
-	struct rtrie_key key = ADDR_TO_KEY(addr4);
-	struct eamt_entry eam;
-	unsigned int i;
+	struct eam eam;
+	__u64 suffix;
+	__u64 hi, lo;
 	int error;
 
 	/* Find the entry. */
-	error = rtrie_get(&eamt.trie4, &key, &eam);
+	error = get4(addr4, &eam);
 	if (error)
 		return error;
 
-	/* Translate the address. */
-	for (i = 0; i < ADDR4_BITS - eam.prefix4.len; i++) {
-		unsigned int offset4 = eam.prefix4.len + i;
-		unsigned int offset6 = eam.prefix6.len + i;
-		addr6_set_bit(&eam.prefix6.address, offset6,
-				addr4_get_bit(addr4, offset4));
+	/* Translate the address. (Shift the suffix left into place.) */
+	suffix = be32_to_cpu(addr4->s_addr) & eam.suffix_mask;
+	/* I'm assuming the prefix address is already zero-trimmed. */
+	hi = eam.prefix6_hi;
+	lo = eam.prefix6_lo;
+	if (eam.shift < 64) {
+		lo |= suffix << eam.shift;
+		if (eam.shift != 0)
+			hi |= suffix >> (64 - eam.shift);
+	} else {
+		hi |= suffix << (eam.shift - 64);
 	}
 
-	/* I'm assuming the prefix address is already zero-trimmed. */
-	*result = eam.prefix6.address;
+	put_unaligned_be64(hi, &result->s6_addr[0]);
+	put_unaligned_be64(lo, &result->s6_addr[8]);
 	return 0;
 }
 
@@ -360,19 +678,315 @@ void eamt_flush(void)
 	rtrie_flush(&eamt.trie6);
 	rtrie_flush(&eamt.trie4);
 	eamt.count = 0;
+	invalidate();
+}
+
+static void pending_reset(void)
+{
+	vfree(pending.entries);
+	pending.entries = NULL;
+	pending.count = 0;
+	pending.capacity = 0;
+	pending.loading = false;
+}
+
+static int pending_append(struct eamt_entry *entries, unsigned int count)
+{
+	struct eam *new_entries;
+	unsigned int capacity;
+	struct eam *eam;
+	unsigned int i;
+	int error;
+
+	if (pending.count + count > pending.capacity) {
+		capacity = pending.capacity ? pending.capacity : 1024;
+		while (capacity < pending.count + count)
+			capacity *= 2;
+
+		new_entries = vmalloc(capacity * sizeof(*new_entries));
+		if (!new_entries)
+			return -ENOMEM;
+		if (pending.entries) {
+			memcpy(new_entries, pending.entries,
+					pending.count * sizeof(*new_entries));
+			vfree(pending.entries);
+		}
+
+		pending.entries = new_entries;
+		pending.capacity = capacity;
+	}
+
+	for (i = 0; i < count; i++) {
+		error = validate_prefixes(&entries[i].prefix6,
+				&entries[i].prefix4);
+		if (error)
+			return error;
+
+		eam = &pending.entries[pending.count + i];
+		eam->entry = entries[i];
+		eam_precompute(eam);
+	}
+
+	pending.count += count;
+	return 0;
+}
+
+static int compare_prefix6(const void *a, const void *b)
+{
+	const struct eam *eam1 = a;
+	const struct eam *eam2 = b;
+
+	if (eam1->prefix6_hi != eam2->prefix6_hi)
+		return (eam1->prefix6_hi < eam2->prefix6_hi) ? -1 : 1;
+	if (eam1->prefix6_lo != eam2->prefix6_lo)
+		return (eam1->prefix6_lo < eam2->prefix6_lo) ? -1 : 1;
+	return ((int)eam1->entry.prefix6.len) - ((int)eam2->entry.prefix6.len);
+}
+
+static int compare_prefix4(const void *a, const void *b)
+{
+	const struct eam *eam1 = a;
+	const struct eam *eam2 = b;
+
+	if (eam1->prefix4 != eam2->prefix4)
+		return (eam1->prefix4 < eam2->prefix4) ? -1 : 1;
+	return ((int)eam1->entry.prefix4.len) - ((int)eam2->entry.prefix4.len);
+}
+
+/**
+ * Validates the pending entries' IPv6 prefixes. Has to be called right after
+ * the entries were sorted by compare_prefix6().
+ *
+ * Once sorted, if some prefix contains other prefixes, the first one of them
+ * will be its neighbor. So we only need to compare adjacent entries.
+ */
+static int validate_sorted6(bool force)
+{
+	struct eamt_entry *prev;
+	struct eamt_entry *curr;
+	unsigned int i;
+
+	for (i = 1; i < pending.count; i++) {
+		prev = &pending.entries[i - 1].entry;
+		curr = &pending.entries[i].entry;
+
+		if (prefix6_equals(&prev->prefix6, &curr->prefix6)) {
+			log_err("Prefix %pI6c/%u is repeated.",
+					&curr->prefix6.address,
+					curr->prefix6.len);
+			return -EEXIST;
+		}
+
+		if (!force && prefix6_contains(&prev->prefix6,
+				&curr->prefix6.address)) {
+			log_err("Prefix %pI6c/%u overlaps with prefix %pI6c/%u. "
+					"Use --force to override this validation.",
+					&prev->prefix6.address, prev->prefix6.len,
+					&curr->prefix6.address, curr->prefix6.len);
+			return -EEXIST;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * IPv4 version of validate_sorted6(). The entries have to be sorted by
+ * compare_prefix4().
+ */
+static int validate_sorted4(bool force)
+{
+	struct eamt_entry *prev;
+	struct eamt_entry *curr;
+	unsigned int i;
+
+	for (i = 1; i < pending.count; i++) {
+		prev = &pending.entries[i - 1].entry;
+		curr = &pending.entries[i].entry;
+
+		if (prefix4_equals(&prev->prefix4, &curr->prefix4)) {
+			log_err("Prefix %pI4/%u is repeated.",
+					&curr->prefix4.address,
+					curr->prefix4.len);
+			return -EEXIST;
+		}
+
+		if (!force && prefix4_contains(&prev->prefix4,
+				&curr->prefix4.address)) {
+			log_err("Prefix %pI4/%u overlaps with prefix %pI4/%u. "
+					"Use --force to override this validation.",
+					&prev->prefix4.address, prev->prefix4.len,
+					&curr->prefix4.address, curr->prefix4.len);
+			return -EEXIST;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Returns a compilation of the pending entries, or NULL if it could not be
+ * built (in which case the lookups will have to make do with the tries).
+ */
+static struct eamt_compiled *compile_pending(void)
+{
+	struct eamt_compiled *compiled;
+
+	compiled = vmalloc(sizeof(*compiled)
+			+ pending.count * sizeof(compiled->entries[0]));
+	if (!compiled)
+		return NULL;
+	compiled->count = pending.count;
+	memcpy(compiled->entries, pending.entries,
+			pending.count * sizeof(compiled->entries[0]));
+	compiled->lpm4 = NULL;
+
+	compiled->lpm6 = build_lpm(compiled, true);
+	if (!compiled->lpm6)
+		goto fail;
+	compiled->lpm4 = build_lpm(compiled, false);
+	if (!compiled->lpm4)
+		goto fail;
+
+	return compiled;
+
+fail:
+	compiled_destroy(compiled);
+	return NULL;
+}
+
+/**
+ * Replaces the table with the pending entries.
+ */
+static int commit_pending(bool force)
+{
+	struct rtrie trie6;
+	struct rtrie trie4;
+	struct eamt_compiled *old;
+	struct eamt_compiled *new = NULL;
+	struct eam *eam;
+	unsigned int i;
+	int error;
+
+	/* Validate. */
+	sort(pending.entries, pending.count, sizeof(*pending.entries),
+			compare_prefix4, NULL);
+	error = validate_sorted4(force);
+	if (error)
+		return error;
+	sort(pending.entries, pending.count, sizeof(*pending.entries),
+			compare_prefix6, NULL);
+	error = validate_sorted6(force);
+	if (error)
+		return error;
+
+	/* Build the new table. Nobody can see it yet, so no grace periods. */
+	rtrie_init(&trie6, sizeof(struct eam));
+	rtrie_init(&trie4, sizeof(struct eam));
+	for (i = 0; i < pending.count; i++) {
+		eam = &pending.entries[i];
+		error = rtrie_add_offline(&trie6, eam,
+				offsetof(typeof(*eam), entry.prefix6.address),
+				eam->entry.prefix6.len);
+		if (error)
+			goto fail;
+		error = rtrie_add_offline(&trie4, eam,
+				offsetof(typeof(*eam), entry.prefix4.address),
+				eam->entry.prefix4.len);
+		if (error)
+			goto fail;
+	}
+
+	if (pending.count)
+		new = compile_pending();
+
+	/*
+	 * Swap it in.
+	 * If the compilation worked, readers jump to the new table as soon as
+	 * @eamt.compiled changes. Otherwise each trie is replaced atomically,
+	 * so every lookup still sees either the old table or the new one.
+	 */
+	mutex_lock(&compile_lock);
+	eamt.generation++;
+	old = rcu_dereference_protected(eamt.compiled,
+			lockdep_is_held(&compile_lock));
+	rcu_assign_pointer(eamt.compiled, new);
+	rtrie_replace(&eamt.trie6, &trie6);
+	rtrie_replace(&eamt.trie4, &trie4);
+	eamt.count = pending.count;
+	mutex_unlock(&compile_lock);
+
+	addrcache_invalidate();
+
+	synchronize_rcu_bh();
+
+	compiled_destroy(old);
+	/* These now hold the old table. */
+	rtrie_destroy(&trie6);
+	rtrie_destroy(&trie4);
+	return 0;
+
+fail:
+	rtrie_destroy(&trie6);
+	rtrie_destroy(&trie4);
+	return error;
+}
+
+/**
+ * eamt_load - Replaces the whole table with the entries userspace sends.
+ *
+ * The table is streamed over several calls; @first starts a new load and
+ * @last finishes it. The old table stays in place (and is the only one
+ * lookups can see) until the last chunk arrives and the new one is validated
+ * and built.
+ * If any chunk fails, the whole load is dropped.
+ */
+int eamt_load(struct eamt_entry *entries, unsigned int count,
+		bool first, bool last, bool force)
+{
+	int error;
+
+	if (first) {
+		pending_reset();
+	} else if (!pending.loading) {
+		log_err("Received an EAMT chunk, but no load is in progress.");
+		return -EINVAL;
+	}
+	pending.loading = true;
+
+	error = pending_append(entries, count);
+	if (error)
+		goto end;
+
+	if (!last)
+		return 0;
+
+	log_debug("Loading %u EAMT entries.", pending.count);
+	error = commit_pending(force);
+	/* Fall through. */
+
+end:
+	pending_reset();
+	return error;
 }
 
 int eamt_init(void)
 {
-	rtrie_init(&eamt.trie6, sizeof(struct eamt_entry));
-	rtrie_init(&eamt.trie4, sizeof(struct eamt_entry));
+	rtrie_init(&eamt.trie6, sizeof(struct eam));
+	rtrie_init(&eamt.trie4, sizeof(struct eam));
 	eamt.count = 0;
+	RCU_INIT_POINTER(eamt.compiled, NULL);
+	eamt.generation = 0;
+	INIT_DELAYED_WORK(&eamt.compile_work, compile_work_fn);
 	return 0;
 }
 
 void eamt_destroy(void)
 {
 	log_debug("Emptying the Address Mapping table...");
+	cancel_delayed_work_sync(&eamt.compile_work);
+	pending_reset();
+	compiled_destroy(rcu_dereference_raw(eamt.compiled));
 	rtrie_destroy(&eamt.trie6);
 	rtrie_destroy(&eamt.trie4);
 }
@@ -26,3 +26,11 @@ verdict handling_hairpinning(struct packet *in, struct tuple *tuple)
 	log_debug("Done hairpinning.");
 	return VERDICT_CONTINUE;
 }
+
+verdict hairpin_shortcut(struct packet *in, struct tuple *tuple_out,
+		struct packet *out)
+{
+	/* Intrinsic hairpins are rare and EAM-dependent; no shortcut. */
+	out->skb = NULL;
+	return VERDICT_CONTINUE;
+}
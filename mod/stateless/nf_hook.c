@@ -1,10 +1,16 @@
 #include "nat64/mod/common/nf_hook.h"
+#include "nat64/mod/common/addr_cache.h"
 #include "nat64/mod/common/config.h"
 #include "nat64/mod/common/core.h"
+#include "nat64/mod/common/icmp_wrapper.h"
+#include "nat64/mod/common/ipv4_id.h"
+#include "nat64/mod/common/local_addrs.h"
 #include "nat64/mod/common/namespace.h"
 #include "nat64/mod/common/nf_wrapper.h"
 #include "nat64/mod/common/nl_handler.h"
 #include "nat64/mod/common/pool6.h"
+#include "nat64/mod/common/prefilter.h"
+#include "nat64/mod/common/route.h"
 #include "nat64/mod/common/types.h"
 #include "nat64/mod/common/log_time.h"
 #include "nat64/mod/stateless/eam.h"
@@ -73,6 +79,21 @@ static int __init nat64_init(void)
 	error = config_init(disabled);
 	if (error)
 		goto config_failure;
+	error = route_init();
+	if (error)
+		goto route_failure;
+	error = icmp64_init();
+	if (error)
+		goto icmp64_failure;
+	error = addrcache_init();
+	if (error)
+		goto addrcache_failure;
+	error = localaddrs_init();
+	if (error)
+		goto localaddrs_failure;
+	error = ipv4id_init();
+	if (error)
+		goto ipv4id_failure;
 	error = eamt_init();
 	if (error)
 		goto eamt_failure;
@@ -93,6 +114,9 @@ static int __init nat64_init(void)
 	error = rfc6791_init(pool6791, pool6791_size);
 	if (error)
 		goto rfc6791_failure;
+	error = prefilter_init();
+	if (error)
+		goto prefilter_failure;
 
 	/* Hook Jool to Netfilter. */
 	error = nf_register_hooks(nfho, ARRAY_SIZE(nfho));
@@ -104,6 +128,9 @@ static int __init nat64_init(void)
 	return error;
 
 nf_register_hooks_failure:
+	prefilter_destroy();
+
+prefilter_failure:
 	rfc6791_destroy();
 
 rfc6791_failure:
@@ -124,6 +151,21 @@ log_time_failure:
 	eamt_destroy();
 
 eamt_failure:
+	ipv4id_destroy();
+
+ipv4id_failure:
+	localaddrs_destroy();
+
+localaddrs_failure:
+	addrcache_destroy();
+
+addrcache_failure:
+	icmp64_destroy();
+
+icmp64_failure:
+	route_destroy();
+
+route_failure:
 	config_destroy();
 
 config_failure:
@@ -139,6 +181,7 @@ static void __exit nat64_exit(void)
 	nf_unregister_hooks(nfho, ARRAY_SIZE(nfho));
 
 	/* Deinitialize the submodules. */
+	prefilter_destroy();
 	rfc6791_destroy();
 	blacklist_destroy();
 	pool6_destroy();
@@ -147,6 +190,11 @@ static void __exit nat64_exit(void)
 	logtime_destroy();
 #endif
 	eamt_destroy();
+	ipv4id_destroy();
+	localaddrs_destroy();
+	addrcache_destroy();
+	icmp64_destroy();
+	route_destroy();
 	config_destroy();
 	joolns_destroy();
 
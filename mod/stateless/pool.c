@@ -1,7 +1,9 @@
 #include "nat64/mod/stateless/pool.h"
 
-#include <linux/rculist.h>
 #include <linux/inet.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
 
 #include "nat64/common/str_utils.h"
 #include "nat64/mod/common/rcu.h"
@@ -10,12 +12,6 @@
 /* I can't have per-pool mutexes because of the replace function. */
 static DEFINE_MUTEX(lock);
 
-RCUTAG_FREE
-static struct pool_entry *get_entry(struct list_head *node)
-{
-	return list_entry(node, struct pool_entry, list_hook);
-}
-
 RCUTAG_FREE
 static int parse_prefix4(const char *str, struct ipv4_prefix *prefix)
 {
@@ -38,42 +34,172 @@ static int parse_prefix4(const char *str, struct ipv4_prefix *prefix)
 	return error;
 }
 
-RCUTAG_FREE
-static void __destroy(struct list_head *pool)
+/*
+ * Blacklists can get big, so don't insist on physically contiguous memory.
+ */
+RCUTAG_USR
+static struct addr4_pool *pool_alloc(unsigned int count)
 {
-	struct list_head *node;
-	struct list_head *tmp;
+	struct addr4_pool *result;
+	size_t size;
 
-	list_for_each_safe(node, tmp, pool) {
-		list_del(node);
-		kfree(get_entry(node));
+	size = sizeof(*result) + count * sizeof(result->entries[0]);
+	if (size <= PAGE_SIZE) {
+		result = kmalloc(size, GFP_KERNEL);
+	} else {
+		result = kmalloc(size, GFP_KERNEL | __GFP_NOWARN);
+		if (!result)
+			result = vmalloc(size);
 	}
 
-	kfree(pool);
+	if (result)
+		result->count = count;
+	return result;
 }
 
-RCUTAG_USR /* Only because of GFP_KERNEL. Can be easily upgraded to FREE. */
-static struct list_head *create_pool(void)
+RCUTAG_FREE
+static void pool_free(struct addr4_pool *pool)
 {
-	struct list_head *result;
+	if (is_vmalloc_addr(pool))
+		vfree(pool);
+	else
+		kfree(pool);
+}
 
-	result = kmalloc(sizeof(*result), GFP_KERNEL);
-	if (!result)
-		return NULL;
-	INIT_LIST_HEAD(result);
+/**
+ * Returns @prefix's first address, in host byte order.
+ */
+RCUTAG_FREE
+static __u32 get_first(struct ipv4_prefix *prefix)
+{
+	if (prefix->len == 0)
+		return 0;
+	return be32_to_cpu(prefix->address.s_addr)
+			& (0xFFFFFFFFU << (32 - min_t(__u8, prefix->len, 32)));
+}
+
+RCUTAG_FREE
+static void init_entry(struct pool_entry *entry, struct ipv4_prefix *prefix)
+{
+	entry->prefix = *prefix;
+	entry->first = get_first(prefix);
+}
+
+/**
+ * Fills in the @offset fields of @pool's entries.
+ */
+RCUTAG_FREE
+static void compute_offsets(struct addr4_pool *pool)
+{
+	__u64 offset = 0;
+	unsigned int i;
+
+	for (i = 0; i < pool->count; i++) {
+		pool->entries[i].offset = offset;
+		offset += prefix4_get_addr_count(&pool->entries[i].prefix);
+	}
+}
+
+/**
+ * Returns the index of the last entry from @pool whose first address is lower
+ * or equal than @addr (host byte order), or -1 if there is no such entry.
+ */
+RCUTAG_FREE
+static int find_entry(struct addr4_pool *pool, __u32 addr)
+{
+	int left = 0;
+	int right = ((int) pool->count) - 1;
+	int middle;
+	int result = -1;
+
+	while (left <= right) {
+		middle = left + (right - left) / 2;
+		if (pool->entries[middle].first <= addr) {
+			result = middle;
+			left = middle + 1;
+		} else {
+			right = middle - 1;
+		}
+	}
 
 	return result;
 }
 
+/**
+ * Returns the index of the entry from @pool that contains the @n'th address of
+ * the pool. @n has to be lower than the pool's address count.
+ */
+RCUTAG_FREE
+static unsigned int find_nth(struct addr4_pool *pool, __u64 n)
+{
+	unsigned int left = 0;
+	unsigned int right = pool->count - 1;
+	unsigned int middle;
+
+	while (left < right) {
+		middle = left + (right - left + 1) / 2;
+		if (pool->entries[middle].offset <= n)
+			left = middle;
+		else
+			right = middle - 1;
+	}
+
+	return left;
+}
+
+RCUTAG_FREE
+static __u64 addr_count(struct addr4_pool *pool)
+{
+	struct pool_entry *last;
+
+	if (pool->count == 0)
+		return 0;
+
+	last = &pool->entries[pool->count - 1];
+	return last->offset + prefix4_get_addr_count(&last->prefix);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	const struct pool_entry *entry1 = a;
+	const struct pool_entry *entry2 = b;
+
+	if (entry1->first != entry2->first)
+		return (entry1->first < entry2->first) ? -1 : 1;
+	return ((int) entry1->prefix.len) - ((int) entry2->prefix.len);
+}
+
+/**
+ * Swaps @new in place of @pool's current table, and frees the old one once
+ * nobody can be looking at it anymore.
+ */
 RCUTAG_USR
-int pool_init(struct list_head __rcu **pool, char *pref_strs[], int pref_count)
+static void pool_replace(struct addr4_pool __rcu **pool, struct addr4_pool *new)
 {
-	struct list_head *result;
-	struct pool_entry *entry;
+	struct addr4_pool *old;
+
+	mutex_lock(&lock);
+	old = rcu_dereference_protected(*pool, lockdep_is_held(&lock));
+	rcu_assign_pointer(*pool, new);
+	mutex_unlock(&lock);
+
+	synchronize_rcu_bh();
+
+	if (old)
+		pool_free(old);
+}
+
+RCUTAG_USR
+int pool_init(struct addr4_pool __rcu **pool, char *pref_strs[], int pref_count)
+{
+	struct addr4_pool *result;
+	struct pool_entry *prev;
+	struct pool_entry *curr;
+	struct ipv4_prefix prefix;
 	unsigned int i;
 	int error;
 
-	result = create_pool();
+	result = pool_alloc(pref_count);
 	if (!result)
 		return -ENOMEM;
 
@@ -81,20 +207,30 @@ int pool_init(struct list_head __rcu **pool, char *pref_strs[], int pref_count)
 		log_debug("Inserting address or prefix to the IPv4 pool: %s.",
 				pref_strs[i]);
 
-		entry = kmalloc(sizeof(*entry), GFP_KERNEL);
-		if (!entry) {
-			error = -ENOMEM;
+		error = parse_prefix4(pref_strs[i], &prefix);
+		if (error)
 			goto revert;
-		}
+		error = prefix4_validate(&prefix);
+		if (error)
+			goto revert;
+		init_entry(&result->entries[i], &prefix);
+	}
 
-		error = parse_prefix4(pref_strs[i], &entry->prefix);
-		if (error) {
-			kfree(entry);
+	/* Sorted, an entry can only intersect with its neighbors. */
+	sort(result->entries, result->count, sizeof(result->entries[0]),
+			compare_entries, NULL);
+	for (i = 1; i < result->count; i++) {
+		prev = &result->entries[i - 1];
+		curr = &result->entries[i];
+		if (prefix4_intersects(&prev->prefix, &curr->prefix)) {
+			log_err("Pool entries %pI4/%u and %pI4/%u intersect.",
+					&prev->prefix.address, prev->prefix.len,
+					&curr->prefix.address, curr->prefix.len);
+			error = -EEXIST;
 			goto revert;
 		}
-
-		list_add_tail(&entry->list_hook, result);
 	}
+	compute_offsets(result);
 
 	mutex_lock(&lock);
 	rcu_assign_pointer(*pool, result);
@@ -102,104 +238,118 @@ int pool_init(struct list_head __rcu **pool, char *pref_strs[], int pref_count)
 	return 0;
 
 revert:
-	__destroy(result);
+	pool_free(result);
 	return error;
 }
 
 RCUTAG_USR
-static void pool_replace(struct list_head __rcu **pool, struct list_head *new)
-{
-	struct list_head *tmp;
-
-	mutex_lock(&lock);
-	tmp = rcu_dereference_protected(*pool, lockdep_is_held(&lock));
-	rcu_assign_pointer(*pool, new);
-	mutex_unlock(&lock);
-
-	synchronize_rcu_bh();
-
-	__destroy(tmp);
-}
-
-RCUTAG_USR
-void pool_destroy(struct list_head __rcu **pool)
+void pool_destroy(struct addr4_pool __rcu **pool)
 {
 	pool_replace(pool, NULL);
 }
 
 RCUTAG_USR
-int pool_add(struct list_head __rcu *pool, struct ipv4_prefix *prefix)
+int pool_add(struct addr4_pool __rcu **pool, struct ipv4_prefix *prefix)
 {
-	struct list_head *list;
-	struct list_head *node;
-	struct pool_entry *entry;
+	struct addr4_pool *old;
+	struct addr4_pool *new;
+	struct pool_entry entry;
+	struct pool_entry *neighbor;
+	unsigned int i;
 	int error;
 
 	error = prefix4_validate(prefix);
 	if (error)
 		return error;
+	init_entry(&entry, prefix);
 
 	mutex_lock(&lock);
-
-	list = rcu_dereference_protected(pool, lockdep_is_held(&lock));
-	list_for_each(node, list) {
-		entry = get_entry(node);
-		if (prefix4_intersects(&entry->prefix, prefix)) {
-			log_err("The requested entry intersects with pool "
-					"entry %pI4/%u.",
-					&entry->prefix.address,
-					entry->prefix.len);
-			error = -EEXIST;
-			goto end;
-		}
+	old = rcu_dereference_protected(*pool, lockdep_is_held(&lock));
+
+	/*
+	 * @i is where the new entry goes. Only the entries next to it can
+	 * intersect with it.
+	 */
+	i = find_entry(old, entry.first) + 1;
+	if (i > 0) {
+		neighbor = &old->entries[i - 1];
+		if (prefix4_intersects(&neighbor->prefix, prefix))
+			goto intersects;
+	}
+	if (i < old->count) {
+		neighbor = &old->entries[i];
+		if (prefix4_intersects(&neighbor->prefix, prefix))
+			goto intersects;
 	}
 
-	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
-	if (!entry) {
-		error = -ENOMEM;
-		goto end;
+	new = pool_alloc(old->count + 1);
+	if (!new) {
+		mutex_unlock(&lock);
+		return -ENOMEM;
 	}
-	entry->prefix = *prefix;
 
-	list_add_tail_rcu(&entry->list_hook, list);
+	memcpy(&new->entries[0], &old->entries[0], i * sizeof(entry));
+	new->entries[i] = entry;
+	memcpy(&new->entries[i + 1], &old->entries[i],
+			(old->count - i) * sizeof(entry));
+	compute_offsets(new);
 
-end:
+	rcu_assign_pointer(*pool, new);
 	mutex_unlock(&lock);
-	return error;
+
+	synchronize_rcu_bh();
+	pool_free(old);
+	return 0;
+
+intersects:
+	log_err("The requested entry intersects with pool entry %pI4/%u.",
+			&neighbor->prefix.address, neighbor->prefix.len);
+	mutex_unlock(&lock);
+	return -EEXIST;
 }
 
 RCUTAG_USR
-int pool_rm(struct list_head __rcu *pool, struct ipv4_prefix *prefix)
+int pool_rm(struct addr4_pool __rcu **pool, struct ipv4_prefix *prefix)
 {
-	struct list_head *list;
-	struct list_head *node;
-	struct pool_entry *entry;
+	struct addr4_pool *old;
+	struct addr4_pool *new;
+	int i;
 
 	mutex_lock(&lock);
+	old = rcu_dereference_protected(*pool, lockdep_is_held(&lock));
 
-	list = rcu_dereference_protected(pool, lockdep_is_held(&lock));
-	list_for_each(node, list) {
-		entry = get_entry(node);
-		if (prefix4_equals(prefix, &entry->prefix)) {
-			list_del_rcu(&entry->list_hook);
-			mutex_unlock(&lock);
-			synchronize_rcu_bh();
-			kfree(entry);
-			return 0;
-		}
+	i = find_entry(old, get_first(prefix));
+	if (i < 0 || !prefix4_equals(prefix, &old->entries[i].prefix)) {
+		mutex_unlock(&lock);
+		log_err("Could not find the requested entry in the IPv4 pool.");
+		return -ESRCH;
+	}
+
+	new = pool_alloc(old->count - 1);
+	if (!new) {
+		mutex_unlock(&lock);
+		return -ENOMEM;
 	}
 
+	memcpy(&new->entries[0], &old->entries[0], i * sizeof(new->entries[0]));
+	memcpy(&new->entries[i], &old->entries[i + 1],
+			(old->count - i - 1) * sizeof(new->entries[0]));
+	compute_offsets(new);
+
+	rcu_assign_pointer(*pool, new);
 	mutex_unlock(&lock);
-	log_err("Could not find the requested entry in the IPv4 pool.");
-	return -ESRCH;
+
+	synchronize_rcu_bh();
+	pool_free(old);
+	return 0;
 }
 
 RCUTAG_USR
-int pool_flush(struct list_head __rcu **pool)
+int pool_flush(struct addr4_pool __rcu **pool)
 {
-	struct list_head *new;
+	struct addr4_pool *new;
 
-	new = create_pool();
+	new = pool_alloc(0);
 	if (!new)
 		return -ENOMEM;
 
@@ -208,47 +358,73 @@ int pool_flush(struct list_head __rcu **pool)
 }
 
 RCUTAG_PKT
-bool pool_contains(struct list_head __rcu *pool, struct in_addr *addr)
+bool pool_contains(struct addr4_pool __rcu *pool, struct in_addr *addr)
+{
+	struct addr4_pool *table;
+	bool result;
+	int i;
+
+	rcu_read_lock_bh();
+
+	table = rcu_dereference_bh(pool);
+	i = find_entry(table, be32_to_cpu(addr->s_addr));
+	result = (i >= 0) && prefix4_contains(&table->entries[i].prefix, addr);
+
+	rcu_read_unlock_bh();
+	return result;
+}
+
+/**
+ * pool_get_nth - Returns (in @result) the address of @pool whose index is @n,
+ * modulo the number of addresses in the pool.
+ *
+ * Returns -ESRCH if the pool is empty.
+ */
+RCUTAG_PKT
+int pool_get_nth(struct addr4_pool __rcu *pool, __u32 n, struct in_addr *result)
 {
-	struct list_head *list;
-	struct list_head *node;
+	struct addr4_pool *table;
 	struct pool_entry *entry;
+	__u64 count;
 
 	rcu_read_lock_bh();
 
-	list = rcu_dereference_bh(pool);
-	list_for_each_rcu_bh(node, list) {
-		entry = get_entry(node);
-		if (prefix4_contains(&entry->prefix, addr)) {
-			rcu_read_unlock_bh();
-			return true;
-		}
+	table = rcu_dereference_bh(pool);
+	count = addr_count(table);
+	if (count == 0) {
+		rcu_read_unlock_bh();
+		return -ESRCH;
 	}
 
+	/* unsigned int % __u64 does something weird, hence the trouble. */
+	if (count <= 0xFFFFFFFFU)
+		n %= (__u32) count;
+
+	entry = &table->entries[find_nth(table, n)];
+	result->s_addr = cpu_to_be32(entry->first + (__u32) (n - entry->offset));
+
 	rcu_read_unlock_bh();
-	return false;
+	return 0;
 }
 
 RCUTAG_PKT
-int pool_foreach(struct list_head __rcu *pool,
+int pool_foreach(struct addr4_pool __rcu *pool,
 		int (*func)(struct ipv4_prefix *, void *), void *arg,
 		struct ipv4_prefix *offset)
 {
-	struct list_head *list;
-	struct list_head *node;
-	struct pool_entry *entry;
+	struct addr4_pool *table;
+	unsigned int i;
 	int error = 0;
 
 	rcu_read_lock_bh();
 
-	list = rcu_dereference_bh(pool);
-	list_for_each_rcu_bh(node, list) {
-		entry = get_entry(node);
+	table = rcu_dereference_bh(pool);
+	for (i = 0; i < table->count; i++) {
 		if (!offset) {
-			error = func(&entry->prefix, arg);
+			error = func(&table->entries[i].prefix, arg);
 			if (error)
 				break;
-		} else if (prefix4_equals(offset, &entry->prefix)) {
+		} else if (prefix4_equals(offset, &table->entries[i].prefix)) {
 			offset = NULL;
 		}
 	}
@@ -258,32 +434,21 @@ int pool_foreach(struct list_head __rcu *pool,
 }
 
 RCUTAG_PKT
-int pool_count(struct list_head __rcu *pool, __u64 *result)
+int pool_count(struct addr4_pool __rcu *pool, __u64 *result)
 {
-	struct list_head *list;
-	struct list_head *node;
-	__u64 count = 0;
-
 	rcu_read_lock_bh();
-	list = rcu_dereference_bh(pool);
-	list_for_each_rcu_bh(node, list) {
-		count += prefix4_get_addr_count(&get_entry(node)->prefix);
-	}
+	*result = addr_count(rcu_dereference_bh(pool));
 	rcu_read_unlock_bh();
-
-	*result = count;
 	return 0;
 }
 
 RCUTAG_PKT
-bool pool_is_empty(struct list_head __rcu *pool)
+bool pool_is_empty(struct addr4_pool __rcu *pool)
 {
-	struct list_head *list;
 	bool result;
 
 	rcu_read_lock_bh();
-	list = rcu_dereference_bh(pool);
-	result = list_empty(list);
+	result = rcu_dereference_bh(pool)->count == 0;
 	rcu_read_unlock_bh();
 
 	return result;
@@ -14,7 +14,7 @@
 #include "nat64/mod/common/tags.h"
 #include "nat64/mod/stateless/pool.h"
 
-static struct list_head __rcu *pool;
+static struct addr4_pool __rcu *pool;
 
 int rfc6791_init(char *pref_strs[], int pref_count)
 {
@@ -39,12 +39,12 @@ int rfc6791_add(struct ipv4_prefix *prefix, bool force)
 		return -EINVAL;
 	}
 
-	return pool_add(pool, prefix);
+	return pool_add(&pool, prefix);
 }
 
 int rfc6791_rm(struct ipv4_prefix *prefix)
 {
-	return pool_rm(pool, prefix);
+	return pool_rm(&pool, prefix);
 }
 
 int rfc6791_flush(void)
@@ -55,39 +55,24 @@ int rfc6791_flush(void)
 /**
  * Returns in "result" the IPv4 address an ICMP error towards "out"'s
  * destination should be sourced with.
+ * Returns -ESRCH if the pool is empty.
  */
-static int get_rfc6791_address(struct packet *in, __u64 count, __be32 *result)
+static int get_rfc6791_address(struct packet *in, __be32 *result)
 {
-	struct list_head *list;
-	struct list_head *node;
-	struct pool_entry *entry = NULL;
-	unsigned int addr_index;
+	struct in_addr addr;
+	__u32 addr_index;
+	int error;
 
-	if (config_randomize_rfc6791_pool())
+	if (config_randomize_rfc6791(in->cfg))
 		get_random_bytes(&addr_index, sizeof(addr_index));
 	else
 		addr_index = pkt_ip6_hdr(in)->hop_limit;
 
-	/* unsigned int % __u64 does something weird, hence the trouble. */
-	if (count <= 0xFFFFFFFFU)
-		addr_index %= (unsigned int) count;
-
-	list = rcu_dereference_bh(pool);
-	list_for_each_rcu_bh(node, list) {
-		entry = list_entry(node, struct pool_entry, list_hook);
-		count = prefix4_get_addr_count(&entry->prefix);
-		if (count >= addr_index)
-			break;
-		addr_index -= count;
-	}
-
-	if (!entry) {
-		/* Because count is not supposed to be zero. */
-		WARN(true, "The pool contents changed while locked!");
-		return -ESRCH;
-	}
+	error = pool_get_nth(pool, addr_index, &addr);
+	if (error)
+		return error;
 
-	*result = htonl(ntohl(entry->prefix.address.s_addr) | addr_index);
+	*result = addr.s_addr;
 	return 0;
 }
 
@@ -123,32 +108,15 @@ static int get_host_address(struct packet *in, struct packet *out,
 
 int rfc6791_get(struct packet *in, struct packet *out, __be32 *result)
 {
-	__u64 count;
-	int error;
-
-	rcu_read_lock_bh();
-
 	/*
-	 * I'm counting the list elements instead of using an algorithm like
-	 * reservoir sampling (http://stackoverflow.com/questions/54059) because
-	 * the random function can be really expensive. Reservoir sampling
-	 * requires one random per iteration, this way requires one random
-	 * period.
+	 * The random function can be really expensive, so don't bother with it
+	 * if the pool is empty.
+	 * (If the pool empties in the meantime, get_rfc6791_address() will
+	 * notice.)
 	 */
-	error = pool_count(pool, &count);
-	if (error) {
-		rcu_read_unlock_bh();
-		log_debug("pool_count failed with errcode %d.", error);
-		return error;
-	}
-
-	if (count != 0) {
-		error = get_rfc6791_address(in, count, result);
-		rcu_read_unlock_bh();
-		return error;
-	}
+	if (!pool_is_empty(pool) && !get_rfc6791_address(in, result))
+		return 0;
 
-	rcu_read_unlock_bh();
 	return get_host_address(in, out, result);
 }
 
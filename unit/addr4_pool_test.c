@@ -0,0 +1,311 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+
+#include "nat64/unit/unit_test.h"
+#include "pool.c"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Stateless IPv4 pool module test");
+
+static struct addr4_pool __rcu *pool;
+
+static int add(__u32 addr, __u8 prefix_len)
+{
+	struct ipv4_prefix prefix;
+
+	prefix.address.s_addr = cpu_to_be32(addr);
+	prefix.len = prefix_len;
+
+	return pool_add(&pool, &prefix);
+}
+
+static int rm(__u32 addr, __u8 prefix_len)
+{
+	struct ipv4_prefix prefix;
+
+	prefix.address.s_addr = cpu_to_be32(addr);
+	prefix.len = prefix_len;
+
+	return pool_rm(&pool, &prefix);
+}
+
+static bool assert_contains(__u32 addr, bool expected)
+{
+	struct in_addr in;
+
+	in.s_addr = cpu_to_be32(addr);
+	return ASSERT_BOOL(expected, pool_contains(pool, &in), "contains %pI4",
+			&in);
+}
+
+static bool assert_nth(__u32 n, __u32 expected)
+{
+	struct in_addr result;
+	bool success = true;
+
+	success &= ASSERT_INT(0, pool_get_nth(pool, n, &result),
+			"get_nth(%u) result", n);
+	success &= ASSERT_BE32(expected, result.s_addr, "get_nth(%u)", n);
+	return success;
+}
+
+static bool assert_count(__u64 expected)
+{
+	__u64 count;
+	bool success = true;
+
+	success &= ASSERT_INT(0, pool_count(pool, &count), "count result");
+	success &= ASSERT_U64(expected, count, "count");
+	return success;
+}
+
+struct foreach_args {
+	struct ipv4_prefix *expected;
+	unsigned int expected_count;
+	unsigned int visited;
+};
+
+static int check_prefix(struct ipv4_prefix *prefix, void *void_args)
+{
+	struct foreach_args *args = void_args;
+	struct ipv4_prefix *expected;
+
+	if (args->visited >= args->expected_count) {
+		log_err("The pool has more entries than expected.");
+		return -EINVAL;
+	}
+
+	expected = &args->expected[args->visited++];
+	if (!prefix4_equals(expected, prefix)) {
+		log_err("Expected %pI4/%u, got %pI4/%u.",
+				&expected->address, expected->len,
+				&prefix->address, prefix->len);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * Asserts @pool's entries are exactly @expected, in that order.
+ */
+static bool assert_entries(struct ipv4_prefix *expected, unsigned int count)
+{
+	struct foreach_args args = {
+		.expected = expected,
+		.expected_count = count,
+		.visited = 0,
+	};
+	bool success = true;
+
+	success &= ASSERT_INT(0, pool_foreach(pool, check_prefix, &args, NULL),
+			"foreach");
+	success &= ASSERT_UINT(count, args.visited, "visited");
+	return success;
+}
+
+static void init_prefix(struct ipv4_prefix *prefix, __u32 addr, __u8 len)
+{
+	prefix->address.s_addr = cpu_to_be32(addr);
+	prefix->len = len;
+}
+
+/**
+ * The module parameters go through pool_init(), so they need to be validated
+ * the same way pool_add() validates.
+ */
+static bool test_init(void)
+{
+	char *good[] = { "198.51.100.0/24", "192.0.2.1", "192.0.2.8/29" };
+	char *suffix[] = { "192.0.2.0/24", "198.51.100.1/24" };
+	char *too_long[] = { "192.0.2.0/33" };
+	char *malformed[] = { "192.0.2.0/24", "potato" };
+	char *intersect[] = { "192.0.2.0/24", "198.51.100.0/24", "192.0.2.128/25" };
+	char *duplicate[] = { "192.0.2.1", "192.0.2.1/32" };
+	struct ipv4_prefix expected[3];
+	bool success = true;
+
+	success &= ASSERT_INT(-EINVAL, pool_init(&pool, suffix,
+			ARRAY_SIZE(suffix)), "suffix");
+	success &= ASSERT_INT(-EINVAL, pool_init(&pool, too_long,
+			ARRAY_SIZE(too_long)), "too long");
+	success &= ASSERT_INT(-EINVAL, pool_init(&pool, malformed,
+			ARRAY_SIZE(malformed)), "malformed");
+	success &= ASSERT_INT(-EEXIST, pool_init(&pool, intersect,
+			ARRAY_SIZE(intersect)), "intersect");
+	success &= ASSERT_INT(-EEXIST, pool_init(&pool, duplicate,
+			ARRAY_SIZE(duplicate)), "duplicate");
+	/* The failures must not leave anything behind. */
+	success &= ASSERT_PTR(NULL, rcu_dereference_raw(pool), "failed pools");
+	if (!success)
+		return false;
+
+	if (!ASSERT_INT(0, pool_init(&pool, good, ARRAY_SIZE(good)), "good"))
+		return false;
+
+	init_prefix(&expected[0], 0xc0000201U, 32);
+	init_prefix(&expected[1], 0xc0000208U, 29);
+	init_prefix(&expected[2], 0xc6336400U, 24);
+	success &= assert_entries(expected, ARRAY_SIZE(expected));
+	success &= assert_count(1 + 8 + 256);
+	success &= assert_contains(0xc0000201U, true);
+	success &= assert_contains(0xc000020fU, true);
+	success &= assert_contains(0xc0000210U, false);
+
+	pool_destroy(&pool);
+	return success;
+}
+
+static bool test_add_rm_contains(void)
+{
+	struct ipv4_prefix expected[4];
+	bool success = true;
+
+	if (!ASSERT_INT(0, pool_init(&pool, NULL, 0), "init"))
+		return false;
+
+	success &= ASSERT_BOOL(true, pool_is_empty(pool), "empty");
+	success &= assert_contains(0, false);
+
+	/* Unsorted on purpose. */
+	success &= ASSERT_INT(0, add(0xc0000200U, 24), "add 1");
+	success &= ASSERT_INT(0, add(0xcb007108U, 30), "add 2");
+	success &= ASSERT_INT(0, add(0xc6336401U, 32), "add 3");
+	success &= ASSERT_INT(0, add(0x0a000000U, 8), "add 4");
+	if (!success)
+		goto end;
+
+	/* Intersections with either neighbor, and with the same entry. */
+	success &= ASSERT_INT(-EEXIST, add(0xc0000280U, 25), "inner");
+	success &= ASSERT_INT(-EEXIST, add(0xc0000000U, 16), "outer");
+	success &= ASSERT_INT(-EEXIST, add(0xc6336401U, 32), "same");
+	success &= ASSERT_INT(-EEXIST, add(0x00000000U, 0), "everything");
+	success &= ASSERT_INT(-EINVAL, add(0xc0000301U, 24), "suffix");
+
+	init_prefix(&expected[0], 0x0a000000U, 8);
+	init_prefix(&expected[1], 0xc0000200U, 24);
+	init_prefix(&expected[2], 0xc6336401U, 32);
+	init_prefix(&expected[3], 0xcb007108U, 30);
+	success &= assert_entries(expected, 4);
+	success &= assert_count((1U << 24) + 256 + 1 + 4);
+	success &= ASSERT_BOOL(false, pool_is_empty(pool), "not empty");
+
+	/* Every edge. */
+	success &= assert_contains(0x00000000U, false);
+	success &= assert_contains(0x09ffffffU, false);
+	success &= assert_contains(0x0a000000U, true);
+	success &= assert_contains(0x0affffffU, true);
+	success &= assert_contains(0x0b000000U, false);
+	success &= assert_contains(0xc00001ffU, false);
+	success &= assert_contains(0xc0000200U, true);
+	success &= assert_contains(0xc00002ffU, true);
+	success &= assert_contains(0xc0000300U, false);
+	success &= assert_contains(0xc6336400U, false);
+	success &= assert_contains(0xc6336401U, true);
+	success &= assert_contains(0xc6336402U, false);
+	success &= assert_contains(0xcb007107U, false);
+	success &= assert_contains(0xcb007108U, true);
+	success &= assert_contains(0xcb00710bU, true);
+	success &= assert_contains(0xcb00710cU, false);
+	success &= assert_contains(0xffffffffU, false);
+
+	/* Removals need an exact match. */
+	success &= ASSERT_INT(-ESRCH, rm(0xc0000200U, 25), "rm subprefix");
+	success &= ASSERT_INT(-ESRCH, rm(0xc0000000U, 16), "rm superprefix");
+	success &= ASSERT_INT(-ESRCH, rm(0xc6336402U, 32), "rm nonexistent");
+	success &= ASSERT_INT(0, rm(0xc0000200U, 24), "rm");
+	success &= ASSERT_INT(-ESRCH, rm(0xc0000200U, 24), "rm again");
+
+	expected[1] = expected[2];
+	expected[2] = expected[3];
+	success &= assert_entries(expected, 3);
+	success &= assert_count((1U << 24) + 1 + 4);
+	success &= assert_contains(0xc0000200U, false);
+	success &= assert_contains(0xc00002ffU, false);
+	success &= assert_contains(0x0a000000U, true);
+	success &= assert_contains(0xc6336401U, true);
+
+	/* The space is free again. */
+	success &= ASSERT_INT(0, add(0xc0000280U, 25), "re-add");
+	success &= assert_contains(0xc0000280U, true);
+	success &= assert_contains(0xc000027fU, false);
+
+	success &= ASSERT_INT(0, pool_flush(&pool), "flush");
+	success &= ASSERT_BOOL(true, pool_is_empty(pool), "flushed");
+	success &= assert_count(0);
+	success &= assert_contains(0x0a000000U, false);
+
+end:
+	pool_destroy(&pool);
+	return success;
+}
+
+/**
+ * pool_get_nth() picks the entry through the prefix sums, so every entry
+ * boundary is a potential off-by-one.
+ */
+static bool test_get_nth(void)
+{
+	struct in_addr result;
+	bool success = true;
+
+	if (!ASSERT_INT(0, pool_init(&pool, NULL, 0), "init"))
+		return false;
+
+	success &= ASSERT_INT(-ESRCH, pool_get_nth(pool, 0, &result), "empty");
+
+	success &= ASSERT_INT(0, add(0xcb007110U, 29), "add 1");
+	success &= ASSERT_INT(0, add(0xc0000200U, 30), "add 2");
+	success &= ASSERT_INT(0, add(0xc6336407U, 32), "add 3");
+	if (!success)
+		goto end;
+
+	/* 192.0.2.0/30 (0-3), 198.51.100.7/32 (4), 203.0.113.16/29 (5-12) */
+	success &= assert_nth(0, 0xc0000200U);
+	success &= assert_nth(1, 0xc0000201U);
+	success &= assert_nth(3, 0xc0000203U);
+	success &= assert_nth(4, 0xc6336407U);
+	success &= assert_nth(5, 0xcb007110U);
+	success &= assert_nth(6, 0xcb007111U);
+	success &= assert_nth(12, 0xcb007117U);
+	/* Modulo. */
+	success &= assert_nth(13, 0xc0000200U);
+	success &= assert_nth(17, 0xc6336407U);
+	success &= assert_nth(0xffffffffU, 0xcb007113U); /* (2^32 - 1) % 13 = 8 */
+
+	/* The offsets have to follow removals. */
+	success &= ASSERT_INT(0, rm(0xc6336407U, 32), "rm");
+	success &= assert_nth(3, 0xc0000203U);
+	success &= assert_nth(4, 0xcb007110U);
+	success &= assert_nth(11, 0xcb007117U);
+	success &= assert_nth(12, 0xc0000200U);
+
+	/* More addresses than __u32 indexes; no modulo. */
+	success &= ASSERT_INT(0, pool_flush(&pool), "flush");
+	success &= ASSERT_INT(0, add(0, 0), "add everything");
+	success &= assert_count(1ULL << 32);
+	success &= assert_nth(0, 0);
+	success &= assert_nth(0xc0000201U, 0xc0000201U);
+	success &= assert_nth(0xffffffffU, 0xffffffffU);
+
+end:
+	pool_destroy(&pool);
+	return success;
+}
+
+int init_module(void)
+{
+	START_TESTS("Stateless IPv4 pool");
+
+	CALL_TEST(test_init(), "Init");
+	CALL_TEST(test_add_rm_contains(), "Add, remove, contains");
+	CALL_TEST(test_get_nth(), "Get nth");
+
+	END_TESTS;
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
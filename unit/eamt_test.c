@@ -133,7 +133,16 @@ static bool test_4to6(char *addr4_str, char *addr6_str)
 
 static bool test(char *addr4, char *addr6)
 {
-	return test_6to4(addr6, addr4) && test_4to6(addr4, addr6);
+	bool success = true;
+
+	/* Once against the tries, once against the compiled tables. */
+	success &= test_6to4(addr6, addr4) && test_4to6(addr4, addr6);
+	compile();
+	success &= ASSERT_BOOL(true, !!rcu_dereference_raw(eamt.compiled),
+			"compiled");
+	success &= test_6to4(addr6, addr4) && test_4to6(addr4, addr6);
+
+	return success;
 }
 
 static bool daniel_test(void)
@@ -423,6 +432,68 @@ static bool remove_test(void)
 	return success;
 }
 
+static bool init_entry(struct eamt_entry *entry, char *addr4, __u8 len4,
+		char *addr6, __u8 len6)
+{
+	if (str_to_addr4(addr4, &entry->prefix4.address))
+		return false;
+	entry->prefix4.len = len4;
+
+	if (str_to_addr6(addr6, &entry->prefix6.address))
+		return false;
+	entry->prefix6.len = len6;
+
+	return true;
+}
+
+static bool load_test(void)
+{
+	struct eamt_entry entries[4];
+	bool success = true;
+
+	success &= init_entry(&entries[0], "1.0.0.0", 32, "1::", 16);
+	success &= init_entry(&entries[1], "2.0.0.0", 32, "1:1::", 32);
+	success &= init_entry(&entries[2], "4.0.0.0", 32, "1:1:1::", 48);
+	success &= init_entry(&entries[3], "10.0.0.0", 24, "2::", 120);
+	success &= add_entry("9.0.0.0", 24, "9::", 120);
+	if (!success)
+		return false;
+
+	/* Chunks */
+	success &= ASSERT_INT(-EINVAL, eamt_load(entries, 2, false, true, true),
+			"chunk without a load");
+	success &= ASSERT_INT(0, eamt_load(entries, 2, true, false, true),
+			"first chunk");
+	success &= test("9.0.0.0", "9::");
+	success &= ASSERT_INT(0, eamt_load(&entries[2], 2, false, true, true),
+			"last chunk");
+	success &= ASSERT_U64(4ULL, eamt.count, "Table count");
+	success &= test_4to6("9.0.0.0", NULL);
+	success &= test_6to4("9::", NULL);
+	success &= test("1.0.0.0", "1::");
+	success &= test("2.0.0.0", "1:1::");
+	success &= test("4.0.0.0", "1:1:1::");
+	success &= test("10.0.0.20", "2::14");
+
+	/* Validations; the table must survive failed loads. */
+	success &= ASSERT_INT(-EEXIST, eamt_load(entries, 4, true, true, false),
+			"overlapping prefixes");
+	entries[1] = entries[0];
+	success &= ASSERT_INT(-EEXIST, eamt_load(entries, 4, true, true, true),
+			"repeated prefixes");
+	success &= ASSERT_U64(4ULL, eamt.count, "Table count after failures");
+	success &= test("2.0.0.0", "1:1::");
+
+	/* Empty load */
+	success &= ASSERT_INT(0, eamt_load(entries, 0, true, true, false),
+			"empty load");
+	success &= ASSERT_U64(0ULL, eamt.count, "Table count after empty load");
+	success &= test_6to4("1::", NULL);
+	success &= test_4to6("1.0.0.0", NULL);
+
+	return success;
+}
+
 static int address_mapping_test_init(void)
 {
 	START_TESTS("Address Mapping test");
@@ -431,6 +502,7 @@ static int address_mapping_test_init(void)
 	INIT_CALL_END(init(), daniel_test(), end(), "Daniel's xlat tests");
 	INIT_CALL_END(init(), anderson_test(), end(), "Tore's xlat tests");
 	INIT_CALL_END(init(), remove_test(), end(), "remove function");
+	INIT_CALL_END(init(), load_test(), end(), "load function");
 
 	END_TESTS;
 }
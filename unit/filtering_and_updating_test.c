@@ -12,6 +12,9 @@ MODULE_DESCRIPTION("Unit tests for the Filtering module");
 #include "nat64/unit/skb_generator.h"
 #include "filtering_and_updating.c"
 
+/* The configuration snapshot the test packets are translated with. */
+static struct global_config cfg;
+
 static int bib_count_fn(struct bib_entry *bib, void *arg)
 {
 	int *count = arg;
@@ -157,6 +160,7 @@ static bool test_filtering_and_updating(void)
 		return false;
 	if (pkt_init_ipv4(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_CONTINUE, filtering_and_updating(&pkt, &tuple), "ICMP error");
 	success &= assert_bib_count(0, L4PROTO_TCP);
@@ -177,6 +181,7 @@ static bool test_filtering_and_updating(void)
 		return false;
 	if (pkt_init_ipv6(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_CONTINUE, filtering_and_updating(&pkt, &tuple), "ICMP error");
 	success &= assert_bib_count(0, L4PROTO_TCP);
@@ -197,6 +202,7 @@ static bool test_filtering_and_updating(void)
 		return false;
 	if (pkt_init_ipv6(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_DROP, filtering_and_updating(&pkt, &tuple), "Hairpinning");
 	success &= assert_bib_count(0, L4PROTO_UDP);
@@ -213,6 +219,7 @@ static bool test_filtering_and_updating(void)
 		return false;
 	if (pkt_init_ipv6(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_ACCEPT, filtering_and_updating(&pkt, &tuple), "Not pool6 packet");
 	success &= assert_bib_count(0, L4PROTO_UDP);
@@ -229,6 +236,7 @@ static bool test_filtering_and_updating(void)
 		return false;
 	if (pkt_init_ipv4(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_ACCEPT, filtering_and_updating(&pkt, &tuple), "Not pool4 packet");
 	success &= assert_bib_count(0, L4PROTO_UDP);
@@ -246,6 +254,7 @@ static bool test_filtering_and_updating(void)
 		return false;
 	if (pkt_init_ipv6(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_CONTINUE, filtering_and_updating(&pkt, &tuple), "IPv6 success");
 	success &= assert_bib_count(1, L4PROTO_UDP);
@@ -262,6 +271,7 @@ static bool test_filtering_and_updating(void)
 		return false;
 	if (pkt_init_ipv4(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_CONTINUE, filtering_and_updating(&pkt, &tuple), "IPv4 success");
 	success &= assert_bib_count(1, L4PROTO_UDP);
@@ -285,6 +295,7 @@ static bool test_udp(void)
 		return false;
 	if (pkt_init_ipv4(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_ACCEPT, ipv4_simple(&pkt, &tuple), "result 1");
 	success &= assert_bib_count(0, L4PROTO_UDP);
@@ -299,6 +310,7 @@ static bool test_udp(void)
 		return false;
 	if (pkt_init_ipv6(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_CONTINUE, ipv6_simple(&pkt, &tuple), "result 2");
 	success &= assert_bib_count(1, L4PROTO_UDP);
@@ -317,6 +329,7 @@ static bool test_udp(void)
 		return false;
 	if (pkt_init_ipv4(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_CONTINUE, ipv4_simple(&pkt, &tuple), "result 3");
 	success &= assert_bib_count(1, L4PROTO_UDP);
@@ -345,6 +358,7 @@ static bool test_icmp(void)
 		return false;
 	if (pkt_init_ipv4(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_ACCEPT, ipv4_simple(&pkt, &tuple), "result 1");
 	success &= assert_bib_count(0, L4PROTO_ICMP);
@@ -359,6 +373,7 @@ static bool test_icmp(void)
 		return false;
 	if (pkt_init_ipv6(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_CONTINUE, ipv6_simple(&pkt, &tuple), "result 2");
 	success &= assert_bib_count(1, L4PROTO_ICMP);
@@ -377,6 +392,7 @@ static bool test_icmp(void)
 		return false;
 	if (pkt_init_ipv4(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_CONTINUE, ipv4_simple(&pkt, &tuple), "result 3");
 	success &= assert_bib_count(1, L4PROTO_ICMP);
@@ -404,6 +420,7 @@ static bool test_tcp_closed_state_handle_6(void)
 		return false;
 	if (pkt_init_ipv6(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_CONTINUE, tcp_closed_state(&pkt, &tuple6),
 			"V6 syn-result");
@@ -430,6 +447,7 @@ static bool test_tcp_closed_state_handle_4(void)
 		return false;
 	if (pkt_init_ipv4(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 	hdr_tcp = tcp_hdr(skb);
 	hdr_tcp->syn = true;
 	hdr_tcp->rst = false;
@@ -466,6 +484,7 @@ static bool test_tcp(void)
 		return false;
 	if (pkt_init_ipv6(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_CONTINUE, tcp(&pkt, &tuple6), "Closed-result");
 	success &= assert_bib_count(1, L4PROTO_TCP);
@@ -485,6 +504,7 @@ static bool test_tcp(void)
 		return false;
 	if (pkt_init_ipv4(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_CONTINUE, tcp(&pkt, &tuple4), "V6 init-result");
 	success &= assert_bib_count(1, L4PROTO_TCP);
@@ -501,6 +521,7 @@ static bool test_tcp(void)
 		return false;
 	if (pkt_init_ipv6(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_CONTINUE, tcp(&pkt, &tuple6), "Established-result");
 	success &= assert_bib_count(1, L4PROTO_TCP);
@@ -517,6 +538,7 @@ static bool test_tcp(void)
 		return false;
 	if (pkt_init_ipv6(&pkt, skb))
 		return false;
+	pkt.cfg = &cfg;
 
 	success &= ASSERT_INT(VERDICT_CONTINUE, tcp(&pkt, &tuple6), "Trans-result");
 	success &= assert_bib_count(1, L4PROTO_TCP);
@@ -538,6 +560,7 @@ static bool init(void)
 
 	if (config_init(false))
 		goto config_fail;
+	config_snapshot(&cfg);
 	if (pool6_init(prefixes6, 1))
 		goto pool6_fail;
 	if (pool4db_init(16, prefixes4, 1))
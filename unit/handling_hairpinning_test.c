@@ -0,0 +1,395 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Handling Hairpinning module test");
+
+#include "nat64/common/str_utils.h"
+#include "nat64/unit/bib.h"
+#include "nat64/unit/route.h"
+#include "nat64/unit/skb_generator.h"
+#include "nat64/unit/types.h"
+#include "nat64/unit/unit_test.h"
+#include "handling_hairpinning.c"
+
+/*
+ * 1::1 talks to 1::2 through the NAT64. Both are masked as 192.0.2.128 (1::2
+ * is 192.0.2.128#2000), which is 64:ff9b::192.0.2.128 from the IPv6 side.
+ */
+#define SENDER "1::1"
+#define RECEIVER "1::2"
+#define POOL4 "192.0.2.128"
+#define POOL4_AS_IPV6 "64:ff9b::c000:280"
+#define TEST_TCLASS 0xb8
+
+/* The configuration snapshot the test packets are translated with. */
+static struct global_config cfg;
+/** What the routing impersonator hands out to the shortcut. */
+static struct dst_entry route_dst;
+
+static int init_sender_tuple(struct tuple *tuple6, l4_protocol proto)
+{
+	return init_tuple6(tuple6, SENDER, 1000, POOL4_AS_IPV6, 2000, proto);
+}
+
+/**
+ * Initializes @pkt as 1::1's packet towards 1::2. Its flow label is not zero
+ * and its traffic class is TEST_TCLASS.
+ * If @partial, the UDP checksum is left for the NIC, as local traffic does.
+ */
+static int create_pkt6(struct packet *pkt, l4_protocol proto, bool partial,
+		__u8 hop_limit)
+{
+	struct tuple tuple6;
+	struct sk_buff *skb;
+	struct ipv6hdr *hdr6;
+	int error;
+
+	error = init_sender_tuple(&tuple6, proto);
+	if (error)
+		return error;
+	error = (proto == L4PROTO_TCP)
+			? create_skb6_tcp(&tuple6, &skb, 100, hop_limit)
+			: create_skb6_udp(&tuple6, &skb, 100, hop_limit);
+	if (error)
+		return error;
+
+	hdr6 = ipv6_hdr(skb);
+	hdr6->priority = TEST_TCLASS >> 4;
+	hdr6->flow_lbl[0] = ((TEST_TCLASS & 0xF) << 4) | 0x1;
+	hdr6->flow_lbl[1] = 0x23;
+	hdr6->flow_lbl[2] = 0x45;
+
+	if (partial) {
+		udp_hdr(skb)->check = ~csum_ipv6_magic(&hdr6->saddr,
+				&hdr6->daddr, skb->len - sizeof(*hdr6),
+				IPPROTO_UDP, 0);
+		skb->ip_summed = CHECKSUM_PARTIAL;
+		skb->csum_start = skb_transport_header(skb) - skb->head;
+		skb->csum_offset = offsetof(struct udphdr, check);
+	}
+
+	error = pkt_init_ipv6(pkt, skb);
+	if (error) {
+		kfree_skb(skb);
+		return error;
+	}
+	pkt->cfg = &cfg;
+	pkt->will_hairpin = true;
+	return 0;
+}
+
+/**
+ * Does what the core does to @pkt6 before it decides to hairpin it: IPv6
+ * Filtering and Updating, and the outgoing tuple computation.
+ */
+static bool first_leg(struct packet *pkt6, struct tuple *tuple4)
+{
+	struct tuple tuple6;
+	bool success = true;
+
+	if (init_sender_tuple(&tuple6, L4PROTO_UDP))
+		return false;
+
+	success &= ASSERT_INT(VERDICT_CONTINUE,
+			filtering_and_updating(pkt6, &tuple6), "IPv6 F&U");
+	success &= ASSERT_INT(VERDICT_CONTINUE,
+			compute_out_tuple(&tuple6, tuple4, pkt6),
+			"IPv4 outgoing tuple");
+	success &= ASSERT_BOOL(true, is_hairpin(pkt6, tuple4), "is hairpin");
+
+	return success;
+}
+
+/**
+ * Translates @pkt6 into IPv4 and then back into IPv6, the way
+ * handling_hairpinning() does.
+ */
+static bool two_pass(struct packet *pkt6, struct tuple *tuple4,
+		struct packet *out)
+{
+	struct packet pkt4 = { .skb = NULL };
+	struct tuple tuple6;
+	bool success = true;
+
+	success &= ASSERT_INT(VERDICT_CONTINUE,
+			translating_the_packet(tuple4, pkt6, &pkt4), "6->4");
+	if (!success)
+		goto end;
+
+	success &= ASSERT_INT(VERDICT_CONTINUE,
+			filtering_and_updating(&pkt4, tuple4), "IPv4 F&U");
+	success &= ASSERT_INT(VERDICT_CONTINUE,
+			compute_out_tuple(tuple4, &tuple6, &pkt4),
+			"IPv6 outgoing tuple");
+	if (!success)
+		goto end;
+
+	success &= ASSERT_INT(VERDICT_CONTINUE,
+			translating_the_packet(&tuple6, &pkt4, out), "4->6");
+	/* Fall through. */
+
+end:
+	kfree_skb(pkt4.skb);
+	return success;
+}
+
+static bool compare_skbs(struct sk_buff *expected, struct sk_buff *actual)
+{
+	unsigned char *expected_ptr = skb_network_header(expected);
+	unsigned char *actual_ptr = skb_network_header(actual);
+	unsigned int i, min_len;
+	int errors = 0;
+
+	if (!ASSERT_UINT(expected->len, actual->len, "skb length"))
+		errors++;
+
+	min_len = min(expected->len, actual->len);
+	for (i = 0; i < min_len && errors < 6; i++) {
+		if (expected_ptr[i] != actual_ptr[i]) {
+			log_err("Packets differ at byte %u. Expected: 0x%x; actual: 0x%x.",
+					i, expected_ptr[i], actual_ptr[i]);
+			errors++;
+		}
+	}
+
+	if (!ASSERT_INT((int) expected->ip_summed, actual->ip_summed,
+			"ip_summed"))
+		errors++;
+
+	return !errors;
+}
+
+static bool assert_csum(struct packet *out, bool partial)
+{
+	struct sk_buff *skb = out->skb;
+	struct ipv6hdr *hdr6 = pkt_ip6_hdr(out);
+	struct udphdr *udp = pkt_udp_hdr(out);
+	unsigned int len = be16_to_cpu(hdr6->payload_len);
+	__sum16 csum;
+	bool success = true;
+
+	if (partial) {
+		/* Pseudoheader only; the NIC adds the rest. */
+		csum = ~csum_ipv6_magic(&hdr6->saddr, &hdr6->daddr, len,
+				IPPROTO_UDP, 0);
+		success &= ASSERT_INT(CHECKSUM_PARTIAL, skb->ip_summed,
+				"ip_summed");
+		success &= ASSERT_UINT((__force __u16) csum,
+				(__force __u16) udp->check, "partial checksum");
+		success &= ASSERT_UINT(
+				(unsigned int) skb_transport_offset(skb),
+				skb->csum_start - skb_headroom(skb),
+				"csum_start");
+		success &= ASSERT_UINT(
+				(unsigned int) offsetof(struct udphdr, check),
+				skb->csum_offset, "csum_offset");
+	} else {
+		csum = csum_ipv6_magic(&hdr6->saddr, &hdr6->daddr, len,
+				IPPROTO_UDP, csum_partial(udp, len, 0));
+		success &= ASSERT_INT(CHECKSUM_NONE, skb->ip_summed,
+				"ip_summed");
+		success &= ASSERT_UINT(0, (__force __u16) csum, "checksum");
+	}
+
+	return success;
+}
+
+/**
+ * Sends 1::1's packet through hairpin_shortcut() and through the regular
+ * two-pass translation, and asserts they yield the same packet.
+ */
+static bool test_shortcut(bool reset_traffic_class, bool partial)
+{
+	struct packet pkt6_slow, pkt6_fast, out_slow = { .skb = NULL }, out_fast;
+	struct ipv6hdr *hdr6;
+	struct udphdr *udp;
+	struct tuple tuple4;
+	struct sk_buff *skb_fast;
+	bool success = true;
+
+	cfg.reset_traffic_class = reset_traffic_class;
+
+	if (create_pkt6(&pkt6_slow, L4PROTO_UDP, partial, 32))
+		return false;
+	if (create_pkt6(&pkt6_fast, L4PROTO_UDP, partial, 32)) {
+		kfree_skb(pkt6_slow.skb);
+		return false;
+	}
+	skb_fast = pkt6_fast.skb;
+
+	success &= first_leg(&pkt6_slow, &tuple4);
+	success &= two_pass(&pkt6_slow, &tuple4, &out_slow);
+	if (!success)
+		goto end;
+
+	success &= first_leg(&pkt6_fast, &tuple4);
+	if (!success)
+		goto end;
+	set_route_dst(&route_dst);
+	success &= ASSERT_INT(VERDICT_CONTINUE,
+			hairpin_shortcut(&pkt6_fast, &tuple4, &out_fast),
+			"shortcut result");
+	set_route_dst(NULL);
+	if (!success)
+		goto end;
+	/* The shortcut translates in place. */
+	success &= ASSERT_PTR(skb_fast, out_fast.skb, "shortcut skb");
+	if (!success)
+		goto end;
+
+	success &= compare_skbs(out_slow.skb, out_fast.skb);
+
+	hdr6 = pkt_ip6_hdr(&out_fast);
+	udp = pkt_udp_hdr(&out_fast);
+	success &= ASSERT_ADDR6(POOL4_AS_IPV6, &hdr6->saddr, "source address");
+	success &= ASSERT_ADDR6(RECEIVER, &hdr6->daddr, "destination address");
+	success &= ASSERT_BE16(tuple4.src.addr4.l4, udp->source, "source port");
+	success &= ASSERT_BE16(2000, udp->dest, "destination port");
+	success &= ASSERT_UINT(30, hdr6->hop_limit, "hop limit");
+	success &= ASSERT_UINT(reset_traffic_class ? 0 : TEST_TCLASS,
+			(hdr6->priority << 4) | (hdr6->flow_lbl[0] >> 4),
+			"traffic class");
+	success &= ASSERT_UINT(0, (hdr6->flow_lbl[0] & 0xF)
+			| hdr6->flow_lbl[1] | hdr6->flow_lbl[2], "flow label");
+	success &= assert_csum(&out_fast, partial);
+	/* Fall through. */
+
+end:
+	kfree_skb(out_slow.skb);
+	kfree_skb(pkt6_slow.skb);
+	kfree_skb(skb_fast);
+	return success;
+}
+
+static bool test_shortcut_csum_full(void)
+{
+	return test_shortcut(false, false);
+}
+
+static bool test_shortcut_csum_partial(void)
+{
+	return test_shortcut(false, true);
+}
+
+static bool test_shortcut_reset_tclass(void)
+{
+	return test_shortcut(true, false);
+}
+
+/**
+ * Asserts hairpin_shortcut() leaves @pkt (and the tables) alone when it
+ * shouldn't take it.
+ */
+static bool assert_refused(struct packet *pkt, char *name)
+{
+	struct tuple tuple4;
+	struct packet out;
+	bool success = true;
+
+	if (init_tuple4(&tuple4, POOL4, 1000, POOL4, 2000, pkt_l4_proto(pkt)))
+		return false;
+
+	success &= ASSERT_BOOL(false, can_shortcut(pkt), "%s", name);
+	success &= ASSERT_INT(VERDICT_CONTINUE,
+			hairpin_shortcut(pkt, &tuple4, &out), "%s result", name);
+	success &= ASSERT_PTR(NULL, out.skb, "%s out", name);
+
+	return success;
+}
+
+static bool test_can_shortcut(void)
+{
+	struct packet pkt;
+	bool success = true;
+
+	if (create_pkt6(&pkt, L4PROTO_UDP, false, 32))
+		return false;
+	success &= ASSERT_BOOL(true, can_shortcut(&pkt), "simple UDP");
+
+	cfg.atomic_frags.build_ipv6_fh = true;
+	success &= assert_refused(&pkt, "build_ipv6_fh");
+	cfg.atomic_frags.build_ipv6_fh = false;
+	kfree_skb(pkt.skb);
+
+	/* The regular path has to send the Time Exceeded. */
+	if (create_pkt6(&pkt, L4PROTO_UDP, false, 3))
+		return false;
+	success &= ASSERT_BOOL(true, can_shortcut(&pkt), "hop limit 3");
+	kfree_skb(pkt.skb);
+	if (create_pkt6(&pkt, L4PROTO_UDP, false, 2))
+		return false;
+	success &= assert_refused(&pkt, "hop limit 2");
+	kfree_skb(pkt.skb);
+	if (create_pkt6(&pkt, L4PROTO_UDP, false, 1))
+		return false;
+	success &= assert_refused(&pkt, "hop limit 1");
+	kfree_skb(pkt.skb);
+
+	if (create_pkt6(&pkt, L4PROTO_TCP, false, 32))
+		return false;
+	success &= assert_refused(&pkt, "TCP");
+	kfree_skb(pkt.skb);
+
+	return success;
+}
+
+static bool init(void)
+{
+	char *prefixes6[] = { "64:ff9b::/96" };
+	char *prefixes4[] = { POOL4 "/32" };
+
+	if (config_init(false))
+		goto config_fail;
+	config_snapshot(&cfg);
+	if (pool6_init(prefixes6, 1))
+		goto pool6_fail;
+	if (pool4db_init(16, prefixes4, 1))
+		goto pool4_fail;
+	if (filtering_init())
+		goto filtering_fail;
+	if (!bib_inject(RECEIVER, 2000, POOL4, 2000, L4PROTO_UDP))
+		goto bib_fail;
+
+	return true;
+
+bib_fail:
+	filtering_destroy();
+filtering_fail:
+	pool4db_destroy();
+pool4_fail:
+	pool6_destroy();
+pool6_fail:
+	config_destroy();
+config_fail:
+	return false;
+}
+
+static void end(void)
+{
+	filtering_destroy();
+	pool4db_destroy();
+	pool6_destroy();
+	config_destroy();
+}
+
+int init_module(void)
+{
+	START_TESTS("Handling Hairpinning");
+
+	route_dst.dev = init_net.loopback_dev;
+	atomic_set(&route_dst.__refcnt, 1);
+
+	INIT_CALL_END(init(), test_shortcut_csum_full(), end(), "Shortcut, full checksum");
+	INIT_CALL_END(init(), test_shortcut_csum_partial(), end(), "Shortcut, partial checksum");
+	INIT_CALL_END(init(), test_shortcut_reset_tclass(), end(), "Shortcut, traffic class reset");
+	INIT_CALL_END(init(), test_can_shortcut(), end(), "Shortcut decider");
+
+	END_TESTS;
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
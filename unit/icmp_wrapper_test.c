@@ -0,0 +1,449 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+
+#include "nat64/common/str_utils.h"
+#include "nat64/unit/unit_test.h"
+#include "icmp_wrapper.c"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("ICMP error rate limiter module test");
+
+#define TEST_BURST 5
+/*
+ * The tests pick their own timestamps, so the rate only needs to be slow
+ * enough for the buckets not to refill between them.
+ */
+#define TEST_RATE 1
+#define TEST_NOW 1000000
+
+static struct sk_buff *create_skb4(__u32 saddr)
+{
+	struct sk_buff *skb;
+
+	skb = alloc_skb(sizeof(struct iphdr), GFP_KERNEL);
+	if (!skb) {
+		log_err("Could not allocate a test packet.");
+		return NULL;
+	}
+
+	skb_reset_network_header(skb);
+	memset(skb_put(skb, sizeof(struct iphdr)), 0, sizeof(struct iphdr));
+	ip_hdr(skb)->saddr = cpu_to_be32(saddr);
+	skb->protocol = htons(ETH_P_IP);
+
+	return skb;
+}
+
+static struct sk_buff *create_skb6(struct in6_addr *saddr)
+{
+	struct sk_buff *skb;
+
+	skb = alloc_skb(sizeof(struct ipv6hdr), GFP_KERNEL);
+	if (!skb) {
+		log_err("Could not allocate a test packet.");
+		return NULL;
+	}
+
+	skb_reset_network_header(skb);
+	memset(skb_put(skb, sizeof(struct ipv6hdr)), 0, sizeof(struct ipv6hdr));
+	ipv6_hdr(skb)->saddr = *saddr;
+	skb->protocol = htons(ETH_P_IPV6);
+
+	return skb;
+}
+
+/**
+ * Returns the number of errors @bucket lets through at @now.
+ */
+static unsigned int drain(struct icmp_bucket *bucket, unsigned long now,
+		unsigned int rate, unsigned int burst)
+{
+	unsigned int result = 0;
+
+	/* Give it a chance to let too many through, but don't get stuck. */
+	while (result <= burst && bucket_charge(bucket, now, rate, burst))
+		result++;
+
+	return result;
+}
+
+static unsigned int drain_skb(struct icmp_limiter *local, struct sk_buff *skb,
+		icmp_error_code error, unsigned long now)
+{
+	struct icmp_key key;
+
+	get_key(skb, error, &key);
+	return drain(get_bucket(local, &key, now, TEST_BURST), now, TEST_RATE,
+			TEST_BURST);
+}
+
+static bool test_bucket(void)
+{
+	struct icmp_bucket bucket = { .stamp = 0, .tokens = 0 };
+	unsigned long now = TEST_NOW;
+	bool success = true;
+
+	/* One error per jiffy, up to three at once. */
+	success &= ASSERT_UINT(3, drain(&bucket, now, HZ, 3), "full");
+	success &= ASSERT_UINT(0, drain(&bucket, now, HZ, 3), "empty");
+	success &= ASSERT_UINT(1, drain(&bucket, now + 1, HZ, 3), "1 jiffy");
+	success &= ASSERT_UINT(3, drain(&bucket, now + 100 * HZ, HZ, 3),
+			"capped");
+
+	/* One error per second, one at a time. */
+	now += 200 * HZ;
+	success &= ASSERT_UINT(1, drain(&bucket, now, 1, 1), "1 first");
+	success &= ASSERT_UINT(0, drain(&bucket, now + HZ - 1, 1, 1),
+			"1 almost");
+	success &= ASSERT_UINT(1, drain(&bucket, now + HZ, 1, 1), "1 second");
+	success &= ASSERT_UINT(0, drain(&bucket, now + HZ, 1, 1), "1 again");
+
+	/* Lowering the burst also lowers the tokens the bucket already has. */
+	now += 200 * HZ;
+	success &= ASSERT_BOOL(true, bucket_charge(&bucket, now, 1, 20),
+			"big burst");
+	success &= ASSERT_UINT(2, drain(&bucket, now, 1, 2), "small burst");
+
+	return success;
+}
+
+static bool test_keys4(void)
+{
+	struct icmp_limiter *local;
+	struct sk_buff *skb1, *skb2 = NULL, *skb3 = NULL;
+	bool success = true;
+
+	local = kzalloc(sizeof(*local), GFP_KERNEL);
+	skb1 = create_skb4(0xc0000201U);
+	skb2 = create_skb4(0xc00002c8U);
+	skb3 = create_skb4(0xc0000301U);
+	if (!local || !skb1 || !skb2 || !skb3) {
+		success = false;
+		goto end;
+	}
+
+	success &= ASSERT_UINT(TEST_BURST, drain_skb(local, skb1,
+			ICMPERR_ADDR_UNREACHABLE, TEST_NOW), "drain");
+	success &= ASSERT_UINT(0, drain_skb(local, skb1,
+			ICMPERR_ADDR_UNREACHABLE, TEST_NOW), "drained");
+	/* Same prefix, other type. */
+	success &= ASSERT_UINT(TEST_BURST, drain_skb(local, skb1,
+			ICMPERR_HOP_LIMIT, TEST_NOW), "other type");
+	/* Same prefix, same type. */
+	success &= ASSERT_UINT(0, drain_skb(local, skb2,
+			ICMPERR_ADDR_UNREACHABLE, TEST_NOW), "same /24");
+	/* Other prefix, same type. */
+	success &= ASSERT_UINT(TEST_BURST, drain_skb(local, skb3,
+			ICMPERR_ADDR_UNREACHABLE, TEST_NOW), "other /24");
+
+end:
+	kfree_skb(skb3);
+	kfree_skb(skb2);
+	kfree_skb(skb1);
+	kfree(local);
+	return success;
+}
+
+static bool test_keys6(void)
+{
+	struct icmp_limiter *local;
+	struct in6_addr addr1, addr2, addr3;
+	struct sk_buff *skb1 = NULL, *skb2 = NULL, *skb3 = NULL;
+	bool success = true;
+
+	if (str_to_addr6("2001:db8:0:1::1", &addr1))
+		return false;
+	if (str_to_addr6("2001:db8:0:1:ffff:ffff:ffff:ffff", &addr2))
+		return false;
+	if (str_to_addr6("2001:db8:0:2::1", &addr3))
+		return false;
+
+	local = kzalloc(sizeof(*local), GFP_KERNEL);
+	if (!local)
+		return false;
+	skb1 = create_skb6(&addr1);
+	skb2 = create_skb6(&addr2);
+	skb3 = create_skb6(&addr3);
+	if (!skb1 || !skb2 || !skb3) {
+		success = false;
+		goto end;
+	}
+
+	success &= ASSERT_UINT(TEST_BURST, drain_skb(local, skb1,
+			ICMPERR_ADDR_UNREACHABLE, TEST_NOW), "drain");
+	success &= ASSERT_UINT(TEST_BURST, drain_skb(local, skb1,
+			ICMPERR_HDR_FIELD, TEST_NOW), "other type");
+	success &= ASSERT_UINT(0, drain_skb(local, skb2,
+			ICMPERR_ADDR_UNREACHABLE, TEST_NOW), "same /64");
+	success &= ASSERT_UINT(TEST_BURST, drain_skb(local, skb3,
+			ICMPERR_ADDR_UNREACHABLE, TEST_NOW), "other /64");
+
+end:
+	kfree_skb(skb3);
+	kfree_skb(skb2);
+	kfree_skb(skb1);
+	kfree(local);
+	return success;
+}
+
+/**
+ * Fills @skbs with IPv4 packets from different /24s whose buckets all land in
+ * the same set.
+ */
+static bool create_colliding_skbs(struct sk_buff **skbs, unsigned int count)
+{
+	struct icmp_key key;
+	unsigned int set = 0;
+	unsigned int found = 0;
+	__u32 i;
+
+	for (i = 0; i < 0x10000U && found < count; i++) {
+		skbs[found] = create_skb4(0xc6000001U | (i << 8));
+		if (!skbs[found])
+			return false;
+
+		get_key(skbs[found], ICMPERR_ADDR_UNREACHABLE, &key);
+		if (found == 0)
+			set = hash_64(key.prefix ^ key.tag, ICMPLIMIT_BITS);
+		if (hash_64(key.prefix ^ key.tag, ICMPLIMIT_BITS) == set) {
+			found++;
+		} else {
+			kfree_skb(skbs[found]);
+			skbs[found] = NULL;
+		}
+	}
+
+	if (found < count) {
+		log_err("Could not find enough colliding prefixes.");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Prefixes that share a set must not share their limit, and a flooding prefix
+ * must not lose its bucket to the others.
+ */
+static bool test_collisions(void)
+{
+	struct icmp_limiter *local;
+	struct sk_buff *skbs[ICMPLIMIT_WAYS + 1] = { NULL };
+	unsigned long now = TEST_NOW;
+	unsigned int i;
+	bool success = true;
+
+	local = kzalloc(sizeof(*local), GFP_KERNEL);
+	if (!local)
+		return false;
+	if (!create_colliding_skbs(skbs, ARRAY_SIZE(skbs))) {
+		success = false;
+		goto end;
+	}
+
+	/* skbs[0] floods; everyone else is still entitled to their burst. */
+	success &= ASSERT_UINT(TEST_BURST, drain_skb(local, skbs[0],
+			ICMPERR_ADDR_UNREACHABLE, now), "flood");
+	for (i = 1; i < ICMPLIMIT_WAYS; i++) {
+		now++;
+		success &= ASSERT_UINT(TEST_BURST, drain_skb(local, skbs[i],
+				ICMPERR_ADDR_UNREACHABLE, now), "neighbor %u", i);
+	}
+
+	/* The set is full; the flooder keeps charging its bucket. */
+	now++;
+	success &= ASSERT_UINT(0, drain_skb(local, skbs[0],
+			ICMPERR_ADDR_UNREACHABLE, now), "flood again");
+
+	/* The newcomer recycles the quietest bucket, not the flooder's. */
+	now++;
+	success &= ASSERT_UINT(TEST_BURST, drain_skb(local, skbs[ICMPLIMIT_WAYS],
+			ICMPERR_ADDR_UNREACHABLE, now), "newcomer");
+	now++;
+	success &= ASSERT_UINT(0, drain_skb(local, skbs[0],
+			ICMPERR_ADDR_UNREACHABLE, now), "flood still limited");
+
+end:
+	for (i = 0; i < ARRAY_SIZE(skbs); i++)
+		kfree_skb(skbs[i]);
+	kfree(local);
+	return success;
+}
+
+static bool test_keys_cpu(void)
+{
+	struct sk_buff *skb;
+	unsigned int cpu, cpu1 = nr_cpu_ids, cpu2 = nr_cpu_ids;
+	bool success = true;
+
+	for_each_possible_cpu(cpu) {
+		if (cpu1 == nr_cpu_ids)
+			cpu1 = cpu;
+		else if (cpu2 == nr_cpu_ids)
+			cpu2 = cpu;
+	}
+	if (cpu2 == nr_cpu_ids) {
+		log_info("Only one CPU; skipping the per-CPU test.");
+		return true;
+	}
+
+	skb = create_skb4(0xc0000201U);
+	if (!skb)
+		return false;
+
+	success &= ASSERT_UINT(TEST_BURST, drain_skb(per_cpu_ptr(limiter, cpu1),
+			skb, ICMPERR_ADDR_UNREACHABLE, TEST_NOW), "drain");
+	success &= ASSERT_UINT(0, drain_skb(per_cpu_ptr(limiter, cpu1),
+			skb, ICMPERR_ADDR_UNREACHABLE, TEST_NOW), "drained");
+	success &= ASSERT_UINT(TEST_BURST, drain_skb(per_cpu_ptr(limiter, cpu2),
+			skb, ICMPERR_ADDR_UNREACHABLE, TEST_NOW), "other CPU");
+
+	kfree_skb(skb);
+	return success;
+}
+
+static int set_rate(__u16 rate)
+{
+	struct global_config *cfg;
+	int error;
+
+	cfg = kmalloc(sizeof(*cfg), GFP_KERNEL);
+	if (!cfg)
+		return -ENOMEM;
+	error = config_clone(cfg);
+	if (error) {
+		kfree(cfg);
+		return error;
+	}
+
+	cfg->icmp_limit_rate = rate;
+	config_replace(cfg);
+	return 0;
+}
+
+/**
+ * Runs icmp64_allow() @count times; returns how many of them said yes.
+ */
+static unsigned int count_allowed(struct packet *pkt, icmp_error_code error,
+		unsigned int count)
+{
+	unsigned int result = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		if (icmp64_allow(pkt, error))
+			result++;
+
+	return result;
+}
+
+/**
+ * The limits come from the packet's config snapshot; stored packets (which
+ * don't have one anymore) fall back to the live config.
+ */
+static bool test_config(void)
+{
+	struct global_config *cfg;
+	struct packet pkt;
+	unsigned int tries = 10 * DEFAULT_ICMP_LIMIT_BURST;
+	bool success = true;
+
+	cfg = kmalloc(sizeof(*cfg), GFP_KERNEL);
+	if (!cfg)
+		return false;
+	if (config_clone(cfg)) {
+		kfree(cfg);
+		return false;
+	}
+
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.skb = create_skb4(0xc0000201U);
+	if (!pkt.skb) {
+		kfree(cfg);
+		return false;
+	}
+	pkt.cfg = cfg;
+
+	/* Slow enough not to refill during the test. */
+	cfg->icmp_limit_rate = 1;
+	cfg->icmp_limit_burst = 2;
+	success &= ASSERT_UINT(2, count_allowed(&pkt, ICMPERR_HOP_LIMIT, tries),
+			"snapshot's burst");
+
+	/* The live config still has a rate; the snapshot wins. */
+	cfg->icmp_limit_rate = 0;
+	success &= ASSERT_UINT(tries, count_allowed(&pkt, ICMPERR_HOP_LIMIT,
+			tries), "snapshot's rate");
+
+	pkt.cfg = NULL;
+	success &= ASSERT_UINT(DEFAULT_ICMP_LIMIT_BURST, count_allowed(&pkt,
+			ICMPERR_ADDR_UNREACHABLE, tries), "live config's burst");
+	success &= ASSERT_INT(0, set_rate(0), "set rate");
+	success &= ASSERT_UINT(tries, count_allowed(&pkt,
+			ICMPERR_ADDR_UNREACHABLE, tries), "live config's rate");
+
+	kfree_skb(pkt.skb);
+	kfree(cfg);
+	return success;
+}
+
+/**
+ * Packet Too Bigs have to get through no matter what.
+ */
+static bool test_exempt(void)
+{
+	struct packet pkt;
+	unsigned int tries = 10 * DEFAULT_ICMP_LIMIT_BURST;
+	bool success = true;
+
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.skb = create_skb4(0xc0000201U);
+	if (!pkt.skb)
+		return false;
+
+	success &= ASSERT_UINT(tries, count_allowed(&pkt, ICMPERR_FRAG_NEEDED,
+			tries), "PTB");
+	success &= ASSERT_UINT(tries, count_allowed(&pkt, ICMPERR_SILENT,
+			tries), "silent");
+
+	kfree_skb(pkt.skb);
+	return success;
+}
+
+static bool init(void)
+{
+	if (config_init(false))
+		return false;
+	if (icmp64_init()) {
+		config_destroy();
+		return false;
+	}
+
+	return true;
+}
+
+static void end(void)
+{
+	icmp64_destroy();
+	config_destroy();
+}
+
+int init_module(void)
+{
+	START_TESTS("ICMP error rate limiter");
+
+	CALL_TEST(test_bucket(), "Token bucket");
+	CALL_TEST(test_keys4(), "IPv4 keys");
+	CALL_TEST(test_keys6(), "IPv6 keys");
+	CALL_TEST(test_collisions(), "Colliding keys");
+	INIT_CALL_END(init(), test_keys_cpu(), end(), "CPU keys");
+	INIT_CALL_END(init(), test_config(), end(), "Config");
+	INIT_CALL_END(init(), test_exempt(), end(), "Exemptions");
+
+	END_TESTS;
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
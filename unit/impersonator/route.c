@@ -1,12 +1,38 @@
-#include "nat64/mod/common/route.h"
+#include "nat64/unit/route.h"
+
+#include <net/dst.h>
 #include "nat64/mod/common/types.h"
 
+
+static struct dst_entry *fake_dst = NULL;
+
+
+void set_route_dst(struct dst_entry *dst)
+{
+	fake_dst = dst;
+}
+
+struct dst_entry *__route4(__be32 daddr, __u8 tos, __u8 proto, __u32 mark,
+		struct packet *pkt)
+{
+	log_debug("Pretending I'm routing an IPv4 packet.");
+	return dst_clone(fake_dst);
+}
+
 struct dst_entry *route4(struct packet *pkt)
 {
 	log_debug("Pretending I'm routing an IPv4 packet.");
 	return NULL;
 }
 
+struct dst_entry *__route6(struct ipv6hdr *hdr, __u8 proto,
+		l4_protocol l4_proto, void *l4_hdr, __u32 mark,
+		struct packet *pkt)
+{
+	log_debug("Pretending I'm routing an IPv6 packet.");
+	return dst_clone(fake_dst);
+}
+
 struct dst_entry *route6(struct packet *pkt)
 {
 	log_debug("Pretending I'm routing an IPv6 packet.");
@@ -18,3 +44,9 @@ struct dst_entry *route(struct packet *pkt)
 	log_debug("Pretending I'm routing a packet.");
 	return NULL;
 }
+
+int route4_input(struct packet *pkt)
+{
+	log_debug("Pretending I'm routing an incoming IPv4 packet.");
+	return 0;
+}
@@ -14,3 +14,13 @@ void inc_stats_skb4(struct sk_buff *skb, int field)
 {
 	/* No code. */
 }
+
+void inc_stats_dev(struct net_device *dev, l3_protocol l3_proto, int field)
+{
+	/* No code. */
+}
+
+void inc_stats_icmp_outerrors(struct sk_buff *skb)
+{
+	/* No code. */
+}
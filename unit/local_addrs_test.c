@@ -0,0 +1,235 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Local IPv4 address snapshot module test");
+
+#include "nat64/common/str_utils.h"
+#include "nat64/mod/stateless/blacklist4.h"
+#include "nat64/unit/unit_test.h"
+#include "local_addrs.c"
+
+/*
+ * The snapshot only cares about the interfaces' indexes and whether they
+ * have an in_device, so these don't need anything else.
+ */
+static struct in_device in_dev;
+static struct net_device dev1;
+static struct net_device dev2;
+static struct net_device dev3;
+
+static __be32 addr(char *str)
+{
+	struct in_addr result;
+
+	if (str_to_addr4(str, &result)) {
+		log_err("Unparseable address: %s. The unit test is broken.", str);
+		return 0;
+	}
+
+	return result.s_addr;
+}
+
+static bool add_ifa(struct local_addrs *snap, int ifindex, char *local,
+		unsigned int len, unsigned char scope, bool secondary)
+{
+	struct in_ifaddr ifa;
+
+	memset(&ifa, 0, sizeof(ifa));
+	ifa.ifa_local = addr(local);
+	ifa.ifa_address = ifa.ifa_local;
+	ifa.ifa_mask = inet_make_mask(len);
+	ifa.ifa_scope = scope;
+	ifa.ifa_flags = secondary ? IFA_F_SECONDARY : 0;
+
+	return ASSERT_INT(0, snapshot_add(snap, ifindex, &ifa),
+			"add of %s/%u", local, len);
+}
+
+static void install(struct local_addrs *snap)
+{
+	struct local_addrs *old;
+
+	mutex_lock(&lock);
+	old = rcu_dereference_protected(snapshot, lockdep_is_held(&lock));
+	rcu_assign_pointer(snapshot, snap);
+	mutex_unlock(&lock);
+
+	synchronize_rcu();
+	kfree(old);
+}
+
+/**
+ * Leaves the following interfaces:
+ *
+ * 	dev1: 192.0.2.1/24 (global), 192.0.2.2/24 (secondary),
+ * 		203.0.113.1/24 (global), 127.0.0.1/8 (host)
+ * 	dev2: 198.51.100.1/24 (global), 192.0.2.2/24 (global), 0.0.0.0/0 (link)
+ * 	dev3: nothing; it doesn't even have an in_device.
+ */
+static bool init(void)
+{
+	struct local_addrs *snap;
+	bool success = true;
+
+	memset(&dev1, 0, sizeof(dev1));
+	dev1.ifindex = 1;
+	RCU_INIT_POINTER(dev1.ip_ptr, &in_dev);
+	memset(&dev2, 0, sizeof(dev2));
+	dev2.ifindex = 2;
+	RCU_INIT_POINTER(dev2.ip_ptr, &in_dev);
+	memset(&dev3, 0, sizeof(dev3));
+	dev3.ifindex = 3;
+
+	snap = snapshot_alloc(7);
+	if (!snap) {
+		log_err("Could not allocate the snapshot.");
+		return false;
+	}
+
+	success &= add_ifa(snap, 1, "192.0.2.1", 24, RT_SCOPE_UNIVERSE, false);
+	success &= add_ifa(snap, 1, "192.0.2.2", 24, RT_SCOPE_UNIVERSE, true);
+	success &= add_ifa(snap, 1, "203.0.113.1", 24, RT_SCOPE_UNIVERSE, false);
+	success &= add_ifa(snap, 1, "127.0.0.1", 8, RT_SCOPE_HOST, false);
+	success &= add_ifa(snap, 2, "198.51.100.1", 24, RT_SCOPE_UNIVERSE,
+			false);
+	success &= add_ifa(snap, 2, "192.0.2.2", 24, RT_SCOPE_UNIVERSE, false);
+	success &= add_ifa(snap, 2, "0.0.0.0", 0, RT_SCOPE_LINK, false);
+
+	install(snap);
+	if (!success)
+		return false;
+
+	if (blacklist_init(NULL, 0)) {
+		install(NULL);
+		return false;
+	}
+
+	return true;
+}
+
+static void end(void)
+{
+	blacklist_destroy();
+	install(NULL);
+}
+
+static bool test_full(void)
+{
+	struct local_addrs *snap;
+	bool success = true;
+
+	snap = snapshot_alloc(2);
+	if (!snap)
+		return false;
+
+	success &= add_ifa(snap, 1, "192.0.2.1", 24, RT_SCOPE_UNIVERSE, false);
+	success &= add_ifa(snap, 1, "192.0.2.2", 24, RT_SCOPE_UNIVERSE, false);
+	/* It has to fail before it looks at the address. */
+	success &= ASSERT_INT(-ENOSPC, snapshot_add(snap, 1, NULL), "full");
+
+	kfree(snap);
+	return success;
+}
+
+static bool test_contains(void)
+{
+	bool success = true;
+
+	success &= ASSERT_BOOL(true, localaddrs_contains(addr("192.0.2.1")), "1");
+	success &= ASSERT_BOOL(true, localaddrs_contains(addr("192.0.2.2")), "2");
+	success &= ASSERT_BOOL(true, localaddrs_contains(addr("203.0.113.1")), "3");
+	success &= ASSERT_BOOL(true, localaddrs_contains(addr("127.0.0.1")), "4");
+	success &= ASSERT_BOOL(true, localaddrs_contains(addr("198.51.100.1")), "5");
+	success &= ASSERT_BOOL(true, localaddrs_contains(addr("0.0.0.0")), "6");
+	success &= ASSERT_BOOL(false, localaddrs_contains(addr("192.0.2.3")), "7");
+	success &= ASSERT_BOOL(false, localaddrs_contains(addr("127.0.0.2")), "8");
+	success &= ASSERT_BOOL(false, localaddrs_contains(addr("255.255.255.255")), "9");
+
+	success &= ASSERT_BOOL(true, localaddrs_contains_global(addr("192.0.2.1")), "g1");
+	/* Secondary on dev1, but primary on dev2. */
+	success &= ASSERT_BOOL(true, localaddrs_contains_global(addr("192.0.2.2")), "g2");
+	success &= ASSERT_BOOL(true, localaddrs_contains_global(addr("203.0.113.1")), "g3");
+	success &= ASSERT_BOOL(false, localaddrs_contains_global(addr("127.0.0.1")), "g4");
+	success &= ASSERT_BOOL(true, localaddrs_contains_global(addr("198.51.100.1")), "g5");
+	success &= ASSERT_BOOL(false, localaddrs_contains_global(addr("0.0.0.0")), "g6");
+	success &= ASSERT_BOOL(false, localaddrs_contains_global(addr("192.0.2.3")), "g7");
+
+	return success;
+}
+
+static bool test_blacklist(void)
+{
+	struct ipv4_prefix prefix;
+	bool success = true;
+
+	prefix.address.s_addr = addr("10.0.0.0");
+	prefix.len = 24;
+	if (!ASSERT_INT(0, blacklist_add(&prefix), "add"))
+		return false;
+
+	/* The pool. */
+	success &= ASSERT_BOOL(true, blacklist_contains(addr("10.0.0.0")), "1");
+	success &= ASSERT_BOOL(true, blacklist_contains(addr("10.0.0.255")), "2");
+	success &= ASSERT_BOOL(false, blacklist_contains(addr("10.0.1.0")), "3");
+	/* The interfaces, regardless of scope. */
+	success &= ASSERT_BOOL(true, blacklist_contains(addr("192.0.2.2")), "4");
+	success &= ASSERT_BOOL(true, blacklist_contains(addr("127.0.0.1")), "5");
+	success &= ASSERT_BOOL(true, blacklist_contains(addr("0.0.0.0")), "6");
+	success &= ASSERT_BOOL(false, blacklist_contains(addr("192.0.2.3")), "7");
+
+	return success;
+}
+
+static bool test_pick(void)
+{
+	__be32 result;
+	bool success = true;
+
+	/* No address shares a subnet with the destination; take the first. */
+	result = 0;
+	success &= ASSERT_INT(0, localaddrs_pick(&dev1, addr("8.8.8.8"),
+			&result), "first result");
+	success &= ASSERT_BE32(0xc0000201, result, "first addr");
+
+	/* The second global address shares the destination's subnet. */
+	result = 0;
+	success &= ASSERT_INT(0, localaddrs_pick(&dev1, addr("203.0.113.50"),
+			&result), "subnet result");
+	success &= ASSERT_BE32(0xcb007101, result, "subnet addr");
+
+	/* dev1 also has 192.0.2.2, but only as a secondary. */
+	result = 0;
+	success &= ASSERT_INT(0, localaddrs_pick(&dev2, addr("192.0.2.50"),
+			&result), "other dev result");
+	success &= ASSERT_BE32(0xc0000202, result, "other dev addr");
+
+	success &= ASSERT_INT(-EINVAL, localaddrs_pick(&dev3, addr("8.8.8.8"),
+			&result), "no in_device");
+
+	/* Now it's an IPv4 device, but it still has no addresses. */
+	dev3.ifindex = 4;
+	RCU_INIT_POINTER(dev3.ip_ptr, &in_dev);
+	success &= ASSERT_INT(-ESRCH, localaddrs_pick(&dev3, addr("8.8.8.8"),
+			&result), "no addresses");
+
+	return success;
+}
+
+int init_module(void)
+{
+	START_TESTS("Local addresses");
+
+	CALL_TEST(test_full(), "Full snapshot");
+	INIT_CALL_END(init(), test_contains(), end(), "Contains");
+	INIT_CALL_END(init(), test_blacklist(), end(), "Blacklist");
+	INIT_CALL_END(init(), test_pick(), end(), "Pick");
+
+	END_TESTS;
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
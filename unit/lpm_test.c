@@ -0,0 +1,238 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Longest prefix match table module test");
+
+#include "nat64/common/str_utils.h"
+#include "nat64/unit/unit_test.h"
+#include "lpm.c"
+
+#define SPARSE_COUNT 100000
+
+static bool init_prefix6(struct ipv6_prefix *prefix, struct lpm_prefix *key,
+		char *addr, __u8 len)
+{
+	if (str_to_addr6(addr, &prefix->address)) {
+		log_err("Unparseable address: %s. The unit test is broken.", addr);
+		return false;
+	}
+	prefix->len = len;
+
+	key->bytes = prefix->address.s6_addr;
+	key->len = len;
+	return true;
+}
+
+static bool assert_lookup6(struct lpm *lpm, char *addr_str, int expected)
+{
+	struct in6_addr addr;
+
+	if (str_to_addr6(addr_str, &addr)) {
+		log_err("Unparseable address: %s. The unit test is broken.",
+				addr_str);
+		return false;
+	}
+
+	return ASSERT_INT(expected, lpm_lookup(lpm, addr.s6_addr), "%s",
+			addr_str);
+}
+
+static bool assert_lookup4(struct lpm *lpm, char *addr_str, int expected)
+{
+	struct in_addr addr;
+
+	if (str_to_addr4(addr_str, &addr)) {
+		log_err("Unparseable address: %s. The unit test is broken.",
+				addr_str);
+		return false;
+	}
+
+	return ASSERT_INT(expected, lpm_lookup(lpm, (__u8 *)&addr), "%s",
+			addr_str);
+}
+
+static bool test_ipv4(void)
+{
+	struct in_addr addrs[5];
+	struct lpm_prefix keys[5];
+	struct lpm *lpm;
+	unsigned int i;
+	bool success = true;
+
+	/* Unsorted on purpose. */
+	str_to_addr4("192.0.2.0", &addrs[0]);
+	keys[0].len = 24;
+	str_to_addr4("192.0.0.0", &addrs[1]);
+	keys[1].len = 16;
+	str_to_addr4("192.0.2.128", &addrs[2]);
+	keys[2].len = 25;
+	str_to_addr4("192.0.2.7", &addrs[3]);
+	keys[3].len = 32;
+	str_to_addr4("10.0.0.0", &addrs[4]);
+	keys[4].len = 8;
+	for (i = 0; i < ARRAY_SIZE(keys); i++)
+		keys[i].bytes = (__u8 *)&addrs[i];
+
+	lpm = lpm_build(4, keys, ARRAY_SIZE(keys));
+	if (!ASSERT_BOOL(true, lpm != NULL, "build"))
+		return false;
+
+	success &= assert_lookup4(lpm, "192.0.2.1", 0);
+	success &= assert_lookup4(lpm, "192.0.3.1", 1);
+	success &= assert_lookup4(lpm, "192.0.2.200", 2);
+	success &= assert_lookup4(lpm, "192.0.2.7", 3);
+	success &= assert_lookup4(lpm, "192.0.2.6", 0);
+	success &= assert_lookup4(lpm, "10.255.0.1", 4);
+	success &= assert_lookup4(lpm, "11.0.0.0", -ESRCH);
+	success &= assert_lookup4(lpm, "192.1.0.0", -ESRCH);
+
+	lpm_destroy(lpm);
+	return success;
+}
+
+/**
+ * The /96 and the /128 share a long run of bits, so the path to them skips
+ * them. The skipped bits still have to be checked.
+ */
+static bool test_path_compression(void)
+{
+	struct ipv6_prefix prefixes[4];
+	struct lpm_prefix keys[4];
+	struct lpm *lpm;
+	bool success = true;
+
+	success &= init_prefix6(&prefixes[0], &keys[0], "2001:db8::", 32);
+	success &= init_prefix6(&prefixes[1], &keys[1], "2001:db8:1:2:3:4::", 96);
+	success &= init_prefix6(&prefixes[2], &keys[2], "2001:db8:1:2:3:4:5:6", 128);
+	success &= init_prefix6(&prefixes[3], &keys[3], "3fff::", 16);
+	if (!success)
+		return false;
+
+	lpm = lpm_build(16, keys, ARRAY_SIZE(keys));
+	if (!ASSERT_BOOL(true, lpm != NULL, "build"))
+		return false;
+
+	success &= assert_lookup6(lpm, "2001:db8:1:2:3:4:5:6", 2);
+	success &= assert_lookup6(lpm, "2001:db8:1:2:3:4:5:7", 1);
+	success &= assert_lookup6(lpm, "2001:db8:1:2:3:4::", 1);
+	/* These fail the skipped bits at different depths. */
+	success &= assert_lookup6(lpm, "2001:db8:1:2:3:5:5:6", 0);
+	success &= assert_lookup6(lpm, "2001:db8:1:2:3::", 0);
+	success &= assert_lookup6(lpm, "2001:db8:8000::", 0);
+	success &= assert_lookup6(lpm, "2001:db9::", -ESRCH);
+	success &= assert_lookup6(lpm, "3fff:ffff::1", 3);
+	success &= assert_lookup6(lpm, "::", -ESRCH);
+
+	lpm_destroy(lpm);
+	return success;
+}
+
+static void init_sparse_addr(struct in6_addr *addr, __u32 i)
+{
+	addr->s6_addr32[0] = cpu_to_be32(0x20010db8U);
+	addr->s6_addr32[1] = cpu_to_be32(i * 0x9E3779B1U);
+	addr->s6_addr32[2] = cpu_to_be32(~i * 0x85EBCA6BU);
+	addr->s6_addr32[3] = cpu_to_be32(i);
+}
+
+/**
+ * Scattered /128s are the worst case of a trie with fixed strides.
+ */
+static bool test_sparse(void)
+{
+	struct in6_addr *addrs;
+	struct lpm_prefix *keys;
+	struct in6_addr addr;
+	struct lpm *lpm = NULL;
+	unsigned int i;
+	bool success = true;
+
+	addrs = vmalloc(SPARSE_COUNT * sizeof(*addrs));
+	keys = vmalloc(SPARSE_COUNT * sizeof(*keys));
+	if (!addrs || !keys) {
+		success = false;
+		goto end;
+	}
+
+	for (i = 0; i < SPARSE_COUNT; i++) {
+		init_sparse_addr(&addrs[i], i);
+		keys[i].bytes = addrs[i].s6_addr;
+		keys[i].len = 128;
+	}
+
+	lpm = lpm_build(16, keys, SPARSE_COUNT);
+	if (!ASSERT_BOOL(true, lpm != NULL, "build")) {
+		success = false;
+		goto end;
+	}
+
+	/* A few slots per prefix; not a node per byte. */
+	success &= ASSERT_BOOL(true, lpm->slot_count < 8 * SPARSE_COUNT,
+			"slot count (%u)", lpm->slot_count);
+
+	for (i = 0; i < SPARSE_COUNT && success; i++) {
+		success &= ASSERT_INT(i, lpm_lookup(lpm, addrs[i].s6_addr),
+				"lookup %u", i);
+	}
+
+	/* Only the last bit differs from a prefix. */
+	init_sparse_addr(&addr, 0);
+	addr.s6_addr[15] ^= 1U;
+	success &= ASSERT_INT(-ESRCH, lpm_lookup(lpm, addr.s6_addr), "miss 1");
+	/* Only one of the skipped bits differs from a prefix. */
+	init_sparse_addr(&addr, 12345);
+	addr.s6_addr[13] ^= 0x10U;
+	success &= ASSERT_INT(-ESRCH, lpm_lookup(lpm, addr.s6_addr), "miss 2");
+
+end:
+	lpm_destroy(lpm);
+	vfree(keys);
+	vfree(addrs);
+	return success;
+}
+
+/**
+ * Tables that can't be compiled have to be reported, so the caller can keep
+ * using its slower structure.
+ */
+static bool test_too_big(void)
+{
+	struct ipv6_prefix prefixes[3];
+	struct lpm_prefix keys[3];
+	struct lpm *lpm;
+	unsigned int old_max_slots = max_slots;
+	bool success = true;
+
+	success &= init_prefix6(&prefixes[0], &keys[0], "2001:db8::", 32);
+	success &= init_prefix6(&prefixes[1], &keys[1], "2001:db8:1::", 48);
+	success &= init_prefix6(&prefixes[2], &keys[2], "2001:db8:2::", 48);
+	if (!success)
+		return false;
+
+	max_slots = 2;
+	lpm = lpm_build(16, keys, ARRAY_SIZE(keys));
+	max_slots = old_max_slots;
+
+	success &= ASSERT_PTR(NULL, lpm, "build");
+	lpm_destroy(lpm);
+	return success;
+}
+
+int init_module(void)
+{
+	START_TESTS("LPM");
+
+	CALL_TEST(test_ipv4(), "IPv4");
+	CALL_TEST(test_path_compression(), "Path compression");
+	CALL_TEST(test_sparse(), "Sparse table");
+	CALL_TEST(test_too_big(), "Table too big");
+
+	END_TESTS;
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
@@ -202,6 +202,8 @@ static bool test_foreach_taddr4(void)
 static void init_sample(struct pool4_sample *sample, __u32 addr, __u16 min,
 		__u16 max)
 {
+	sample->mark = 1;
+	sample->proto = L4PROTO_TCP;
 	sample->addr.s_addr = cpu_to_be32(addr);
 	sample->range.min = min;
 	sample->range.max = max;
@@ -611,6 +613,118 @@ static bool test_rm(void)
 	return success;
 }
 
+/**
+ * Adds lots of tables (one per mark) so the database has to grow, then removes
+ * them so it has to shrink back.
+ */
+static bool test_resize(void)
+{
+	struct ipv4_prefix prefix;
+	struct port_range ports;
+	struct pool4_db *database;
+	__u32 mark;
+	__u32 tables;
+	__u64 samples;
+	__u64 taddrs;
+	bool success = true;
+
+	prefix.address.s_addr = cpu_to_be32(0xc0000200U);
+	prefix.len = 32;
+	ports.min = 100;
+	ports.max = 199;
+
+	for (mark = 0; mark < 100; mark++) {
+		success &= ASSERT_INT(0, pool4db_add(mark, L4PROTO_UDP, &prefix,
+				&ports), "add %u", mark);
+	}
+
+	database = rcu_dereference_raw(db);
+	success &= ASSERT_BOOL(true, db_slots(database) >= 100, "grown");
+	for (mark = 0; mark < 100; mark++) {
+		success &= ASSERT_BOOL(true, !!find_table(database, mark,
+				L4PROTO_UDP), "find %u", mark);
+	}
+	pool4db_count(&tables, &samples, &taddrs);
+	success &= ASSERT_UINT(100U, tables, "table count");
+	success &= ASSERT_U64(10000ULL, taddrs, "taddr count");
+
+	for (mark = 0; mark < 100; mark++) {
+		success &= ASSERT_INT(0, pool4db_rm(mark, L4PROTO_UDP, &prefix,
+				&ports), "rm %u", mark);
+	}
+
+	database = rcu_dereference_raw(db);
+	success &= ASSERT_UINT(slots(), db_slots(database), "shrunk");
+	success &= ASSERT_BOOL(true, pool4db_is_empty(), "empty");
+
+	return success;
+}
+
+struct dump_page_args {
+	struct pool4_sample last;
+	unsigned int visits[10];
+};
+
+/* Sends one sample per "page", so the test can change the database between. */
+static int dump_page(struct pool4_sample *sample, void *void_args)
+{
+	struct dump_page_args *args = void_args;
+
+	if (sample->mark < ARRAY_SIZE(args->visits))
+		args->visits[sample->mark]++;
+	args->last = *sample;
+	return 1;
+}
+
+/**
+ * Paginated dumps resume from the last sample they sent. Tables added in the
+ * meantime make the database grow, which must not make the dump skip or repeat
+ * any of the tables that were there all along.
+ */
+static bool test_foreach_sample_resize(void)
+{
+	struct ipv4_prefix prefix;
+	struct port_range ports;
+	struct dump_page_args args;
+	struct pool4_sample *offset = NULL;
+	unsigned int initial_slots;
+	__u32 mark;
+	int error;
+	bool success = true;
+
+	prefix.address.s_addr = cpu_to_be32(0xc0000200U);
+	prefix.len = 32;
+	ports.min = 100;
+	ports.max = 199;
+	memset(&args, 0, sizeof(args));
+
+	for (mark = 0; mark < ARRAY_SIZE(args.visits); mark++) {
+		success &= ASSERT_INT(0, pool4db_add(mark, L4PROTO_UDP, &prefix,
+				&ports), "add %u", mark);
+	}
+	if (!success)
+		return false;
+	initial_slots = db_slots(rcu_dereference_raw(db));
+
+	mark = 1000;
+	do {
+		error = pool4db_foreach_sample(dump_page, &args, offset);
+		offset = &args.last;
+		/* Grow the database between pages. */
+		success &= ASSERT_INT(0, pool4db_add(mark, L4PROTO_UDP, &prefix,
+				&ports), "add %u", mark);
+		mark++;
+	} while (error == 1 && mark < 2000);
+
+	success &= ASSERT_INT(0, error, "dump result");
+	success &= ASSERT_BOOL(true, db_slots(rcu_dereference_raw(db))
+			> initial_slots, "grown");
+	for (mark = 0; mark < ARRAY_SIZE(args.visits); mark++)
+		success &= ASSERT_UINT(1U, args.visits[mark], "visits %u", mark);
+
+	return success;
+}
+
 static bool init(void)
 {
 	int error;
@@ -641,8 +755,11 @@ int init_module(void)
 	INIT_CALL_END(init(), test_init_power(), destroy(), "Power init");
 	INIT_CALL_END(init(), test_foreach_taddr4(), destroy(), "Taddr for");
 	INIT_CALL_END(init(), test_foreach_sample(), destroy(), "Sample for");
+	INIT_CALL_END(init(), test_foreach_sample_resize(), destroy(),
+			"Sample for, resized");
 	INIT_CALL_END(init(), test_add(), destroy(), "Add");
 	INIT_CALL_END(init(), test_rm(), destroy(), "Rm");
+	INIT_CALL_END(init(), test_resize(), destroy(), "Resize");
 
 	END_TESTS;
 }
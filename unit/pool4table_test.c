@@ -0,0 +1,349 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+
+#include "nat64/unit/unit_test.h"
+#include "pool4/table.c"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("IPv4 pool table module test");
+
+static DEFINE_MUTEX(lock);
+static struct pool4_table *table;
+
+#define TADDR_COUNT 21
+
+static bool add(__u32 addr, __u8 prefix_len, __u16 min, __u16 max)
+{
+	struct ipv4_prefix prefix;
+	struct port_range ports;
+	int error;
+
+	prefix.address.s_addr = cpu_to_be32(addr);
+	prefix.len = prefix_len;
+	ports.min = min;
+	ports.max = max;
+
+	mutex_lock(&lock);
+	error = pool4table_add(table, &prefix, &ports);
+	mutex_unlock(&lock);
+
+	return ASSERT_INT(0, error, "add of %pI4/%u (%u-%u)",
+			&prefix.address, prefix.len, min, max);
+}
+
+static bool rm(__u32 addr, __u8 prefix_len, __u16 min, __u16 max)
+{
+	struct ipv4_prefix prefix;
+	struct port_range ports;
+	int error;
+
+	prefix.address.s_addr = cpu_to_be32(addr);
+	prefix.len = prefix_len;
+	ports.min = min;
+	ports.max = max;
+
+	mutex_lock(&lock);
+	error = pool4table_rm(table, &prefix, &ports);
+	mutex_unlock(&lock);
+
+	return ASSERT_INT(0, error, "rm of %pI4/%u (%u-%u)",
+			&prefix.address, prefix.len, min, max);
+}
+
+/**
+ * Leaves @table as if reindex() had failed to allocate the index.
+ */
+static void drop_index(void)
+{
+	struct pool4_index *index;
+
+	mutex_lock(&lock);
+	index = rcu_dereference_protected(table->index,
+			lockdep_is_held(&lock));
+	RCU_INIT_POINTER(table->index, NULL);
+	synchronize_rcu_bh();
+	index_destroy(index);
+	mutex_unlock(&lock);
+}
+
+/**
+ * Leaves the following table:
+ *
+ * 	192.0.2.1	10-19	(offset 0)
+ * 	192.0.2.1	30-39	(offset 10)
+ * 	192.0.2.0	5	(offset 20)
+ *
+ * 192.0.2.1 is added first, so it comes first in iteration order but last in
+ * the sorted keys.
+ */
+static bool add_common_samples(void)
+{
+	bool success = true;
+
+	success &= add(0xc0000201, 32, 10, 19);
+	success &= add(0xc0000200, 32, 5, 5);
+	success &= add(0xc0000201, 32, 30, 39);
+
+	return success;
+}
+
+static void init_taddr(struct ipv4_transport_addr *taddr, __u32 addr,
+		__u16 port)
+{
+	taddr->l3.s_addr = cpu_to_be32(addr);
+	taddr->l4 = port;
+}
+
+static unsigned int init_expected(struct ipv4_transport_addr *expected)
+{
+	unsigned int i = 0;
+	unsigned int port;
+
+	for (port = 10; port <= 19; port++)
+		init_taddr(&expected[i++], 0xc0000201, port);
+	for (port = 30; port <= 39; port++)
+		init_taddr(&expected[i++], 0xc0000201, port);
+	init_taddr(&expected[i++], 0xc0000200, 5);
+
+	return i;
+}
+
+static bool test_find_offset(void)
+{
+	struct pool4_index *index;
+	bool success = true;
+
+	if (!add_common_samples())
+		return false;
+
+	rcu_read_lock_bh();
+	index = rcu_dereference_bh(table->index);
+	if (!ASSERT_BOOL(true, index != NULL, "index")) {
+		rcu_read_unlock_bh();
+		return false;
+	}
+
+	success &= ASSERT_UINT(0, find_offset(index, 0), "0");
+	success &= ASSERT_UINT(0, find_offset(index, 9), "9");
+	success &= ASSERT_UINT(1, find_offset(index, 10), "10");
+	success &= ASSERT_UINT(1, find_offset(index, 19), "19");
+	success &= ASSERT_UINT(2, find_offset(index, 20), "20");
+	rcu_read_unlock_bh();
+
+	return success;
+}
+
+static bool test_index(void)
+{
+	struct pool4_index *index;
+	bool success = true;
+
+	if (!add_common_samples())
+		return false;
+
+	rcu_read_lock_bh();
+	index = rcu_dereference_bh(table->index);
+	if (!ASSERT_BOOL(true, index != NULL, "index")) {
+		rcu_read_unlock_bh();
+		return false;
+	}
+
+	success &= ASSERT_UINT(3, index->count, "count");
+	success &= ASSERT_UINT(2, index->addrs, "addrs");
+	success &= ASSERT_UINT(TADDR_COUNT, index->taddrs, "taddrs");
+
+	success &= ASSERT_ADDR4("192.0.2.1", &index->ranges[0].addr, "r0 addr");
+	success &= ASSERT_UINT(10, index->ranges[0].range.min, "r0 min");
+	success &= ASSERT_UINT(0, index->ranges[0].offset, "r0 offset");
+	success &= ASSERT_ADDR4("192.0.2.1", &index->ranges[1].addr, "r1 addr");
+	success &= ASSERT_UINT(30, index->ranges[1].range.min, "r1 min");
+	success &= ASSERT_UINT(10, index->ranges[1].offset, "r1 offset");
+	success &= ASSERT_ADDR4("192.0.2.0", &index->ranges[2].addr, "r2 addr");
+	success &= ASSERT_UINT(5, index->ranges[2].range.min, "r2 min");
+	success &= ASSERT_UINT(20, index->ranges[2].offset, "r2 offset");
+
+	success &= ASSERT_UINT(0xc0000200, index->keys[0].addr, "k0 addr");
+	success &= ASSERT_UINT(5, index->keys[0].range.min, "k0 min");
+	success &= ASSERT_UINT(0xc0000201, index->keys[1].addr, "k1 addr");
+	success &= ASSERT_UINT(10, index->keys[1].range.min, "k1 min");
+	success &= ASSERT_UINT(0xc0000201, index->keys[2].addr, "k2 addr");
+	success &= ASSERT_UINT(30, index->keys[2].range.min, "k2 min");
+	rcu_read_unlock_bh();
+
+	return success;
+}
+
+struct foreach_taddr4_args {
+	struct ipv4_transport_addr *expected;
+	unsigned int expected_len;
+	unsigned int i;
+};
+
+static int validate_taddr4(struct ipv4_transport_addr *addr, void *void_args)
+{
+	struct foreach_taddr4_args *args = void_args;
+	bool success = true;
+
+	success &= ASSERT_BOOL(true, args->i < args->expected_len,
+			"overflow (%u %u)", args->i, args->expected_len);
+	if (!success)
+		return -EINVAL;
+
+	success &= __ASSERT_ADDR4(&args->expected[args->i].l3, &addr->l3, "addr");
+	success &= ASSERT_UINT(args->expected[args->i].l4, addr->l4, "port");
+
+	args->i++;
+	return success ? 0 : -EINVAL;
+}
+
+static bool assert_contains(__u32 addr, __u16 port, bool expected)
+{
+	struct ipv4_transport_addr taddr;
+	bool success;
+
+	init_taddr(&taddr, addr, port);
+	rcu_read_lock_bh();
+	success = ASSERT_BOOL(expected, pool4table_contains(table, &taddr),
+			"contains %pI4:%u", &taddr.l3, port);
+	rcu_read_unlock_bh();
+
+	return success;
+}
+
+/**
+ * Runs the reader functions on the common samples. The results have to be the
+ * same whether the index is there or not.
+ */
+static bool validate_common_samples(void)
+{
+	struct ipv4_transport_addr expected[2 * TADDR_COUNT];
+	struct foreach_taddr4_args args;
+	__u64 samples = 0;
+	__u64 taddrs = 0;
+	unsigned int i;
+	int error;
+	bool success = true;
+
+	success &= assert_contains(0xc0000201, 9, false);
+	success &= assert_contains(0xc0000201, 10, true);
+	success &= assert_contains(0xc0000201, 19, true);
+	success &= assert_contains(0xc0000201, 20, false);
+	success &= assert_contains(0xc0000201, 29, false);
+	success &= assert_contains(0xc0000201, 30, true);
+	success &= assert_contains(0xc0000201, 39, true);
+	success &= assert_contains(0xc0000201, 40, false);
+	success &= assert_contains(0xc0000200, 4, false);
+	success &= assert_contains(0xc0000200, 5, true);
+	success &= assert_contains(0xc0000200, 6, false);
+	success &= assert_contains(0xc0000202, 10, false);
+
+	rcu_read_lock_bh();
+	pool4table_count(table, &samples, &taddrs);
+	rcu_read_unlock_bh();
+	success &= ASSERT_U64(2, samples, "samples");
+	success &= ASSERT_U64(TADDR_COUNT, taddrs, "taddrs");
+
+	if (init_expected(expected) != TADDR_COUNT) {
+		log_err("Input mismatch. Unit test is broken.");
+		return false;
+	}
+	memcpy(&expected[TADDR_COUNT], &expected[0],
+			TADDR_COUNT * sizeof(*expected));
+
+	for (i = 0; i < 2 * TADDR_COUNT; i++) {
+		args.expected = &expected[i % TADDR_COUNT];
+		args.expected_len = TADDR_COUNT;
+		args.i = 0;
+
+		rcu_read_lock_bh();
+		error = pool4table_foreach_taddr4(table, validate_taddr4, &args,
+				i);
+		rcu_read_unlock_bh();
+
+		success &= ASSERT_INT(0, error, "call %u", i);
+		success &= ASSERT_UINT(TADDR_COUNT, args.i, "visited %u", i);
+	}
+
+	return success;
+}
+
+static bool test_readers(void)
+{
+	if (!add_common_samples())
+		return false;
+	return validate_common_samples();
+}
+
+static bool test_readers_no_index(void)
+{
+	bool success = true;
+
+	if (!add_common_samples())
+		return false;
+
+	drop_index();
+	success &= ASSERT_PTR(NULL, rcu_access_pointer(table->index), "index");
+	success &= validate_common_samples();
+
+	return success;
+}
+
+static bool test_reindex(void)
+{
+	bool success = true;
+
+	if (!add_common_samples())
+		return false;
+
+	/* A failed rebuild must not leave a stale index behind. */
+	drop_index();
+	success &= rm(0xc0000201, 32, 12, 13);
+	success &= ASSERT_BOOL(true, rcu_access_pointer(table->index) != NULL,
+			"index rebuilt");
+	success &= assert_contains(0xc0000201, 11, true);
+	success &= assert_contains(0xc0000201, 12, false);
+	success &= assert_contains(0xc0000201, 13, false);
+	success &= assert_contains(0xc0000201, 14, true);
+
+	success &= rm(0xc0000200, 24, 0, 65535);
+	success &= ASSERT_PTR(NULL, rcu_access_pointer(table->index),
+			"empty table has no index");
+	success &= assert_contains(0xc0000201, 11, false);
+
+	return success;
+}
+
+static bool init(void)
+{
+	table = pool4table_create(1, L4PROTO_TCP, &lock);
+	if (!table) {
+		log_err("Could not allocate the table.");
+		return false;
+	}
+
+	return true;
+}
+
+static void destroy(void)
+{
+	pool4table_destroy(table);
+}
+
+int init_module(void)
+{
+	START_TESTS("IPv4 Pool table");
+
+	INIT_CALL_END(init(), test_find_offset(), destroy(), "Offset");
+	INIT_CALL_END(init(), test_index(), destroy(), "Index");
+	INIT_CALL_END(init(), test_readers(), destroy(), "Readers");
+	INIT_CALL_END(init(), test_readers_no_index(), destroy(), "Fallback");
+	INIT_CALL_END(init(), test_reindex(), destroy(), "Reindex");
+
+	END_TESTS;
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
@@ -0,0 +1,166 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("IPv6 pool module test");
+
+#include "nat64/common/str_utils.h"
+#include "nat64/unit/unit_test.h"
+#include "pool6.c"
+
+static int add(char *addr, __u8 len)
+{
+	struct ipv6_prefix prefix;
+
+	if (str_to_addr6(addr, &prefix.address)) {
+		log_err("Unparseable address: %s. The unit test is broken.", addr);
+		return -EINVAL;
+	}
+	prefix.len = len;
+
+	return pool6_add(&prefix);
+}
+
+static int rm(char *addr, __u8 len)
+{
+	struct ipv6_prefix prefix;
+
+	if (str_to_addr6(addr, &prefix.address)) {
+		log_err("Unparseable address: %s. The unit test is broken.", addr);
+		return -EINVAL;
+	}
+	prefix.len = len;
+
+	return pool6_remove(&prefix);
+}
+
+/**
+ * Asserts pool6_get(@addr_str) returns @expected_len (0 means "no match").
+ */
+static bool assert_get(char *addr_str, __u8 expected_len)
+{
+	struct in6_addr addr;
+	struct ipv6_prefix prefix;
+	int error;
+
+	if (str_to_addr6(addr_str, &addr)) {
+		log_err("Unparseable address: %s. The unit test is broken.",
+				addr_str);
+		return false;
+	}
+
+	error = pool6_get(&addr, &prefix);
+	if (!expected_len)
+		return ASSERT_INT(-ESRCH, error, "%s result", addr_str);
+
+	if (!ASSERT_INT(0, error, "%s result", addr_str))
+		return false;
+	return ASSERT_UINT(expected_len, prefix.len, "%s length", addr_str)
+			&& ASSERT_BOOL(true, ipv6_prefix_equal(&prefix.address,
+					&addr, prefix.len), "%s prefix",
+					addr_str);
+}
+
+/**
+ * Simulates a failed reindex(), so pool6_get() has to walk the list.
+ */
+static void drop_index(void)
+{
+	struct pool6_index *old;
+
+	mutex_lock(&lock);
+	old = rcu_dereference_protected(pool_index, lockdep_is_held(&lock));
+	RCU_INIT_POINTER(pool_index, NULL);
+	mutex_unlock(&lock);
+
+	synchronize_rcu_bh();
+	index_destroy(old);
+}
+
+/**
+ * The prefixes are added in an order in which "the first one that matches"
+ * would be wrong.
+ */
+static bool init(void)
+{
+	if (pool6_init(NULL, 0))
+		return false;
+
+	if (add("2001:db8:1:2::", 64)
+			|| add("2001:db8::", 32)
+			|| add("64:ff9b::", 96)
+			|| add("2001:db8:1:2:3:4::", 96)
+			|| add("2001:db8:1::", 48)) {
+		pool6_destroy();
+		return false;
+	}
+
+	return true;
+}
+
+static void end(void)
+{
+	pool6_destroy();
+}
+
+/**
+ * If @use_index is false, the index is dropped after every modification, so
+ * only the list is tested.
+ */
+static bool test_longest_match(bool use_index)
+{
+	bool success = true;
+
+	if (use_index) {
+		if (!ASSERT_BOOL(true, rcu_dereference_raw(pool_index) != NULL,
+				"index"))
+			return false;
+	} else {
+		drop_index();
+	}
+
+	success &= assert_get("2001:db8:1:2:3:4:5:6", 96);
+	success &= assert_get("2001:db8:1:2:3:5::", 64);
+	success &= assert_get("2001:db8:1:2::", 64);
+	success &= assert_get("2001:db8:1:3::1", 48);
+	success &= assert_get("2001:db8:2::1", 32);
+	success &= assert_get("2001:db8:ffff:ffff::", 32);
+	success &= assert_get("64:ff9b::c000:201", 96);
+	success &= assert_get("64:ff9b:1::c000:201", 0);
+	success &= assert_get("2001:db9::", 0);
+	success &= assert_get("::", 0);
+
+	/* The shorter prefixes have to take over the removed one's space. */
+	if (!ASSERT_INT(0, rm("2001:db8:1::", 48), "rm /48"))
+		return false;
+	if (!use_index)
+		drop_index();
+	success &= assert_get("2001:db8:1:2:3:4:5:6", 96);
+	success &= assert_get("2001:db8:1:2::", 64);
+	success &= assert_get("2001:db8:1:3::1", 32);
+
+	if (!ASSERT_INT(0, rm("2001:db8:1:2::", 64), "rm /64"))
+		return false;
+	if (!use_index)
+		drop_index();
+	success &= assert_get("2001:db8:1:2:3:4:5:6", 96);
+	success &= assert_get("2001:db8:1:2::", 32);
+
+	return success;
+}
+
+int init_module(void)
+{
+	START_TESTS("IPv6 pool");
+
+	INIT_CALL_END(init(), test_longest_match(true), end(), "Index");
+	INIT_CALL_END(init(), test_longest_match(false), end(), "List");
+
+	END_TESTS;
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
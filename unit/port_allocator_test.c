@@ -1,4 +1,5 @@
 #include <linux/module.h>
+#include "nat64/common/constants.h"
 #include "nat64/unit/types.h"
 #include "nat64/unit/unit_test.h"
 #include "bib/port_allocator.c"
@@ -53,44 +54,24 @@ static bool test_md5(void)
 	secret_key_len = 2;
 
 	/* Expected value gotten from DuckDuckGo. Look up "md5 abcdefg...". */
-	return ASSERT_INT(0, f(&tuple6, &result), "errcode")
+	return ASSERT_INT(0, f(&tuple6, DEFAULT_F_ARGS, &result), "errcode")
 			&& ASSERT_BE32(0xb6a824a9u, result, "hash");
 }
 
-static int set_f_args(unsigned int args)
-{
-	struct global_config *cfg;
-	int error;
-
-	cfg = kmalloc(sizeof(*cfg), GFP_KERNEL);
-	if (!cfg)
-		return -ENOMEM;
-	cfg->mtu_plateaus = NULL;
-
-	error = config_clone(cfg);
-	if (error)
-		return error;
-
-	cfg->nat64.f_args = args;
-
-	config_replace(cfg);
-	return 0;
-}
-
 static bool f_args_test(void)
 {
 	struct tuple tuple6;
 	bool success = true;
+	unsigned int f_args;
 	unsigned int result1;
 	unsigned int result2;
 
-	if (set_f_args(0b1111))
-		return false;
+	f_args = 0b1111;
 	if (init_tuple6(&tuple6, "1::1", 1111, "2::2", 2222, L4PROTO_TCP))
 		return false;
 
-	success &= ASSERT_INT(0, f(&tuple6, &result1), "result 1");
-	success &= ASSERT_INT(0, f(&tuple6, &result2), "result 2");
+	success &= ASSERT_INT(0, f(&tuple6, f_args, &result1), "result 1");
+	success &= ASSERT_INT(0, f(&tuple6, f_args, &result2), "result 2");
 	success &= ASSERT_UINT(result1, result2,
 			"Same arguments, result has to be the same");
 
@@ -102,30 +83,29 @@ static bool f_args_test(void)
 	 * small change this test will spit a false negative.
 	 * But the chance is small enough that it shouldn't matter.
 	 */
-	success &= ASSERT_INT(0, f(&tuple6, &result2), "result 3");
+	success &= ASSERT_INT(0, f(&tuple6, f_args, &result2), "result 3");
 	success &= ASSERT_BOOL(true, result1 != result2,
 			"Small change on all fields matter");
 
-	if (set_f_args(0b0010))
-		return false;
+	f_args = 0b0010;
 	if (init_tuple6(&tuple6, "1::1", 1111, "2::2", 2222, L4PROTO_TCP))
 		return false;
 
-	success &= ASSERT_INT(0, f(&tuple6, &result1), "result 4");
-	success &= ASSERT_INT(0, f(&tuple6, &result2), "result 5");
+	success &= ASSERT_INT(0, f(&tuple6, f_args, &result1), "result 4");
+	success &= ASSERT_INT(0, f(&tuple6, f_args, &result2), "result 5");
 	success &= ASSERT_UINT(result1, result2,
 			"Same arguments, fewer arguments than first test");
 
 	memset(&tuple6.src, 3, sizeof(tuple6.src));
 	tuple6.dst.addr6.l4 = 3333;
 
-	success &= ASSERT_INT(0, f(&tuple6, &result2), "result 6");
+	success &= ASSERT_INT(0, f(&tuple6, f_args, &result2), "result 6");
 	success &= ASSERT_UINT(result1, result2,
 			"All fields that don't matter changed");
 
 	memset(&tuple6.dst.addr6.l3, 3, sizeof(tuple6.dst.addr6.l3));
 
-	success &= ASSERT_INT(0, f(&tuple6, &result2), "result 7");
+	success &= ASSERT_INT(0, f(&tuple6, f_args, &result2), "result 7");
 	success &= ASSERT_BOOL(true, result1 != result2,
 			"The one field that matters changed");
 
@@ -0,0 +1,339 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Destination prefilter module test");
+
+#include "nat64/common/str_utils.h"
+#include "nat64/unit/unit_test.h"
+#include "prefilter.c"
+
+static int add_pool6(char *addr, __u8 len)
+{
+	struct ipv6_prefix prefix;
+
+	if (str_to_addr6(addr, &prefix.address)) {
+		log_err("Unparseable address: %s. The unit test is broken.", addr);
+		return -EINVAL;
+	}
+	prefix.len = len;
+
+	return pool6_add(&prefix);
+}
+
+static int add_blacklist(__u32 addr, __u8 len)
+{
+	struct ipv4_prefix prefix;
+
+	prefix.address.s_addr = cpu_to_be32(addr);
+	prefix.len = len;
+
+	return blacklist_add(&prefix);
+}
+
+static int add_eam(char *addr6, __u8 len6, __u32 addr4, __u8 len4)
+{
+	struct ipv6_prefix prefix6;
+	struct ipv4_prefix prefix4;
+
+	if (str_to_addr6(addr6, &prefix6.address)) {
+		log_err("Unparseable address: %s. The unit test is broken.", addr6);
+		return -EINVAL;
+	}
+	prefix6.len = len6;
+	prefix4.address.s_addr = cpu_to_be32(addr4);
+	prefix4.len = len4;
+
+	return eamt_add(&prefix6, &prefix4, false);
+}
+
+static int add_pool4(__u32 addr)
+{
+	struct ipv4_prefix prefix;
+	struct port_range ports;
+
+	prefix.address.s_addr = cpu_to_be32(addr);
+	prefix.len = 32;
+	ports.min = 1;
+	ports.max = 65535;
+
+	return pool4db_add(0, L4PROTO_UDP, &prefix, &ports);
+}
+
+/**
+ * Same as prefilter_update(), except the test picks the translator type
+ * (xlat_is_siit() is hardcoded during the unit tests).
+ */
+static bool build(bool siit)
+{
+	struct prefilter *new;
+	int error;
+
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return false;
+
+	error = siit ? build_siit(new) : build_nat64(new);
+	if (!ASSERT_INT(0, error, "build")) {
+		kfree(new);
+		return false;
+	}
+
+	replace(new);
+	return true;
+}
+
+static bool assert_wants4(__u32 daddr, __u8 protocol, bool expected)
+{
+	struct iphdr hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.daddr = cpu_to_be32(daddr);
+	hdr.protocol = protocol;
+
+	return ASSERT_BOOL(expected, prefilter_wants4(&hdr), "%pI4 (%u)",
+			&hdr.daddr, protocol);
+}
+
+static bool assert_wants6(char *daddr, bool expected)
+{
+	struct ipv6hdr hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	if (str_to_addr6(daddr, &hdr.daddr)) {
+		log_err("Unparseable address: %s. The unit test is broken.",
+				daddr);
+		return false;
+	}
+
+	return ASSERT_BOOL(expected, prefilter_wants6(&hdr), "%s", daddr);
+}
+
+/**
+ * Without a filter, everything has to go through.
+ */
+static bool test_no_filter(void)
+{
+	bool success = true;
+
+	success &= assert_wants4(0xc0000201U, IPPROTO_UDP, true);
+	success &= assert_wants4(0x7f000001U, IPPROTO_UDP, true);
+	success &= assert_wants6("2001:db8::1", true);
+
+	return success;
+}
+
+/**
+ * Without pool6 nor EAMT, a SIIT has nothing to translate.
+ */
+static bool test_siit_empty(void)
+{
+	bool success = true;
+
+	if (!build(true))
+		return false;
+
+	success &= assert_wants4(0xc0000201U, IPPROTO_UDP, false);
+	success &= assert_wants4(0x0a000001U, IPPROTO_TCP, false);
+	success &= assert_wants6("64:ff9b::c000:201", false);
+	success &= assert_wants6("2001:db8::1", false);
+
+	return success;
+}
+
+/**
+ * With pool6, any IPv4 destination might be translated, except for the ones
+ * generate_addr6_siit() refuses.
+ */
+static bool test_siit_pool6(void)
+{
+	bool success = true;
+
+	if (!ASSERT_INT(0, add_pool6("64:ff9b::", 96), "add pool6"))
+		return false;
+	if (!build(true))
+		return false;
+
+	success &= assert_wants6("64:ff9b::c000:201", true);
+	success &= assert_wants6("64:ff9b:ffff::", true); /* Same /16. */
+	success &= assert_wants6("65::1", false);
+	success &= assert_wants6("2001:db8::1", false);
+
+	success &= assert_wants4(0xc0000201U, IPPROTO_UDP, true);
+	success &= assert_wants4(0x0a000001U, IPPROTO_UDP, true);
+	success &= assert_wants4(0xdfffffffU, IPPROTO_UDP, true);
+	/* Scope subnets. */
+	success &= assert_wants4(0x00010203U, IPPROTO_UDP, false);
+	success &= assert_wants4(0x7f000001U, IPPROTO_UDP, false);
+	success &= assert_wants4(0xa9fe0101U, IPPROTO_UDP, false);
+	success &= assert_wants4(0xa9ff0101U, IPPROTO_UDP, true);
+	success &= assert_wants4(0xe0000001U, IPPROTO_UDP, false);
+	success &= assert_wants4(0xefffffffU, IPPROTO_UDP, false);
+	success &= assert_wants4(0xf0000000U, IPPROTO_UDP, true);
+
+	return success;
+}
+
+/**
+ * Blacklisted /16s are skipped, unless the EAMT claims part of them.
+ * Smaller blacklisted networks can't be told apart from their neighbors.
+ */
+static bool test_siit_blacklist(void)
+{
+	bool success = true;
+
+	success &= ASSERT_INT(0, add_pool6("64:ff9b::", 96), "add pool6");
+	success &= ASSERT_INT(0, add_blacklist(0xc6330000U, 16), "add /16");
+	success &= ASSERT_INT(0, add_blacklist(0xcb007100U, 24), "add /24");
+	success &= ASSERT_INT(0, add_blacklist(0x0a000000U, 8), "add /8");
+	if (!success || !build(true))
+		return false;
+
+	success &= assert_wants4(0xc6336401U, IPPROTO_UDP, false);
+	success &= assert_wants4(0xc632ffffU, IPPROTO_UDP, true);
+	success &= assert_wants4(0xc6340000U, IPPROTO_UDP, true);
+	success &= assert_wants4(0xcb007101U, IPPROTO_UDP, true);
+	success &= assert_wants4(0x0a000001U, IPPROTO_UDP, false);
+	success &= assert_wants4(0x0affffffU, IPPROTO_UDP, false);
+
+	/* The EAMT overrides the blacklist. */
+	success &= ASSERT_INT(0, add_eam("2001:db8:100::", 120, 0xc6336400U, 24),
+			"add EAM");
+	if (!success || !build(true))
+		return false;
+
+	success &= assert_wants4(0xc6336401U, IPPROTO_UDP, true);
+	success &= assert_wants4(0x0a000001U, IPPROTO_UDP, false);
+	success &= assert_wants6("2001:db8:100::1", true);
+
+	return success;
+}
+
+/**
+ * Without pool6, only the EAMT's networks are translated.
+ */
+static bool test_siit_eamt(void)
+{
+	bool success = true;
+
+	success &= ASSERT_INT(0, add_eam("2001:db8:aaaa::", 120, 0xc0000200U, 24),
+			"add EAM 1");
+	success &= ASSERT_INT(0, add_eam("3fff::", 104, 0xcb000000U, 8),
+			"add EAM 2");
+	if (!success || !build(true))
+		return false;
+
+	success &= assert_wants4(0xc0000201U, IPPROTO_UDP, true);
+	success &= assert_wants4(0xc000ffffU, IPPROTO_UDP, true); /* Same /16. */
+	success &= assert_wants4(0xc0010000U, IPPROTO_UDP, false);
+	success &= assert_wants4(0xcb000001U, IPPROTO_UDP, true);
+	success &= assert_wants4(0xcbffffffU, IPPROTO_UDP, true);
+	success &= assert_wants4(0xcc000000U, IPPROTO_UDP, false);
+	success &= assert_wants4(0xc6336401U, IPPROTO_UDP, false);
+
+	success &= assert_wants6("2001:db8:aaaa::1", true);
+	success &= assert_wants6("2001::1", true); /* Same /16. */
+	success &= assert_wants6("2002::1", false);
+	success &= assert_wants6("3fff::1", true);
+	success &= assert_wants6("64:ff9b::c000:201", false);
+
+	return success;
+}
+
+/**
+ * An empty pool4 stands for the node's own addresses, which the filter
+ * doesn't track, so every IPv4 destination has to go through.
+ */
+static bool test_nat64_empty_pool4(void)
+{
+	bool success = true;
+
+	if (!ASSERT_INT(0, add_pool6("64:ff9b::", 96), "add pool6"))
+		return false;
+	if (!build(false))
+		return false;
+
+	success &= assert_wants4(0xc0000201U, IPPROTO_UDP, true);
+	success &= assert_wants4(0xcb007101U, IPPROTO_TCP, true);
+	success &= assert_wants6("64:ff9b::c000:201", true);
+	success &= assert_wants6("2001:db8::1", false);
+
+	return success;
+}
+
+static bool test_nat64_pool4(void)
+{
+	bool success = true;
+
+	success &= ASSERT_INT(0, add_pool6("64:ff9b::", 96), "add pool6");
+	success &= ASSERT_INT(0, add_pool4(0xc0000201U), "add pool4 1");
+	success &= ASSERT_INT(0, add_pool4(0xcb007101U), "add pool4 2");
+	if (!success || !build(false))
+		return false;
+
+	success &= assert_wants4(0xc0000201U, IPPROTO_UDP, true);
+	success &= assert_wants4(0xc0000301U, IPPROTO_TCP, true); /* Same /16. */
+	success &= assert_wants4(0xcb007101U, IPPROTO_UDP, true);
+	success &= assert_wants4(0xc6336401U, IPPROTO_UDP, false);
+	success &= assert_wants4(0xc0010201U, IPPROTO_UDP, false);
+	/* ICMP errors are matched by their inner packet. */
+	success &= assert_wants4(0xc6336401U, IPPROTO_ICMP, true);
+
+	success &= assert_wants6("64:ff9b::c633:6401", true);
+	success &= assert_wants6("2001:db8::1", false);
+
+	return success;
+}
+
+static bool init(void)
+{
+	if (pool6_init(NULL, 0))
+		goto pool6_fail;
+	if (blacklist_init(NULL, 0))
+		goto blacklist_fail;
+	if (eamt_init())
+		goto eamt_fail;
+	if (pool4db_init(0, NULL, 0))
+		goto pool4_fail;
+
+	return true;
+
+pool4_fail:
+	eamt_destroy();
+eamt_fail:
+	blacklist_destroy();
+blacklist_fail:
+	pool6_destroy();
+pool6_fail:
+	return false;
+}
+
+static void end(void)
+{
+	prefilter_destroy();
+	pool4db_destroy();
+	eamt_destroy();
+	blacklist_destroy();
+	pool6_destroy();
+}
+
+int init_module(void)
+{
+	START_TESTS("Prefilter");
+
+	INIT_CALL_END(init(), test_no_filter(), end(), "No filter");
+	INIT_CALL_END(init(), test_siit_empty(), end(), "SIIT, empty");
+	INIT_CALL_END(init(), test_siit_pool6(), end(), "SIIT, pool6");
+	INIT_CALL_END(init(), test_siit_blacklist(), end(), "SIIT, blacklist");
+	INIT_CALL_END(init(), test_siit_eamt(), end(), "SIIT, EAMT");
+	INIT_CALL_END(init(), test_nat64_empty_pool4(), end(), "NAT64, empty pool4");
+	INIT_CALL_END(init(), test_nat64_pool4(), end(), "NAT64, pool4");
+
+	END_TESTS;
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
@@ -0,0 +1,87 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+
+#include "nat64/unit/unit_test.h"
+#include "rfc6791.c"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("RFC 6791 pool module test");
+
+static struct global_config cfg;
+
+/**
+ * Asserts the address rfc6791_get() picks for an IPv6 packet whose hop limit
+ * is @hop_limit. (The hop limit is the address index when randomization is
+ * disabled.)
+ */
+static bool assert_get(__u8 hop_limit, __u32 expected)
+{
+	struct sk_buff *skb;
+	struct packet in;
+	__be32 result;
+	bool success = true;
+
+	skb = alloc_skb(sizeof(struct ipv6hdr), GFP_KERNEL);
+	if (!skb) {
+		log_err("Could not allocate a test packet.");
+		return false;
+	}
+	skb_reset_network_header(skb);
+	memset(skb_put(skb, sizeof(struct ipv6hdr)), 0, sizeof(struct ipv6hdr));
+	ipv6_hdr(skb)->hop_limit = hop_limit;
+
+	memset(&in, 0, sizeof(in));
+	in.skb = skb;
+	in.cfg = &cfg;
+
+	/* @out is only needed when the pool is empty. */
+	success &= ASSERT_INT(0, rfc6791_get(&in, NULL, &result),
+			"hop limit %u result", hop_limit);
+	success &= ASSERT_BE32(expected, result, "hop limit %u", hop_limit);
+
+	kfree_skb(skb);
+	return success;
+}
+
+/**
+ * rfc6791_get() used to overshoot by one at every entry boundary. (Index 4
+ * below yielded 192.0.2.4, which is not even in the pool.)
+ */
+static bool test_get(void)
+{
+	char *prefixes[] = { "192.0.2.0/30", "203.0.113.16/29" };
+	bool success = true;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.siit.randomize_error_addresses = false;
+
+	if (!ASSERT_INT(0, rfc6791_init(prefixes, ARRAY_SIZE(prefixes)), "init"))
+		return false;
+
+	/* 192.0.2.0/30 (0-3), 203.0.113.16/29 (4-11) */
+	success &= assert_get(0, 0xc0000200U);
+	success &= assert_get(3, 0xc0000203U);
+	success &= assert_get(4, 0xcb007110U);
+	success &= assert_get(5, 0xcb007111U);
+	success &= assert_get(11, 0xcb007117U);
+	success &= assert_get(12, 0xc0000200U);
+	success &= assert_get(255, 0xc0000203U); /* 255 % 12 = 3 */
+
+	rfc6791_destroy();
+	return success;
+}
+
+int init_module(void)
+{
+	START_TESTS("RFC 6791 pool");
+
+	CALL_TEST(test_get(), "Get");
+
+	END_TESTS;
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
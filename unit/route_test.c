@@ -0,0 +1,236 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Route cache module test");
+
+#include "nat64/common/str_utils.h"
+#include "nat64/unit/unit_test.h"
+#include "route.c"
+
+/*
+ * The cache only needs the dst's reference counter and dst_check(), so this
+ * doesn't have to be a real route. The test keeps its own reference, so the
+ * kernel never tries to destroy it.
+ */
+static struct rt6_info fake_rt;
+static bool fake_valid;
+
+static struct dst_entry *fake_check(struct dst_entry *dst, u32 cookie)
+{
+	return fake_valid ? dst : NULL;
+}
+
+static struct dst_ops fake_ops = {
+	.family = AF_INET6,
+	.check = fake_check,
+};
+
+static int refcount(void)
+{
+	return atomic_read(&fake_rt.dst.__refcnt);
+}
+
+static bool init_flow6(struct flowi6 *flow, char *daddr, char *saddr,
+		__u16 sport)
+{
+	memset(flow, 0, sizeof(*flow));
+	if (str_to_addr6(daddr, &flow->daddr)
+			|| str_to_addr6(saddr, &flow->saddr)) {
+		log_err("Unparseable address. The unit test is broken.");
+		return false;
+	}
+	flow->flowi6_mark = 0;
+	flow->flowi6_tos = 0;
+	flow->flowi6_proto = IPPROTO_UDP;
+	flow->fl6_sport = cpu_to_be16(sport);
+	flow->fl6_dport = cpu_to_be16(53);
+	return true;
+}
+
+static void init_flow4(struct flowi4 *flow, __u32 daddr)
+{
+	memset(flow, 0, sizeof(*flow));
+	flow->flowi4_scope = RT_SCOPE_UNIVERSE;
+	flow->flowi4_proto = IPPROTO_UDP;
+	flow->daddr = cpu_to_be32(daddr);
+}
+
+/**
+ * Asserts the cache has (@expected) or doesn't have (!@expected) a route for
+ * @flow.
+ */
+static bool assert_get6(struct flowi6 *flow, bool expected, char *name)
+{
+	struct dst_entry *dst;
+	bool success;
+
+	dst = dstcache_get6(flow);
+	success = ASSERT_PTR(expected ? &fake_rt.dst : NULL, dst, "%s", name);
+	if (dst)
+		dst_release(dst);
+
+	return success;
+}
+
+static bool assert_get4(struct flowi4 *flow, bool expected, char *name)
+{
+	struct dst_entry *dst;
+	bool success;
+
+	dst = dstcache_get4(flow);
+	success = ASSERT_PTR(expected ? &fake_rt.dst : NULL, dst, "%s", name);
+	if (dst)
+		dst_release(dst);
+
+	return success;
+}
+
+/**
+ * Flows towards the same destination share the route, whatever their source.
+ */
+static bool test_hits(void)
+{
+	struct flowi6 flow6;
+	struct flowi4 flow4;
+	bool success = true;
+
+	if (!init_flow6(&flow6, "2001:db8::1", "64:ff9b::c000:201", 1000))
+		return false;
+	dstcache_put6(&flow6, &fake_rt.dst);
+	success &= ASSERT_INT(2, refcount(), "refcount after put");
+
+	success &= assert_get6(&flow6, true, "same flow");
+	if (!init_flow6(&flow6, "2001:db8::1", "64:ff9b::cb00:7101", 2000))
+		return false;
+	flow6.flowlabel = cpu_to_be32(1234);
+	success &= assert_get6(&flow6, true, "other source");
+	success &= ASSERT_INT(2, refcount(), "refcount after gets");
+
+	flow6.flowi6_mark = 1;
+	success &= assert_get6(&flow6, false, "other mark");
+	flow6.flowi6_mark = 0;
+	flow6.flowi6_tos = 0x20;
+	success &= assert_get6(&flow6, false, "other traffic class");
+	flow6.flowi6_tos = 0;
+	flow6.flowi6_proto = IPPROTO_TCP;
+	success &= assert_get6(&flow6, false, "other protocol");
+	if (!init_flow6(&flow6, "2001:db8::2", "64:ff9b::c000:201", 1000))
+		return false;
+	success &= assert_get6(&flow6, false, "other destination");
+
+	init_flow4(&flow4, 0xc0000201U);
+	dstcache_put4(&flow4, &fake_rt.dst);
+	success &= assert_get4(&flow4, true, "IPv4 same flow");
+	init_flow4(&flow4, 0xc0000202U);
+	success &= assert_get4(&flow4, false, "IPv4 other destination");
+	success &= ASSERT_INT(3, refcount(), "refcount after IPv4");
+
+	return success;
+}
+
+/**
+ * Routes the kernel has given up on must not be served.
+ */
+static bool test_invalidation(void)
+{
+	struct flowi6 flow;
+	bool success = true;
+
+	if (!init_flow6(&flow, "2001:db8::1", "64:ff9b::c000:201", 1000))
+		return false;
+
+	dstcache_put6(&flow, &fake_rt.dst);
+	success &= assert_get6(&flow, true, "valid");
+
+	/* The routing table changed; dst_check() rejects it. */
+	fake_valid = false;
+	success &= assert_get6(&flow, false, "dst_check() failed");
+	success &= ASSERT_INT(1, refcount(), "refcount after dst_check()");
+	fake_valid = true;
+	success &= assert_get6(&flow, false, "dropped");
+
+	/* Dead; dst_check() would not have noticed. */
+	dstcache_put6(&flow, &fake_rt.dst);
+	fake_rt.dst.obsolete = DST_OBSOLETE_DEAD;
+	success &= assert_get6(&flow, false, "dead");
+	success &= ASSERT_INT(1, refcount(), "refcount after dead");
+
+	return success;
+}
+
+/**
+ * Interfaces going away have to take the cache's references with them.
+ */
+static bool test_netdev_flush(void)
+{
+	struct flowi6 flow6;
+	struct flowi4 flow4;
+	bool success = true;
+
+	if (!init_flow6(&flow6, "2001:db8::1", "64:ff9b::c000:201", 1000))
+		return false;
+	init_flow4(&flow4, 0xc0000201U);
+
+	dstcache_put6(&flow6, &fake_rt.dst);
+	dstcache_put4(&flow4, &fake_rt.dst);
+	success &= ASSERT_INT(3, refcount(), "refcount after puts");
+
+	/* Harmless events don't flush. */
+	handle_netdev_event(&netdev_notifier, NETDEV_UP, NULL);
+	success &= ASSERT_INT(3, refcount(), "refcount after up");
+	success &= assert_get6(&flow6, true, "after up");
+
+	handle_netdev_event(&netdev_notifier, NETDEV_DOWN, NULL);
+	success &= ASSERT_INT(1, refcount(), "refcount after down");
+	success &= assert_get6(&flow6, false, "IPv6 after down");
+	success &= assert_get4(&flow4, false, "IPv4 after down");
+
+	dstcache_put6(&flow6, &fake_rt.dst);
+	handle_netdev_event(&netdev_notifier, NETDEV_UNREGISTER, NULL);
+	success &= ASSERT_INT(1, refcount(), "refcount after unregister");
+	success &= assert_get6(&flow6, false, "after unregister");
+
+	return success;
+}
+
+/**
+ * The caches are per CPU, so the tests must not migrate halfway through.
+ */
+static bool init(void)
+{
+	memset(&fake_rt, 0, sizeof(fake_rt));
+	fake_rt.dst.ops = &fake_ops;
+	fake_rt.dst.obsolete = DST_OBSOLETE_FORCE_CHK;
+	atomic_set(&fake_rt.dst.__refcnt, 1);
+	fake_valid = true;
+
+	if (route_init())
+		return false;
+
+	preempt_disable();
+	return true;
+}
+
+static void end(void)
+{
+	preempt_enable();
+	route_destroy();
+}
+
+int init_module(void)
+{
+	START_TESTS("Route cache");
+
+	INIT_CALL_END(init(), test_hits(), end(), "Hits");
+	INIT_CALL_END(init(), test_invalidation(), end(), "Invalidation");
+	INIT_CALL_END(init(), test_netdev_flush(), end(), "Netdev flush");
+
+	END_TESTS;
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
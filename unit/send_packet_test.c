@@ -0,0 +1,509 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/udp.h>
+#include <net/ip6_checksum.h>
+
+#include "nat64/unit/unit_test.h"
+#include "send_packet.c"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Packet sending module test");
+
+#define FRAG_ID 0x12345678U
+#define HDRS_LEN ((unsigned int) (sizeof(struct ipv6hdr) \
+		+ sizeof(struct frag_hdr)))
+/* Where the test data starts within each page, so page_offset matters. */
+#define PAGE_DATA_OFFSET 100
+
+/**
+ * What a fragment sent by fragment6() is supposed to look like.
+ */
+struct frag_expect {
+	/* Fragment offset; includes the original fragment header's. */
+	__u16 offset;
+	/* Length of the fragmentable part. */
+	unsigned int len;
+	bool mf;
+	/* skb_headlen() of the fragment; includes the headers. */
+	unsigned int headlen;
+	unsigned int nr_frags;
+};
+
+static unsigned char pattern(unsigned int i)
+{
+	return (i & 0xFFU) ^ (i >> 8);
+}
+
+static void init_frag_expect(struct frag_expect *expect, __u16 offset,
+		unsigned int len, bool mf, unsigned int linear,
+		unsigned int nr_frags)
+{
+	expect->offset = offset;
+	expect->len = len;
+	expect->mf = mf;
+	expect->headlen = HDRS_LEN + linear;
+	expect->nr_frags = nr_frags;
+}
+
+/**
+ * Builds @pkt: an IPv6 packet whose fragmentable part is @linear bytes in the
+ * linear area followed by one page fragment per @page_lens entry.
+ * Byte i of the fragmentable part is pattern(i).
+ *
+ * If @hdr_frag is not NULL, the packet gets a copy of it as its fragment
+ * header.
+ */
+static int create_pkt(struct packet *pkt, struct frag_hdr *hdr_frag,
+		unsigned int linear, unsigned int *page_lens,
+		unsigned int page_count)
+{
+	struct sk_buff *skb;
+	struct ipv6hdr *hdr6;
+	struct page *page;
+	unsigned char *data;
+	unsigned int hdrs_len;
+	unsigned int i, j, k = 0;
+
+	hdrs_len = sizeof(*hdr6) + (hdr_frag ? sizeof(*hdr_frag) : 0);
+	skb = alloc_skb(LL_MAX_HEADER + hdrs_len + linear, GFP_KERNEL);
+	if (!skb) {
+		log_err("Could not allocate a test packet.");
+		return -ENOMEM;
+	}
+
+	skb_reserve(skb, LL_MAX_HEADER);
+	skb_reset_network_header(skb);
+	skb_put(skb, hdrs_len + linear);
+	skb->protocol = htons(ETH_P_IPV6);
+
+	hdr6 = ipv6_hdr(skb);
+	memset(hdr6, 0, sizeof(*hdr6));
+	hdr6->version = 6;
+	hdr6->nexthdr = hdr_frag ? NEXTHDR_FRAGMENT : NEXTHDR_UDP;
+	hdr6->hop_limit = 64;
+	hdr6->saddr.s6_addr32[0] = cpu_to_be32(0x20010db8U);
+	hdr6->saddr.s6_addr32[3] = cpu_to_be32(1);
+	hdr6->daddr.s6_addr32[0] = cpu_to_be32(0x20010db8U);
+	hdr6->daddr.s6_addr32[3] = cpu_to_be32(2);
+
+	memset(pkt, 0, sizeof(*pkt));
+	pkt->skb = skb;
+	pkt->l3_proto = L3PROTO_IPV6;
+	pkt->l4_proto = L4PROTO_UDP;
+	pkt->fragmentable = true;
+	pkt->frag_id = cpu_to_be32(FRAG_ID);
+	if (hdr_frag) {
+		pkt->hdr_frag = (struct frag_hdr *) (hdr6 + 1);
+		memcpy(pkt->hdr_frag, hdr_frag, sizeof(*hdr_frag));
+	}
+
+	data = skb_network_header(skb) + hdrs_len;
+	for (i = 0; i < linear; i++)
+		data[i] = pattern(k++);
+
+	for (i = 0; i < page_count; i++) {
+		page = alloc_page(GFP_KERNEL);
+		if (!page) {
+			log_err("Could not allocate a test page.");
+			kfree_skb(skb);
+			return -ENOMEM;
+		}
+
+		data = page_address(page) + PAGE_DATA_OFFSET;
+		for (j = 0; j < page_lens[i]; j++)
+			data[j] = pattern(k++);
+
+		skb_fill_page_desc(skb, i, page, PAGE_DATA_OFFSET, page_lens[i]);
+		skb->len += page_lens[i];
+		skb->data_len += page_lens[i];
+		skb->truesize += PAGE_SIZE;
+	}
+
+	hdr6->payload_len = cpu_to_be16(skb->len - sizeof(*hdr6));
+	return 0;
+}
+
+/**
+ * Moves @pkt's last @len bytes to a frag_list, the way the kernel leaves
+ * reassembled packets. @pkt has to be linear.
+ */
+static int move_to_frag_list(struct packet *pkt, unsigned int len)
+{
+	struct sk_buff *skb = pkt->skb;
+	struct sk_buff *list;
+
+	list = alloc_skb(len, GFP_KERNEL);
+	if (!list) {
+		log_err("Could not allocate a test packet.");
+		return -ENOMEM;
+	}
+
+	memcpy(skb_put(list, len), skb_tail_pointer(skb) - len, len);
+	skb_trim(skb, skb->len - len);
+
+	skb_shinfo(skb)->frag_list = list;
+	skb->len += len;
+	skb->data_len += len;
+	skb->truesize += list->truesize;
+	return 0;
+}
+
+/**
+ * Returns a copy of @pkt's fragmentable part.
+ */
+static unsigned char *copy_data(struct packet *pkt, unsigned int *len)
+{
+	unsigned int data_start;
+	unsigned char *result;
+
+	data_start = sizeof(struct ipv6hdr);
+	if (pkt->hdr_frag)
+		data_start += sizeof(struct frag_hdr);
+	*len = pkt->skb->len - data_start;
+
+	result = kmalloc(*len, GFP_KERNEL);
+	if (!result)
+		return NULL;
+	if (skb_copy_bits(pkt->skb, data_start, result, *len)) {
+		kfree(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+/**
+ * Pops the fragments fragment6() sent, validates them against @expected, and
+ * reassembles their fragmentable parts into @data.
+ * @base_offset is the fragment offset of @data's first byte.
+ */
+static bool collect_fragments(struct ipv6hdr *hdr6, __u8 nexthdr, __u32 id,
+		__u16 base_offset, struct frag_expect *expected,
+		unsigned int count, unsigned char *data)
+{
+	struct sk_buff *frag;
+	struct ipv6hdr *frag_hdr6;
+	struct frag_hdr *hdr_frag;
+	struct frag_expect *expect;
+	unsigned int i;
+	bool success = true;
+
+	success &= ASSERT_UINT(count, skb_queue_len(&sent_skbs), "fragments");
+	if (!success)
+		return false;
+
+	for (i = 0; i < count; i++) {
+		frag = skb_dequeue(&sent_skbs);
+		expect = &expected[i];
+
+		frag_hdr6 = ipv6_hdr(frag);
+		success &= ASSERT_UINT(NEXTHDR_FRAGMENT, frag_hdr6->nexthdr,
+				"%u nexthdr", i);
+		success &= ASSERT_BE16((__u16) (sizeof(*hdr_frag) + expect->len),
+				frag_hdr6->payload_len, "%u payload len", i);
+		success &= ASSERT_BOOL(true, ipv6_addr_equal(&hdr6->saddr,
+				&frag_hdr6->saddr), "%u saddr", i);
+		success &= ASSERT_BOOL(true, ipv6_addr_equal(&hdr6->daddr,
+				&frag_hdr6->daddr), "%u daddr", i);
+
+		hdr_frag = (struct frag_hdr *) (frag_hdr6 + 1);
+		success &= ASSERT_UINT(nexthdr, hdr_frag->nexthdr,
+				"%u frag nexthdr", i);
+		success &= ASSERT_BE32(id, hdr_frag->identification,
+				"%u id", i);
+		success &= ASSERT_UINT(expect->offset,
+				get_fragment_offset_ipv6(hdr_frag), "%u offset", i);
+		success &= ASSERT_BOOL(expect->mf,
+				is_more_fragments_set_ipv6(hdr_frag), "%u MF", i);
+
+		success &= ASSERT_UINT(HDRS_LEN + expect->len, frag->len,
+				"%u len", i);
+		success &= ASSERT_UINT(expect->headlen, skb_headlen(frag),
+				"%u headlen", i);
+		success &= ASSERT_UINT(expect->nr_frags,
+				skb_shinfo(frag)->nr_frags, "%u nr_frags", i);
+		success &= ASSERT_BOOL(false, frag->ip_summed == CHECKSUM_PARTIAL,
+				"%u checksum partial", i);
+
+		if (success) {
+			success &= ASSERT_INT(0, skb_copy_bits(frag, HDRS_LEN,
+					data + expect->offset - base_offset,
+					expect->len), "%u copy", i);
+		}
+
+		kfree_skb(frag);
+	}
+
+	return success;
+}
+
+/**
+ * Fragments @pkt and validates the result.
+ */
+static bool test_fragment6(struct packet *pkt, unsigned int mtu,
+		__u8 nexthdr, __u32 id, __u16 base_offset,
+		struct frag_expect *expected, unsigned int count)
+{
+	struct ipv6hdr hdr6;
+	unsigned char *expected_data;
+	unsigned char *actual_data = NULL;
+	unsigned int len;
+	bool success = true;
+
+	memcpy(&hdr6, ipv6_hdr(pkt->skb), sizeof(hdr6));
+	expected_data = copy_data(pkt, &len);
+	if (!expected_data) {
+		kfree_skb(pkt->skb);
+		return false;
+	}
+	actual_data = kzalloc(len, GFP_KERNEL);
+	if (!actual_data) {
+		kfree_skb(pkt->skb);
+		success = false;
+		goto end;
+	}
+
+	success &= ASSERT_BOOL(true, must_fragment(pkt, mtu), "must fragment");
+	success &= ASSERT_INT(VERDICT_CONTINUE, fragment6(pkt, mtu), "verdict");
+	if (!success)
+		goto end;
+
+	success &= collect_fragments(&hdr6, nexthdr, id, base_offset,
+			expected, count, actual_data);
+	success &= ASSERT_BOOL(true, !memcmp(expected_data, actual_data, len),
+			"data");
+
+end:
+	kfree(actual_data);
+	kfree(expected_data);
+	return success;
+}
+
+/**
+ * The offsets have to be multiples of 8 and only the last fragment can lack
+ * the MF bit.
+ */
+static bool test_linear(void)
+{
+	struct packet pkt;
+	struct frag_expect expected[3];
+
+	if (create_pkt(&pkt, NULL, 3000, NULL, 0))
+		return false;
+
+	/* (1500 - 40 - 8) & ~7 = 1448 */
+	init_frag_expect(&expected[0], 0, 1448, true, 1448, 0);
+	init_frag_expect(&expected[1], 1448, 1448, true, 1448, 0);
+	init_frag_expect(&expected[2], 2896, 104, false, 104, 0);
+
+	return test_fragment6(&pkt, 1500, NEXTHDR_UDP, FRAG_ID, 0, expected,
+			ARRAY_SIZE(expected));
+}
+
+/**
+ * append_data() copies what is in the linear area, and takes references to
+ * the pages otherwise.
+ */
+static bool test_paged(void)
+{
+	struct packet pkt;
+	unsigned int page_lens[] = { 2000, 1500 };
+	struct frag_expect expected[3];
+
+	if (create_pkt(&pkt, NULL, 100, page_lens, ARRAY_SIZE(page_lens)))
+		return false;
+
+	/* (1280 - 40 - 8) & ~7 = 1232 */
+	/* Linear 100 + first page 1132. */
+	init_frag_expect(&expected[0], 0, 1232, true, 100, 1);
+	/* First page 868 + second page 364. */
+	init_frag_expect(&expected[1], 1232, 1232, true, 0, 2);
+	/* Second page 1136. */
+	init_frag_expect(&expected[2], 2464, 1136, false, 0, 1);
+
+	return test_fragment6(&pkt, 1280, NEXTHDR_UDP, FRAG_ID, 0, expected,
+			ARRAY_SIZE(expected));
+}
+
+/**
+ * If the packet already is a fragment, the new fragments have to inherit its
+ * offset, MF bit, identification and next header, rather than nest another
+ * fragment header.
+ */
+static bool test_existing_header(void)
+{
+	struct packet pkt;
+	struct frag_hdr hdr_frag;
+	struct frag_expect expected[2];
+	bool success = true;
+
+	hdr_frag.nexthdr = NEXTHDR_TCP;
+	hdr_frag.reserved = 0;
+	hdr_frag.identification = cpu_to_be32(0xabcdef01U);
+
+	/* Not the last fragment. */
+	hdr_frag.frag_off = build_ipv6_frag_off_field(2000, true);
+	if (create_pkt(&pkt, &hdr_frag, 2000, NULL, 0))
+		return false;
+
+	init_frag_expect(&expected[0], 2000, 1232, true, 1232, 0);
+	init_frag_expect(&expected[1], 3232, 768, true, 768, 0);
+	success &= test_fragment6(&pkt, 1280, NEXTHDR_TCP, 0xabcdef01U, 2000,
+			expected, ARRAY_SIZE(expected));
+
+	/* The last fragment, and the kernel reassembled it. */
+	hdr_frag.frag_off = build_ipv6_frag_off_field(2000, false);
+	if (create_pkt(&pkt, &hdr_frag, 2000, NULL, 0))
+		return false;
+	if (move_to_frag_list(&pkt, 1000)) {
+		kfree_skb(pkt.skb);
+		return false;
+	}
+
+	/* The frag_list is copied, so everything is linear. */
+	init_frag_expect(&expected[0], 2000, 1232, true, 1232, 0);
+	init_frag_expect(&expected[1], 3232, 768, false, 768, 0);
+	success &= test_fragment6(&pkt, 1280, NEXTHDR_TCP, 0xabcdef01U, 2000,
+			expected, ARRAY_SIZE(expected));
+
+	return success;
+}
+
+/**
+ * A checksum the NIC was supposed to finish can't be finished by the NIC
+ * anymore once the packet is split.
+ */
+static bool test_checksum_partial(void)
+{
+	struct packet pkt;
+	struct ipv6hdr hdr6;
+	struct udphdr *hdr_udp;
+	struct frag_expect expected[2];
+	unsigned char *data = NULL;
+	unsigned int len = 2000;
+	__sum16 csum;
+	bool success = true;
+
+	if (create_pkt(&pkt, NULL, len, NULL, 0))
+		return false;
+
+	memcpy(&hdr6, ipv6_hdr(pkt.skb), sizeof(hdr6));
+	hdr_udp = (struct udphdr *) (ipv6_hdr(pkt.skb) + 1);
+	hdr_udp->source = cpu_to_be16(2000);
+	hdr_udp->dest = cpu_to_be16(4000);
+	hdr_udp->len = cpu_to_be16(len);
+	hdr_udp->check = ~csum_ipv6_magic(&hdr6.saddr, &hdr6.daddr, len,
+			IPPROTO_UDP, 0);
+	if (!skb_partial_csum_set(pkt.skb, sizeof(hdr6),
+			offsetof(struct udphdr, check))) {
+		log_err("Could not set the partial checksum.");
+		kfree_skb(pkt.skb);
+		return false;
+	}
+
+	data = kzalloc(len, GFP_KERNEL);
+	if (!data) {
+		kfree_skb(pkt.skb);
+		return false;
+	}
+
+	init_frag_expect(&expected[0], 0, 1232, true, 1232, 0);
+	init_frag_expect(&expected[1], 1232, 768, false, 768, 0);
+
+	success &= ASSERT_INT(VERDICT_CONTINUE, fragment6(&pkt, 1280),
+			"verdict");
+	if (!success)
+		goto end;
+	success &= collect_fragments(&hdr6, NEXTHDR_UDP, FRAG_ID, 0, expected,
+			ARRAY_SIZE(expected), data);
+	if (!success)
+		goto end;
+
+	csum = csum_ipv6_magic(&hdr6.saddr, &hdr6.daddr, len, IPPROTO_UDP,
+			csum_partial(data, len, 0));
+	success &= ASSERT_UINT(0, (__force __u16) csum, "checksum");
+	success &= ASSERT_UINT(pattern(len - 1), data[len - 1], "payload");
+
+end:
+	kfree(data);
+	return success;
+}
+
+static bool test_must_fragment(void)
+{
+	struct packet pkt;
+	struct frag_hdr hdr_frag;
+	bool success = true;
+
+	/* 40 + 2000 bytes. */
+	if (create_pkt(&pkt, NULL, 2000, NULL, 0))
+		return false;
+
+	success &= ASSERT_BOOL(true, must_fragment(&pkt, 1500), "too big");
+	success &= ASSERT_BOOL(false, must_fragment(&pkt, 2040), "fits");
+	success &= ASSERT_BOOL(false, must_fragment(&pkt, 1279), "tiny MTU");
+
+	pkt.fragmentable = false;
+	success &= ASSERT_BOOL(false, must_fragment(&pkt, 1500), "DF");
+	pkt.fragmentable = true;
+
+	/* The kernel will segment it first. */
+	skb_shinfo(pkt.skb)->gso_size = 1000;
+	success &= ASSERT_BOOL(false, must_fragment(&pkt, 1500), "GSO");
+	skb_shinfo(pkt.skb)->gso_size = 0;
+
+	/* The kernel can fragment it along the frag_list. */
+	if (move_to_frag_list(&pkt, 1000)) {
+		kfree_skb(pkt.skb);
+		return false;
+	}
+	success &= ASSERT_BOOL(false, must_fragment(&pkt, 1500), "frag_list");
+	kfree_skb(pkt.skb);
+
+	/* ...unless it would have to nest fragment headers. */
+	hdr_frag.nexthdr = NEXTHDR_UDP;
+	hdr_frag.reserved = 0;
+	hdr_frag.frag_off = build_ipv6_frag_off_field(0, true);
+	hdr_frag.identification = cpu_to_be32(FRAG_ID);
+	if (create_pkt(&pkt, &hdr_frag, 2000, NULL, 0))
+		return false;
+	if (move_to_frag_list(&pkt, 1000)) {
+		kfree_skb(pkt.skb);
+		return false;
+	}
+	success &= ASSERT_BOOL(true, must_fragment(&pkt, 1500),
+			"frag_list and fragment header");
+	kfree_skb(pkt.skb);
+
+	return success;
+}
+
+static bool init(void)
+{
+	skb_queue_head_init(&sent_skbs);
+	return true;
+}
+
+static void end(void)
+{
+	skb_queue_purge(&sent_skbs);
+}
+
+int init_module(void)
+{
+	START_TESTS("Packet sending");
+
+	INIT_CALL_END(init(), test_linear(), end(), "Linear");
+	INIT_CALL_END(init(), test_paged(), end(), "Paged");
+	INIT_CALL_END(init(), test_existing_header(), end(), "Fragment header");
+	INIT_CALL_END(init(), test_checksum_partial(), end(), "Checksum partial");
+	INIT_CALL_END(init(), test_must_fragment(), end(), "Must fragment");
+
+	END_TESTS;
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
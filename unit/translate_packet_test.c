@@ -1,8 +1,12 @@
 #include <linux/module.h>
 #include <linux/printk.h>
+#include <net/checksum.h>
+#include <net/tcp.h>
+#include <asm/unaligned.h>
 
 #include "nat64/unit/unit_test.h"
 #include "nat64/common/str_utils.h"
+#include "nat64/unit/route.h"
 #include "nat64/unit/skb_generator.h"
 #include "nat64/unit/validator.h"
 #include "nat64/unit/types.h"
@@ -14,6 +18,9 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Alberto Leiva Popper");
 MODULE_DESCRIPTION("Translating the Packet module test.");
 
+/** What the routing impersonator hands out while in-place tests run. */
+static struct dst_entry route_dst;
+
 static bool test_function_has_unexpired_src_route(void)
 {
 	struct iphdr *hdr = kmalloc(60, GFP_ATOMIC); /* 60 is the max value allowed by hdr.ihl. */
@@ -129,6 +136,41 @@ static bool test_function_build_id_field(void)
 	return success;
 }
 
+static bool test_function_clamp_mss(void)
+{
+	struct {
+		struct tcphdr tcp;
+		__u8 opts[12];
+	} hdr;
+	__u8 opts[] = {
+		TCPOPT_NOP, TCPOPT_NOP, TCPOPT_SACK_PERM, TCPOLEN_SACK_PERM,
+		TCPOPT_MSS, TCPOLEN_MSS, 0x05, 0xb4, /* 1460 */
+		TCPOPT_NOP, TCPOPT_NOP, TCPOPT_NOP, TCPOPT_EOL,
+	};
+	bool success = true;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.tcp.doff = sizeof(hdr) >> 2;
+	hdr.tcp.syn = 1;
+	memcpy(hdr.opts, opts, sizeof(opts));
+	hdr.tcp.check = csum_fold(csum_partial(&hdr, sizeof(hdr), 0));
+
+	ttpcomm_clamp_mss(&hdr.tcp, 1500, true);
+	success &= ASSERT_UINT(1440, get_unaligned_be16(&hdr.opts[6]), "1500");
+	success &= ASSERT_UINT(0, csum_fold(csum_partial(&hdr, sizeof(hdr), 0)),
+			"1500 checksum");
+
+	ttpcomm_clamp_mss(&hdr.tcp, 9000, true);
+	success &= ASSERT_UINT(1440, get_unaligned_be16(&hdr.opts[6]),
+			"Never raise");
+
+	hdr.tcp.syn = 0;
+	ttpcomm_clamp_mss(&hdr.tcp, 1280, true);
+	success &= ASSERT_UINT(1440, get_unaligned_be16(&hdr.opts[6]), "Not SYN");
+
+	return success;
+}
+
 static bool update_config(bool lower_mtu_fail)
 {
 	struct global_config *config;
@@ -238,8 +280,22 @@ static bool test_function_icmp4_to_icmp6_param_prob(void)
 	return success;
 }
 
+/**
+ * Turns @pkt into a GSO IPv4/TCP packet whose segments are @seg_len long.
+ */
+static void fake_gso(struct packet *pkt, unsigned int seg_len)
+{
+	unsigned int hdrs_len = sizeof(struct iphdr) + sizeof(struct tcphdr);
+
+	skb_reset_network_header(pkt->skb);
+	pkt->payload = pkt->skb->data + hdrs_len;
+	skb_shinfo(pkt->skb)->gso_size = seg_len - hdrs_len;
+	skb_shinfo(pkt->skb)->gso_type = SKB_GSO_TCPV4;
+}
+
 static bool test_function_generate_ipv4_id_nofrag(void)
 {
+	struct global_config cfg;
 	struct packet pkt;
 	struct sk_buff *skb;
 	__be16 attempt_1, attempt_2, attempt_3;
@@ -249,11 +305,13 @@ static bool test_function_generate_ipv4_id_nofrag(void)
 	if (!skb)
 		return false;
 	pkt.skb = skb;
+	config_snapshot(&cfg);
+	cfg.ipv4_id_mode = IPV4_ID_RANDOM;
 
 	skb_put(skb, 1000);
-	attempt_1 = generate_ipv4_id_nofrag(&pkt);
-	attempt_2 = generate_ipv4_id_nofrag(&pkt);
-	attempt_3 = generate_ipv4_id_nofrag(&pkt);
+	attempt_1 = generate_ipv4_id_nofrag(&cfg, &pkt);
+	attempt_2 = generate_ipv4_id_nofrag(&cfg, &pkt);
+	attempt_3 = generate_ipv4_id_nofrag(&cfg, &pkt);
 	/*
 	 * At least one of the attempts should be nonzero,
 	 * otherwise the random would be sucking major ****.
@@ -261,14 +319,25 @@ static bool test_function_generate_ipv4_id_nofrag(void)
 	success &= ASSERT_BOOL(true, (attempt_1 | attempt_2 | attempt_3) != 0, "Len < 1260");
 
 	skb_put(skb, 260);
-	attempt_1 = generate_ipv4_id_nofrag(&pkt);
-	attempt_2 = generate_ipv4_id_nofrag(&pkt);
-	attempt_3 = generate_ipv4_id_nofrag(&pkt);
+	attempt_1 = generate_ipv4_id_nofrag(&cfg, &pkt);
+	attempt_2 = generate_ipv4_id_nofrag(&cfg, &pkt);
+	attempt_3 = generate_ipv4_id_nofrag(&cfg, &pkt);
 	success &= ASSERT_BOOL(true, (attempt_1 | attempt_2 | attempt_3) != 0, "Len = 1260");
 
 	skb_put(skb, 200);
-	success &= ASSERT_BE16(0, generate_ipv4_id_nofrag(&pkt), "Len > 1260");
+	success &= ASSERT_BE16(0, generate_ipv4_id_nofrag(&cfg, &pkt), "Len > 1260");
+
+	/* GSO packets are judged by their segments, not by their total length. */
+	fake_gso(&pkt, 1000);
+	attempt_1 = generate_ipv4_id_nofrag(&cfg, &pkt);
+	attempt_2 = generate_ipv4_id_nofrag(&cfg, &pkt);
+	attempt_3 = generate_ipv4_id_nofrag(&cfg, &pkt);
+	success &= ASSERT_BOOL(true, (attempt_1 | attempt_2 | attempt_3) != 0, "GSO, segments < 1260");
 
+	fake_gso(&pkt, 1300);
+	success &= ASSERT_BE16(0, generate_ipv4_id_nofrag(&cfg, &pkt), "GSO, segments > 1260");
+
+	skb_shinfo(skb)->gso_size = 0;
 	kfree_skb(skb);
 	return success;
 }
@@ -293,13 +362,68 @@ static bool test_function_generate_df_flag(void)
 	skb_put(skb, 200);
 	success &= ASSERT_UINT(1, generate_df_flag(&pkt), "Len > 1260");
 
+	fake_gso(&pkt, 1000);
+	success &= ASSERT_UINT(0, generate_df_flag(&pkt), "GSO, segments < 1260");
+
+	fake_gso(&pkt, 1300);
+	success &= ASSERT_UINT(1, generate_df_flag(&pkt), "GSO, segments > 1260");
+
+	skb_shinfo(skb)->gso_size = 0;
 	kfree_skb(skb);
 	return success;
 }
 
+/**
+ * Initializes @pkt out of @hdrs, which is an IPv6 header followed by its
+ * extension headers (@hdrs_len bytes in total). A zeroed TCP header is appended
+ * so the packet has something to carry.
+ */
+static int init_pkt6(struct packet *pkt, void *hdrs, unsigned int hdrs_len)
+{
+	struct sk_buff *skb;
+	struct tcphdr *tcp;
+	unsigned int len = hdrs_len + sizeof(*tcp);
+	int error;
+
+	skb = alloc_skb(len, GFP_ATOMIC);
+	if (!skb) {
+		log_err("Could not allocate a test packet.");
+		return -ENOMEM;
+	}
+	skb_put(skb, len);
+	skb_reset_network_header(skb);
+
+	memcpy(skb->data, hdrs, hdrs_len);
+	ipv6_hdr(skb)->version = 6;
+	ipv6_hdr(skb)->payload_len = cpu_to_be16(len - sizeof(struct ipv6hdr));
+
+	tcp = (struct tcphdr *) (skb->data + hdrs_len);
+	memset(tcp, 0, sizeof(*tcp));
+	tcp->doff = sizeof(*tcp) / 4;
+
+	error = pkt_init_ipv6(pkt, skb);
+	if (error)
+		kfree_skb(skb);
+	return error;
+}
+
+static bool assert_xlat_proto(__u8 expected, void *hdrs, unsigned int hdrs_len,
+		char *test_name)
+{
+	struct packet pkt;
+	bool success;
+
+	if (init_pkt6(&pkt, hdrs, hdrs_len))
+		return false;
+
+	success = ASSERT_UINT(expected, ttp64_xlat_proto(&pkt), test_name);
+	kfree_skb(pkt.skb);
+	return success;
+}
+
 /**
  * By the way. This test kind of looks like it should test more combinations of headers.
- * But that'd be testing the header iterator, not the build_protocol_field() function.
+ * But that'd be testing the packet parser, not the build_protocol_field() function.
  * Please look elsewhere for that.
  */
 static bool test_function_build_protocol_field(void)
@@ -308,9 +432,8 @@ static bool test_function_build_protocol_field(void)
 	struct ipv6_opt_hdr *hop_by_hop_hdr;
 	struct ipv6_opt_hdr *routing_hdr;
 	struct ipv6_opt_hdr *dest_options_hdr;
-	struct icmp6hdr *icmp6_hdr;
 
-	ip6_hdr = kmalloc(sizeof(*ip6_hdr) + 8 + 16 + 24 + sizeof(struct tcphdr), GFP_ATOMIC);
+	ip6_hdr = kzalloc(sizeof(*ip6_hdr) + 8 + 16 + 24, GFP_ATOMIC);
 	if (!ip6_hdr) {
 		log_err("Could not allocate a test packet.");
 		goto failure;
@@ -318,13 +441,11 @@ static bool test_function_build_protocol_field(void)
 
 	/* Just ICMP. */
 	ip6_hdr->nexthdr = NEXTHDR_ICMP;
-	ip6_hdr->payload_len = cpu_to_be16(sizeof(*icmp6_hdr));
-	if (!ASSERT_UINT(IPPROTO_ICMP, ttp64_xlat_proto(ip6_hdr), "Just ICMP"))
+	if (!assert_xlat_proto(IPPROTO_ICMP, ip6_hdr, sizeof(*ip6_hdr), "Just ICMP"))
 		goto failure;
 
 	/* Skippable headers then ICMP. */
 	ip6_hdr->nexthdr = NEXTHDR_HOP;
-	ip6_hdr->payload_len = cpu_to_be16(8 + 16 + 24 + sizeof(*icmp6_hdr));
 
 	hop_by_hop_hdr = (struct ipv6_opt_hdr *) (ip6_hdr + 1);
 	hop_by_hop_hdr->nexthdr = NEXTHDR_ROUTING;
@@ -338,13 +459,14 @@ static bool test_function_build_protocol_field(void)
 	dest_options_hdr->nexthdr = NEXTHDR_ICMP;
 	dest_options_hdr->hdrlen = 2;
 
-	if (!ASSERT_UINT(IPPROTO_ICMP, ttp64_xlat_proto(ip6_hdr), "Skippable then ICMP"))
+	if (!assert_xlat_proto(IPPROTO_ICMP, ip6_hdr, sizeof(*ip6_hdr) + 8 + 16 + 24,
+			"Skippable then ICMP"))
 		goto failure;
 
 	/* Skippable headers then something else */
 	dest_options_hdr->nexthdr = NEXTHDR_TCP;
-	ip6_hdr->payload_len = cpu_to_be16(8 + 16 + 24 + sizeof(struct tcphdr));
-	if (!ASSERT_UINT(IPPROTO_TCP, ttp64_xlat_proto(ip6_hdr), "Skippable then TCP"))
+	if (!assert_xlat_proto(IPPROTO_TCP, ip6_hdr, sizeof(*ip6_hdr) + 8 + 16 + 24,
+			"Skippable then TCP"))
 		goto failure;
 
 	kfree(ip6_hdr);
@@ -355,25 +477,44 @@ failure:
 	return false;
 }
 
+static bool assert_segments_left(bool expected, __u32 expected_offset,
+		void *hdrs, unsigned int hdrs_len, char *test_name)
+{
+	struct packet pkt;
+	__u32 offset;
+	bool success;
+
+	if (init_pkt6(&pkt, hdrs, hdrs_len))
+		return false;
+
+	success = ASSERT_BOOL(expected, has_nonzero_segments_left(&pkt, &offset), test_name);
+	if (expected)
+		success &= ASSERT_UINT(expected_offset, offset, test_name);
+
+	kfree_skb(pkt.skb);
+	return success;
+}
+
 static bool test_function_has_nonzero_segments_left(void)
 {
 	struct ipv6hdr *ip6_hdr;
 	struct ipv6_rt_hdr *routing_hdr;
 	struct frag_hdr *fragment_hdr;
-	__u32 offset;
+	/* The routing header's length is rounded up to 8 octets. */
+	const unsigned int rt_len = 8;
 
 	bool success = true;
 
-	ip6_hdr = kmalloc(sizeof(*ip6_hdr) + sizeof(*fragment_hdr) + sizeof(*routing_hdr), GFP_ATOMIC);
+	ip6_hdr = kzalloc(sizeof(*ip6_hdr) + sizeof(*fragment_hdr) + rt_len, GFP_ATOMIC);
 	if (!ip6_hdr) {
 		log_err("Could not allocate a test packet.");
 		return false;
 	}
-	ip6_hdr->payload_len = cpu_to_be16(sizeof(*fragment_hdr) + sizeof(*routing_hdr));
 
 	/* No extension headers. */
 	ip6_hdr->nexthdr = NEXTHDR_TCP;
-	success &= ASSERT_BOOL(false, has_nonzero_segments_left(ip6_hdr, &offset), "No extension headers");
+	success &= assert_segments_left(false, 0, ip6_hdr, sizeof(*ip6_hdr),
+			"No extension headers");
 
 	if (!success)
 		goto end;
@@ -381,16 +522,19 @@ static bool test_function_has_nonzero_segments_left(void)
 	/* Routing header with nonzero segments left. */
 	ip6_hdr->nexthdr = NEXTHDR_ROUTING;
 	routing_hdr = (struct ipv6_rt_hdr *) (ip6_hdr + 1);
+	routing_hdr->nexthdr = NEXTHDR_TCP;
+	routing_hdr->hdrlen = 0;
 	routing_hdr->segments_left = 12;
-	success &= ASSERT_BOOL(true, has_nonzero_segments_left(ip6_hdr, &offset), "Nonzero left - result");
-	success &= ASSERT_UINT(40 + 3, offset, "Nonzero left - offset");
+	success &= assert_segments_left(true, 40 + 3, ip6_hdr,
+			sizeof(*ip6_hdr) + rt_len, "Nonzero left");
 
 	if (!success)
 		goto end;
 
 	/* Routing header with zero segments left. */
 	routing_hdr->segments_left = 0;
-	success &= ASSERT_BOOL(false, has_nonzero_segments_left(ip6_hdr, &offset), "Zero left");
+	success &= assert_segments_left(false, 0, ip6_hdr,
+			sizeof(*ip6_hdr) + rt_len, "Zero left");
 
 	if (!success)
 		goto end;
@@ -402,10 +546,14 @@ static bool test_function_has_nonzero_segments_left(void)
 	ip6_hdr->nexthdr = NEXTHDR_FRAGMENT;
 	fragment_hdr = (struct frag_hdr *) (ip6_hdr + 1);
 	fragment_hdr->nexthdr = NEXTHDR_ROUTING;
+	fragment_hdr->frag_off = 0;
 	routing_hdr = (struct ipv6_rt_hdr *) (fragment_hdr + 1);
+	routing_hdr->nexthdr = NEXTHDR_TCP;
+	routing_hdr->hdrlen = 0;
 	routing_hdr->segments_left = 24;
-	success &= ASSERT_BOOL(true, has_nonzero_segments_left(ip6_hdr, &offset), "Two headers - result");
-	success &= ASSERT_UINT(40 + 8 + 3, offset, "Two headers - offset");
+	success &= assert_segments_left(true, 40 + 8 + 3, ip6_hdr,
+			sizeof(*ip6_hdr) + sizeof(*fragment_hdr) + rt_len,
+			"Two headers");
 
 	/* Fall through. */
 end:
@@ -488,11 +636,97 @@ static bool compare_skbs(struct sk_buff *expected, struct sk_buff *actual)
 	return !errors;
 }
 
+/**
+ * The copying path can handle simple packets too; @in_place false forces it on
+ * them. (Only TCP and UDP can be translated in place in the first place.)
+ */
+static void prepare_path(struct packet *pkt, bool in_place)
+{
+	if (in_place)
+		set_route_dst(&route_dst);
+	else
+		pkt->is_simple = false;
+}
+
+/**
+ * If @in_place, asserts that @out is @in's own skb (and forgets @in, since it
+ * no longer exists on its own).
+ */
+static bool assert_path(struct sk_buff **in, struct packet *out, bool in_place)
+{
+	bool success;
+
+	set_route_dst(NULL);
+	if (!in_place)
+		return ASSERT_BOOL(false, out->skb == *in, "Translated in place");
+
+	success = ASSERT_BOOL(true, out->skb == *in, "Translated in place");
+	if (success)
+		*in = NULL;
+	return success;
+}
+
+static bool test_function_can_xlat_in_place(void)
+{
+	struct global_config cfg;
+	struct packet pkt6, pkt4;
+	struct sk_buff *skb6 = NULL, *skb4 = NULL;
+	struct tuple tuple6, tuple4;
+	bool success = false;
+
+	if (init_tuple6(&tuple6, "1::1", 50080, "64::192.0.2.5", 51234, L4PROTO_UDP) != 0
+			|| init_tuple4(&tuple4, "192.0.2.5", 1234, "192.0.2.2", 80, L4PROTO_UDP) != 0
+			|| create_skb6_udp(&tuple6, &skb6, 100, 32) != 0
+			|| create_skb4_udp(&tuple4, &skb4, 100, 32) != 0
+			|| pkt_init_ipv6(&pkt6, skb6) != 0
+			|| pkt_init_ipv4(&pkt4, skb4) != 0)
+		goto end;
+	config_snapshot(&cfg);
+	pkt6.cfg = &cfg;
+	pkt4.cfg = &cfg;
+
+	success = ASSERT_BOOL(true, ttpcomm_can_xlat_in_place(&tuple4, &pkt6), "IPv6");
+	success &= ASSERT_BOOL(true, ttpcomm_can_xlat_in_place(&tuple6, &pkt4), "IPv4");
+
+	pkt6.will_hairpin = true;
+	success &= ASSERT_BOOL(false, ttpcomm_can_xlat_in_place(&tuple4, &pkt6), "Hairpin");
+	pkt6.will_hairpin = false;
+
+	pkt6.original_pkt = &pkt4;
+	success &= ASSERT_BOOL(false, ttpcomm_can_xlat_in_place(&tuple4, &pkt6), "Second pass");
+	pkt6.original_pkt = &pkt6;
+
+	pkt6.is_inner = true;
+	success &= ASSERT_BOOL(false, ttpcomm_can_xlat_in_place(&tuple4, &pkt6), "Inner");
+	pkt6.is_inner = false;
+
+	skb_shinfo(skb6)->gso_size = 50;
+	skb_shinfo(skb6)->gso_type = SKB_GSO_TCPV6;
+	success &= ASSERT_BOOL(false, ttpcomm_can_xlat_in_place(&tuple4, &pkt6), "Unsupported GSO");
+	skb_shinfo(skb6)->gso_size = 0;
+	skb_shinfo(skb6)->gso_type = 0;
+
+	ip_hdr(skb4)->frag_off = 0;
+	cfg.atomic_frags.build_ipv6_fh = true;
+	success &= ASSERT_BOOL(false, ttpcomm_can_xlat_in_place(&tuple6, &pkt4), "Needs fragment header");
+	cfg.atomic_frags.build_ipv6_fh = false;
+
+	ip_hdr(skb4)->frag_off = cpu_to_be16(IP_MF);
+	success &= ASSERT_BOOL(false, ttpcomm_can_xlat_in_place(&tuple6, &pkt4), "IPv4 fragment");
+	/* Fall through. */
+
+end:
+	kfree_skb(skb6);
+	kfree_skb(skb4);
+	return success;
+}
+
 static bool test_4to6(l4_protocol l4_proto,
 		int (*create_skb4_fn)(struct tuple *, struct sk_buff **, u16, u8),
 		int (*create_skb6_fn)(struct tuple *, struct sk_buff **, u16, u8),
-		u16 expected_payload6_len)
+		u16 expected_payload6_len, bool in_place)
 {
+	struct global_config cfg;
 	struct packet pkt4, pkt6_actual = { .skb = NULL };
 	struct sk_buff *skb4 = NULL, *skb6_expected = NULL;
 	struct tuple tuple4, tuple6;
@@ -504,46 +738,64 @@ static bool test_4to6(l4_protocol l4_proto,
 			|| create_skb6_fn(&tuple6, &skb6_expected, expected_payload6_len, 31) != 0
 			|| pkt_init_ipv4(&pkt4, skb4))
 		goto end;
+	config_snapshot(&cfg);
+	pkt4.cfg = &cfg;
+	prepare_path(&pkt4, in_place);
 
 	if (translating_the_packet(&tuple6, &pkt4, &pkt6_actual) != VERDICT_CONTINUE)
 		goto end;
+	if (!assert_path(&skb4, &pkt6_actual, in_place))
+		goto end;
 
 	result = compare_skbs(skb6_expected, pkt6_actual.skb);
 	/* Fall through. */
 
 end:
+	set_route_dst(NULL);
 	kfree_skb(skb4);
 	kfree_skb(skb6_expected);
-	kfree_skb(pkt6_actual.skb);
+	if (pkt6_actual.skb != skb4)
+		kfree_skb(pkt6_actual.skb);
 	return result;
 }
 
 static bool test_4to6_udp(void)
 {
-	return test_4to6(L4PROTO_UDP, create_skb4_udp, create_skb6_udp, 100);
+	return test_4to6(L4PROTO_UDP, create_skb4_udp, create_skb6_udp, 100, false);
 }
 
 static bool test_4to6_tcp(void)
 {
-	return test_4to6(L4PROTO_TCP, create_skb4_tcp, create_skb6_tcp, 100);
+	return test_4to6(L4PROTO_TCP, create_skb4_tcp, create_skb6_tcp, 100, false);
+}
+
+static bool test_4to6_udp_in_place(void)
+{
+	return test_4to6(L4PROTO_UDP, create_skb4_udp, create_skb6_udp, 100, true);
+}
+
+static bool test_4to6_tcp_in_place(void)
+{
+	return test_4to6(L4PROTO_TCP, create_skb4_tcp, create_skb6_tcp, 100, true);
 }
 
 static bool test_4to6_icmp_info(void)
 {
-	return test_4to6(L4PROTO_ICMP, create_skb4_icmp_info, create_skb6_icmp_info, 100);
+	return test_4to6(L4PROTO_ICMP, create_skb4_icmp_info, create_skb6_icmp_info, 100, false);
 }
 
 static bool test_4to6_icmp_error(void)
 {
-	return test_4to6(L4PROTO_TCP, create_skb4_icmp_error, create_skb6_icmp_error, 120);
+	return test_4to6(L4PROTO_TCP, create_skb4_icmp_error, create_skb6_icmp_error, 120, false);
 }
 
 static bool test_6to4(l4_protocol l4_proto,
 		int (*create_skb6_fn)(struct tuple *, struct sk_buff **, u16, u8),
 		int (*create_skb4_fn)(struct tuple *, struct sk_buff **, u16, u8),
-		u16 expected_payload4_len)
+		u16 expected_payload4_len, bool in_place)
 {
 	struct global_config *config;
+	struct global_config cfg;
 	struct packet pkt6, pkt4_actual = { .skb = NULL };
 	struct sk_buff *skb6 = NULL, *skb4_expected = NULL;
 	struct tuple tuple6, tuple4;
@@ -569,17 +821,24 @@ static bool test_6to4(l4_protocol l4_proto,
 			|| create_skb4_fn(&tuple4, &skb4_expected, expected_payload4_len, 31) != 0
 			|| pkt_init_ipv6(&pkt6, skb6))
 		goto end;
+	config_snapshot(&cfg);
+	pkt6.cfg = &cfg;
+	prepare_path(&pkt6, in_place);
 
 	if (translating_the_packet(&tuple4, &pkt6, &pkt4_actual) != VERDICT_CONTINUE)
 		goto end;
+	if (!assert_path(&skb6, &pkt4_actual, in_place))
+		goto end;
 
 	result = compare_skbs(skb4_expected, pkt4_actual.skb);
 	/* Fall through. */
 
 end:
+	set_route_dst(NULL);
 	kfree_skb(skb6);
 	kfree_skb(skb4_expected);
-	kfree_skb(pkt4_actual.skb);
+	if (pkt4_actual.skb != skb6)
+		kfree_skb(pkt4_actual.skb);
 	return result;
 }
 
@@ -588,6 +847,7 @@ static bool test_6to4_custom_payload(l4_protocol l4_proto,
 		int (*create_skb4_fn)(struct tuple *, struct sk_buff **, u16 *, u16, u8),
 		u16 expected_payload4_len, u16 *payload_array)
 {
+	struct global_config cfg;
 	struct packet pkt6, pkt4_actual = { .skb = NULL };
 	struct sk_buff *skb6 = NULL, *skb4_expected = NULL;
 	struct tuple tuple6, tuple4;
@@ -599,6 +859,9 @@ static bool test_6to4_custom_payload(l4_protocol l4_proto,
 			|| create_skb4_fn(&tuple4, &skb4_expected, payload_array, expected_payload4_len, 31) != 0
 			|| pkt_init_ipv6(&pkt6, skb6) != 0)
 		goto end;
+	config_snapshot(&cfg);
+	pkt6.cfg = &cfg;
+	prepare_path(&pkt6, false);
 
 	if (translating_the_packet(&tuple4, &pkt6, &pkt4_actual) != VERDICT_CONTINUE)
 		goto end;
@@ -627,22 +890,32 @@ static bool test_6to4_udp_custom_payload(void)
 
 static bool test_6to4_udp(void)
 {
-	return test_6to4(L4PROTO_UDP, create_skb6_udp, create_skb4_udp, 100);
+	return test_6to4(L4PROTO_UDP, create_skb6_udp, create_skb4_udp, 100, false);
 }
 
 static bool test_6to4_tcp(void)
 {
-	return test_6to4(L4PROTO_TCP, create_skb6_tcp, create_skb4_tcp, 100);
+	return test_6to4(L4PROTO_TCP, create_skb6_tcp, create_skb4_tcp, 100, false);
+}
+
+static bool test_6to4_udp_in_place(void)
+{
+	return test_6to4(L4PROTO_UDP, create_skb6_udp, create_skb4_udp, 100, true);
+}
+
+static bool test_6to4_tcp_in_place(void)
+{
+	return test_6to4(L4PROTO_TCP, create_skb6_tcp, create_skb4_tcp, 100, true);
 }
 
 static bool test_6to4_icmp_info(void)
 {
-	return test_6to4(L4PROTO_ICMP, create_skb6_icmp_info, create_skb4_icmp_info, 100);
+	return test_6to4(L4PROTO_ICMP, create_skb6_icmp_info, create_skb4_icmp_info, 100, false);
 }
 
 static bool test_6to4_icmp_error(void)
 {
-	return test_6to4(L4PROTO_TCP, create_skb6_icmp_error, create_skb4_icmp_error, 80);
+	return test_6to4(L4PROTO_TCP, create_skb6_icmp_error, create_skb4_icmp_error, 80, false);
 }
 
 int init_module(void)
@@ -653,10 +926,13 @@ int init_module(void)
 		return false;
 	if (is_error(pool6_init(NULL, 0)))
 		return false;
+	route_dst.dev = init_net.loopback_dev;
+	atomic_set(&route_dst.__refcnt, 1);
 
 	/* Misc single function tests */
 	CALL_TEST(test_function_has_unexpired_src_route(), "Unexpired source route querier");
 	CALL_TEST(test_function_build_id_field(), "Identification builder");
+	CALL_TEST(test_function_clamp_mss(), "MSS clamping function");
 	CALL_TEST(test_function_icmp6_minimum_mtu(), "ICMP6 Minimum MTU function");
 	CALL_TEST(test_function_icmp4_to_icmp6_param_prob(), "Param problem function");
 
@@ -680,6 +956,12 @@ int init_module(void)
 
 	CALL_TEST(test_6to4_udp_custom_payload(), "zero IPv4-UDP checksums, 6->4 UDP");
 
+	CALL_TEST(test_function_can_xlat_in_place(), "In-place translation decider");
+	CALL_TEST(test_4to6_udp_in_place(), "In-place translation, 4->6 UDP");
+	CALL_TEST(test_4to6_tcp_in_place(), "In-place translation, 4->6 TCP");
+	CALL_TEST(test_6to4_udp_in_place(), "In-place translation, 6->4 UDP");
+	CALL_TEST(test_6to4_tcp_in_place(), "In-place translation, 6->4 TCP");
+
 	pool6_destroy();
 	config_destroy();
 
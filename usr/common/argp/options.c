@@ -173,6 +173,15 @@ static const struct argp_option flush_opt = {
 		.group = 0,
 };
 
+static const struct argp_option load_opt = {
+		.name = "load",
+		.key = ARGP_LOAD,
+		.arg = "FILE",
+		.flags = 0,
+		.doc = "Replace the whole target with the entries listed in FILE.",
+		.group = 0,
+};
+
 static const struct argp_option db_hdr_opt = {
 		.doc = "Database miscellaneous options:",
 		.group = 4,
@@ -344,6 +353,47 @@ static const struct argp_option plateaus_alias_opt = {
 		.doc = "",
 };
 
+static const struct argp_option mss_clamp_opt = {
+		.name = OPTNAME_MSS_CLAMP,
+		.key = ARGP_MSS_CLAMP,
+		.arg = NUM_FORMAT,
+		.flags = 0,
+		.doc = "Lower the MSS of translated TCP SYNs so the segments "
+				"fit this IPv6 MTU (0 = disabled).\n",
+		.group = 0,
+};
+
+static const struct argp_option icmp_limit_rate_opt = {
+		.name = OPTNAME_ICMP_LIMIT_RATE,
+		.key = ARGP_ICMP_LIMIT_RATE,
+		.arg = NUM_FORMAT,
+		.flags = 0,
+		.doc = "Send at most this many ICMP errors per second, per CPU, "
+				"error type and source prefix (0 = unlimited). "
+				"Packet Too Bigs are never limited.\n",
+		.group = 0,
+};
+
+static const struct argp_option icmp_limit_burst_opt = {
+		.name = OPTNAME_ICMP_LIMIT_BURST,
+		.key = ARGP_ICMP_LIMIT_BURST,
+		.arg = NUM_FORMAT,
+		.flags = 0,
+		.doc = "Number of ICMP errors the rate limit lets through in a "
+				"single burst.\n",
+		.group = 0,
+};
+
+static const struct argp_option ipv4_id_mode_opt = {
+		.name = OPTNAME_IPV4_ID_MODE,
+		.key = ARGP_IPV4_ID_MODE,
+		.arg = NUM_FORMAT,
+		.flags = 0,
+		.doc = "Defines how IPv4 identification is generated.\n"
+				"(0 = Random; 1 = Per-CPU counters)",
+		.group = 0,
+};
+
 static const struct argp_option adf_opt = {
 		.name = OPTNAME_DROP_BY_ADDR,
 		.key = ARGP_DROP_ADDR,
@@ -678,6 +728,7 @@ static const struct argp_option *options_siit[] = {
 	&update_opt,
 	&rm_opt,
 	&flush_opt,
+	&load_opt,
 
 	&db_hdr_opt,
 	&csv_opt,
@@ -694,6 +745,10 @@ static const struct argp_option *options_siit[] = {
 	&tos_alias_opt,
 	&plateaus_opt,
 	&plateaus_alias_opt,
+	&mss_clamp_opt,
+	&icmp_limit_rate_opt,
+	&icmp_limit_burst_opt,
+	&ipv4_id_mode_opt,
 	&csum_fix_opt,
 	&hairpin_mode_opt,
 	&random_pool6791_opt,
@@ -747,6 +802,10 @@ static const struct argp_option *options_nat64[] = {
 	&tos_alias_opt,
 	&plateaus_opt,
 	&plateaus_alias_opt,
+	&mss_clamp_opt,
+	&icmp_limit_rate_opt,
+	&icmp_limit_burst_opt,
+	&ipv4_id_mode_opt,
 	&adf_opt,
 	&adf_alias_opt,
 	&icmp_filter_opt,
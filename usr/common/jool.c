@@ -42,6 +42,7 @@ struct arguments {
 	struct {
 		bool quick;
 		bool force;
+		char *file;
 		bool tcp, udp, icmp;
 
 		struct {
@@ -147,6 +148,18 @@ static int set_global_u8(struct arguments *args, __u8 type, char *value, __u8 mi
 	return set_global_arg(args, type, sizeof(tmp), &tmp);
 }
 
+static int set_global_u16(struct arguments *args, __u8 type, char *value, __u16 min, __u16 max)
+{
+	__u16 tmp;
+	int error;
+
+	error = str_to_u16(value, &tmp, min, max);
+	if (error)
+		return error;
+
+	return set_global_arg(args, type, sizeof(tmp), &tmp);
+}
+
 static int set_global_u64(struct arguments *args, __u8 type, char *value, __u64 min, __u64 max,
 		__u64 multiplier)
 {
@@ -363,6 +376,10 @@ static int parse_opt(int key, char *str, struct argp_state *state)
 	case ARGP_FLUSH:
 		error = update_state(args, FLUSH_MODES, OP_FLUSH);
 		break;
+	case ARGP_LOAD:
+		error = update_state(args, LOAD_MODES, OP_LOAD);
+		args->db.file = str;
+		break;
 
 	case ARGP_UDP:
 		error = update_state(args, MODE_POOL4 | MODE_BIB | MODE_SESSION,
@@ -403,7 +420,7 @@ static int parse_opt(int key, char *str, struct argp_state *state)
 		break;
 	case ARGP_FORCE:
 		error = update_state(args, MODE_POOL6 | MODE_POOL4 | MODE_EAMT
-				| MODE_RFC6791, OP_ADD);
+				| MODE_RFC6791, OP_ADD | OP_LOAD);
 		args->db.force = true;
 		break;
 
@@ -502,6 +519,19 @@ static int parse_opt(int key, char *str, struct argp_state *state)
 	case ARGP_PLATEAUS:
 		error = set_global_u16_array(args, MTU_PLATEAUS, str);
 		break;
+	case ARGP_MSS_CLAMP:
+		error = set_global_u16(args, MSS_CLAMP, str, 0, 0xFFFF);
+		break;
+	case ARGP_ICMP_LIMIT_RATE:
+		error = set_global_u16(args, ICMP_LIMIT_RATE, str, 0, 0xFFFF);
+		break;
+	case ARGP_ICMP_LIMIT_BURST:
+		error = set_global_u16(args, ICMP_LIMIT_BURST, str, 1, 0xFFFF);
+		break;
+	case ARGP_IPV4_ID_MODE:
+		error = set_global_u8(args, IPV4_ID_MODE, str, 0,
+				IPV4_ID_MODE_COUNT - 1);
+		break;
 	case ARGP_ENABLE_TRANSLATION:
 		error = set_global_bool(args, ENABLE, "true");
 		break;
@@ -751,6 +781,8 @@ static int main_wrapped(int argc, char **argv)
 					args.db.pool4.prefix_set, &args.db.pool4.prefix);
 		case OP_FLUSH:
 			return eam_flush();
+		case OP_LOAD:
+			return eam_load(args.db.file, args.db.force);
 		default:
 			log_err("Unknown operation for EAMT mode: %u.", args.op);
 			return -EINVAL;
@@ -1,13 +1,21 @@
 #include "nat64/usr/eam.h"
 #include "nat64/common/config.h"
 #include "nat64/common/str_utils.h"
+#include "nat64/usr/str_utils.h"
 #include "nat64/usr/types.h"
 #include "nat64/usr/netlink.h"
 #include <errno.h>
+#include <stdio.h>
+#include <string.h>
 
 
 #define HDR_LEN sizeof(struct request_hdr)
 #define PAYLOAD_LEN sizeof(union request_eamt)
+/*
+ * Entries per --load message.
+ * libnl won't build messages larger than a page, so keep this well below that.
+ */
+#define LOAD_CHUNK_LEN 128
 
 struct display_params {
 	bool csv_format;
@@ -191,3 +199,122 @@ int eam_flush(void)
 	init_request_hdr(&request, sizeof(request), MODE_EAMT, OP_FLUSH);
 	return netlink_request(&request, request.length, NULL, NULL);
 }
+
+static int send_load_chunk(unsigned char *request, __u16 count, bool last)
+{
+	struct request_hdr *hdr = (struct request_hdr *) request;
+	union request_eamt *payload = (union request_eamt *) (request + HDR_LEN);
+	int error;
+
+	init_request_hdr(hdr, HDR_LEN + PAYLOAD_LEN + count * sizeof(struct eamt_entry),
+			MODE_EAMT, OP_LOAD);
+	payload->load.count = count;
+	payload->load.last = last;
+
+	error = netlink_request(request, hdr->length, NULL, NULL);
+	payload->load.first = false;
+	return error;
+}
+
+/**
+ * Parses @line (an "<IPv6 prefix> <IPv4 prefix>" pair) into @entry.
+ * Returns 1 if @line does not contain an entry (because it's blank or a comment).
+ */
+static int parse_load_line(char *line, struct eamt_entry *entry)
+{
+	char prefix6_str[INET6_ADDRSTRLEN + 5];
+	char prefix4_str[INET_ADDRSTRLEN + 4];
+	char junk;
+	char *comma;
+	int matches;
+	int error;
+
+	/* Also accept the output of --display --csv. */
+	if (strncmp(line, "IPv6 Prefix,", strlen("IPv6 Prefix,")) == 0)
+		return 1;
+	while ((comma = strchr(line, ',')) != NULL)
+		*comma = ' ';
+
+	matches = sscanf(line, " %49s %19s %c", prefix6_str, prefix4_str, &junk);
+	if (matches == EOF || prefix6_str[0] == '#')
+		return 1;
+	if (matches != 2) {
+		log_err("Expected an IPv6 prefix and an IPv4 prefix.");
+		return -EINVAL;
+	}
+
+	error = str_to_ipv6_prefix(prefix6_str, &entry->prefix6);
+	if (error)
+		return error;
+	return str_to_ipv4_prefix(prefix4_str, &entry->prefix4);
+}
+
+/**
+ * Replaces the entire EAMT with the entries listed in @file_name.
+ * The kernel only switches to the new table once it has all of it, so the table
+ * is never left halfway loaded.
+ */
+int eam_load(char *file_name, bool force)
+{
+	unsigned char request[HDR_LEN + PAYLOAD_LEN
+			+ LOAD_CHUNK_LEN * sizeof(struct eamt_entry)];
+	union request_eamt *payload = (union request_eamt *) (request + HDR_LEN);
+	struct eamt_entry *entries = (struct eamt_entry *) (payload + 1);
+	char line[256];
+	unsigned int line_num = 0;
+	unsigned int total = 0;
+	__u16 count = 0;
+	FILE *file;
+	int error = 0;
+
+	file = fopen(file_name, "r");
+	if (!file) {
+		error = -errno;
+		log_err("Could not open '%s': %s", file_name, strerror(errno));
+		return error;
+	}
+
+	memset(payload, 0, PAYLOAD_LEN);
+	payload->load.first = true;
+	payload->load.force = force;
+
+	while (fgets(line, sizeof(line), file)) {
+		line_num++;
+		if (!strchr(line, '\n') && !feof(file)) {
+			log_err("%s:%u: Line is too long.", file_name, line_num);
+			error = -EINVAL;
+			goto end;
+		}
+
+		error = parse_load_line(line, &entries[count]);
+		if (error < 0) {
+			log_err("%s:%u: Could not parse the entry.", file_name, line_num);
+			goto end;
+		}
+		if (error > 0)
+			continue;
+
+		count++;
+		total++;
+		if (count == LOAD_CHUNK_LEN) {
+			error = send_load_chunk(request, count, false);
+			if (error)
+				goto end;
+			count = 0;
+		}
+	}
+
+	if (ferror(file)) {
+		log_err("Could not read '%s'.", file_name);
+		error = -EIO;
+		goto end;
+	}
+
+	error = send_load_chunk(request, count, true);
+	if (!error)
+		printf("Loaded %u entries.\n", total);
+
+end:
+	fclose(file);
+	return error;
+}
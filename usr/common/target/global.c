@@ -54,6 +54,18 @@ static char *int_to_hairpin_mode(enum eam_hairpinning_mode mode)
 	return "unknown";
 }
 
+static char *int_to_ipv4_id_mode(enum ipv4_id_mode mode)
+{
+	switch (mode) {
+	case IPV4_ID_RANDOM:
+		return "random";
+	case IPV4_ID_COUNTER:
+		return "counter";
+	}
+
+	return "unknown";
+}
+
 static char* print_allow_atomic_frags(struct global_config *conf)
 {
 	if (!conf->atomic_frags.df_always_on
@@ -91,6 +103,14 @@ static int handle_display_response(struct nl_msg *msg, void *arg)
 	printf("  --%s:\n     ", OPTNAME_MTU_PLATEAUS);
 	print_plateaus(conf, "\n     ");
 	printf("\n");
+	printf("  --%s: %u\n", OPTNAME_MSS_CLAMP, conf->mss_clamp);
+	printf("  --%s: %u\n", OPTNAME_ICMP_LIMIT_RATE,
+			conf->icmp_limit_rate);
+	printf("  --%s: %u\n", OPTNAME_ICMP_LIMIT_BURST,
+			conf->icmp_limit_burst);
+	printf("  --%s: %u (%s)\n", OPTNAME_IPV4_ID_MODE,
+			conf->ipv4_id_mode,
+			int_to_ipv4_id_mode(conf->ipv4_id_mode));
 
 	if (xlat_is_nat64()) {
 		printf("  --%s: %llu\n", OPTNAME_MAX_SO,
@@ -182,6 +202,11 @@ static int handle_display_response_csv(struct nl_msg *msg, void *arg)
 	printf("\"");
 	print_plateaus(conf, ",");
 	printf("\"\n");
+	printf("%s,%u\n", OPTNAME_MSS_CLAMP, conf->mss_clamp);
+	printf("%s,%u\n", OPTNAME_ICMP_LIMIT_RATE, conf->icmp_limit_rate);
+	printf("%s,%u\n", OPTNAME_ICMP_LIMIT_BURST, conf->icmp_limit_burst);
+	printf("%s,%s\n", OPTNAME_IPV4_ID_MODE,
+			int_to_ipv4_id_mode(conf->ipv4_id_mode));
 
 	if (xlat_is_nat64()) {
 		printf("%s,%llu\n", OPTNAME_MAX_SO,